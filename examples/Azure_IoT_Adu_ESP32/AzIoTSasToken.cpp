@@ -12,6 +12,17 @@
 
 #define INDEFINITE_TIME ((time_t)-1)
 
+#define HMAC_SHA256_BLOCK_SIZE 64
+#define HMAC_SHA256_SIZE 32
+#define HMAC_INNER_PAD 0x36
+#define HMAC_OUTER_PAD 0x5C
+
+// The token is renewed once this percentage of its lifetime has passed, less a jitter of up to
+// SAS_TOKEN_RENEWAL_JITTER_PERCENT of it that depends on the device, so devices connected at the
+// same time do not all renew at the same time.
+#define SAS_TOKEN_RENEWAL_LIFETIME_PERCENT 80
+#define SAS_TOKEN_RENEWAL_JITTER_PERCENT 10
+
 #define az_span_is_content_equal(x, AZ_SPAN_EMPTY) \
   (az_span_size(x) == az_span_size(AZ_SPAN_EMPTY) && az_span_ptr(x) == az_span_ptr(AZ_SPAN_EMPTY))
 
@@ -61,29 +72,6 @@ static uint32_t getSasTokenExpiration(const char* sasToken)
   return se_as_unix_time;
 }
 
-static void mbedtls_hmac_sha256(az_span key, az_span payload, az_span signed_payload)
-{
-  mbedtls_md_context_t ctx;
-  mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
-
-  mbedtls_md_init(&ctx);
-  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 1);
-  mbedtls_md_hmac_starts(&ctx, (const unsigned char*)az_span_ptr(key), az_span_size(key));
-  mbedtls_md_hmac_update(&ctx, (const unsigned char*)az_span_ptr(payload), az_span_size(payload));
-  mbedtls_md_hmac_finish(&ctx, (byte*)az_span_ptr(signed_payload));
-  mbedtls_md_free(&ctx);
-}
-
-static void hmac_sha256_sign_signature(
-    az_span decoded_key,
-    az_span signature,
-    az_span signed_signature,
-    az_span* out_signed_signature)
-{
-  mbedtls_hmac_sha256(decoded_key, signature, signed_signature);
-  *out_signed_signature = az_span_slice(signed_signature, 0, 32);
-}
-
 static void base64_encode_bytes(
     az_span decoded_bytes,
     az_span base64_encoded_bytes,
@@ -130,37 +118,131 @@ static int decode_base64_bytes(
   }
 }
 
-static int iot_sample_generate_sas_base64_encoded_signed_signature(
-    az_span sas_base64_encoded_key,
-    az_span sas_signature,
-    az_span sas_base64_encoded_signed_signature,
-    az_span* out_sas_base64_encoded_signed_signature)
+AzIoTSasSigner::AzIoTSasSigner()
+{
+  mbedtls_md_init(&this->innerContext);
+  mbedtls_md_init(&this->outerContext);
+  mbedtls_md_init(&this->workContext);
+  this->isInitialized = false;
+}
+
+AzIoTSasSigner::~AzIoTSasSigner()
 {
-  // Decode the sas base64 encoded key to use for HMAC signing.
-  char sas_decoded_key_buffer[32];
-  az_span sas_decoded_key = AZ_SPAN_FROM_BUFFER(sas_decoded_key_buffer);
+  mbedtls_md_free(&this->innerContext);
+  mbedtls_md_free(&this->outerContext);
+  mbedtls_md_free(&this->workContext);
+}
 
-  if (decode_base64_bytes(sas_base64_encoded_key, sas_decoded_key, &sas_decoded_key) != 0)
+int AzIoTSasSigner::Init(az_span base64EncodedKey)
+{
+  // Keys of up to a SHA-256 block, as issued by Azure IoT, are used as is by HMAC.
+  uint8_t decoded_key_buffer[HMAC_SHA256_BLOCK_SIZE];
+  az_span decoded_key = AZ_SPAN_FROM_BUFFER(decoded_key_buffer);
+  uint8_t inner_padded_key[HMAC_SHA256_BLOCK_SIZE];
+  uint8_t outer_padded_key[HMAC_SHA256_BLOCK_SIZE];
+  const mbedtls_md_info_t* md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  int result = 0;
+
+  this->isInitialized = false;
+  mbedtls_md_free(&this->innerContext);
+  mbedtls_md_free(&this->outerContext);
+  mbedtls_md_free(&this->workContext);
+  mbedtls_md_init(&this->innerContext);
+  mbedtls_md_init(&this->outerContext);
+  mbedtls_md_init(&this->workContext);
+
+  if (decode_base64_bytes(base64EncodedKey, decoded_key, &decoded_key) != 0)
   {
-    Logger.Error("Failed generating encoded signed signature");
+    Logger.Error("Failed decoding SAS key");
     return 1;
   }
 
-  // HMAC-SHA256 sign the signature with the decoded key.
-  char sas_hmac256_signed_signature_buffer[32];
-  az_span sas_hmac256_signed_signature = AZ_SPAN_FROM_BUFFER(sas_hmac256_signed_signature_buffer);
-  hmac_sha256_sign_signature(
-      sas_decoded_key, sas_signature, sas_hmac256_signed_signature, &sas_hmac256_signed_signature);
+  for (int i = 0; i < HMAC_SHA256_BLOCK_SIZE; i++)
+  {
+    uint8_t key_byte = i < az_span_size(decoded_key) ? decoded_key_buffer[i] : 0;
+    inner_padded_key[i] = key_byte ^ HMAC_INNER_PAD;
+    outer_padded_key[i] = key_byte ^ HMAC_OUTER_PAD;
+  }
+
+  if (mbedtls_md_setup(&this->innerContext, md_info, 0) != 0
+      || mbedtls_md_setup(&this->outerContext, md_info, 0) != 0
+      || mbedtls_md_setup(&this->workContext, md_info, 0) != 0
+      || mbedtls_md_starts(&this->innerContext) != 0
+      || mbedtls_md_update(&this->innerContext, inner_padded_key, sizeof(inner_padded_key)) != 0
+      || mbedtls_md_starts(&this->outerContext) != 0
+      || mbedtls_md_update(&this->outerContext, outer_padded_key, sizeof(outer_padded_key)) != 0)
+  {
+    Logger.Error("Failed computing HMAC-SHA256 key schedule");
+    result = 1;
+  }
+  else
+  {
+    this->isInitialized = true;
+  }
+
+  memset(decoded_key_buffer, 0, sizeof(decoded_key_buffer));
+  memset(inner_padded_key, 0, sizeof(inner_padded_key));
+  memset(outer_padded_key, 0, sizeof(outer_padded_key));
+
+  return result;
+}
+
+bool AzIoTSasSigner::IsInitialized() { return this->isInitialized; }
+
+int AzIoTSasSigner::Sign(
+    az_span signature,
+    az_span signedSignatureBuffer,
+    az_span* outSignedSignature)
+{
+  uint8_t hash[HMAC_SHA256_SIZE];
+
+  if (!this->isInitialized)
+  {
+    Logger.Error("SAS signer not initialized");
+    return 1;
+  }
+
+  // HMAC(key, signature) = H((key ^ opad) || H((key ^ ipad) || signature)), resuming from the
+  // states kept after hashing the padded key blocks.
+  if (mbedtls_md_clone(&this->workContext, &this->innerContext) != 0
+      || mbedtls_md_update(
+             &this->workContext, az_span_ptr(signature), (size_t)az_span_size(signature))
+          != 0
+      || mbedtls_md_finish(&this->workContext, hash) != 0
+      || mbedtls_md_clone(&this->workContext, &this->outerContext) != 0
+      || mbedtls_md_update(&this->workContext, hash, sizeof(hash)) != 0
+      || mbedtls_md_finish(&this->workContext, hash) != 0)
+  {
+    Logger.Error("Failed signing SAS signature");
+    return 1;
+  }
 
   // Base64 encode the result of the HMAC signing.
-  base64_encode_bytes(
-      sas_hmac256_signed_signature,
-      sas_base64_encoded_signed_signature,
-      out_sas_base64_encoded_signed_signature);
+  base64_encode_bytes(AZ_SPAN_FROM_BUFFER(hash), signedSignatureBuffer, outSignedSignature);
 
   return 0;
 }
 
+static uint32_t getSasTokenRenewalTime(
+    const char* sasToken,
+    uint32_t expirationUnixTime,
+    unsigned int expiryTimeInMinutes)
+{
+  uint64_t lifetime = (uint64_t)expiryTimeInMinutes * 60;
+  uint32_t jitterRange = (uint32_t)(lifetime * SAS_TOKEN_RENEWAL_JITTER_PERCENT / 100) + 1;
+  uint32_t hash = 2166136261u; // FNV-1a
+
+  // The token starts with the resource URI, which includes the device id.
+  for (int i = 0; sasToken[i] != '\0' && sasToken[i] != '&'; i++)
+  {
+    hash = (hash ^ (uint8_t)sasToken[i]) * 16777619u;
+  }
+
+  return expirationUnixTime
+      - (uint32_t)(lifetime * (100 - SAS_TOKEN_RENEWAL_LIFETIME_PERCENT) / 100)
+      - hash % jitterRange;
+}
+
 int64_t iot_sample_get_epoch_expiration_time_from_minutes(uint32_t minutes)
 {
   time_t now = time(NULL);
@@ -169,7 +251,7 @@ int64_t iot_sample_get_epoch_expiration_time_from_minutes(uint32_t minutes)
 
 az_span generate_sas_token(
     az_iot_hub_client* hub_client,
-    az_span device_key,
+    AzIoTSasSigner& signer,
     az_span sas_signature,
     unsigned int expiryTimeInMinutes,
     az_span sas_token)
@@ -191,11 +273,8 @@ az_span generate_sas_token(
   char b64enc_hmacsha256_signature[64];
   az_span sas_base64_encoded_signed_signature = AZ_SPAN_FROM_BUFFER(b64enc_hmacsha256_signature);
 
-  if (iot_sample_generate_sas_base64_encoded_signed_signature(
-          device_key,
-          sas_signature,
-          sas_base64_encoded_signed_signature,
-          &sas_base64_encoded_signed_signature)
+  if (signer.Sign(
+          sas_signature, sas_base64_encoded_signed_signature, &sas_base64_encoded_signed_signature)
       != 0)
   {
     Logger.Error("Failed generating SAS token signed signature");
@@ -236,14 +315,22 @@ AzIoTSasToken::AzIoTSasToken(
   this->signatureBuffer = signatureBuffer;
   this->sasTokenBuffer = sasTokenBuffer;
   this->expirationUnixTime = 0;
+  this->renewalUnixTime = 0;
   this->sasToken = AZ_SPAN_EMPTY;
 }
 
 int AzIoTSasToken::Generate(unsigned int expiryTimeInMinutes)
 {
+  // The key is decoded and its HMAC key schedule computed once, for all the tokens generated.
+  if (!this->signer.IsInitialized() && this->signer.Init(this->deviceKey) != 0)
+  {
+    Logger.Error("Failed initializing SAS signer");
+    return 1;
+  }
+
   this->sasToken = generate_sas_token(
       this->client,
-      this->deviceKey,
+      this->signer,
       this->signatureBuffer,
       expiryTimeInMinutes,
       this->sasTokenBuffer);
@@ -265,6 +352,8 @@ int AzIoTSasToken::Generate(unsigned int expiryTimeInMinutes)
     }
     else
     {
+      this->renewalUnixTime = getSasTokenRenewalTime(
+          (const char*)az_span_ptr(this->sasToken), this->expirationUnixTime, expiryTimeInMinutes);
       return 0;
     }
   }
@@ -285,4 +374,19 @@ bool AzIoTSasToken::IsExpired()
   }
 }
 
+bool AzIoTSasToken::IsRenewalDue()
+{
+  time_t now = time(NULL);
+
+  if (now == INDEFINITE_TIME)
+  {
+    Logger.Error("Failed getting current time");
+    return true;
+  }
+  else
+  {
+    return (now >= this->renewalUnixTime);
+  }
+}
+
 az_span AzIoTSasToken::Get() { return this->sasToken; }
@@ -7,6 +7,28 @@
 #include <Arduino.h>
 #include <az_iot_hub_client.h>
 #include <az_span.h>
+#include <mbedtls/md.h>
+
+// Signs SAS signatures with HMAC-SHA256 using a key decoded once, keeping the SHA-256 states after
+// the inner and outer padded key blocks so each signature only hashes the signature itself.
+class AzIoTSasSigner
+{
+public:
+  AzIoTSasSigner();
+  ~AzIoTSasSigner();
+  int Init(az_span base64EncodedKey);
+  bool IsInitialized();
+  int Sign(az_span signature, az_span signedSignatureBuffer, az_span* outSignedSignature);
+
+private:
+  AzIoTSasSigner(const AzIoTSasSigner&);
+  AzIoTSasSigner& operator=(const AzIoTSasSigner&);
+
+  mbedtls_md_context_t innerContext;
+  mbedtls_md_context_t outerContext;
+  mbedtls_md_context_t workContext;
+  bool isInitialized;
+};
 
 class AzIoTSasToken
 {
@@ -18,15 +40,18 @@ public:
       az_span sasTokenBuffer);
   int Generate(unsigned int expiryTimeInMinutes);
   bool IsExpired();
+  bool IsRenewalDue();
   az_span Get();
 
 private:
   az_iot_hub_client* client;
   az_span deviceKey;
+  AzIoTSasSigner signer;
   az_span signatureBuffer;
   az_span sasTokenBuffer;
   az_span sasToken;
   uint32_t expirationUnixTime;
+  uint32_t renewalUnixTime;
 };
 
 #endif // AZIOTSASTOKEN_H
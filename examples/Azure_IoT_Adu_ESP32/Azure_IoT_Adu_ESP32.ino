@@ -1120,9 +1120,9 @@ void loop()
     send_init_state = true;
   }
 #ifndef IOT_CONFIG_USE_X509_CERT
-  else if (sasToken.IsExpired())
+  else if (sasToken.IsRenewalDue())
   {
-    Logger.Info("SAS token expired; reconnecting with a new one.");
+    Logger.Info("SAS token renewal due; reconnecting with a new one.");
     (void)esp_mqtt_client_destroy(mqtt_client);
     initialize_mqtt_client();
     send_init_state = true;
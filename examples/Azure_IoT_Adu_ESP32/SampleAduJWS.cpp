@@ -48,6 +48,8 @@ typedef struct prvJWSValidationContext
   az_span jws_signature;
   az_span signing_key_n;
   az_span signing_key_e;
+  az_span jws_signed_sha;
+  az_span jwk_signed_sha;
   az_span manifest_sha_calculation;
   az_span parsed_manifest_sha;
   az_span base64_encoded_header;
@@ -56,16 +58,7 @@ typedef struct prvJWSValidationContext
   az_span jwk_base64_encoded_header;
   az_span jwk_base64_encoded_payload;
   az_span jwk_base64_encoded_signature;
-  int32_t base64_signature_length;
   int32_t out_parsed_manifest_sha_size;
-  int32_t out_signing_key_e_length;
-  int32_t out_signing_key_n_length;
-  int32_t out_jws_header_length;
-  int32_t out_jws_payload_length;
-  int32_t out_jws_signature_length;
-  int32_t out_jwk_header_length;
-  int32_t out_jwk_payload_length;
-  int32_t out_jwk_signature_length;
   az_span kid_span;
   az_span sha256_span;
   az_span base64_encoded_n_span;
@@ -127,33 +120,6 @@ static az_result split_jws(
   return AZ_OK;
 }
 
-/* Usual base64 encoded characters use `+` and `/` for the two extra characters
- */
-/* In URL encoded schemes, those aren't allowed, so the characters are swapped
- */
-/* for `-` and `_`. We have to swap them back to the usual characters. */
-static void swap_to_url_encoding_chars(az_span signature_span)
-{
-  int32_t index = 0;
-  uint8_t* signature_ptr = az_span_ptr(signature_span);
-  int32_t signature_length = az_span_size(signature_span);
-
-  while (index < signature_length)
-  {
-    if (*signature_ptr == '-')
-    {
-      *signature_ptr = '+';
-    }
-    else if (*signature_ptr == '_')
-    {
-      *signature_ptr = '/';
-    }
-
-    signature_ptr++;
-    index++;
-  }
-}
-
 /**
  * @brief Calculate the SHA256 over a buffer of bytes
  *
@@ -181,38 +147,35 @@ static az_result jws_sha256_calculate(az_span input_span, az_span output_span)
 /**
  * @brief Verify the manifest via RS256 for the JWS.
  *
- * @param input_span The input span over which the RS256 will be verified.
+ * @param sha256_span The SHA256 of the signed input, calculated with
+ * jws_sha256_calculate() before the input was decoded in place.
  * @param signature_span The encrypted signature span which will be decrypted by \p
  * n_span and \p e_span.
  * @param n_span The key's modulus which is used to decrypt \p signature.
  * @param e_span The exponent used for the key.
  * @param buffer_span The buffer used as scratch space to make the calculations.
- * It should be at least `jwsRSA3072_SIZE` + `jwsSHA256_SIZE` in size.
+ * It should be at least `jwsRSA3072_SIZE` in size.
  * @return az_result The result of the operation.
  * @retval AZ_OK if successful.
  */
 static az_result jws_rs256_verify(
-    az_span input_span,
+    az_span sha256_span,
     az_span signature_span,
     az_span n_span,
     az_span e_span,
     az_span buffer_span)
 {
-  az_result result;
   int32_t mbed_tls_result;
-  uint8_t* sha_buffer_ptr;
   size_t decrypted_length;
   mbedtls_rsa_context ctx;
   int sha_match_result;
 
-  if (az_span_size(buffer_span) < jwsSHA_CALCULATION_SCRATCH_SIZE)
+  if (az_span_size(buffer_span) < jwsRSA3072_SIZE)
   {
     Logger.Error("[JWS] Buffer Not Large Enough");
     return AZ_ERROR_NOT_ENOUGH_SPACE;
   }
 
-  sha_buffer_ptr = az_span_ptr(buffer_span) + jwsRSA3072_SIZE;
-
   /* The signature is encrypted using the input key. We need to decrypt the */
   /* signature which gives us the SHA256 inside a PKCS7 structure. We then
    * compare */
@@ -257,6 +220,16 @@ static az_result jws_rs256_verify(
     return AZ_ERROR_NOT_SUPPORTED;
   }
 
+  /* The signature is as long as the key's modulus, which is also how much is read from it. The
+   * modulus may be given with a leading zero byte (as the ADU root keys are), which does not count
+   * towards its length. */
+  if ((size_t)az_span_size(signature_span) != mbedtls_rsa_get_len(&ctx))
+  {
+    Logger.Error("[JWS] Signature length does not match the key length");
+    mbedtls_rsa_free(&ctx);
+    return AZ_ERROR_NOT_SUPPORTED;
+  }
+
   /* RSA */
   mbed_tls_result = mbedtls_rsa_pkcs1_decrypt(
       &ctx,
@@ -277,27 +250,42 @@ static az_result jws_rs256_verify(
 
   mbedtls_rsa_free(&ctx);
 
-  result = jws_sha256_calculate(input_span, az_span_create(sha_buffer_ptr, jwsSHA256_SIZE));
-
-  if (result != AZ_OK)
-  {
-    Logger.Error("[JWS] jws_sha256_calculate failed");
-    return result;
-  }
-
   /* TODO: remove this once we have a valid PKCS7 parser. */
-  sha_match_result
-      = memcmp(az_span_ptr(buffer_span) + jwsPKCS7_PAYLOAD_OFFSET, sha_buffer_ptr, jwsSHA256_SIZE);
+  sha_match_result = memcmp(
+      az_span_ptr(buffer_span) + jwsPKCS7_PAYLOAD_OFFSET, az_span_ptr(sha256_span), jwsSHA256_SIZE);
 
   if (sha_match_result)
   {
     Logger.Error("[JWS] SHA of JWK does NOT match");
-    result = AZ_ERROR_NOT_SUPPORTED;
+    return AZ_ERROR_NOT_SUPPORTED;
   }
 
   return AZ_OK;
 }
 
+/**
+ * @brief Calculate the SHA256 of the signed input of a JWS, that is its base64
+ * url encoded header and payload joined by a '.'.
+ *
+ * @param base64_encoded_header The base64 url encoded header, as split by split_jws().
+ * @param base64_encoded_payload The base64 url encoded payload, as split by split_jws().
+ * @param output_span The output span into which the SHA256 is written. It must
+ * be 32 bytes in length.
+ * @return az_result The result of the operation.
+ * @retval AZ_OK if successful.
+ */
+static az_result jws_signed_input_sha256_calculate(
+    az_span base64_encoded_header,
+    az_span base64_encoded_payload,
+    az_span output_span)
+{
+  return jws_sha256_calculate(
+      az_span_create(
+          az_span_ptr(base64_encoded_header),
+          az_span_size(base64_encoded_header) + az_span_size(base64_encoded_payload) + 1),
+      output_span);
+}
+
 static az_result find_sjwk_value(az_json_reader* payload_json_reader, az_span* jwk_value_ptr)
 {
   az_result result = AZ_OK;
@@ -475,164 +463,105 @@ static az_result find_manifest_sha(az_json_reader* payload_json_reader, az_span*
   return AZ_OK;
 }
 
-static az_result base64_decode_jwk(jws_validation_context* manifest_context)
+/**
+ * @brief Base64 url decode a span in place, logging failures.
+ *
+ * @param[in,out] span_ptr The span to decode. On success it is sliced to the
+ * decoded bytes, which are written over the start of the text.
+ * @param name The name of the value, for logging.
+ * @return az_result The result of the operation.
+ * @retval AZ_OK if successful.
+ */
+static az_result base64_url_decode_in_place(az_span* span_ptr, const char* name)
 {
-  az_result result;
-
-  result = az_base64_url_decode(
-      manifest_context->jwk_header,
-      manifest_context->jwk_base64_encoded_header,
-      &manifest_context->out_jwk_header_length);
-
-  if (az_result_failed(result))
-  {
-    Logger.Error("[JWS] JWK header az_base64_url_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsJWK_HEADER_SIZE) + " bytes");
-    }
-
-    return result;
-  }
-
-  manifest_context->jwk_header
-      = az_span_slice(manifest_context->jwk_header, 0, manifest_context->out_jwk_header_length);
-
-  result = az_base64_url_decode(
-      manifest_context->jwk_payload,
-      manifest_context->jwk_base64_encoded_payload,
-      &manifest_context->out_jwk_payload_length);
+  int32_t out_length;
+  az_result result = az_base64_url_decode_in_place(*span_ptr, &out_length);
 
   if (az_result_failed(result))
   {
-    Logger.Error("[JWS] JWK payload az_base64_url_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsJWK_PAYLOAD_SIZE) + " bytes");
-    }
-
-    return result;
-  }
-
-  manifest_context->jwk_payload
-      = az_span_slice(manifest_context->jwk_payload, 0, manifest_context->out_jwk_payload_length);
-
-  result = az_base64_url_decode(
-      manifest_context->jwk_signature,
-      manifest_context->jwk_base64_encoded_signature,
-      &manifest_context->out_jwk_signature_length);
-
-  if (az_result_failed(result))
-  {
-    Logger.Error("[JWS] JWK signature az_base64_url_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsSIGNATURE_SIZE) + " bytes");
-    }
-
+    Logger.Error(
+        "[JWS] " + String(name) + " az_base64_url_decode_in_place failed: result "
+        + String(result, HEX));
     return result;
   }
 
-  manifest_context->jwk_signature = az_span_slice(
-      manifest_context->jwk_signature, 0, manifest_context->out_jwk_signature_length);
+  *span_ptr = az_span_slice(*span_ptr, 0, out_length);
 
   return AZ_OK;
 }
 
-static az_result base64_decode_signing_key(jws_validation_context* manifest_context)
+/**
+ * @brief Base64 decode a span in place, logging failures.
+ *
+ * @param[in,out] span_ptr The span to decode. On success it is sliced to the
+ * decoded bytes, which are written over the start of the text.
+ * @param name The name of the value, for logging.
+ * @return az_result The result of the operation.
+ * @retval AZ_OK if successful.
+ */
+static az_result base64_decode_in_place(az_span* span_ptr, const char* name)
 {
-  az_result result;
-
-  result = az_base64_decode(
-      manifest_context->signing_key_n,
-      manifest_context->base64_encoded_n_span,
-      &manifest_context->out_signing_key_n_length);
-
-  if (az_result_failed(result))
-  {
-    Logger.Error("[JWS] Signing key n az_base64_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsRSA3072_SIZE) + " bytes");
-    }
-
-    return result;
-  }
-
-  manifest_context->signing_key_n = az_span_slice(
-      manifest_context->signing_key_n, 0, manifest_context->out_signing_key_n_length);
-
-  result = az_base64_decode(
-      manifest_context->signing_key_e,
-      manifest_context->base64_encoded_e_span,
-      &manifest_context->out_signing_key_e_length);
+  int32_t out_length;
+  az_result result = az_base64_decode_in_place(*span_ptr, &out_length);
 
   if (az_result_failed(result))
   {
-    Logger.Error("[JWS] Signing key e az_base64_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error(
-          "[JWS] Decode buffer was too small: " + String(jwsSIGNING_KEY_E_SIZE) + " bytes");
-    }
-
+    Logger.Error(
+        "[JWS] " + String(name) + " az_base64_decode_in_place failed: result "
+        + String(result, HEX));
     return result;
   }
 
-  manifest_context->signing_key_e = az_span_slice(
-      manifest_context->signing_key_e, 0, manifest_context->out_signing_key_e_length);
+  *span_ptr = az_span_slice(*span_ptr, 0, out_length);
 
   return AZ_OK;
 }
 
-static az_result base64_decode_jws_header_and_payload(jws_validation_context* manifest_context)
+/* The SHA256 of the JWK signed input must be calculated before this, since its
+ * header and payload are decoded in place. */
+static az_result base64_decode_jwk(jws_validation_context* manifest_context)
 {
-  az_result result;
+  manifest_context->jwk_header = manifest_context->jwk_base64_encoded_header;
+  _az_adu_jws_return_if_failed(
+      base64_url_decode_in_place(&manifest_context->jwk_header, "JWK header"));
 
-  result = az_base64_url_decode(
-      manifest_context->jws_payload,
-      manifest_context->base64_encoded_payload,
-      &manifest_context->out_jws_payload_length);
+  manifest_context->jwk_payload = manifest_context->jwk_base64_encoded_payload;
+  _az_adu_jws_return_if_failed(
+      base64_url_decode_in_place(&manifest_context->jwk_payload, "JWK payload"));
 
-  if (az_result_failed(result))
-  {
-    Logger.Error("[JWS] JWS payload az_base64_url_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsJWS_PAYLOAD_SIZE) + " bytes");
-    }
+  manifest_context->jwk_signature = manifest_context->jwk_base64_encoded_signature;
+  _az_adu_jws_return_if_failed(
+      base64_url_decode_in_place(&manifest_context->jwk_signature, "JWK signature"));
 
-    return result;
-  }
-
-  manifest_context->jws_payload
-      = az_span_slice(manifest_context->jws_payload, 0, manifest_context->out_jws_payload_length);
+  return AZ_OK;
+}
 
-  result = az_base64_url_decode(
-      manifest_context->jws_signature,
-      manifest_context->base64_encoded_signature,
-      &manifest_context->out_jws_signature_length);
+/* The signing key parts are decoded within the decoded JWK payload, which is
+ * not parsed any further afterwards. */
+static az_result base64_decode_signing_key(jws_validation_context* manifest_context)
+{
+  manifest_context->signing_key_n = manifest_context->base64_encoded_n_span;
+  _az_adu_jws_return_if_failed(
+      base64_decode_in_place(&manifest_context->signing_key_n, "Signing key n"));
 
-  if (az_result_failed(result))
-  {
-    Logger.Error("[JWS] JWS signature az_base64_url_decode failed: result " + String(result, HEX));
+  manifest_context->signing_key_e = manifest_context->base64_encoded_e_span;
+  _az_adu_jws_return_if_failed(
+      base64_decode_in_place(&manifest_context->signing_key_e, "Signing key e"));
 
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsSIGNATURE_SIZE) + " bytes");
-    }
+  return AZ_OK;
+}
 
-    return result;
-  }
+/* The SHA256 of the JWS signed input must be calculated before this, since its
+ * payload is decoded in place. */
+static az_result base64_decode_jws_payload_and_signature(jws_validation_context* manifest_context)
+{
+  manifest_context->jws_payload = manifest_context->base64_encoded_payload;
+  _az_adu_jws_return_if_failed(
+      base64_url_decode_in_place(&manifest_context->jws_payload, "JWS payload"));
 
-  manifest_context->jws_signature = az_span_slice(
-      manifest_context->jws_signature, 0, manifest_context->out_jws_signature_length);
+  manifest_context->jws_signature = manifest_context->base64_encoded_signature;
+  _az_adu_jws_return_if_failed(
+      base64_url_decode_in_place(&manifest_context->jws_signature, "JWS signature"));
 
   return AZ_OK;
 }
@@ -701,26 +630,16 @@ static az_result verify_sha_match(jws_validation_context* manifest_context, az_s
     return AZ_ERROR_ITEM_NOT_FOUND;
   }
 
-  result = az_base64_decode(
-      manifest_context->parsed_manifest_sha,
-      manifest_context->sha256_span,
-      &manifest_context->out_parsed_manifest_sha_size);
+  manifest_context->parsed_manifest_sha = manifest_context->sha256_span;
+  result = base64_decode_in_place(&manifest_context->parsed_manifest_sha, "Parsed manifest SHA");
 
   if (az_result_failed(result))
   {
-    Logger.Error(
-        "[JWS] Parsed manifest SHA az_base64_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsSHA256_SIZE) + " bytes");
-    }
-
     return result;
   }
 
-  manifest_context->parsed_manifest_sha = az_span_slice(
-      manifest_context->parsed_manifest_sha, 0, manifest_context->out_parsed_manifest_sha_size);
+  manifest_context->out_parsed_manifest_sha_size
+      = az_span_size(manifest_context->parsed_manifest_sha);
 
   if (manifest_context->out_parsed_manifest_sha_size != jwsSHA256_SIZE)
   {
@@ -761,11 +680,23 @@ az_result SampleJWS::ManifestAuthenticate(
   jws_validation_context manifest_context = { 0 };
   int32_t root_key_index;
 
-  /* Break up scratch buffer for reusable and persistent sections */
-  uint8_t* persistent_scratch_space_head = az_span_ptr(scratch_buffer_span);
-  uint8_t* reusable_scratch_space_root
-      = persistent_scratch_space_head + jwsJWS_HEADER_SIZE + jwsJWK_PAYLOAD_SIZE;
-  uint8_t* reusable_scratch_space_head = reusable_scratch_space_root;
+  /* All base64 values are decoded in place within jws_span, so the scratch
+   * buffer only holds the RSA decryption output and the SHA256 of the signed
+   * inputs, which must be calculated before those are decoded. */
+  if (az_span_size(scratch_buffer_span) < jwsSCRATCH_BUFFER_SIZE)
+  {
+    Logger.Error("[JWS] Scratch buffer was too small: " + String(jwsSCRATCH_BUFFER_SIZE) + " bytes");
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  manifest_context.scratch_calculation_buffer
+      = az_span_slice(scratch_buffer_span, 0, jwsRSA3072_SIZE);
+  manifest_context.jws_signed_sha
+      = az_span_slice(scratch_buffer_span, jwsRSA3072_SIZE, jwsRSA3072_SIZE + jwsSHA256_SIZE);
+  manifest_context.jwk_signed_sha = az_span_slice(
+      scratch_buffer_span,
+      jwsRSA3072_SIZE + jwsSHA256_SIZE,
+      jwsRSA3072_SIZE + (2 * jwsSHA256_SIZE));
 
   /*------------------- Parse and Decode the JWS Header
    * ------------------------*/
@@ -782,32 +713,29 @@ az_result SampleJWS::ManifestAuthenticate(
     return result;
   }
 
+  result = jws_signed_input_sha256_calculate(
+      manifest_context.base64_encoded_header,
+      manifest_context.base64_encoded_payload,
+      manifest_context.jws_signed_sha);
+
+  if (az_result_failed(result))
+  {
+    Logger.Error("[JWS] SHA256 Calculation failed");
+    return result;
+  }
+
   /* Note that we do not use mbedTLS to base64 decode values since we need the
    * ability to assume padding characters. */
   /* mbedTLS will stop the decoding short and we would then need to add in the
    * remaining characters. */
-  manifest_context.jws_header = az_span_create(persistent_scratch_space_head, jwsJWS_HEADER_SIZE);
-  persistent_scratch_space_head += jwsJWS_HEADER_SIZE;
-  result = az_base64_url_decode(
-      manifest_context.jws_header,
-      manifest_context.base64_encoded_header,
-      &manifest_context.out_jws_header_length);
+  manifest_context.jws_header = manifest_context.base64_encoded_header;
+  result = base64_url_decode_in_place(&manifest_context.jws_header, "JWS header");
 
   if (az_result_failed(result))
   {
-    Logger.Error("[JWS] JWS header az_base64_url_decode failed: result " + String(result, HEX));
-
-    if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
-    {
-      Logger.Error("[JWS] Decode buffer was too small: " + String(jwsJWS_HEADER_SIZE) + " bytes");
-    }
-
     return result;
   }
 
-  manifest_context.jws_header
-      = az_span_slice(manifest_context.jws_header, 0, manifest_context.out_jws_header_length);
-
   /*------------------- Parse SJWK JSON Payload ------------------------*/
 
   /* The "sjwk" is the signed signing public key */
@@ -840,13 +768,16 @@ az_result SampleJWS::ManifestAuthenticate(
     return result;
   }
 
-  manifest_context.jwk_header = az_span_create(reusable_scratch_space_head, jwsJWK_HEADER_SIZE);
-  reusable_scratch_space_head += jwsJWK_HEADER_SIZE;
-  /* Needs to be persisted so we can parse the signing key N and E later */
-  manifest_context.jwk_payload = az_span_create(persistent_scratch_space_head, jwsJWK_PAYLOAD_SIZE);
-  persistent_scratch_space_head += jwsJWK_PAYLOAD_SIZE;
-  manifest_context.jwk_signature = az_span_create(reusable_scratch_space_head, jwsSIGNATURE_SIZE);
-  reusable_scratch_space_head += jwsSIGNATURE_SIZE;
+  result = jws_signed_input_sha256_calculate(
+      manifest_context.jwk_base64_encoded_header,
+      manifest_context.jwk_base64_encoded_payload,
+      manifest_context.jwk_signed_sha);
+
+  if (az_result_failed(result))
+  {
+    Logger.Error("[JWS] SHA256 Calculation failed");
+    return result;
+  }
 
   result = base64_decode_jwk(&manifest_context);
   if (az_result_failed(result))
@@ -887,14 +818,8 @@ az_result SampleJWS::ManifestAuthenticate(
 
   /*------------------- Verify the signature ------------------------*/
 
-  manifest_context.scratch_calculation_buffer
-      = az_span_create(reusable_scratch_space_head, jwsSHA_CALCULATION_SCRATCH_SIZE);
-  reusable_scratch_space_head += jwsSHA_CALCULATION_SCRATCH_SIZE;
   result = jws_rs256_verify(
-      az_span_create(
-          az_span_ptr(manifest_context.jwk_base64_encoded_header),
-          az_span_size(manifest_context.jwk_base64_encoded_header)
-              + az_span_size(manifest_context.jwk_base64_encoded_payload) + 1),
+      manifest_context.jwk_signed_sha,
       manifest_context.jwk_signature,
       root_keys[root_key_index].root_key_n,
       root_keys[root_key_index].root_key_exponent,
@@ -906,36 +831,19 @@ az_result SampleJWS::ManifestAuthenticate(
     return result;
   }
 
-  /*------------------- Reuse Buffer Space ------------------------*/
-
-  /* The JWK verification is now done, so we can reuse the buffers which it
-   * used. */
-  reusable_scratch_space_head = reusable_scratch_space_root;
-
   /*------------------- Decode remaining values from JWS
    * ------------------------*/
 
-  manifest_context.jws_payload = az_span_create(reusable_scratch_space_head, jwsJWS_PAYLOAD_SIZE);
-  reusable_scratch_space_head += jwsJWS_PAYLOAD_SIZE;
-  manifest_context.jws_signature = az_span_create(reusable_scratch_space_head, jwsSIGNATURE_SIZE);
-  reusable_scratch_space_head += jwsSIGNATURE_SIZE;
-
-  result = base64_decode_jws_header_and_payload(&manifest_context);
+  result = base64_decode_jws_payload_and_signature(&manifest_context);
 
   if (result != AZ_OK)
   {
-    Logger.Error("[JWS] base64_decode_jws_header_and_payload failed");
+    Logger.Error("[JWS] base64_decode_jws_payload_and_signature failed");
     return result;
   }
 
   /*------------------- Base64 decode the signing key ------------------------*/
 
-  manifest_context.signing_key_n = az_span_create(reusable_scratch_space_head, jwsRSA3072_SIZE);
-  reusable_scratch_space_head += jwsRSA3072_SIZE;
-  manifest_context.signing_key_e
-      = az_span_create(reusable_scratch_space_head, jwsSIGNING_KEY_E_SIZE);
-  reusable_scratch_space_head += jwsSIGNING_KEY_E_SIZE;
-
   result = base64_decode_signing_key(&manifest_context);
 
   if (result != AZ_OK)
@@ -954,10 +862,7 @@ az_result SampleJWS::ManifestAuthenticate(
   }
 
   result = jws_rs256_verify(
-      az_span_create(
-          az_span_ptr(manifest_context.base64_encoded_header),
-          az_span_size(manifest_context.base64_encoded_header)
-              + az_span_size(manifest_context.base64_encoded_payload) + 1),
+      manifest_context.jws_signed_sha,
       manifest_context.jws_signature,
       manifest_context.signing_key_n,
       manifest_context.signing_key_e,
@@ -971,12 +876,8 @@ az_result SampleJWS::ManifestAuthenticate(
 
   /*------------------- Verify that the SHAs match ------------------------*/
 
-  manifest_context.manifest_sha_calculation
-      = az_span_create(reusable_scratch_space_head, jwsSHA256_SIZE);
-  reusable_scratch_space_head += jwsSHA256_SIZE;
-  manifest_context.parsed_manifest_sha
-      = az_span_create(reusable_scratch_space_head, jwsSHA256_SIZE);
-  reusable_scratch_space_head += jwsSHA256_SIZE;
+  /* The JWK verification is done, so its SHA256 space can be reused. */
+  manifest_context.manifest_sha_calculation = manifest_context.jwk_signed_sha;
 
   return verify_sha_match(&manifest_context, manifest_span);
 }
@@ -19,21 +19,11 @@
 
 #define jwsRSA3072_SIZE 384
 #define jwsSHA256_SIZE 32
-#define jwsJWS_HEADER_SIZE 1400
-#define jwsJWS_PAYLOAD_SIZE 60
-#define jwsJWK_HEADER_SIZE 48
-#define jwsJWK_PAYLOAD_SIZE 700
-#define jwsSIGNATURE_SIZE 400
-#define jwsSIGNING_KEY_E_SIZE 10
-#define jwsSIGNING_KEY_N_SIZE jwsRSA3072_SIZE
-#define jwsSHA_CALCULATION_SCRATCH_SIZE jwsRSA3072_SIZE + jwsSHA256_SIZE
 
-/* This is the minimum amount of space needed to store values which are held at
- * the same time. jwsJWS_PAYLOAD_SIZE, one jwsSIGNATURE_SIZE, and one
- * jwsSHA256_SIZE are excluded since they will reuse buffer space. */
-#define jwsSCRATCH_BUFFER_SIZE                                                       \
-  (jwsJWS_HEADER_SIZE + jwsJWK_HEADER_SIZE + jwsJWK_PAYLOAD_SIZE + jwsSIGNATURE_SIZE \
-   + jwsSIGNING_KEY_N_SIZE + jwsSIGNING_KEY_E_SIZE + jwsSHA_CALCULATION_SCRATCH_SIZE)
+/* All base64 values are decoded in place within the JWS, so the scratch buffer
+ * only holds the RSA decryption output and the SHA256 of the JWS and JWK signed
+ * inputs, which are calculated before those are decoded. */
+#define jwsSCRATCH_BUFFER_SIZE (jwsRSA3072_SIZE + (2 * jwsSHA256_SIZE))
 
 namespace SampleJWS
 {
@@ -52,7 +42,8 @@ typedef struct RootKey
  * @brief Authenticate the manifest from ADU.
  *
  * @param[in] manifest_span The escaped manifest from the ADU twin property.
- * @param[in] jws_span The JWS used to authenticate \p manifest_span.
+ * @param[in,out] jws_span The JWS used to authenticate \p manifest_span. Its
+ * base64 values are decoded in place, so its content is overwritten.
  * @param[in] root_keys An array of root keys that may be used to verify the payload.
  * @param[in] root_keys_length The number of root keys in \p root_keys.
  * @param[in] scratch_buffer_span Scratch buffer space for calculations. It
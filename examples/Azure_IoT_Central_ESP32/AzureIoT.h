@@ -62,9 +62,74 @@ extern log_function_t default_logging_function;
 #define DPS_GLOBAL_ENDPOINT_PORT AZ_IOT_DEFAULT_MQTT_CONNECT_PORT
 #define IOT_HUB_ENDPOINT_PORT AZ_IOT_DEFAULT_MQTT_CONNECT_PORT
 
+// "devices/{device id}/messages/events/" with a null terminator, for device ids of up to 128
+// characters (the IoT Hub limit).
+#define TELEMETRY_TOPIC_CACHE_SIZE (8 + 128 + 17 + 1)
+
+// Maximum number of outstanding reported properties updates is one less than this (power of two).
+#define REQUEST_TRACKER_CAPACITY 8
+#define PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS 30
+
+// Commands, properties responses and writable properties updates.
+#define IOT_HUB_SUBSCRIPTION_COUNT 3
+
+// Maximum number of QoS 1 telemetry messages awaiting a PUBACK, and the maximum payload size of
+// each. Payloads are copied so they can be published again after a reconnection.
+#define TELEMETRY_IN_FLIGHT_WINDOW_SIZE 4
+#define TELEMETRY_IN_FLIGHT_MAX_PAYLOAD_SIZE 512
+
+// Maximum number of stored telemetry messages forwarded per second after reconnecting.
+#define TELEMETRY_STORE_DRAIN_RATE_PER_SECOND 10
+
+// Outbound messages are published by priority: command responses and properties updates first,
+// then alarms, then routine telemetry. Each call to azure_iot_do_work publishes at most this many
+// queued messages, picking the highest priority one before each.
+#define OUTBOUND_PUBLISH_BUDGET_PER_WORK 4
+
+// Command responses and properties updates that can wait to be published, and the size of the
+// buffer each has for its topic and payload.
+#define RESPONSE_LANE_SIZE 2
+#define RESPONSE_LANE_BUFFER_SIZE 1024
+
+// Slots of the telemetry in-flight window routine telemetry may use; the rest are kept for alarms.
+#define TELEMETRY_ROUTINE_LANE_BUDGET 2
+
+// Changes to the reported properties shadow are coalesced into a single update, published once
+// the oldest unpublished change is this old or once this many properties changed, whichever comes
+// first. Only one update of the shadow is in flight at a time.
+#define REPORTED_PROPERTIES_FLUSH_DELAY_IN_SECONDS 5
+#define REPORTED_PROPERTIES_FLUSH_CHANGE_COUNT 8
+
 #define DEFAULT_SAS_TOKEN_LIFETIME_IN_MINUTES 60
 #define SAS_TOKEN_REFRESH_THRESHOLD_IN_SECS 30
 
+// The IoT Hub SAS token is renewed once SAS_TOKEN_RENEWAL_LIFETIME_PERCENT of its lifetime has
+// passed, less a jitter of up to SAS_TOKEN_RENEWAL_JITTER_PERCENT of it derived from the device
+// id, so devices connected at the same time renew at different times. The next token is generated
+// SAS_TOKEN_PREGENERATION_LEAD_IN_SECS ahead of the renewal, and the reconnection waits until no
+// outbound message is awaiting an acknowledgement, or until SAS_TOKEN_REFRESH_THRESHOLD_IN_SECS
+// before the token expires. A failed pre-generation is retried after
+// SAS_TOKEN_PREGENERATION_MIN_RETRY_DELAY_IN_SECS, doubled on each further failure up to
+// SAS_TOKEN_PREGENERATION_MAX_RETRY_DELAY_IN_SECS.
+#define SAS_TOKEN_RENEWAL_LIFETIME_PERCENT 80
+#define SAS_TOKEN_RENEWAL_JITTER_PERCENT 10
+#define SAS_TOKEN_PREGENERATION_LEAD_IN_SECS 60
+#define SAS_TOKEN_PREGENERATION_MIN_RETRY_DELAY_IN_SECS 2
+#define SAS_TOKEN_PREGENERATION_MAX_RETRY_DELAY_IN_SECS 32
+#define SAS_TOKEN_BUFFER_SIZE 512
+
+// An assignment kept with `dps_assignment_cache` is used for up to
+// DPS_ASSIGNMENT_CACHE_TTL_IN_SECONDS after it was obtained from Azure Device Provisioning.
+#define DPS_ASSIGNMENT_CACHE_TTL_IN_SECONDS (7 * 24 * 60 * 60)
+
+// While Azure Device Provisioning is assigning the device, its status is queried with a
+// decorrelated jitter backoff: each delay is random, between the retry-after given by the service
+// (or DPS_QUERY_MIN_RETRY_DELAY_MSEC, if none is given) and three times the previous delay, capped
+// at DPS_QUERY_MAX_RETRY_DELAY_MSEC. A retry-after above the cap is still honored. Devices booted
+// at the same time thus spread their queries instead of querying in lockstep.
+#define DPS_QUERY_MIN_RETRY_DELAY_MSEC 1000
+#define DPS_QUERY_MAX_RETRY_DELAY_MSEC 30000
+
 /*
  * The structures below define a generic interface to abstract the interaction of this module,
  * with any MQTT client used in the user application.
@@ -97,6 +162,15 @@ typedef struct mqtt_message_t_struct
   mqtt_qos_t qos;
 } mqtt_message_t;
 
+/*
+ * @brief    Generic pointer to a TLS session saved by the application MQTT client.
+ * @remark   Returned by `mqtt_client_get_tls_session_function_t`, and kept by the Azure IoT client
+ *           until it is released with `mqtt_client_free_tls_session_function_t`. What it points
+ *           to (e.g., a session ticket or a session ID with its master secret) depends on the TLS
+ *           stack used by the MQTT client.
+ */
+typedef void* mqtt_client_tls_session_t;
+
 /*
  * @brief    Configuration structure passed by `mqtt_client_init_function_t` to the user
  *           application for initializing the actual MQTT client.
@@ -127,6 +201,16 @@ typedef struct mqtt_client_config_t_struct
    * @brief    Password to be provided in the CONNECT sent by the MQTT client.
    */
   az_span password;
+
+  /*
+   * @brief    TLS session to be resumed by the MQTT client, or NULL for a full TLS handshake.
+   * @remark   This is the session saved on the last connection to the same broker, if
+   *           `mqtt_client_get_tls_session` is provided. The MQTT client shall offer it in the
+   *           TLS handshake (as a session ticket or session ID), falling back to a full handshake
+   *           if the broker does not resume it. The session is still owned by the Azure IoT
+   *           client, so the MQTT client must not release it.
+   */
+  mqtt_client_tls_session_t tls_session;
 } mqtt_client_config_t;
 
 /*
@@ -183,7 +267,7 @@ typedef int (*mqtt_client_deinit_function_t)(mqtt_client_handle_t mqtt_client_ha
  * @return       int                   The packet ID on success, or NEGATIVE if any failure occurs.
  *                                     If the QoS in `mqtt_message` is:
  *                                     - AT LEAST ONCE, the Azure IoT client expects
- * `azure_iot_mqtt_client_connected` to be called once the MQTT client receives a PUBACK.
+ * `azure_iot_mqtt_client_publish_completed` to be called once the MQTT client receives a PUBACK.
  *                                     - AT MOST ONCE, there should be no PUBACK, so no further
  * action is needed for this PUBLISH.
  */
@@ -211,8 +295,41 @@ typedef int (*mqtt_client_subscribe_function_t)(
     az_span topic,
     mqtt_qos_t qos);
 
+/*
+ * @brief        Function to save the TLS session of a connected MQTT client.
+ * @remark       Optional. When this function is invoked, the MQTT client (referenced by
+ * `mqtt_client_handle`) is connected to the broker, and shall return a copy of its current TLS
+ * session that can be resumed on later connections to the same broker. Azure IoT client keeps the
+ * session across reconnects (e.g., for renewing the SAS token) and across `azure_iot_stop` and
+ * `azure_iot_start`, passing it in `mqtt_client_config_t` to `mqtt_client_init_function_t`.
+ *
+ * @param[in]    mqtt_client_handle    A pointer to the instance of the MQTT client previously
+ * created with `mqtt_client_init_function_t` function.
+ *
+ * @return       mqtt_client_tls_session_t    The saved TLS session, or NULL if the session cannot
+ * be resumed or if any failure occurs.
+ */
+typedef mqtt_client_tls_session_t (*mqtt_client_get_tls_session_function_t)(
+    mqtt_client_handle_t mqtt_client_handle);
+
+/*
+ * @brief        Function to release a TLS session saved with
+ * `mqtt_client_get_tls_session_function_t`.
+ * @remark       Invoked when Azure IoT client replaces or discards a saved TLS session.
+ *
+ * @param[in]    tls_session    The TLS session to release.
+ *
+ * @return       Nothing.
+ */
+typedef void (*mqtt_client_free_tls_session_function_t)(mqtt_client_tls_session_t tls_session);
+
 /*
  * @brief    Structure that consolidates all the abstracted MQTT functions.
+ * @remark   `mqtt_client_get_tls_session` and `mqtt_client_free_tls_session` are optional, and
+ *           allow the MQTT client to resume TLS sessions instead of doing a full TLS handshake
+ *           on every connection. Either both or none must be set. No sample shipped with this
+ *           library implements them, as the ESP-IDF MQTT client used by the ESP32 samples does
+ *           not expose its TLS session.
  */
 typedef struct mqtt_client_interface_t_struct
 {
@@ -220,6 +337,8 @@ typedef struct mqtt_client_interface_t_struct
   mqtt_client_deinit_function_t mqtt_client_deinit;
   mqtt_client_publish_function_t mqtt_client_publish;
   mqtt_client_subscribe_function_t mqtt_client_subscribe;
+  mqtt_client_get_tls_session_function_t mqtt_client_get_tls_session;
+  mqtt_client_free_tls_session_function_t mqtt_client_free_tls_session;
 } mqtt_client_interface_t;
 
 /*
@@ -243,8 +362,9 @@ typedef int (*base64_decode_function_t)(
     size_t* decoded_length);
 
 /*
- * @brief         This function must be provided by the user for the AzureIoT layer
- *                to perform the generation of the SAS tokens used as MQTT passwords.
+ * @brief         Base64-encodes data.
+ * @remark        Not used by the AzureIoT layer anymore, since SAS signatures are encoded in place
+ *                while generating the SAS tokens used as MQTT passwords. Can be NULL.
  *
  * @param[in]     data              Buffer containing the Base64-decoded content.
  * @param[in]     data_length       Length of `data`.
@@ -294,17 +414,86 @@ typedef struct data_manipulation_functions_t_struct
   hmac_sha256_encryption_function_t hmac_sha256_encrypt;
 } data_manipulation_functions_t;
 
+/*
+ * @brief         This function must be provided by the user for the AzureIoT layer to read the
+ *                device assignment kept in persistent storage (e.g., flash or NVS).
+ *
+ * @param[in]     buffer            Buffer where to read the assignment record into.
+ * @param[in]     buffer_size       Size of `buffer`.
+ * @param[out]    length            The length of the record read into `buffer`.
+ *
+ * @return        int               0 on success, or non-zero if no record is stored or if any
+ *                                  failure occurs.
+ */
+typedef int (*dps_assignment_load_function_t)(uint8_t* buffer, size_t buffer_size, size_t* length);
+
+/*
+ * @brief         This function must be provided by the user for the AzureIoT layer to keep the
+ *                device assignment in persistent storage (e.g., flash or NVS).
+ * @remark        The record is opaque to the user application, and must be stored as is,
+ *                replacing any previous record. It is protected by a checksum and expires, so it
+ *                does not need to be validated by the user application.
+ *
+ * @param[in]     data              The assignment record to store, or NULL to erase the stored
+ *                                  record.
+ * @param[in]     length            Length of `data`, or zero to erase the stored record.
+ *
+ * @return        int               0 on success, or non-zero if any failure occurs.
+ */
+typedef int (*dps_assignment_save_function_t)(const uint8_t* data, size_t length);
+
+/*
+ * @brief    Structure that consolidates the functions to persist the device assignment.
+ */
+typedef struct dps_assignment_cache_t_struct
+{
+  dps_assignment_load_function_t load;
+  dps_assignment_save_function_t save;
+} dps_assignment_cache_t;
+
+/*
+ * @brief    Priorities of the telemetry messages sent with `azure_iot_send_telemetry_at_least_once`.
+ */
+typedef enum azure_iot_telemetry_priority_t_enum
+{
+  /*
+   * @brief    Published before any routine telemetry, and may use the whole in-flight window.
+   */
+  azure_iot_telemetry_priority_alarm,
+  /*
+   * @brief    May use up to TELEMETRY_ROUTINE_LANE_BUDGET slots of the in-flight window.
+   */
+  azure_iot_telemetry_priority_routine
+} azure_iot_telemetry_priority_t;
+
+/*
+ * @brief        Defines the callback for notifying the delivery of a telemetry message sent with
+ *               `azure_iot_send_telemetry_at_least_once`.
+ *
+ * @param[in]    context    The context provided by the caller when sending the telemetry message.
+ *
+ * @return                  Nothing.
+ */
+typedef void (*telemetry_completed_t)(void* context);
+
 /*
  * @brief        Defines the callback for notifying the completion of a reported properties update.
  *
- * @param[in]    request_id     Request ID provided by the caller when sending the reported
- * properties update.
+ * @param[in]    request_id     Request ID of the reported properties update, as returned by
+ * `azure_iot_send_properties_update`, or generated by the Azure IoT client for updates of the
+ * `reported_properties_shadow`.
  * @param[in]    status_code    Result of the reported properties update (uses HTTP status code
  * semantics).
+ * @param[in]    version        The `$version` of the reported properties last acknowledged by
+ * Azure IoT Hub: the one set by this update if it succeeded, otherwise the one set by the last
+ * update that did. Zero if none has been acknowledged since `azure_iot_init`.
  *
  * @return                      Nothing.
  */
-typedef void (*properties_update_completed_t)(uint32_t request_id, az_iot_status status_code);
+typedef void (*properties_update_completed_t)(
+    uint32_t request_id,
+    az_iot_status status_code,
+    int32_t version);
 
 /*
  * @brief        Defines the callback for receiving a writable-properties update.
@@ -396,7 +585,8 @@ typedef enum azure_iot_status_t_struct
 
 /*
  * @brief     Internal states of the Azure IoT client.
- * @remark    These states are not exposed to the user application.
+ * @remark    These states are only exposed to the user application for instrumentation, through
+ *            `azure_iot_metrics_t` and `on_state_changed`.
  */
 typedef enum azure_iot_client_state_t_struct
 {
@@ -412,16 +602,169 @@ typedef enum azure_iot_client_state_t_struct
   azure_iot_state_provisioned,
   azure_iot_state_connecting_to_hub,
   azure_iot_state_connected_to_hub,
-  azure_iot_state_subscribing_to_pnp_cmds,
-  azure_iot_state_subscribed_to_pnp_cmds,
-  azure_iot_state_subscribing_to_pnp_props,
-  azure_iot_state_subscribed_to_pnp_props,
-  azure_iot_state_subscribing_to_pnp_writable_props,
+  azure_iot_state_subscribing_to_pnp,
   azure_iot_state_ready,
   azure_iot_state_refreshing_sas,
   azure_iot_state_error
 } azure_iot_client_state_t;
 
+#define AZURE_IOT_CLIENT_STATE_COUNT (azure_iot_state_error + 1)
+
+/*
+ * @brief        Defines the callback for reading a monotonic clock with millisecond resolution.
+ * @remark       Used by the Azure IoT client for its metrics and to schedule the device
+ *               provisioning status queries (e.g., `esp_timer_get_time() / 1000` on ESP32).
+ *
+ * @return       The current time in milliseconds, from any fixed origin.
+ */
+typedef int64_t (*get_time_msec_function_t)(void);
+
+/*
+ * @brief    Connection metrics of the Azure IoT client, returned by `azure_iot_get_metrics`.
+ * @remark   Times are in milliseconds, read from the `get_time_msec` of the configuration. If it
+ *           is not set, `az_platform_clock_msec` is used, or the system time if the platform does
+ *           not provide it. The system time only has a resolution of one second, so times and
+ *           durations are then multiples of 1000, and those under a second mostly read as zero.
+ *           Times relative to `start_time_msec` cover the last `azure_iot_start` (e.g.,
+ *           `state_entered_msec[azure_iot_state_ready]` is the time it took to be ready), while
+ *           durations and counters add up since `azure_iot_init`.
+ */
+typedef struct azure_iot_metrics_t_struct
+{
+  /*
+   * @brief    Time of the last `azure_iot_start`, on the same clock as the other times.
+   */
+  int64_t start_time_msec;
+
+  /*
+   * @brief    Time at which each state was first entered since `start_time_msec`, relative to
+   *           it, or -1 if it was not entered.
+   */
+  int32_t state_entered_msec[AZURE_IOT_CLIENT_STATE_COUNT];
+
+  /*
+   * @brief    Total time spent in each state, including the time spent so far in the current one.
+   */
+  uint32_t state_duration_msec[AZURE_IOT_CLIENT_STATE_COUNT];
+
+  /*
+   * @brief    Time at which each SUBACK of the Azure IoT Hub subscriptions was received since
+   *           `start_time_msec`, in order of arrival, relative to it, or -1 if not received.
+   */
+  int32_t subscription_completed_msec[IOT_HUB_SUBSCRIPTION_COUNT];
+
+  /*
+   * @brief    Time between the client last leaving `azure_iot_state_ready` (e.g., to renew the
+   *           SAS token, or on a disconnection) and becoming ready again.
+   */
+  uint32_t last_reconnect_duration_msec;
+
+  /*
+   * @brief    Number of MQTT connections started, to Azure Device Provisioning or IoT Hub.
+   */
+  uint32_t connection_count;
+
+  /*
+   * @brief    Number of connections to Azure IoT Hub started after the client had been ready.
+   */
+  uint32_t reconnect_count;
+
+  /*
+   * @brief    Number of disconnections notified with `azure_iot_mqtt_client_disconnected`.
+   */
+  uint32_t disconnection_count;
+
+  /*
+   * @brief    Number of times the client became ready.
+   */
+  uint32_t ready_count;
+
+  /*
+   * @brief    Number of reconnections to renew the SAS token.
+   */
+  uint32_t sas_token_renewal_count;
+
+  /*
+   * @brief    Number of device provisioning status queries.
+   */
+  uint32_t dps_query_count;
+
+  /*
+   * @brief    Number of times the client went into error state.
+   */
+  uint32_t error_count;
+
+  /*
+   * @brief    Number of publishes the MQTT client failed to send.
+   */
+  uint32_t publish_failure_count;
+
+  /*
+   * @brief    Topic and payload bytes of the messages published and received.
+   */
+  uint32_t bytes_sent;
+  uint32_t bytes_received;
+} azure_iot_metrics_t;
+
+/*
+ * @brief        Defines the callback for notifying a change of the internal state of the Azure
+ *               IoT client.
+ * @remark       The callback is invoked by the Azure IoT client functions that change the state,
+ *               so it must not call them.
+ *
+ * @param[in]    previous_state    The state left.
+ * @param[in]    state             The state entered.
+ * @param[in]    duration_msec     Time spent in `previous_state`.
+ *
+ * @return                         Nothing.
+ */
+typedef void (*state_changed_t)(
+    azure_iot_client_state_t previous_state,
+    azure_iot_client_state_t state,
+    uint32_t duration_msec);
+
+/*
+ * @brief     States of a slot of the QoS 1 telemetry in-flight window.
+ * @remark    These states are not exposed to the user application.
+ */
+typedef enum telemetry_in_flight_state_t_enum
+{
+  telemetry_in_flight_free = 0,
+  telemetry_in_flight_queued,
+  telemetry_in_flight_publishing,
+  telemetry_in_flight_awaiting_puback
+} telemetry_in_flight_state_t;
+
+/*
+ * @brief     A QoS 1 telemetry message sent but not yet acknowledged by Azure IoT Hub.
+ * @remark    None of the members within this structure may be accessed directly by the user
+ *            application.
+ */
+typedef struct telemetry_in_flight_t_struct
+{
+  telemetry_in_flight_state_t state;
+  azure_iot_telemetry_priority_t priority;
+  int packet_id;
+  telemetry_completed_t on_completed;
+  void* context;
+  size_t payload_length;
+  uint8_t payload[TELEMETRY_IN_FLIGHT_MAX_PAYLOAD_SIZE];
+} telemetry_in_flight_t;
+
+/*
+ * @brief     A command response or properties update waiting to be published.
+ * @remark    `request_id` is the id of a properties update, or 0 for a command response.
+ *            None of the members within this structure may be accessed directly by the user
+ *            application.
+ */
+typedef struct outbound_response_t_struct
+{
+  uint32_t request_id;
+  size_t topic_length;
+  size_t payload_length;
+  uint8_t buffer[RESPONSE_LANE_BUFFER_SIZE];
+} outbound_response_t;
+
 /*
  * @brief    Structure that holds the configuration for the Azure IoT client.
  * @remark   Once `azure_iot_start` is called, this structure SHALL NOT be modified by the
@@ -526,7 +869,7 @@ typedef struct azure_iot_config_t_struct
    * SAS-token authentication (as used with Azure IoT Central), this size must be at least:
    *              sizeof(data_buffer) >= ( lengthof(<iot-hub-fqdn>) + lengthof(<device-id>) +
    *                                       lengthof(<MQTT-clientid>) + lengthof(<MQTT-username>) +
-   *                                       2 * lengthof(<MQTT-password>) )
+   *                                       lengthof(<MQTT-password>) )
    *
    *              Where:
    *              <MQTT-clientid>  = <device-id> + '\0'
@@ -539,8 +882,7 @@ typedef struct azure_iot_config_t_struct
    * + '\0' lengthof(<sha256-string>) <= lengthof(<64-char-string>) <expiration-time> =
    * <10-digit-unix-time>
    *
-   *              Note: We use two times the length of <MQTT-password> given the internal operations
-   * needed to generate it.
+   *              Note: <MQTT-password> is generated in place, with no intermediate buffers.
    *
    *              Example:
    *              <iot-hub-fqdn>    = "iotc-1a430cf3-6f05-4b84-965d-cb1385077966.azure-devices.net"
@@ -551,7 +893,7 @@ typedef struct azure_iot_config_t_struct
    *              <expiration-time> = "1641251566"
    *              <user-agent>      = "c%2F1.1.0-beta.1(FreeRTOS)"
    *
-   *              sizeof(data_buffer) >= 592 bytes (59 bytes + 2 bytes + 3 bytes + 190 bytes + 338
+   *              sizeof(data_buffer) >= 423 bytes (59 bytes + 2 bytes + 3 bytes + 190 bytes + 169
    * bytes, respectively)
    */
   az_span data_buffer;
@@ -570,9 +912,9 @@ typedef struct azure_iot_config_t_struct
   /*
    * @brief    Amount of minutes for which the MQTT password should be valid.
    * @remark   If set to zero, Azure IoT client sets it to the default value of 60 minutes.
-   *           Once this amount of minutes has passed and the MQTT password is expired,
-   *           Azure IoT client triggers its logic to generate a new password and reconnect with
-   *           Azure IoT Hub.
+   *           Before the MQTT password expires, Azure IoT client generates a new password and
+   *           reconnects with Azure IoT Hub, at a time that varies by device (see
+   *           SAS_TOKEN_RENEWAL_LIFETIME_PERCENT).
    */
   uint32_t sas_token_lifetime_in_minutes;
 
@@ -599,6 +941,80 @@ typedef struct azure_iot_config_t_struct
    *            `azure_iot_send_command_response`.
    */
   command_request_received_t on_command_request_received;
+
+  /*
+   * @brief     Optional callback handler used by Azure IoT client to inform the user application
+   *            of every change of its internal state.
+   * @remark    Meant for instrumentation (e.g., tracing where the time to connect goes), along
+   *            with `azure_iot_get_metrics`. Set to NULL to disable.
+   */
+  state_changed_t on_state_changed;
+
+  /*
+   * @brief     Optional monotonic clock with millisecond resolution.
+   * @remark    Times the metrics and the device provisioning status queries. If set to NULL,
+   *            `az_platform_clock_msec` is used, or the system time if the platform does not
+   *            provide it. The system time is set by the user application (e.g., with SNTP), can
+   *            jump, and only has a resolution of one second (see `azure_iot_metrics_t`).
+   */
+  get_time_msec_function_t get_time_msec;
+
+  /*
+   * @brief     Optional store where telemetry is kept while the client is not connected.
+   * @remark    If set, messages given to `azure_iot_send_telemetry` while the client is not
+   *            connected (or that fail to be published) are appended to this store instead of
+   *            being lost, evicting the oldest stored messages when it is full. Once connected,
+   *            they are forwarded oldest first with QoS 1, one at a time and at most
+   *            TELEMETRY_STORE_DRAIN_RATE_PER_SECOND per second. A message is only removed from
+   *            the store once acknowledged, so it survives a reconnection or a restart of the
+   *            device (if the store is persistent) while in flight. The store must be initialized
+   *            with `az_iot_message_store_init` before `azure_iot_start` is called.
+   *            Set to NULL to disable.
+   */
+  az_iot_message_store* telemetry_store;
+
+  /*
+   * @brief     Optional compression of telemetry payloads.
+   * @remark    If set, telemetry payloads are compressed with `az_iot_message_compress` right
+   *            before they are published, and the `$.ce` (content encoding) message property is
+   *            set to the `content_encoding` of these options. Payloads that compression does not
+   *            make smaller are published as is. Use `az_iot_message_compression_options_default`
+   *            for the default dictionary. Set to NULL to disable.
+   */
+  az_iot_message_compression_options const* telemetry_compression;
+
+  /*
+   * @brief     Optional shadow of the reported properties, updated by the user application.
+   * @remark    If set, the user application writes reported properties with the
+   *            `az_iot_hub_client_properties_shadow_set_*` functions instead of calling
+   *            `azure_iot_send_properties_update`. Writes to the same property are merged, and
+   *            only the properties whose value changed since Azure IoT Hub last acknowledged it
+   *            are published, in a single update, once
+   *            REPORTED_PROPERTIES_FLUSH_DELAY_IN_SECONDS have passed since the first change or
+   *            once REPORTED_PROPERTIES_FLUSH_CHANGE_COUNT properties changed. Changes made while
+   *            an update is in flight wait for its response (or for it to time out), and are then
+   *            coalesced into the next update. `on_properties_update_completed` is invoked for
+   *            each update. String values are compared by a 32-bit hash, so a new string with
+   *            the same hash as the acknowledged one is not published (see
+   *            `az_iot_hub_client_properties_shadow_set_string`). The shadow must be initialized
+   *            with `az_iot_hub_client_properties_shadow_init` before `azure_iot_start` is called.
+   *            Set to NULL to disable.
+   */
+  az_iot_hub_client_properties_shadow* reported_properties_shadow;
+
+  /*
+   * @brief     Optional persistence of the IoT Hub and device id assigned by Azure Device
+   *            Provisioning.
+   * @remark    If `load` and `save` are set, the assignment is saved once device provisioning
+   *            completes, along with the time it expires (see DPS_ASSIGNMENT_CACHE_TTL_IN_SECONDS)
+   *            and a checksum that also covers `dps_id_scope` and `dps_registration_id`. When
+   *            started with `use_device_provisioning` set and no `iot_hub_fqdn` or `device_id`,
+   *            the client connects straight to the Azure IoT Hub of a valid, unexpired saved
+   *            assignment, skipping device provisioning. If that connection is refused (see
+   *            `azure_iot_mqtt_client_connection_refused`), the saved assignment is erased and the
+   *            next start provisions the device again. Set both, or leave both NULL to disable.
+   */
+  dps_assignment_cache_t dps_assignment_cache;
 } azure_iot_config_t;
 
 /*
@@ -615,12 +1031,43 @@ typedef struct azure_iot_t_struct
   mqtt_client_handle_t mqtt_client_handle;
   az_iot_hub_client iot_hub_client;
   az_iot_hub_client_options iot_hub_client_options;
+  uint8_t telemetry_topic_cache[TELEMETRY_TOPIC_CACHE_SIZE];
+  az_iot_hub_client_request_tracker request_tracker;
+  az_iot_hub_client_request_tracker_entry request_tracker_entries[REQUEST_TRACKER_CAPACITY];
+  int pending_subscription_packet_ids[IOT_HUB_SUBSCRIPTION_COUNT];
+  int pending_subscription_count;
+  telemetry_in_flight_t telemetry_in_flight[TELEMETRY_IN_FLIGHT_WINDOW_SIZE];
+  // The message of the window forwarded from the telemetry store, popped from it once acknowledged.
+  telemetry_in_flight_t* stored_telemetry_in_flight;
+  // The packet id of a PUBACK processed while a message of the window was being published.
+  int early_puback_packet_id;
+  uint32_t telemetry_store_drain_time;
+  int telemetry_store_drain_count;
+  outbound_response_t response_lane[RESPONSE_LANE_SIZE];
+  int response_lane_head;
+  int response_lane_count;
+  uint32_t reported_properties_request_id;
+  uint32_t reported_properties_change_time;
+  int32_t reported_properties_version;
   az_iot_provisioning_client dps_client;
   azure_iot_client_state_t state;
   uint32_t sas_token_expiration_time;
-  uint32_t dps_retry_after_seconds;
-  uint32_t dps_last_query_time;
+  uint32_t sas_token_renewal_time;
+  uint32_t sas_token_pregeneration_retry_time;
+  uint32_t sas_token_pregeneration_retry_delay;
+  uint32_t next_sas_token_expiration_time;
+  size_t next_sas_token_length;
+  uint8_t next_sas_token[SAS_TOKEN_BUFFER_SIZE];
+  int64_t dps_next_query_time_msec;
+  int32_t dps_query_delay_msec;
+  uint32_t dps_query_jitter_state;
   az_span dps_operation_id;
+  bool is_dps_assignment_cached;
+  mqtt_client_tls_session_t dps_tls_session;
+  mqtt_client_tls_session_t iot_hub_tls_session;
+  azure_iot_metrics_t metrics;
+  int64_t state_entered_time_msec;
+  int64_t ready_left_time_msec;
 } azure_iot_t;
 
 /*
@@ -664,7 +1111,8 @@ int azure_iot_start(azure_iot_t* azure_iot);
  * @brief        Stops an Azure IoT client.
  * @remark       This function must be called once the user application wants to stop working and
  *               disconnect from the Azure IoT services. The same instance of `azure_iot_t` can be
- *               used again by the user application by calling `azure_iot_start`.
+ *               used again by the user application by calling `azure_iot_start`. TLS sessions
+ *               saved with `mqtt_client_get_tls_session` are kept, to be resumed once restarted.
  *
  * @param[in]    azure_iot           A pointer to the instance of `azure_iot_t` defined by the
  * caller.
@@ -686,6 +1134,20 @@ int azure_iot_stop(azure_iot_t* azure_iot);
  */
 azure_iot_status_t azure_iot_get_status(azure_iot_t* azure_iot);
 
+/*
+ * @brief        Gets the connection metrics of the Azure IoT client.
+ * @remark       Unlike `azure_iot_get_status`, these detail the time spent in each internal state,
+ *               to find out where the time to connect goes.
+ *
+ * @param[in]    azure_iot    A pointer to the instance of `azure_iot_t` previously initialized by
+ * the caller.
+ * @param[out]   metrics      A pointer to where to copy the metrics to. Please see the
+ * `azure_iot_metrics_t` documentation above for details.
+ *
+ * @return       Nothing.
+ */
+void azure_iot_get_metrics(azure_iot_t* azure_iot, azure_iot_metrics_t* metrics);
+
 /*
  * @brief        Causes the Azure IoT client to perform its tasks for connecting and working with
  * Azure IoT services.
@@ -704,6 +1166,8 @@ void azure_iot_do_work(azure_iot_t* azure_iot);
 
 /*
  * @brief        Sends a telemetry payload to the Azure IoT Hub.
+ * @remark       If `telemetry_store` is set in `azure_iot_config_t`, the message is stored while the
+ *               client is not connected and forwarded once it is.
  *
  * @param[in]    azure_iot    A pointer to the instance of `azure_iot_t` previously initialized by
  * the caller.
@@ -714,22 +1178,78 @@ void azure_iot_do_work(azure_iot_t* azure_iot);
  */
 int azure_iot_send_telemetry(azure_iot_t* azure_iot, az_span message);
 
+/*
+ * @brief        Sends a telemetry payload to the Azure IoT Hub with QoS 1 (AT LEAST ONCE).
+ * @remark       Up to TELEMETRY_IN_FLIGHT_WINDOW_SIZE messages can await a PUBACK at once, so
+ *               several messages can be sent without waiting for each to be acknowledged, of which
+ *               routine telemetry may use TELEMETRY_ROUTINE_LANE_BUDGET. Queued alarms are
+ *               published before queued routine telemetry. The
+ *               payload is copied, so `message` may be reused as soon as this function returns.
+ *               If the client is not connected, the message is queued and published once it is.
+ *               Messages not acknowledged when the connection is lost are published again after
+ *               the client reconnects, so Azure IoT Hub may receive some of them more than once.
+ *               Use `azure_iot_get_telemetry_window_space` to check whether a message can be
+ *               sent before generating it.
+ *
+ * @param[in]    azure_iot       A pointer to the instance of `azure_iot_t` previously initialized
+ * by the caller.
+ * @param[in]    message         An az_span instance containing the buffer and size of the actual
+ * message to be sent. Must not be larger than TELEMETRY_IN_FLIGHT_MAX_PAYLOAD_SIZE.
+ * @param[in]    priority        The priority of the message.
+ * @param[in]    on_completed    Callback invoked once Azure IoT Hub acknowledges the message.
+ *                               Can be NULL.
+ * @param[in]    context         A pointer passed to `on_completed`. Can be NULL.
+ *
+ * @return       int             0 on success, or non-zero if the window is full or any failure
+ * occurs.
+ */
+int azure_iot_send_telemetry_at_least_once(
+    azure_iot_t* azure_iot,
+    az_span message,
+    azure_iot_telemetry_priority_t priority,
+    telemetry_completed_t on_completed,
+    void* context);
+
+/*
+ * @brief        Gets how many more telemetry messages of a given priority
+ *               `azure_iot_send_telemetry_at_least_once` can accept before the window is full.
+ * @remark       Space is released as Azure IoT Hub acknowledges the messages in flight.
+ *
+ * @param[in]    azure_iot    A pointer to the instance of `azure_iot_t` previously initialized by
+ * the caller.
+ * @param[in]    priority     The priority of the messages to be sent.
+ *
+ * @return       int          The number of free slots available to `priority`.
+ */
+int azure_iot_get_telemetry_window_space(
+    azure_iot_t* azure_iot,
+    azure_iot_telemetry_priority_t priority);
+
 /**
  * @brief        Sends a property update message to Azure IoT Hub.
  *
  * @param[in]    azure_iot     The pointer to the azure_iot_t instance that holds the state of the
  * Azure IoT client.
- * @param[in]    request_id    An unique identification number to correlate the response with when
  * @param[in]    message       An `az_span` with the message with the reported properties update
  *                             (a JSON document formatted according to the DTDL specification).
  *                             `message` gets passed as-is to the MQTT client publish function as
  * the payload, so if your MQTT client expects a null-terminated string for payload, make sure
  * `message` is a null-terminated string. `on_properties_update_completed` (set in
- * azure_iot_config_t) is invoked.
+ * azure_iot_config_t) is invoked when the response is received, or with
+ * AZ_IOT_STATUS_TIMEOUT if none is received within PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS.
+ * The update is copied and published ahead of any telemetry; if the client is not connected, it
+ * is published once it is. Up to RESPONSE_LANE_SIZE updates and command responses can wait.
+ * Properties that change often are better written to the `reported_properties_shadow` (see
+ * azure_iot_config_t), which coalesces them into fewer updates.
+ * @param[out]   out_request_id The request id generated for the update, to correlate the response
+ *                              with when `on_properties_update_completed` is invoked. Can be NULL.
  *
  * @return       int           0 if the function succeeds, or non-zero if any failure occurs.
  */
-int azure_iot_send_properties_update(azure_iot_t* azure_iot, uint32_t request_id, az_span message);
+int azure_iot_send_properties_update(
+    azure_iot_t* azure_iot,
+    az_span message,
+    uint32_t* out_request_id);
 
 /**
  * @brief        Sends a property update message to Azure IoT Hub.
@@ -744,6 +1264,8 @@ int azure_iot_send_properties_update(azure_iot_t* azure_iot, uint32_t request_id
  * @param[in]    payload            A custom payload to be sent in the device command response.
  *                                  This is expected to be a json content.
  *                                  If no payload is to be sent, please set it as AZ_SPAN_EMPTY.
+ * @remark       The response is copied and published ahead of any telemetry; if the client is not
+ *               connected, it is published once it is.
  *
  * @return       int                0 if the function succeeds, or non-zero if any failure occurs.
  */
@@ -779,6 +1301,22 @@ int azure_iot_mqtt_client_connected(azure_iot_t* azure_iot);
  */
 int azure_iot_mqtt_client_disconnected(azure_iot_t* azure_iot);
 
+/*
+ * @brief        Informs the Azure IoT client that the Azure IoT service refused the MQTT
+ *               connection for its credentials.
+ * @remark       This should be called when the CONNACK return code is "bad user name or password"
+ *               or "not authorized", before `azure_iot_mqtt_client_disconnected`. If the client
+ *               was connecting to the Azure IoT Hub of an assignment loaded from
+ *               `dps_assignment_cache`, the assignment is erased so the device is provisioned
+ *               again; the device may have been moved to another Azure IoT Hub.
+ *
+ * @param[in]    azure_iot    A pointer to the instance of `azure_iot_t` previously initialized by
+ * the caller.
+ *
+ * @return       int          0 on success, or non-zero if any failure occurs.
+ */
+int azure_iot_mqtt_client_connection_refused(azure_iot_t* azure_iot);
+
 /*
  * @brief        Informs the Azure IoT client that the MQTT client has subscribed to a topic.
  * @remark       This must be called after Azure IoT client invokes the `mqtt_client_subscribe`
@@ -803,7 +1341,7 @@ int azure_iot_mqtt_client_subscribe_completed(azure_iot_t* azure_iot, int packet
  *
  * @param[in]    azure_iot    A pointer to the instance of `azure_iot_t` previously initialized by
  * the caller.
- * @param[in]    packet_id    The ID of the subscription performed previous by the Azure IoT client.
+ * @param[in]    packet_id    The packet ID returned by `mqtt_client_publish` for the PUBLISH.
  *
  * @return       int          0 on success, or non-zero if any failure occurs.
  */
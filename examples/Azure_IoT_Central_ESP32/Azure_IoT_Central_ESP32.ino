@@ -43,7 +43,9 @@
 #include <mbedtls/sha256.h>
 
 // Libraries for MQTT client and WiFi connection
+#include <Preferences.h>
 #include <WiFi.h>
+#include <esp_timer.h>
 #include <mqtt_client.h>
 
 // Azure IoT SDK for C includes
@@ -105,7 +107,9 @@ static uint8_t az_iot_data_buffer[AZ_IOT_DATA_BUFFER_SIZE];
 
 #define MQTT_PROTOCOL_PREFIX "mqtts://"
 
-static uint32_t properties_request_id = 0;
+#define DPS_ASSIGNMENT_PREFERENCES_NAMESPACE "azure_iot"
+#define DPS_ASSIGNMENT_PREFERENCES_KEY "dps_assignment"
+
 static bool send_device_info = true;
 static bool azure_initial_connect = false; //Turns true when ESP32 successfully connects to Azure IoT Central for the first time
 
@@ -263,7 +267,9 @@ static int mqtt_client_publish_function(
 {
   LogInfo("MQTT client publishing to '%s'", az_span_ptr(mqtt_message->topic));
 
-  int mqtt_result = esp_mqtt_client_publish(
+  // esp_mqtt_client_publish returns the packet id (0 for QoS 0) or negative on error already, so
+  // no conversion is needed. The packet id is needed to match the PUBACK of QoS 1 messages.
+  int packet_id = esp_mqtt_client_publish(
       (esp_mqtt_client_handle_t)mqtt_client_handle,
       (const char*)az_span_ptr(mqtt_message->topic), // topic is always null-terminated.
       (const char*)az_span_ptr(mqtt_message->payload),
@@ -271,14 +277,7 @@ static int mqtt_client_publish_function(
       (int)mqtt_message->qos,
       MQTT_DO_NOT_RETAIN_MSG);
 
-  if (mqtt_result == -1)
-  {
-    return RESULT_ERROR;
-  }
-  else
-  {
-    return RESULT_OK;
-  }
+  return packet_id;
 }
 
 /* --- Other Interface functions required by Azure IoT --- */
@@ -334,12 +333,70 @@ static int base64_encode(
   return mbedtls_base64_encode(encoded, encoded_size, encoded_length, data, data_length);
 }
 
+/*
+ * See the documentation of `dps_assignment_load_function_t` in AzureIoT.h for details.
+ */
+static int dps_assignment_load(uint8_t* buffer, size_t buffer_size, size_t* length)
+{
+  Preferences preferences;
+
+  if (!preferences.begin(DPS_ASSIGNMENT_PREFERENCES_NAMESPACE, true))
+  {
+    return 1;
+  }
+
+  *length = preferences.getBytes(DPS_ASSIGNMENT_PREFERENCES_KEY, buffer, buffer_size);
+  preferences.end();
+
+  return (*length == 0 ? 1 : 0);
+}
+
+/*
+ * See the documentation of `dps_assignment_save_function_t` in AzureIoT.h for details.
+ */
+static int dps_assignment_save(const uint8_t* data, size_t length)
+{
+  Preferences preferences;
+  int result;
+
+  if (!preferences.begin(DPS_ASSIGNMENT_PREFERENCES_NAMESPACE, false))
+  {
+    return 1;
+  }
+
+  if (length == 0)
+  {
+    (void)preferences.remove(DPS_ASSIGNMENT_PREFERENCES_KEY);
+    result = 0;
+  }
+  else
+  {
+    result = (preferences.putBytes(DPS_ASSIGNMENT_PREFERENCES_KEY, data, length) == length ? 0 : 1);
+  }
+
+  preferences.end();
+
+  return result;
+}
+
+/*
+ * See the documentation of `get_time_msec_function_t` in AzureIoT.h for details.
+ */
+static int64_t get_time_msec() { return esp_timer_get_time() / 1000; }
+
 /*
  * See the documentation of `properties_update_completed_t` in AzureIoT.h for details.
  */
-static void on_properties_update_completed(uint32_t request_id, az_iot_status status_code)
+static void on_properties_update_completed(
+    uint32_t request_id,
+    az_iot_status status_code,
+    int32_t version)
 {
-  LogInfo("Properties update request completed (id=%d, status=%d)", request_id, status_code);
+  LogInfo(
+      "Properties update request completed (id=%d, status=%d, version=%d)",
+      request_id,
+      status_code,
+      version);
 }
 
 /*
@@ -351,7 +408,7 @@ void on_properties_received(az_span properties)
 
   // It is recommended not to perform work within callbacks.
   // The properties are being handled here to simplify the sample.
-  if (azure_pnp_handle_properties_update(&azure_iot, properties, properties_request_id++) != 0)
+  if (azure_pnp_handle_properties_update(&azure_iot, properties) != 0)
   {
     LogError("Failed handling properties update.");
   }
@@ -418,6 +475,9 @@ static void configure_azure_iot() {
   azure_iot_config.on_properties_update_completed = on_properties_update_completed;
   azure_iot_config.on_properties_received = on_properties_received;
   azure_iot_config.on_command_request_received = on_command_request_received;
+  azure_iot_config.dps_assignment_cache.load = dps_assignment_load;
+  azure_iot_config.dps_assignment_cache.save = dps_assignment_save;
+  azure_iot_config.get_time_msec = get_time_msec;
 
   azure_iot_init(&azure_iot, &azure_iot_config);
 }
@@ -463,7 +523,7 @@ void loop()
 
         if (send_device_info)
         {
-          (void)azure_pnp_send_device_info(&azure_iot, properties_request_id++);
+          (void)azure_pnp_send_device_info(&azure_iot);
           send_device_info = false; // Only need to send once.
         }
         else if (azure_pnp_send_telemetry(&azure_iot) != 0)
@@ -577,9 +637,11 @@ static esp_err_t esp_mqtt_event_handler(esp_mqtt_event_handle_t event)
           break;
         case MQTT_CONNECTION_REFUSE_BAD_USERNAME:
           LogError("connect_return_code=MQTT_CONNECTION_REFUSE_BAD_USERNAME");
+          (void)azure_iot_mqtt_client_connection_refused(&azure_iot);
           break;
         case MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED:
           LogError("connect_return_code=MQTT_CONNECTION_REFUSE_NOT_AUTHORIZED");
+          (void)azure_iot_mqtt_client_connection_refused(&azure_iot);
           break;
         default:
           LogError("connect_return_code=unknown (%d)", event->error_handle->connect_return_code);
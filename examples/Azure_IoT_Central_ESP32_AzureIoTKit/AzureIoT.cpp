@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 
 #include "AzureIoT.h"
+#include <inttypes.h>
 #include <stdarg.h>
 
 #include <az_precondition_internal.h>
@@ -25,16 +26,21 @@ log_function_t default_logging_function = NULL;
 #define MQTT_CLIENT_ID_BUFFER_SIZE 256
 #define MQTT_USERNAME_BUFFER_SIZE 350
 #define DECODED_SAS_KEY_BUFFER_SIZE 64
-#define PLAIN_SAS_SIGNATURE_BUFFER_SIZE 256
-#define SAS_HMAC256_ENCRYPTED_SIGNATURE_BUFFER_SIZE 32
-#define SAS_SIGNATURE_BUFFER_SIZE 64
-#define MQTT_PASSWORD_BUFFER_SIZE 512
+#define TELEMETRY_PROPERTIES_BUFFER_SIZE 64
 
 #define DPS_REGISTER_CUSTOM_PAYLOAD_BEGIN "{\"modelId\":\""
 #define DPS_REGISTER_CUSTOM_PAYLOAD_END "\"}"
 
 #define NUMBER_OF_SECONDS_IN_A_MINUTE 60
 
+// A DPS assignment record is: version (1 byte), expiration time (4 bytes, little endian), checksum
+// (4 bytes, little endian), then the length (1 byte) and content of the IoT Hub FQDN and of the
+// device id.
+#define DPS_ASSIGNMENT_RECORD_VERSION 1
+#define DPS_ASSIGNMENT_RECORD_EXPIRATION_OFFSET 1
+#define DPS_ASSIGNMENT_RECORD_CHECKSUM_OFFSET 5
+#define DPS_ASSIGNMENT_RECORD_HEADER_SIZE 9
+
 #define EXIT_IF_TRUE(condition, retcode, message, ...) \
   do                                                   \
   {                                                    \
@@ -48,14 +54,39 @@ log_function_t default_logging_function = NULL;
 #define EXIT_IF_AZ_FAILED(azresult, retcode, message, ...) \
   EXIT_IF_TRUE(az_result_failed(azresult), retcode, message, ##__VA_ARGS__)
 
+static const az_span iot_hub_subscription_topics[IOT_HUB_SUBSCRIPTION_COUNT]
+    = { AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_HUB_CLIENT_COMMANDS_SUBSCRIBE_TOPIC),
+        AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_SUBSCRIBE_TOPIC),
+        AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_HUB_CLIENT_PROPERTIES_WRITABLE_UPDATES_SUBSCRIBE_TOPIC) };
+
+/*
+ * @brief    Decoded device key, passed as context to `sign_sas_signature`.
+ */
+typedef struct sas_signing_key_t_struct
+{
+  hmac_sha256_encryption_function_t hmac_sha256_encrypt;
+  uint8_t decoded_key[DECODED_SAS_KEY_BUFFER_SIZE];
+  size_t decoded_key_length;
+} sas_signing_key_t;
+
 /* --- Internal function prototypes --- */
 static uint32_t get_current_unix_time();
 
+static int64_t get_current_time_msec(azure_iot_t* azure_iot);
+
+static void schedule_dps_query(azure_iot_t* azure_iot, uint32_t retry_after_seconds);
+
+static int decode_sas_signing_key(
+    az_span device_key,
+    data_manipulation_functions_t data_manipulation_functions,
+    sas_signing_key_t* signing_key);
+
+static az_result sign_sas_signature(void* context, az_span data, az_span signed_data);
+
 static int generate_sas_token_for_dps(
     az_iot_provisioning_client* provisioning_client,
     az_span device_key,
     unsigned int duration_in_minutes,
-    az_span data_buffer_span,
     data_manipulation_functions_t data_manipulation_functions,
     az_span sas_token,
     uint32_t* expiration_time);
@@ -64,7 +95,6 @@ static int generate_sas_token_for_iot_hub(
     az_iot_hub_client* iot_hub_client,
     az_span device_key,
     unsigned int duration_in_minutes,
-    az_span data_buffer_span,
     data_manipulation_functions_t data_manipulation_functions,
     az_span sas_token,
     uint32_t* expiration_time);
@@ -82,6 +112,77 @@ static az_span generate_dps_register_custom_property(
     az_span data_buffer,
     az_span* remainder);
 
+static void on_properties_update_request_completed(
+    void* context,
+    uint32_t request_id,
+    az_iot_status status);
+
+static bool is_pending_subscription(azure_iot_t* azure_iot, int packet_id);
+
+static int get_telemetry_mqtt_message(
+    azure_iot_t* azure_iot,
+    az_span payload,
+    mqtt_message_t* mqtt_message);
+
+static int publish_in_flight_telemetry(azure_iot_t* azure_iot, telemetry_in_flight_t* telemetry);
+
+static void requeue_unacknowledged_telemetry(azure_iot_t* azure_iot);
+
+static void complete_in_flight_telemetry(
+    azure_iot_t* azure_iot,
+    telemetry_in_flight_t* telemetry);
+
+static telemetry_in_flight_t* get_free_in_flight_telemetry(
+    azure_iot_t* azure_iot,
+    azure_iot_telemetry_priority_t priority);
+
+static telemetry_in_flight_t* get_queued_in_flight_telemetry(azure_iot_t* azure_iot);
+
+static int store_telemetry(azure_iot_t* azure_iot, az_span message);
+
+static bool forward_stored_telemetry(azure_iot_t* azure_iot, uint32_t now);
+
+static outbound_response_t* get_free_outbound_response(azure_iot_t* azure_iot);
+
+static int start_properties_update(
+    azure_iot_t* azure_iot,
+    outbound_response_t** out_response,
+    uint32_t* out_request_id);
+
+static int publish_queued_response(azure_iot_t* azure_iot, uint32_t now);
+
+static int publish_queued_responses(azure_iot_t* azure_iot, uint32_t now);
+
+static void publish_outbound_messages(azure_iot_t* azure_iot, uint32_t now);
+
+static int publish_reported_properties_shadow(azure_iot_t* azure_iot);
+
+static void flush_reported_properties_shadow(azure_iot_t* azure_iot, uint32_t now);
+
+static uint32_t get_sas_token_renewal_time(azure_iot_t* azure_iot, uint32_t expiration_time);
+
+static bool is_outbound_idle(azure_iot_t* azure_iot);
+
+static int pregenerate_sas_token(azure_iot_t* azure_iot);
+
+static uint32_t get_fnv1a_hash(uint32_t hash, az_span data);
+
+static uint32_t get_dps_assignment_checksum(azure_iot_t* azure_iot, az_span record);
+
+static int load_dps_assignment(azure_iot_t* azure_iot);
+
+static int save_dps_assignment(azure_iot_t* azure_iot);
+
+static void save_tls_session(azure_iot_t* azure_iot, mqtt_client_tls_session_t* tls_session);
+
+static void free_tls_session(azure_iot_t* azure_iot, mqtt_client_tls_session_t* tls_session);
+
+static void set_state(azure_iot_t* azure_iot, azure_iot_client_state_t state);
+
+static void reset_start_metrics(azure_iot_t* azure_iot, int64_t now_msec);
+
+static int publish_mqtt_message(azure_iot_t* azure_iot, mqtt_message_t* mqtt_message);
+
 #define is_device_provisioned(azure_iot)                                     \
   (!az_span_is_content_equal(azure_iot->config->iot_hub_fqdn, AZ_SPAN_EMPTY) \
    && !az_span_is_content_equal(azure_iot->config->device_id, AZ_SPAN_EMPTY))
@@ -120,12 +221,17 @@ void azure_iot_init(azure_iot_t* azure_iot, azure_iot_config_t* azure_iot_config
 
   _az_PRECONDITION_VALID_SPAN(azure_iot_config->data_buffer, 1, false);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->data_manipulation_functions.base64_decode);
-  _az_PRECONDITION_NOT_NULL(azure_iot_config->data_manipulation_functions.base64_encode);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->data_manipulation_functions.hmac_sha256_encrypt);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->mqtt_client_interface.mqtt_client_init);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->mqtt_client_interface.mqtt_client_deinit);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->mqtt_client_interface.mqtt_client_subscribe);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->mqtt_client_interface.mqtt_client_publish);
+  _az_PRECONDITION(
+      (azure_iot_config->mqtt_client_interface.mqtt_client_get_tls_session == NULL)
+      == (azure_iot_config->mqtt_client_interface.mqtt_client_free_tls_session == NULL));
+  _az_PRECONDITION(
+      (azure_iot_config->dps_assignment_cache.load == NULL)
+      == (azure_iot_config->dps_assignment_cache.save == NULL));
   _az_PRECONDITION_NOT_NULL(azure_iot_config->on_properties_update_completed);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->on_properties_received);
   _az_PRECONDITION_NOT_NULL(azure_iot_config->on_command_request_received);
@@ -134,8 +240,15 @@ void azure_iot_init(azure_iot_t* azure_iot, azure_iot_config_t* azure_iot_config
   azure_iot->config = azure_iot_config;
   azure_iot->data_buffer = azure_iot->config->data_buffer;
   azure_iot->state = azure_iot_state_initialized;
+  azure_iot->state_entered_time_msec = get_current_time_msec(azure_iot);
+  reset_start_metrics(azure_iot, azure_iot->state_entered_time_msec);
   azure_iot->dps_operation_id = AZ_SPAN_EMPTY;
 
+  (void)az_iot_hub_client_request_tracker_init(
+      &azure_iot->request_tracker,
+      azure_iot->request_tracker_entries,
+      sizeofarray(azure_iot->request_tracker_entries));
+
   if (azure_iot->config->sas_token_lifetime_in_minutes == 0)
   {
     azure_iot->config->sas_token_lifetime_in_minutes = DEFAULT_SAS_TOKEN_LIFETIME_IN_MINUTES;
@@ -161,7 +274,7 @@ int azure_iot_start(azure_iot_t* azure_iot)
   else
   {
     // TODO: should only go to started if stopped or in error?
-    azure_iot->state = azure_iot_state_started;
+    set_state(azure_iot, azure_iot_state_started);
     result = RESULT_OK;
   }
 
@@ -186,13 +299,13 @@ int azure_iot_stop(azure_iot_t* azure_iot)
       if (azure_iot->config->mqtt_client_interface.mqtt_client_deinit(azure_iot->mqtt_client_handle)
           != 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed deinitializing MQTT client.");
         result = RESULT_ERROR;
       }
       else
       {
-        azure_iot->state = azure_iot_state_initialized;
+        set_state(azure_iot, azure_iot_state_initialized);
         result = RESULT_OK;
       }
 
@@ -200,7 +313,7 @@ int azure_iot_stop(azure_iot_t* azure_iot)
     }
     else
     {
-      azure_iot->state = azure_iot_state_initialized;
+      set_state(azure_iot, azure_iot_state_initialized);
       result = RESULT_OK;
     }
   }
@@ -230,11 +343,7 @@ azure_iot_status_t azure_iot_get_status(azure_iot_t* azure_iot)
     case azure_iot_state_provisioned:
     case azure_iot_state_connecting_to_hub:
     case azure_iot_state_connected_to_hub:
-    case azure_iot_state_subscribing_to_pnp_cmds:
-    case azure_iot_state_subscribed_to_pnp_cmds:
-    case azure_iot_state_subscribing_to_pnp_props:
-    case azure_iot_state_subscribed_to_pnp_props:
-    case azure_iot_state_subscribing_to_pnp_writable_props:
+    case azure_iot_state_subscribing_to_pnp:
     case azure_iot_state_refreshing_sas:
       status = azure_iot_connecting;
       break;
@@ -250,6 +359,16 @@ azure_iot_status_t azure_iot_get_status(azure_iot_t* azure_iot)
   return status;
 }
 
+void azure_iot_get_metrics(azure_iot_t* azure_iot, azure_iot_metrics_t* metrics)
+{
+  _az_PRECONDITION_NOT_NULL(azure_iot);
+  _az_PRECONDITION_NOT_NULL(metrics);
+
+  *metrics = azure_iot->metrics;
+  metrics->state_duration_msec[azure_iot->state]
+      += (uint32_t)(get_current_time_msec(azure_iot) - azure_iot->state_entered_time_msec);
+}
+
 void azure_iot_do_work(azure_iot_t* azure_iot)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
@@ -290,13 +409,19 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
         // reserved for IoT Hub FQDN and Device ID previously provisioned.
         azure_iot->data_buffer = azure_iot->config->data_buffer;
 
+        // A saved assignment, if any, sets the IoT Hub FQDN and Device ID, skipping provisioning.
+        azure_iot->is_dps_assignment_cached = (load_dps_assignment(azure_iot) == RESULT_OK);
+      }
+
+      if (azure_iot->config->use_device_provisioning && !is_device_provisioned(azure_iot))
+      {
         result = get_mqtt_client_config_for_dps(azure_iot, &mqtt_client_config);
-        azure_iot->state = azure_iot_state_connecting_to_dps;
+        set_state(azure_iot, azure_iot_state_connecting_to_dps);
       }
       else
       {
         result = get_mqtt_client_config_for_iot_hub(azure_iot, &mqtt_client_config);
-        azure_iot->state = azure_iot_state_connecting_to_hub;
+        set_state(azure_iot, azure_iot_state_connecting_to_hub);
       }
 
       if (result != 0
@@ -304,7 +429,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
                  &mqtt_client_config, &azure_iot->mqtt_client_handle)
               != 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed initializing MQTT client.");
         return;
       }
@@ -314,7 +439,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
       break;
     case azure_iot_state_connected_to_dps:
       // Subscribe to DPS topic.
-      azure_iot->state = azure_iot_state_subscribing_to_dps;
+      set_state(azure_iot, azure_iot_state_subscribing_to_dps);
 
       packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_subscribe(
           azure_iot->mqtt_client_handle,
@@ -323,7 +448,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (packet_id < 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed subscribing to Azure Device Provisioning respose topic.");
         return;
       }
@@ -342,7 +467,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (az_result_failed(azrc))
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed getting the DPS register topic: az_result return code 0x%08x.", azrc);
         return;
       }
@@ -352,7 +477,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
       if (az_span_is_content_equal(mqtt_message.topic, AZ_SPAN_EMPTY)
           || az_span_is_content_equal(data_buffer, AZ_SPAN_EMPTY))
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed reserving memory for DPS register payload.");
         return;
       }
@@ -362,7 +487,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (az_span_is_content_equal(dps_register_custom_property, AZ_SPAN_EMPTY))
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed generating DPS register custom property payload.");
         return;
       }
@@ -377,7 +502,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (az_result_failed(azrc))
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("az_iot_provisioning_client_get_request_payload failed (0x%08x).", azrc);
         return;
       }
@@ -385,30 +510,25 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
       mqtt_message.payload = az_span_slice(mqtt_message.payload, 0, length);
       mqtt_message.qos = mqtt_qos_at_most_once;
 
-      azure_iot->state = azure_iot_state_provisioning_waiting;
+      set_state(azure_iot, azure_iot_state_provisioning_waiting);
+      azure_iot->dps_query_delay_msec = 0;
+      // Seeded with the registration id, so devices booted at the same time diverge.
+      azure_iot->dps_query_jitter_state
+          = get_fnv1a_hash(2166136261u, azure_iot->config->dps_registration_id)
+          ^ (uint32_t)get_current_time_msec(azure_iot);
 
-      packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
-          azure_iot->mqtt_client_handle, &mqtt_message);
+      packet_id = publish_mqtt_message(azure_iot, &mqtt_message);
 
       if (packet_id < 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed publishing to DPS registration topic");
         return;
       }
 
       break;
     case azure_iot_state_provisioning_querying:
-      now = get_current_unix_time();
-
-      if (now == 0)
-      {
-        azure_iot->state = azure_iot_state_error;
-        LogError("Failed getting current time for DPS query throttling");
-        return;
-      }
-
-      if ((now - azure_iot->dps_last_query_time) < azure_iot->dps_retry_after_seconds)
+      if (get_current_time_msec(azure_iot) < azure_iot->dps_next_query_time_msec)
       {
         // Throttling query...
         return;
@@ -423,7 +543,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (az_result_failed(azrc))
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError(
             "Unable to get provisioning query status publish topic: az_result return code 0x%08x.",
             azrc);
@@ -434,15 +554,13 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
       mqtt_message.payload = AZ_SPAN_EMPTY;
       mqtt_message.qos = mqtt_qos_at_most_once;
 
-      azure_iot->state = azure_iot_state_provisioning_waiting;
-      azure_iot->dps_last_query_time = now;
+      set_state(azure_iot, azure_iot_state_provisioning_waiting);
 
-      packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
-          azure_iot->mqtt_client_handle, &mqtt_message);
+      packet_id = publish_mqtt_message(azure_iot, &mqtt_message);
 
       if (packet_id < 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed publishing to DPS status query topic");
         return;
       }
@@ -457,7 +575,7 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
                  azure_iot->mqtt_client_handle)
               != 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed de-initializing MQTT client.");
         return;
       }
@@ -469,18 +587,18 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (result != 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed getting MQTT client configuration for connecting to IoT Hub.");
         return;
       }
 
-      azure_iot->state = azure_iot_state_connecting_to_hub;
+      set_state(azure_iot, azure_iot_state_connecting_to_hub);
 
       if (azure_iot->config->mqtt_client_interface.mqtt_client_init(
               &mqtt_client_config, &azure_iot->mqtt_client_handle)
           != 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed initializing MQTT client for IoT Hub connection.");
         return;
       }
@@ -489,58 +607,42 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
     case azure_iot_state_connecting_to_hub:
       break;
     case azure_iot_state_connected_to_hub:
-      azure_iot->state = azure_iot_state_subscribing_to_pnp_cmds;
+      // All subscriptions are sent at once, without waiting for each SUBACK, so connecting takes a
+      // single round-trip. The state and the count are set first, since a SUBACK may be processed
+      // before the packet id of its SUBSCRIBE is stored.
+      set_state(azure_iot, azure_iot_state_subscribing_to_pnp);
+      azure_iot->pending_subscription_count = IOT_HUB_SUBSCRIPTION_COUNT;
 
-      packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_subscribe(
-          azure_iot->mqtt_client_handle,
-          AZ_SPAN_FROM_STR(AZ_IOT_HUB_CLIENT_COMMANDS_SUBSCRIBE_TOPIC),
-          mqtt_qos_at_least_once);
+      // PUBACKs for telemetry published on the previous connection will never arrive.
+      requeue_unacknowledged_telemetry(azure_iot);
 
-      if (packet_id < 0)
+      for (int i = 0; i < IOT_HUB_SUBSCRIPTION_COUNT; i++)
       {
-        azure_iot->state = azure_iot_state_error;
-        LogError("Failed subscribing to IoT Plug and Play commands topic.");
-        return;
+        azure_iot->pending_subscription_packet_ids[i] = 0;
       }
 
-      break;
-    case azure_iot_state_subscribing_to_pnp_cmds:
-      break;
-    case azure_iot_state_subscribed_to_pnp_cmds:
-      azure_iot->state = azure_iot_state_subscribing_to_pnp_props;
-
-      packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_subscribe(
-          azure_iot->mqtt_client_handle,
-          AZ_SPAN_FROM_STR(AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_SUBSCRIBE_TOPIC),
-          mqtt_qos_at_least_once);
-
-      if (packet_id < 0)
+      for (int i = 0; i < IOT_HUB_SUBSCRIPTION_COUNT; i++)
       {
-        azure_iot->state = azure_iot_state_error;
-        LogError("Failed subscribing to IoT Plug and Play properties topic.");
-        return;
-      }
-
-      break;
-    case azure_iot_state_subscribing_to_pnp_props:
-      break;
-    case azure_iot_state_subscribed_to_pnp_props:
-      azure_iot->state = azure_iot_state_subscribing_to_pnp_writable_props;
+        packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_subscribe(
+            azure_iot->mqtt_client_handle,
+            iot_hub_subscription_topics[i],
+            mqtt_qos_at_least_once);
 
-      packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_subscribe(
-          azure_iot->mqtt_client_handle,
-          AZ_SPAN_FROM_STR(AZ_IOT_HUB_CLIENT_PROPERTIES_WRITABLE_UPDATES_SUBSCRIBE_TOPIC),
-          mqtt_qos_at_least_once);
+        if (packet_id < 0)
+        {
+          set_state(azure_iot, azure_iot_state_error);
+          LogError(
+              "Failed subscribing to IoT Plug and Play topic (%.*s).",
+              az_span_size(iot_hub_subscription_topics[i]),
+              az_span_ptr(iot_hub_subscription_topics[i]));
+          return;
+        }
 
-      if (packet_id < 0)
-      {
-        azure_iot->state = azure_iot_state_error;
-        LogError("Failed subscribing to IoT Plug and Play writable properties topic.");
-        return;
+        azure_iot->pending_subscription_packet_ids[i] = packet_id;
       }
 
       break;
-    case azure_iot_state_subscribing_to_pnp_writable_props:
+    case azure_iot_state_subscribing_to_pnp:
       break;
     case azure_iot_state_ready:
       // Checking for SAS token expiration.
@@ -548,24 +650,66 @@ void azure_iot_do_work(azure_iot_t* azure_iot)
 
       if (now == 0)
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Failed getting current time for checking SAS token expiration.");
         return;
       }
-      else if ((azure_iot->sas_token_expiration_time - now) < SAS_TOKEN_REFRESH_THRESHOLD_IN_SECS)
+      else if (
+          (azure_iot->sas_token_expiration_time - now) < SAS_TOKEN_REFRESH_THRESHOLD_IN_SECS
+          || (now >= azure_iot->sas_token_renewal_time && is_outbound_idle(azure_iot)))
       {
-        azure_iot->state = azure_iot_state_refreshing_sas;
+        LogInfo("Renewing SAS token.");
+        set_state(azure_iot, azure_iot_state_refreshing_sas);
         if (azure_iot->config->mqtt_client_interface.mqtt_client_deinit(
                 azure_iot->mqtt_client_handle)
             != 0)
         {
-          azure_iot->state = azure_iot_state_error;
+          set_state(azure_iot, azure_iot_state_error);
           LogError("Failed de-initializing MQTT client.");
           return;
         }
 
         azure_iot->mqtt_client_handle = NULL;
       }
+      else
+      {
+        // Generated ahead of the renewal, so reconnecting does not wait for it.
+        if (azure_iot->next_sas_token_length == 0
+            && now + SAS_TOKEN_PREGENERATION_LEAD_IN_SECS >= azure_iot->sas_token_renewal_time
+            && now >= azure_iot->sas_token_pregeneration_retry_time
+            && !az_span_is_content_equal(azure_iot->config->device_key, AZ_SPAN_EMPTY)
+            && pregenerate_sas_token(azure_iot) != RESULT_OK)
+        {
+          // The renewal time is kept; the retries back off until the token is generated
+          // when reconnecting.
+          azure_iot->sas_token_pregeneration_retry_delay *= 2;
+
+          if (azure_iot->sas_token_pregeneration_retry_delay
+              < SAS_TOKEN_PREGENERATION_MIN_RETRY_DELAY_IN_SECS)
+          {
+            azure_iot->sas_token_pregeneration_retry_delay
+                = SAS_TOKEN_PREGENERATION_MIN_RETRY_DELAY_IN_SECS;
+          }
+          else if (
+              azure_iot->sas_token_pregeneration_retry_delay
+              > SAS_TOKEN_PREGENERATION_MAX_RETRY_DELAY_IN_SECS)
+          {
+            azure_iot->sas_token_pregeneration_retry_delay
+                = SAS_TOKEN_PREGENERATION_MAX_RETRY_DELAY_IN_SECS;
+          }
+
+          azure_iot->sas_token_pregeneration_retry_time
+              = now + azure_iot->sas_token_pregeneration_retry_delay;
+          LogError(
+              "Failed pre-generating SAS token; retrying in %" PRIu32 " seconds.",
+              azure_iot->sas_token_pregeneration_retry_delay);
+        }
+
+        (void)az_iot_hub_client_request_tracker_sweep(
+            &azure_iot->request_tracker, (int64_t)now * 1000);
+        flush_reported_properties_shadow(azure_iot, now);
+        publish_outbound_messages(azure_iot, now);
+      }
       break;
     case azure_iot_state_refreshing_sas:
       break;
@@ -580,60 +724,149 @@ int azure_iot_send_telemetry(azure_iot_t* azure_iot, az_span message)
   _az_PRECONDITION_NOT_NULL(azure_iot);
   _az_PRECONDITION_VALID_SPAN(message, 1, false);
 
-  az_result azr;
-  size_t topic_length;
   mqtt_message_t mqtt_message;
 
-  azr = az_iot_hub_client_telemetry_get_publish_topic(
-      &azure_iot->iot_hub_client,
-      NULL,
-      (char*)az_span_ptr(azure_iot->data_buffer),
-      az_span_size(azure_iot->data_buffer),
-      &topic_length);
-  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed to get the telemetry topic");
+  if (azure_iot->state != azure_iot_state_ready && azure_iot->config->telemetry_store != NULL)
+  {
+    return store_telemetry(azure_iot, message);
+  }
+
+  if (get_telemetry_mqtt_message(azure_iot, message, &mqtt_message) != RESULT_OK)
+  {
+    return RESULT_ERROR;
+  }
 
-  mqtt_message.topic = az_span_slice(azure_iot->data_buffer, 0, topic_length + 1);
-  mqtt_message.payload = message;
   mqtt_message.qos = mqtt_qos_at_most_once;
 
-  int packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
-      azure_iot->mqtt_client_handle, &mqtt_message);
-  EXIT_IF_TRUE(packet_id < 0, RESULT_ERROR, "Failed publishing to telemetry topic");
+  int packet_id = publish_mqtt_message(azure_iot, &mqtt_message);
+
+  if (packet_id < 0)
+  {
+    LogError("Failed publishing to telemetry topic");
+    return azure_iot->config->telemetry_store != NULL ? store_telemetry(azure_iot, message)
+                                                      : RESULT_ERROR;
+  }
 
   return RESULT_OK;
 }
 
-int azure_iot_send_properties_update(azure_iot_t* azure_iot, uint32_t request_id, az_span message)
+int azure_iot_send_telemetry_at_least_once(
+    azure_iot_t* azure_iot,
+    az_span message,
+    azure_iot_telemetry_priority_t priority,
+    telemetry_completed_t on_completed,
+    void* context)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
   _az_PRECONDITION_VALID_SPAN(message, 1, false);
 
-  az_result azr;
-  size_t topic_length;
-  mqtt_message_t mqtt_message;
-  az_span data_buffer = azure_iot->data_buffer;
-  az_span request_id_span = data_buffer;
+  EXIT_IF_TRUE(
+      az_span_size(message) > TELEMETRY_IN_FLIGHT_MAX_PAYLOAD_SIZE,
+      RESULT_ERROR,
+      "Telemetry message too large (%d bytes).",
+      az_span_size(message));
+
+  telemetry_in_flight_t* telemetry = get_free_in_flight_telemetry(azure_iot, priority);
+  EXIT_IF_TRUE(telemetry == NULL, RESULT_ERROR, "Telemetry window is full.");
+
+  (void)memcpy(telemetry->payload, az_span_ptr(message), (size_t)az_span_size(message));
+  telemetry->payload_length = (size_t)az_span_size(message);
+  telemetry->priority = priority;
+  telemetry->on_completed = on_completed;
+  telemetry->context = context;
+  telemetry->packet_id = 0;
+  telemetry->state = telemetry_in_flight_queued;
+
+  // If not connected, or if messages of higher priority are waiting, the message stays queued
+  // until azure_iot_do_work gets to it.
+  if (azure_iot->state == azure_iot_state_ready && azure_iot->response_lane_count == 0
+      && get_queued_in_flight_telemetry(azure_iot) == telemetry
+      && publish_in_flight_telemetry(azure_iot, telemetry) != RESULT_OK)
+  {
+    telemetry->state = telemetry_in_flight_free;
+    LogError("Failed publishing to telemetry topic");
+    return RESULT_ERROR;
+  }
 
-  azr = az_span_u32toa(request_id_span, request_id, &data_buffer);
-  EXIT_IF_TRUE(az_result_failed(azr), RESULT_ERROR, "Failed generating Twin request id.");
-  request_id_span = az_span_slice(
-      request_id_span, 0, az_span_size(request_id_span) - az_span_size(data_buffer));
+  return RESULT_OK;
+}
 
-  azr = az_iot_hub_client_properties_get_reported_publish_topic(
-      &azure_iot->iot_hub_client,
-      request_id_span,
-      (char*)az_span_ptr(data_buffer),
-      az_span_size(data_buffer),
-      &topic_length);
-  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed to get the reported properties publish topic");
+int azure_iot_get_telemetry_window_space(
+    azure_iot_t* azure_iot,
+    azure_iot_telemetry_priority_t priority)
+{
+  _az_PRECONDITION_NOT_NULL(azure_iot);
 
-  mqtt_message.topic = az_span_slice(data_buffer, 0, topic_length);
-  mqtt_message.payload = message;
-  mqtt_message.qos = mqtt_qos_at_most_once;
+  int space = 0;
+  int routine_space = TELEMETRY_ROUTINE_LANE_BUDGET;
 
-  int packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
-      azure_iot->mqtt_client_handle, &mqtt_message);
-  EXIT_IF_TRUE(packet_id < 0, RESULT_ERROR, "Failed publishing to reported properties topic.");
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    if (azure_iot->telemetry_in_flight[i].state == telemetry_in_flight_free)
+    {
+      space++;
+    }
+    else if (azure_iot->telemetry_in_flight[i].priority == azure_iot_telemetry_priority_routine)
+    {
+      routine_space--;
+    }
+  }
+
+  if (priority == azure_iot_telemetry_priority_routine && routine_space < space)
+  {
+    space = routine_space < 0 ? 0 : routine_space;
+  }
+
+  return space;
+}
+
+int azure_iot_send_properties_update(
+    azure_iot_t* azure_iot,
+    az_span message,
+    uint32_t* out_request_id)
+{
+  _az_PRECONDITION_NOT_NULL(azure_iot);
+  _az_PRECONDITION_VALID_SPAN(message, 1, false);
+
+  outbound_response_t* response;
+  uint32_t request_id;
+  uint32_t now = get_current_unix_time();
+  EXIT_IF_TRUE(now == 0, RESULT_ERROR, "Failed getting current time for properties update.");
+
+  EXIT_IF_TRUE(
+      start_properties_update(azure_iot, &response, &request_id) != RESULT_OK,
+      RESULT_ERROR,
+      "Failed starting reported properties update.");
+
+  if ((size_t)az_span_size(message) > sizeof(response->buffer) - response->topic_length)
+  {
+    (void)az_iot_hub_client_request_tracker_remove(&azure_iot->request_tracker, request_id);
+    LogError("Properties update too large (%d bytes).", az_span_size(message));
+    return RESULT_ERROR;
+  }
+
+  if (az_span_size(message) > 0)
+  {
+    (void)memcpy(
+        &response->buffer[response->topic_length],
+        az_span_ptr(message),
+        (size_t)az_span_size(message));
+  }
+
+  response->payload_length = (size_t)az_span_size(message);
+  azure_iot->response_lane_count++;
+
+  if (out_request_id != NULL)
+  {
+    *out_request_id = request_id;
+  }
+
+  // If not connected the update waits in the response lane until the client is ready. If
+  // publishing fails it stays there, to be published again by azure_iot_do_work.
+  if (azure_iot->state == azure_iot_state_ready)
+  {
+    (void)publish_queued_responses(azure_iot, now);
+  }
 
   return RESULT_OK;
 }
@@ -648,25 +881,27 @@ int azure_iot_mqtt_client_connected(azure_iot_t* azure_iot)
   {
     if (!azure_iot->config->use_device_provisioning)
     {
-      azure_iot->state = azure_iot_state_error;
+      set_state(azure_iot, azure_iot_state_error);
       LogError("Invalid state, provisioning disabled in config.");
       result = RESULT_ERROR;
     }
     else
     {
-      azure_iot->state = azure_iot_state_connected_to_dps;
+      save_tls_session(azure_iot, &azure_iot->dps_tls_session);
+      set_state(azure_iot, azure_iot_state_connected_to_dps);
       result = RESULT_OK;
     }
   }
   else if (azure_iot->state == azure_iot_state_connecting_to_hub)
   {
-    azure_iot->state = azure_iot_state_connected_to_hub;
+    save_tls_session(azure_iot, &azure_iot->iot_hub_tls_session);
+    set_state(azure_iot, azure_iot_state_connected_to_hub);
     result = RESULT_OK;
   }
   else
   {
     LogError("Unexpected mqtt client connection (%d).", azure_iot->state);
-    azure_iot->state = azure_iot_state_error;
+    set_state(azure_iot, azure_iot_state_error);
     result = RESULT_ERROR;
   }
 
@@ -683,19 +918,45 @@ int azure_iot_mqtt_client_disconnected(azure_iot_t* azure_iot)
   {
     // Moving the state to azure_iot_state_provisioned will cause this client to move
     // on to trying to connect to the Azure IoT Hub again.
-    azure_iot->state = azure_iot_state_provisioned;
+    set_state(azure_iot, azure_iot_state_provisioned);
     result = RESULT_OK;
   }
   else
   {
     // MQTT client could disconnect at any time for any reason, it is an expected situation.
-    azure_iot->state = azure_iot_state_initialized;
+    azure_iot->metrics.disconnection_count++;
+    set_state(azure_iot, azure_iot_state_initialized);
     result = RESULT_OK;
   }
 
   return result;
 }
 
+int azure_iot_mqtt_client_connection_refused(azure_iot_t* azure_iot)
+{
+  _az_PRECONDITION_NOT_NULL(azure_iot);
+
+  if (azure_iot->state == azure_iot_state_connecting_to_hub && azure_iot->is_dps_assignment_cached)
+  {
+    LogInfo("Connection refused with the saved DPS assignment, device will be provisioned again.");
+
+    // Both were set by load_dps_assignment, from the beginning of the data buffer.
+    azure_iot->config->iot_hub_fqdn = AZ_SPAN_EMPTY;
+    azure_iot->config->device_id = AZ_SPAN_EMPTY;
+    azure_iot->data_buffer = azure_iot->config->data_buffer;
+    azure_iot->is_dps_assignment_cached = false;
+    free_tls_session(azure_iot, &azure_iot->iot_hub_tls_session);
+
+    EXIT_IF_TRUE(
+        azure_iot->config->dps_assignment_cache.save != NULL
+            && azure_iot->config->dps_assignment_cache.save(NULL, 0) != 0,
+        RESULT_ERROR,
+        "Failed erasing the saved DPS assignment.");
+  }
+
+  return RESULT_OK;
+}
+
 int azure_iot_mqtt_client_subscribe_completed(azure_iot_t* azure_iot, int packet_id)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
@@ -705,22 +966,29 @@ int azure_iot_mqtt_client_subscribe_completed(azure_iot_t* azure_iot, int packet
 
   if (azure_iot->state == azure_iot_state_subscribing_to_dps)
   {
-    azure_iot->state = azure_iot_state_subscribed_to_dps;
-    result = RESULT_OK;
-  }
-  else if (azure_iot->state == azure_iot_state_subscribing_to_pnp_cmds)
-  {
-    azure_iot->state = azure_iot_state_subscribed_to_pnp_cmds;
-    result = RESULT_OK;
-  }
-  else if (azure_iot->state == azure_iot_state_subscribing_to_pnp_props)
-  {
-    azure_iot->state = azure_iot_state_subscribed_to_pnp_props;
+    set_state(azure_iot, azure_iot_state_subscribed_to_dps);
     result = RESULT_OK;
   }
-  else if (azure_iot->state == azure_iot_state_subscribing_to_pnp_writable_props)
+  else if (
+      azure_iot->state == azure_iot_state_subscribing_to_pnp
+      && is_pending_subscription(azure_iot, packet_id))
   {
-    azure_iot->state = azure_iot_state_ready;
+    azure_iot->pending_subscription_count--;
+
+    int32_t* subscription_completed_msec = &azure_iot->metrics.subscription_completed_msec
+        [IOT_HUB_SUBSCRIPTION_COUNT - 1 - azure_iot->pending_subscription_count];
+
+    if (*subscription_completed_msec < 0)
+    {
+      *subscription_completed_msec
+          = (int32_t)(get_current_time_msec(azure_iot) - azure_iot->metrics.start_time_msec);
+    }
+
+    if (azure_iot->pending_subscription_count == 0)
+    {
+      set_state(azure_iot, azure_iot_state_ready);
+    }
+
     result = RESULT_OK;
   }
   else
@@ -732,14 +1000,40 @@ int azure_iot_mqtt_client_subscribe_completed(azure_iot_t* azure_iot, int packet
   return result;
 }
 
-/*
- * Currently unused.
- */
 int azure_iot_mqtt_client_publish_completed(azure_iot_t* azure_iot, int packet_id)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
 
-  (void)packet_id;
+  // QoS 0 publishes have no packet id.
+  if (packet_id <= 0)
+  {
+    return RESULT_OK;
+  }
+
+  bool is_publishing = false;
+
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    telemetry_in_flight_t* telemetry = &azure_iot->telemetry_in_flight[i];
+
+    if (telemetry->state == telemetry_in_flight_awaiting_puback && telemetry->packet_id == packet_id)
+    {
+      complete_in_flight_telemetry(azure_iot, telemetry);
+      return RESULT_OK;
+    }
+    else if (telemetry->state == telemetry_in_flight_publishing)
+    {
+      is_publishing = true;
+    }
+  }
+
+  // The PUBACK may be processed before `mqtt_client_publish` returns the packet id, so it is kept
+  // until then and only completes the message if the packet id is the one returned. Any other
+  // PUBACK is not for a message of the window, and is ignored.
+  if (is_publishing)
+  {
+    azure_iot->early_puback_packet_id = packet_id;
+  }
 
   return RESULT_OK;
 }
@@ -753,6 +1047,9 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
   int result;
   az_result azrc;
 
+  azure_iot->metrics.bytes_received
+      += (uint32_t)(az_span_size(mqtt_message->topic) + az_span_size(mqtt_message->payload));
+
   if (azure_iot->state == azure_iot_state_ready)
   {
     // This message should either be:
@@ -760,13 +1057,24 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
     // - a response to a "get" properties request, or
     // - a command request.
 
-    az_iot_hub_client_properties_message property_message;
-    azrc = az_iot_hub_client_properties_parse_received_topic(
-        &azure_iot->iot_hub_client, mqtt_message->topic, &property_message);
+    az_iot_hub_client_received_topic received_topic;
+    azrc = az_iot_hub_client_parse_received_topic(
+        &azure_iot->iot_hub_client, mqtt_message->topic, &received_topic);
 
-    if (az_result_succeeded(azrc))
+    if (az_result_failed(azrc))
     {
-      switch (property_message.message_type)
+      LogError(
+          "Could not recognize MQTT message (%.*s).",
+          az_span_size(mqtt_message->topic),
+          az_span_ptr(mqtt_message->topic));
+      result = RESULT_ERROR;
+    }
+    else if (received_topic.type == AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_PROPERTIES)
+    {
+      az_iot_hub_client_properties_message* property_message
+          = &received_topic.parsed.properties_message;
+
+      switch (property_message->message_type)
       {
         // A response from a property GET publish message with the property document as a payload.
         case AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_GET_RESPONSE:
@@ -787,62 +1095,72 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
         case AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_ACKNOWLEDGEMENT:
           result = RESULT_OK;
 
-          if (azure_iot->config->on_properties_update_completed != NULL)
+          // Only successful updates carry the new version, which is passed on by the callback.
+          if (az_span_size(property_message->version) > 0
+              && az_result_failed(az_span_atoi32(
+                  property_message->version, &azure_iot->reported_properties_version)))
           {
-            uint32_t request_id = 0;
-
-            if (az_result_failed(az_span_atou32(property_message.request_id, &request_id)))
-            {
-              LogError(
-                  "Failed parsing properties update request id (%.*s).",
-                  az_span_size(property_message.request_id),
-                  az_span_ptr(property_message.request_id));
-              result = RESULT_ERROR;
-            }
-            else
-            {
-              azure_iot->config->on_properties_update_completed(
-                  request_id, property_message.status);
-            }
+            LogError(
+                "Invalid reported properties version (%.*s).",
+                az_span_size(property_message->version),
+                az_span_ptr(property_message->version));
+          }
+
+          // Invokes on_properties_update_request_completed for the matching request.
+          azrc = az_iot_hub_client_request_tracker_complete(
+              &azure_iot->request_tracker, property_message->request_id, property_message->status);
+
+          if (az_result_failed(azrc))
+          {
+            LogError(
+                "Unexpected properties update response (id=%.*s): az_result return code 0x%08x.",
+                az_span_size(property_message->request_id),
+                az_span_ptr(property_message->request_id),
+                azrc);
+            result = RESULT_ERROR;
           }
           break;
 
         // An error has occurred
         case AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_ERROR:
+          LogError("Message Type: Request Error (status=%d)", property_message->status);
+          result = RESULT_ERROR;
+
+          // A rejected (for example, throttled) properties update completes right away instead of
+          // timing out. Responses to other requests are not tracked.
+          (void)az_iot_hub_client_request_tracker_complete(
+              &azure_iot->request_tracker, property_message->request_id, property_message->status);
+          break;
+
+        default:
           LogError("Message Type: Request Error");
           result = RESULT_ERROR;
           break;
       }
     }
-    else
+    else if (received_topic.type == AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_COMMAND)
     {
-      az_iot_hub_client_command_request az_sdk_command_request;
-      azrc = az_iot_hub_client_commands_parse_received_topic(
-          &azure_iot->iot_hub_client, mqtt_message->topic, &az_sdk_command_request);
-
-      if (az_result_succeeded(azrc))
+      if (azure_iot->config->on_command_request_received != NULL)
       {
-        if (azure_iot->config->on_command_request_received != NULL)
-        {
-          command_request_t command_request;
-          command_request.request_id = az_sdk_command_request.request_id;
-          command_request.component_name = az_sdk_command_request.component_name;
-          command_request.command_name = az_sdk_command_request.command_name;
-          command_request.payload = mqtt_message->payload;
+        command_request_t command_request;
+        command_request.request_id = received_topic.parsed.command_request.request_id;
+        command_request.component_name = received_topic.parsed.command_request.component_name;
+        command_request.command_name = received_topic.parsed.command_request.command_name;
+        command_request.payload = mqtt_message->payload;
 
-          azure_iot->config->on_command_request_received(command_request);
-        }
-
-        result = RESULT_OK;
-      }
-      else
-      {
-        LogError(
-            "Could not recognize MQTT message (%.*s).",
-            az_span_size(mqtt_message->topic),
-            az_span_ptr(mqtt_message->topic));
-        result = RESULT_ERROR;
+        azure_iot->config->on_command_request_received(command_request);
       }
+
+      result = RESULT_OK;
+    }
+    else
+    {
+      // Cloud-to-device messages are not subscribed to, so they are not expected here.
+      LogError(
+          "Unexpected MQTT message (%.*s).",
+          az_span_size(mqtt_message->topic),
+          az_span_ptr(mqtt_message->topic));
+      result = RESULT_ERROR;
     }
   }
   else if (azure_iot->state == azure_iot_state_provisioning_waiting)
@@ -870,7 +1188,7 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
 
           if (az_span_is_content_equal(azure_iot->dps_operation_id, AZ_SPAN_EMPTY))
           {
-            azure_iot->state = azure_iot_state_error;
+            set_state(azure_iot, azure_iot_state_error);
             LogError("Failed reserving memory for DPS operation id.");
             result = RESULT_ERROR;
           }
@@ -878,8 +1196,8 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
 
         if (result == RESULT_OK)
         {
-          azure_iot->dps_retry_after_seconds = register_response.retry_after_seconds;
-          azure_iot->state = azure_iot_state_provisioning_querying;
+          schedule_dps_query(azure_iot, register_response.retry_after_seconds);
+          set_state(azure_iot, azure_iot_state_provisioning_querying);
         }
       }
       else if (register_response.operation_status == AZ_IOT_PROVISIONING_STATUS_ASSIGNED)
@@ -892,7 +1210,7 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
 
         if (az_span_is_content_equal(azure_iot->config->iot_hub_fqdn, AZ_SPAN_EMPTY))
         {
-          azure_iot->state = azure_iot_state_error;
+          set_state(azure_iot, azure_iot_state_error);
           LogError("Failed saving IoT Hub fqdn from provisioning.");
           result = RESULT_ERROR;
         }
@@ -903,21 +1221,25 @@ int azure_iot_mqtt_client_message_received(azure_iot_t* azure_iot, mqtt_message_
 
           if (az_span_is_content_equal(azure_iot->config->device_id, AZ_SPAN_EMPTY))
           {
-            azure_iot->state = azure_iot_state_error;
+            set_state(azure_iot, azure_iot_state_error);
             LogError("Failed saving device id from provisioning.");
             result = RESULT_ERROR;
           }
           else
           {
             azure_iot->data_buffer = data_buffer;
-            azure_iot->state = azure_iot_state_provisioned;
+            set_state(azure_iot, azure_iot_state_provisioned);
+            azure_iot->is_dps_assignment_cached = false;
+            // A session saved with a previously assigned IoT Hub cannot be resumed with this one.
+            free_tls_session(azure_iot, &azure_iot->iot_hub_tls_session);
+            (void)save_dps_assignment(azure_iot);
             result = RESULT_OK;
           }
         }
       }
       else
       {
-        azure_iot->state = azure_iot_state_error;
+        set_state(azure_iot, azure_iot_state_error);
         LogError("Device provisisioning failed.");
         result = RESULT_OK;
       }
@@ -942,53 +1264,1264 @@ int azure_iot_send_command_response(
   _az_PRECONDITION_VALID_SPAN(request_id, 1, false);
 
   az_result azrc;
-  mqtt_message_t mqtt_message;
   size_t topic_length;
-  int packet_id;
 
-  mqtt_message.topic = azure_iot->data_buffer;
+  outbound_response_t* response = get_free_outbound_response(azure_iot);
+  EXIT_IF_TRUE(response == NULL, RESULT_ERROR, "Response lane is full.");
 
   azrc = az_iot_hub_client_commands_response_get_publish_topic(
       &azure_iot->iot_hub_client,
       request_id,
       response_status,
-      (char*)az_span_ptr(mqtt_message.topic),
-      az_span_size(mqtt_message.topic),
+      (char*)response->buffer,
+      sizeof(response->buffer),
       &topic_length);
   EXIT_IF_AZ_FAILED(azrc, RESULT_ERROR, "Failed to get the commands response topic.");
 
-  mqtt_message.topic = az_span_slice(mqtt_message.topic, 0, topic_length + 1);
-  mqtt_message.payload = payload;
-  mqtt_message.qos = mqtt_qos_at_most_once;
-
-  packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
-      azure_iot->mqtt_client_handle, &mqtt_message);
+  EXIT_IF_TRUE(
+      (size_t)az_span_size(payload) > sizeof(response->buffer) - (topic_length + 1),
+      RESULT_ERROR,
+      "Command response too large (%d bytes).",
+      az_span_size(payload));
+
+  if (az_span_size(payload) > 0)
+  {
+    (void)memcpy(
+        &response->buffer[topic_length + 1], az_span_ptr(payload), (size_t)az_span_size(payload));
+  }
+
+  response->request_id = 0;
+  response->topic_length = topic_length + 1;
+  response->payload_length = (size_t)az_span_size(payload);
+  azure_iot->response_lane_count++;
+
+  // If not connected the response waits in the response lane until the client is ready. If
+  // publishing fails it stays there, to be published again by azure_iot_do_work.
+  if (azure_iot->state == azure_iot_state_ready
+      && publish_queued_responses(azure_iot, get_current_unix_time()) != RESULT_OK)
+  {
+    LogError(
+        "Failed publishing command response (%.*s).",
+        az_span_size(request_id),
+        az_span_ptr(request_id));
+  }
+
+  return RESULT_OK;
+}
+
+/* --- Implementation of internal functions --- */
+
+/*
+ * @brief           Gets the number of seconds since UNIX epoch until now.
+ * @return uint32_t Number of seconds.
+ */
+static uint32_t get_current_unix_time()
+{
+  time_t now = time(NULL);
+  return (now == INDEFINITE_TIME ? 0 : (uint32_t)(now));
+}
+
+/*
+ * @brief           Completes a reported properties update tracked in azure_iot->request_tracker,
+ * either because its response was received or because it timed out.
+ * @remark          An update of the reported properties shadow is completed in the shadow too, so
+ * its properties are either acknowledged or published again by the next update.
+ * @param[in]       context    A pointer to the instance of azure_iot_t that sent the update.
+ * @param[in]       request_id The request id of the update, generated by
+ * `azure_iot_send_properties_update` or for an update of the reported properties shadow.
+ * @param[in]       status     The status of the response, or AZ_IOT_STATUS_TIMEOUT.
+ */
+static void on_properties_update_request_completed(
+    void* context,
+    uint32_t request_id,
+    az_iot_status status)
+{
+  azure_iot_t* azure_iot = (azure_iot_t*)context;
+
+  if (status == AZ_IOT_STATUS_TIMEOUT)
+  {
+    LogError("Properties update request timed out (id=%" PRIu32 ").", request_id);
+  }
+
+  if (azure_iot->reported_properties_request_id != 0
+      && request_id == azure_iot->reported_properties_request_id)
+  {
+    (void)az_iot_hub_client_properties_shadow_complete_update(
+        azure_iot->config->reported_properties_shadow, status);
+    azure_iot->reported_properties_request_id = 0;
+  }
+
+  azure_iot->config->on_properties_update_completed(
+      request_id, status, azure_iot->reported_properties_version);
+}
+
+/*
+ * @brief           Checks whether a SUBACK belongs to one of the pending IoT Hub subscriptions, and
+ * if so marks that subscription as completed.
+ * @remark          A SUBACK may be processed before the packet id of its SUBSCRIBE is stored, so an
+ * unknown packet id is accepted while some packet ids are still missing.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       packet_id  The packet id of the SUBACK.
+ *
+ * @return bool     true if the SUBACK was expected, false otherwise.
+ */
+static bool is_pending_subscription(azure_iot_t* azure_iot, int packet_id)
+{
+  bool has_missing_packet_id = false;
+
+  for (int i = 0; i < IOT_HUB_SUBSCRIPTION_COUNT; i++)
+  {
+    if (azure_iot->pending_subscription_packet_ids[i] == packet_id)
+    {
+      azure_iot->pending_subscription_packet_ids[i] = -1;
+      return true;
+    }
+
+    has_missing_packet_id |= (azure_iot->pending_subscription_packet_ids[i] == 0);
+  }
+
+  return has_missing_packet_id;
+}
+
+/*
+ * @brief           Gets the topic and payload of a telemetry message, in azure_iot->data_buffer.
+ * @remark          If azure_iot->config->telemetry_compression is set, the payload is compressed
+ * into azure_iot->data_buffer and the topic gets the content encoding property, unless compression
+ * does not make the payload smaller.
+ * @param[in]       azure_iot     A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       payload       The telemetry payload.
+ * @param[out]      mqtt_message  The message, with its topic and payload set.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int get_telemetry_mqtt_message(
+    azure_iot_t* azure_iot,
+    az_span payload,
+    mqtt_message_t* mqtt_message)
+{
+  az_result azr;
+  size_t topic_length;
+  az_span data_buffer = azure_iot->data_buffer;
+  uint8_t properties_buffer[TELEMETRY_PROPERTIES_BUFFER_SIZE];
+  az_iot_message_properties properties;
+  az_iot_message_properties* topic_properties = NULL;
+
+  mqtt_message->payload = payload;
+
+  if (azure_iot->config->telemetry_compression != NULL)
+  {
+    azr = az_iot_message_properties_init(&properties, AZ_SPAN_FROM_BUFFER(properties_buffer), 0);
+    EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed initializing telemetry properties");
+
+    // On failure the payload is published uncompressed.
+    if (az_result_succeeded(az_iot_message_compress(
+            azure_iot->config->telemetry_compression,
+            payload,
+            data_buffer,
+            &properties,
+            &mqtt_message->payload)))
+    {
+      topic_properties = &properties;
+      data_buffer = az_span_slice_to_end(data_buffer, az_span_size(mqtt_message->payload));
+    }
+  }
+
+  azr = az_iot_hub_client_telemetry_get_publish_topic(
+      &azure_iot->iot_hub_client,
+      topic_properties,
+      (char*)az_span_ptr(data_buffer),
+      az_span_size(data_buffer),
+      &topic_length);
+  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed to get the telemetry topic");
+
+  mqtt_message->topic = az_span_slice(data_buffer, 0, topic_length + 1);
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Publishes a message of the telemetry in-flight window with QoS 1.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       telemetry  A pointer to a queued message of azure_iot->telemetry_in_flight.
+ *
+ * @return int      0 on success, non-zero if any failure occurs. On failure the message stays
+ * queued.
+ */
+static int publish_in_flight_telemetry(azure_iot_t* azure_iot, telemetry_in_flight_t* telemetry)
+{
+  mqtt_message_t mqtt_message;
+
+  if (get_telemetry_mqtt_message(
+          azure_iot,
+          az_span_create(telemetry->payload, (int32_t)telemetry->payload_length),
+          &mqtt_message)
+      != RESULT_OK)
+  {
+    return RESULT_ERROR;
+  }
+
+  mqtt_message.qos = mqtt_qos_at_least_once;
+
+  telemetry->state = telemetry_in_flight_publishing;
+  azure_iot->early_puback_packet_id = 0;
+
+  int packet_id = publish_mqtt_message(azure_iot, &mqtt_message);
 
   if (packet_id < 0)
   {
-    azure_iot->state = azure_iot_state_error;
-    LogError(
-        "Failed publishing command response (%.*s).",
-        az_span_size(request_id),
-        az_span_ptr(request_id));
+    telemetry->state = telemetry_in_flight_queued;
+    return RESULT_ERROR;
+  }
+
+  telemetry->packet_id = packet_id;
+  telemetry->state = telemetry_in_flight_awaiting_puback;
+
+  // Its PUBACK may already have been processed.
+  if (azure_iot->early_puback_packet_id == packet_id)
+  {
+    complete_in_flight_telemetry(azure_iot, telemetry);
+  }
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Queues again the messages of the telemetry in-flight window that were published
+ * but not acknowledged, so they are published on the new connection.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ */
+static void requeue_unacknowledged_telemetry(azure_iot_t* azure_iot)
+{
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    if (azure_iot->telemetry_in_flight[i].state == telemetry_in_flight_awaiting_puback)
+    {
+      azure_iot->telemetry_in_flight[i].state = telemetry_in_flight_queued;
+    }
+  }
+}
+
+/*
+ * @brief           Releases a message of the telemetry in-flight window and notifies its delivery.
+ * @remark          The slot is released before the callback is invoked, so the callback may send
+ * another message. A message forwarded from azure_iot->config->telemetry_store only leaves the
+ * store now.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       telemetry  A pointer to the acknowledged message.
+ */
+static void complete_in_flight_telemetry(azure_iot_t* azure_iot, telemetry_in_flight_t* telemetry)
+{
+  telemetry_completed_t on_completed = telemetry->on_completed;
+  void* context = telemetry->context;
+
+  telemetry->state = telemetry_in_flight_free;
+
+  if (telemetry == azure_iot->stored_telemetry_in_flight)
+  {
+    azure_iot->stored_telemetry_in_flight = NULL;
+    az_result azr = az_iot_message_store_pop(azure_iot->config->telemetry_store);
+
+    if (az_result_failed(azr))
+    {
+      LogError("Failed removing stored telemetry: az_result return code 0x%08x.", azr);
+    }
+  }
+
+  if (on_completed != NULL)
+  {
+    on_completed(context);
+  }
+}
+
+/*
+ * @brief           Gets a free slot of the telemetry in-flight window for a message.
+ * @remark          Routine telemetry may only use up to TELEMETRY_ROUTINE_LANE_BUDGET slots, so
+ * alarms always find room.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       priority   The priority of the message.
+ *
+ * @return telemetry_in_flight_t*  A free slot, or NULL if none is available to `priority`.
+ */
+static telemetry_in_flight_t* get_free_in_flight_telemetry(
+    azure_iot_t* azure_iot,
+    azure_iot_telemetry_priority_t priority)
+{
+  telemetry_in_flight_t* free_telemetry = NULL;
+  int routine_count = 0;
+
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    if (azure_iot->telemetry_in_flight[i].state == telemetry_in_flight_free)
+    {
+      if (free_telemetry == NULL)
+      {
+        free_telemetry = &azure_iot->telemetry_in_flight[i];
+      }
+    }
+    else if (azure_iot->telemetry_in_flight[i].priority == azure_iot_telemetry_priority_routine)
+    {
+      routine_count++;
+    }
+  }
+
+  if (priority == azure_iot_telemetry_priority_routine
+      && routine_count >= TELEMETRY_ROUTINE_LANE_BUDGET)
+  {
+    return NULL;
+  }
+
+  return free_telemetry;
+}
+
+/*
+ * @brief           Gets the queued message of the telemetry in-flight window to publish next.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return telemetry_in_flight_t*  The first queued alarm, else the first queued routine message,
+ * or NULL if no message is queued.
+ */
+static telemetry_in_flight_t* get_queued_in_flight_telemetry(azure_iot_t* azure_iot)
+{
+  telemetry_in_flight_t* queued_telemetry = NULL;
+
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    telemetry_in_flight_t* telemetry = &azure_iot->telemetry_in_flight[i];
+
+    if (telemetry->state == telemetry_in_flight_queued)
+    {
+      if (telemetry->priority == azure_iot_telemetry_priority_alarm)
+      {
+        return telemetry;
+      }
+      else if (queued_telemetry == NULL)
+      {
+        queued_telemetry = telemetry;
+      }
+    }
+  }
+
+  return queued_telemetry;
+}
+
+/*
+ * @brief           Appends a telemetry message to azure_iot->config->telemetry_store, to be
+ * forwarded once connected.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       message    The telemetry message.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int store_telemetry(azure_iot_t* azure_iot, az_span message)
+{
+  az_iot_message_store* store = azure_iot->config->telemetry_store;
+  int32_t count = az_iot_message_store_get_count(store);
+
+  az_result azr = az_iot_message_store_append(store, message);
+  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed storing telemetry message.");
+
+  // Messages are evicted oldest first, so if any was, the one being forwarded is gone from the
+  // store. Its copy in the in-flight window is still delivered, but must not pop another message.
+  if (az_iot_message_store_get_count(store) <= count)
+  {
+    azure_iot->stored_telemetry_in_flight = NULL;
+  }
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Forwards the oldest message of azure_iot->config->telemetry_store through the
+ * telemetry in-flight window, as routine telemetry and at most
+ * TELEMETRY_STORE_DRAIN_RATE_PER_SECOND per second.
+ * @remark          A message only leaves the store once its PUBACK is received, so one that is not
+ * acknowledged (because the connection is lost, or the device restarts) is sent again. Only the
+ * oldest message can be read from the store, so the next one is forwarded once it is acknowledged.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now        The current time, in seconds since UNIX epoch.
+ *
+ * @return bool     true if a message was forwarded, false otherwise.
+ */
+static bool forward_stored_telemetry(azure_iot_t* azure_iot, uint32_t now)
+{
+  az_iot_message_store* store = azure_iot->config->telemetry_store;
+
+  if (store == NULL || azure_iot->stored_telemetry_in_flight != NULL)
+  {
+    return false;
+  }
+
+  if (now != azure_iot->telemetry_store_drain_time)
+  {
+    azure_iot->telemetry_store_drain_time = now;
+    azure_iot->telemetry_store_drain_count = 0;
+  }
+
+  while (azure_iot->telemetry_store_drain_count < TELEMETRY_STORE_DRAIN_RATE_PER_SECOND
+         && az_iot_message_store_get_count(store) > 0)
+  {
+    telemetry_in_flight_t* telemetry
+        = get_free_in_flight_telemetry(azure_iot, azure_iot_telemetry_priority_routine);
+
+    if (telemetry == NULL)
+    {
+      break;
+    }
+
+    az_span message;
+    az_result azr
+        = az_iot_message_store_peek(store, AZ_SPAN_FROM_BUFFER(telemetry->payload), &message);
+
+    if (azr == AZ_ERROR_NOT_ENOUGH_SPACE)
+    {
+      LogError(
+          "Dropping stored telemetry message larger than %d bytes.",
+          TELEMETRY_IN_FLIGHT_MAX_PAYLOAD_SIZE);
+      (void)az_iot_message_store_pop(store);
+      continue;
+    }
+    else if (az_result_failed(azr))
+    {
+      if (azr != AZ_ERROR_ITEM_NOT_FOUND)
+      {
+        LogError("Failed reading stored telemetry: az_result return code 0x%08x.", azr);
+      }
+
+      break;
+    }
+
+    telemetry->payload_length = (size_t)az_span_size(message);
+    telemetry->priority = azure_iot_telemetry_priority_routine;
+    telemetry->on_completed = NULL;
+    telemetry->context = NULL;
+    telemetry->packet_id = 0;
+    telemetry->state = telemetry_in_flight_queued;
+    azure_iot->stored_telemetry_in_flight = telemetry;
+    azure_iot->telemetry_store_drain_count++;
+
+    // On failure the message stays queued in the window and is published again later.
+    (void)publish_in_flight_telemetry(azure_iot, telemetry);
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * @brief           Gets the free slot at the end of the response lane.
+ * @remark          The slot is only added to the lane once azure_iot->response_lane_count is
+ * incremented.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return outbound_response_t*  The free slot, or NULL if the lane is full.
+ */
+static outbound_response_t* get_free_outbound_response(azure_iot_t* azure_iot)
+{
+  if (azure_iot->response_lane_count >= RESPONSE_LANE_SIZE)
+  {
+    return NULL;
+  }
+
+  int tail = (azure_iot->response_lane_head + azure_iot->response_lane_count) % RESPONSE_LANE_SIZE;
+
+  return &azure_iot->response_lane[tail];
+}
+
+/*
+ * @brief           Starts a reported properties update in the free slot at the end of the response
+ * lane: generates its request id, writes its topic and tracks the request.
+ * @remark          Every reported properties update, of the application or of the reported
+ * properties shadow, gets its request id here from azure_iot->request_tracker, so no two updates
+ * in flight share an id. The request is tracked without a deadline, which is only set once the
+ * update is published (see publish_queued_response), so an update queued while not connected
+ * cannot time out before it is sent. The update is only added to the lane once
+ * azure_iot->response_lane_count is incremented; if it is not, its request must be removed from
+ * azure_iot->request_tracker.
+ * @param[in]       azure_iot       A pointer to an initialized instance of azure_iot_t.
+ * @param[out]      out_response    The slot of the update, with its topic (and the null terminator
+ * after it) written. The payload goes right after it.
+ * @param[out]      out_request_id  The request id of the update.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int start_properties_update(
+    azure_iot_t* azure_iot,
+    outbound_response_t** out_response,
+    uint32_t* out_request_id)
+{
+  az_result azr;
+  size_t topic_length;
+  uint8_t request_id_buffer[AZ_IOT_HUB_CLIENT_REQUEST_ID_MAX_SIZE];
+  az_span request_id_span;
+  uint32_t request_id;
+
+  outbound_response_t* response = get_free_outbound_response(azure_iot);
+  EXIT_IF_TRUE(response == NULL, RESULT_ERROR, "Response lane is full.");
+
+  azr = az_iot_hub_client_request_tracker_get_next_request_id(
+      &azure_iot->request_tracker,
+      AZ_SPAN_FROM_BUFFER(request_id_buffer),
+      &request_id_span,
+      &request_id);
+  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed generating Twin request id.");
+
+  azr = az_iot_hub_client_properties_get_reported_publish_topic(
+      &azure_iot->iot_hub_client,
+      request_id_span,
+      (char*)response->buffer,
+      sizeof(response->buffer),
+      &topic_length);
+  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed to get the reported properties publish topic");
+
+  // Tracked before publishing, so the response cannot arrive before it can be matched.
+  azr = az_iot_hub_client_request_tracker_add(
+      &azure_iot->request_tracker,
+      request_id,
+      INT64_MAX,
+      on_properties_update_request_completed,
+      azure_iot);
+  EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed tracking reported properties update request.");
+
+  response->request_id = request_id;
+  response->topic_length = topic_length + 1;
+  *out_response = response;
+  *out_request_id = request_id;
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Publishes the oldest command response or properties update of the response
+ * lane, removing it from the lane if successful.
+ * @remark          A properties update times out PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS after it is
+ * published. Its deadline is set right before publishing, so the response cannot arrive first.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now        The current time, in seconds since UNIX epoch.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int publish_queued_response(azure_iot_t* azure_iot, uint32_t now)
+{
+  outbound_response_t* response = &azure_iot->response_lane[azure_iot->response_lane_head];
+  mqtt_message_t mqtt_message;
+
+  if (response->request_id != 0)
+  {
+    az_result azr;
+
+    // The tracker has no way to move a deadline, so the request is tracked again.
+    (void)az_iot_hub_client_request_tracker_remove(
+        &azure_iot->request_tracker, response->request_id);
+    azr = az_iot_hub_client_request_tracker_add(
+        &azure_iot->request_tracker,
+        response->request_id,
+        ((int64_t)now + PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS) * 1000,
+        on_properties_update_request_completed,
+        azure_iot);
+    EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed tracking reported properties update request.");
+  }
+
+  mqtt_message.topic = az_span_create(response->buffer, (int32_t)response->topic_length);
+  mqtt_message.payload = az_span_create(
+      &response->buffer[response->topic_length], (int32_t)response->payload_length);
+  mqtt_message.qos = mqtt_qos_at_most_once;
+
+  int packet_id = publish_mqtt_message(azure_iot, &mqtt_message);
+
+  if (packet_id < 0)
+  {
+    return RESULT_ERROR;
+  }
+
+  azure_iot->response_lane_head = (azure_iot->response_lane_head + 1) % RESPONSE_LANE_SIZE;
+  azure_iot->response_lane_count--;
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Publishes all the messages of the response lane.
+ * @remark          Publishing stops at the first failure, to be retried by azure_iot_do_work.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now        The current time, in seconds since UNIX epoch.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int publish_queued_responses(azure_iot_t* azure_iot, uint32_t now)
+{
+  while (azure_iot->response_lane_count > 0)
+  {
+    if (publish_queued_response(azure_iot, now) != RESULT_OK)
+    {
+      LogError("Failed publishing queued response.");
+      return RESULT_ERROR;
+    }
+  }
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Publishes up to OUTBOUND_PUBLISH_BUDGET_PER_WORK queued messages, by priority.
+ * @remark          The lanes are checked again before each message, so a command response or an
+ * alarm queued meanwhile (for example by a callback of the MQTT client) is published before the
+ * next routine telemetry message, and a backlog of stored telemetry never holds up the rest.
+ * Publishing stops at the first failure, to be retried on the next call.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now        The current time, in seconds since UNIX epoch.
+ */
+static void publish_outbound_messages(azure_iot_t* azure_iot, uint32_t now)
+{
+  for (int i = 0; i < OUTBOUND_PUBLISH_BUDGET_PER_WORK; i++)
+  {
+    telemetry_in_flight_t* telemetry;
+
+    if (azure_iot->response_lane_count > 0)
+    {
+      if (publish_queued_response(azure_iot, now) != RESULT_OK)
+      {
+        LogError("Failed publishing queued response.");
+        break;
+      }
+    }
+    else if ((telemetry = get_queued_in_flight_telemetry(azure_iot)) != NULL)
+    {
+      if (publish_in_flight_telemetry(azure_iot, telemetry) != RESULT_OK)
+      {
+        LogError("Failed publishing queued telemetry.");
+        break;
+      }
+    }
+    else if (!forward_stored_telemetry(azure_iot, now))
+    {
+      break;
+    }
+  }
+}
+
+/*
+ * @brief           Writes the changed properties of the reported properties shadow into an update
+ * queued in the response lane, tracked until its response is received.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int publish_reported_properties_shadow(azure_iot_t* azure_iot)
+{
+  az_iot_hub_client_properties_shadow* shadow = azure_iot->config->reported_properties_shadow;
+  az_result azr;
+  outbound_response_t* response;
+  uint32_t request_id;
+  az_json_writer json_writer;
+  int32_t property_count = 0;
+
+  EXIT_IF_TRUE(
+      start_properties_update(azure_iot, &response, &request_id) != RESULT_OK,
+      RESULT_ERROR,
+      "Failed starting reported properties update.");
+
+  azr = az_json_writer_init(
+      &json_writer,
+      az_span_create(
+          &response->buffer[response->topic_length],
+          (int32_t)(sizeof(response->buffer) - response->topic_length)),
+      NULL);
+
+  if (az_result_succeeded(azr))
+  {
+    azr = az_iot_hub_client_properties_shadow_write_changes(
+        &azure_iot->iot_hub_client, shadow, &json_writer, &property_count);
+  }
+
+  if (az_result_failed(azr) || property_count == 0)
+  {
+    (void)az_iot_hub_client_request_tracker_remove(&azure_iot->request_tracker, request_id);
+    EXIT_IF_AZ_FAILED(azr, RESULT_ERROR, "Failed writing reported properties update.");
+    return RESULT_OK;
+  }
+
+  response->payload_length
+      = (size_t)az_span_size(az_json_writer_get_bytes_used_in_destination(&json_writer));
+  azure_iot->response_lane_count++;
+  azure_iot->reported_properties_request_id = request_id;
+
+  LogInfo(
+      "Coalesced %d reported properties into update (id=%" PRIu32 ").", property_count, request_id);
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Publishes the changes of the reported properties shadow once they are due.
+ * @remark          Changes are due REPORTED_PROPERTIES_FLUSH_DELAY_IN_SECONDS after the first one
+ * is seen, or as soon as REPORTED_PROPERTIES_FLUSH_CHANGE_COUNT properties changed. Nothing is
+ * published while an update of the shadow is in flight; the changes made meanwhile are due once
+ * it completes. A failed update is retried on the next call.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now        The current time, in seconds since UNIX epoch.
+ */
+static void flush_reported_properties_shadow(azure_iot_t* azure_iot, uint32_t now)
+{
+  az_iot_hub_client_properties_shadow* shadow = azure_iot->config->reported_properties_shadow;
+
+  if (shadow == NULL || az_iot_hub_client_properties_shadow_is_update_in_flight(shadow))
+  {
+    return;
+  }
+
+  int32_t change_count = az_iot_hub_client_properties_shadow_get_change_count(shadow);
+
+  if (change_count == 0)
+  {
+    azure_iot->reported_properties_change_time = 0;
+    return;
+  }
+
+  if (azure_iot->reported_properties_change_time == 0)
+  {
+    azure_iot->reported_properties_change_time = now;
+  }
+
+  if (change_count < REPORTED_PROPERTIES_FLUSH_CHANGE_COUNT
+      && now - azure_iot->reported_properties_change_time
+          < REPORTED_PROPERTIES_FLUSH_DELAY_IN_SECONDS)
+  {
+    return;
+  }
+
+  if (publish_reported_properties_shadow(azure_iot) == RESULT_OK)
+  {
+    azure_iot->reported_properties_change_time = 0;
+  }
+}
+
+/*
+ * @brief           Calculates when the IoT Hub SAS token should be renewed.
+ * @remark          The jitter is derived from the device id, so it stays the same across
+ * reconnections and differs between devices, spreading out the renewals of devices that connected
+ * at the same time (for example, after a gateway or network outage).
+ * @param[in]       azure_iot        A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       expiration_time  The expiration time of the SAS token, as unix time.
+ *
+ * @return uint32_t The renewal time, as unix time.
+ */
+static uint32_t get_sas_token_renewal_time(azure_iot_t* azure_iot, uint32_t expiration_time)
+{
+  uint64_t lifetime
+      = (uint64_t)azure_iot->config->sas_token_lifetime_in_minutes * NUMBER_OF_SECONDS_IN_A_MINUTE;
+  uint32_t jitter_range = (uint32_t)(lifetime * SAS_TOKEN_RENEWAL_JITTER_PERCENT / 100) + 1;
+  uint32_t hash = get_fnv1a_hash(2166136261u, azure_iot->config->device_id);
+
+  return expiration_time
+      - (uint32_t)(lifetime * (100 - SAS_TOKEN_RENEWAL_LIFETIME_PERCENT) / 100)
+      - hash % jitter_range;
+}
+
+/*
+ * @brief           Checks whether no outbound message is waiting to be published or acknowledged,
+ * so reconnecting now would not delay or lose any.
+ * @remark          Stored telemetry is not considered, since it is kept across reconnections.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return bool     true if idle, false otherwise.
+ */
+static bool is_outbound_idle(azure_iot_t* azure_iot)
+{
+  if (azure_iot->response_lane_count > 0
+      || az_iot_hub_client_request_tracker_get_count(&azure_iot->request_tracker) > 0)
+  {
+    return false;
+  }
+
+  for (int i = 0; i < TELEMETRY_IN_FLIGHT_WINDOW_SIZE; i++)
+  {
+    if (azure_iot->telemetry_in_flight[i].state != telemetry_in_flight_free)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * @brief           Generates the SAS token for the next connection to IoT Hub into
+ * azure_iot->next_sas_token, so the renewal only needs to reconnect.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int pregenerate_sas_token(azure_iot_t* azure_iot)
+{
+  int length = generate_sas_token_for_iot_hub(
+      &azure_iot->iot_hub_client,
+      azure_iot->config->device_key,
+      azure_iot->config->sas_token_lifetime_in_minutes,
+      azure_iot->config->data_manipulation_functions,
+      AZ_SPAN_FROM_BUFFER(azure_iot->next_sas_token),
+      &azure_iot->next_sas_token_expiration_time);
+  EXIT_IF_TRUE(length == 0, RESULT_ERROR, "Failed generating next SAS token.");
+
+  azure_iot->next_sas_token_length = (size_t)length;
+  azure_iot->sas_token_pregeneration_retry_time = 0;
+  azure_iot->sas_token_pregeneration_retry_delay = 0;
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Gets the current time in milliseconds.
+ * @remark          Uses the `get_time_msec` of the configuration if set, else
+ * `az_platform_clock_msec` if the platform provides it, or the system time otherwise (with a
+ * resolution of one second).
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return int64_t  The current time in milliseconds, or zero if it could not be obtained.
+ */
+static int64_t get_current_time_msec(azure_iot_t* azure_iot)
+{
+  int64_t now_msec;
+
+  if (azure_iot->config->get_time_msec != NULL)
+  {
+    now_msec = azure_iot->config->get_time_msec();
+  }
+  else if (az_result_failed(az_platform_clock_msec(&now_msec)))
+  {
+    now_msec = (int64_t)get_current_unix_time() * 1000;
+  }
+
+  return now_msec;
+}
+
+/*
+ * @brief           Schedules the next query of the device provisioning status.
+ * @remark          The delay uses decorrelated jitter: it is a random value between the base delay
+ * and three times the previous delay, capped at DPS_QUERY_MAX_RETRY_DELAY_MSEC. The base delay is
+ * the retry-after given by Azure Device Provisioning, or DPS_QUERY_MIN_RETRY_DELAY_MSEC if none is
+ * given, and is always honored, even if above the cap.
+ * @param[in]       azure_iot            A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       retry_after_seconds  The retry-after of the DPS response, or zero.
+ */
+static void schedule_dps_query(azure_iot_t* azure_iot, uint32_t retry_after_seconds)
+{
+  int32_t base_delay_msec = DPS_QUERY_MIN_RETRY_DELAY_MSEC;
+  int32_t max_delay_msec = DPS_QUERY_MAX_RETRY_DELAY_MSEC;
+  int64_t upper_delay_msec;
+  int32_t delay_msec;
+  uint32_t random;
+
+  if (retry_after_seconds > 0)
+  {
+    // Keeps three times the delay within int32_t (about 8 days).
+    base_delay_msec = retry_after_seconds < (uint32_t)(INT32_MAX / 3 / 1000)
+        ? (int32_t)retry_after_seconds * 1000
+        : INT32_MAX / 3 / 1000 * 1000;
+  }
+
+  if (max_delay_msec < base_delay_msec)
+  {
+    max_delay_msec = base_delay_msec;
+  }
+
+  upper_delay_msec = (int64_t)(azure_iot->dps_query_delay_msec > base_delay_msec
+                                   ? azure_iot->dps_query_delay_msec
+                                   : base_delay_msec)
+      * 3;
+
+  // xorshift32
+  random = azure_iot->dps_query_jitter_state;
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  azure_iot->dps_query_jitter_state = random;
+
+  delay_msec = base_delay_msec
+      + (int32_t)(random % (uint32_t)(upper_delay_msec - base_delay_msec + 1));
+
+  if (delay_msec > max_delay_msec)
+  {
+    delay_msec = max_delay_msec;
+  }
+
+  azure_iot->dps_query_delay_msec = delay_msec;
+  azure_iot->dps_next_query_time_msec = get_current_time_msec(azure_iot) + delay_msec;
+}
+
+/*
+ * @brief           Continues an FNV-1a hash with the given data.
+ * @param[in]       hash  The hash of the preceding data, or 2166136261 (the FNV offset basis).
+ * @param[in]       data  The data to hash.
+ *
+ * @return uint32_t The hash.
+ */
+static uint32_t get_fnv1a_hash(uint32_t hash, az_span data)
+{
+  uint8_t* data_ptr = az_span_ptr(data);
+
+  for (int32_t i = 0; i < az_span_size(data); i++)
+  {
+    hash = (hash ^ data_ptr[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * @brief           Calculates the checksum of a DPS assignment record.
+ * @remark          The DPS ID scope and registration ID are included, so a record saved for a
+ * different configuration is not used.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       record     The DPS assignment record. Its checksum field is not included.
+ *
+ * @return uint32_t The checksum.
+ */
+static uint32_t get_dps_assignment_checksum(azure_iot_t* azure_iot, az_span record)
+{
+  uint32_t hash = get_fnv1a_hash(2166136261u, azure_iot->config->dps_id_scope);
+  hash = get_fnv1a_hash(hash, azure_iot->config->dps_registration_id);
+  hash = get_fnv1a_hash(hash, az_span_slice(record, 0, DPS_ASSIGNMENT_RECORD_CHECKSUM_OFFSET));
+  return get_fnv1a_hash(hash, az_span_slice_to_end(record, DPS_ASSIGNMENT_RECORD_HEADER_SIZE));
+}
+
+/*
+ * @brief           Loads the DPS assignment saved with `dps_assignment_cache`, setting the IoT Hub
+ * FQDN and Device ID in the configuration if it is valid and not expired.
+ * @remark          The IoT Hub FQDN and Device ID are kept at the beginning of
+ * azure_iot->data_buffer, as when device provisioning completes.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return int      0 if a valid assignment was loaded, non-zero otherwise.
+ */
+static int load_dps_assignment(azure_iot_t* azure_iot)
+{
+  az_span data_buffer = azure_iot->data_buffer;
+  az_span record = data_buffer;
+  uint8_t* record_ptr = az_span_ptr(record);
+  size_t length;
+  int32_t iot_hub_fqdn_length;
+  int32_t device_id_length;
+  uint32_t expiration_time = 0;
+  uint32_t checksum = 0;
+  uint32_t now;
+
+  if (azure_iot->config->dps_assignment_cache.load == NULL
+      || azure_iot->config->dps_assignment_cache.load(
+             record_ptr, (size_t)az_span_size(record), &length)
+          != 0)
+  {
     return RESULT_ERROR;
   }
-  else
+
+  EXIT_IF_TRUE(
+      length < DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 2 || length > (size_t)az_span_size(record)
+          || record_ptr[0] != DPS_ASSIGNMENT_RECORD_VERSION,
+      RESULT_ERROR,
+      "Invalid saved DPS assignment.");
+
+  record = az_span_slice(record, 0, (int32_t)length);
+  iot_hub_fqdn_length = record_ptr[DPS_ASSIGNMENT_RECORD_HEADER_SIZE];
+  EXIT_IF_TRUE(
+      DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 2 + iot_hub_fqdn_length > az_span_size(record),
+      RESULT_ERROR,
+      "Invalid saved DPS assignment.");
+
+  device_id_length = record_ptr[DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 1 + iot_hub_fqdn_length];
+  EXIT_IF_TRUE(
+      DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 2 + iot_hub_fqdn_length + device_id_length
+              != az_span_size(record)
+          || iot_hub_fqdn_length == 0 || device_id_length == 0,
+      RESULT_ERROR,
+      "Invalid saved DPS assignment.");
+
+  for (int i = 3; i >= 0; i--)
+  {
+    expiration_time
+        = (expiration_time << 8) | record_ptr[DPS_ASSIGNMENT_RECORD_EXPIRATION_OFFSET + i];
+    checksum = (checksum << 8) | record_ptr[DPS_ASSIGNMENT_RECORD_CHECKSUM_OFFSET + i];
+  }
+
+  EXIT_IF_TRUE(
+      checksum != get_dps_assignment_checksum(azure_iot, record),
+      RESULT_ERROR,
+      "Saved DPS assignment is corrupted or for another registration.");
+
+  now = get_current_unix_time();
+
+  if (now == 0 || now >= expiration_time)
+  {
+    LogInfo("Saved DPS assignment expired.");
+    return RESULT_ERROR;
+  }
+
+  // The data buffer holds the record; both are moved to its beginning in place.
+  azure_iot->config->iot_hub_fqdn = slice_and_copy_az_span(
+      data_buffer,
+      az_span_slice(
+          record,
+          DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 1,
+          DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 1 + iot_hub_fqdn_length),
+      &data_buffer);
+  azure_iot->config->device_id = slice_and_copy_az_span(
+      data_buffer,
+      az_span_slice_to_end(record, DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 2 + iot_hub_fqdn_length),
+      &data_buffer);
+  azure_iot->data_buffer = data_buffer;
+
+  LogInfo(
+      "Using saved DPS assignment (IoT Hub: %.*s, Device ID: %.*s).",
+      az_span_size(azure_iot->config->iot_hub_fqdn),
+      az_span_ptr(azure_iot->config->iot_hub_fqdn),
+      az_span_size(azure_iot->config->device_id),
+      az_span_ptr(azure_iot->config->device_id));
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Saves the IoT Hub FQDN and Device ID assigned by device provisioning with
+ * `dps_assignment_cache`, to be used for up to DPS_ASSIGNMENT_CACHE_TTL_IN_SECONDS.
+ * @remark          The record is built in the free space of azure_iot->data_buffer.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ *
+ * @return int      0 on success or if `dps_assignment_cache` is not set, non-zero if any failure
+ * occurs.
+ */
+static int save_dps_assignment(azure_iot_t* azure_iot)
+{
+  az_span iot_hub_fqdn = azure_iot->config->iot_hub_fqdn;
+  az_span device_id = azure_iot->config->device_id;
+  int32_t length = DPS_ASSIGNMENT_RECORD_HEADER_SIZE + 2 + az_span_size(iot_hub_fqdn)
+      + az_span_size(device_id);
+  az_span record;
+  az_span remainder;
+  uint8_t* record_ptr;
+  uint32_t expiration_time;
+  uint32_t checksum;
+  uint32_t now;
+
+  if (azure_iot->config->dps_assignment_cache.save == NULL)
   {
     return RESULT_OK;
   }
+
+  EXIT_IF_TRUE(
+      az_span_size(iot_hub_fqdn) > UINT8_MAX || az_span_size(device_id) > UINT8_MAX,
+      RESULT_ERROR,
+      "DPS assignment too long to be saved.");
+
+  now = get_current_unix_time();
+  EXIT_IF_TRUE(now == 0, RESULT_ERROR, "Failed getting current time for DPS assignment.");
+
+  record = split_az_span(azure_iot->data_buffer, length, NULL);
+  EXIT_IF_TRUE(
+      az_span_is_content_equal(record, AZ_SPAN_EMPTY),
+      RESULT_ERROR,
+      "Failed reserving memory for DPS assignment.");
+
+  record_ptr = az_span_ptr(record);
+  record_ptr[0] = DPS_ASSIGNMENT_RECORD_VERSION;
+
+  remainder = az_span_slice_to_end(record, DPS_ASSIGNMENT_RECORD_HEADER_SIZE);
+  remainder = az_span_copy_u8(remainder, (uint8_t)az_span_size(iot_hub_fqdn));
+  remainder = az_span_copy(remainder, iot_hub_fqdn);
+  remainder = az_span_copy_u8(remainder, (uint8_t)az_span_size(device_id));
+  (void)az_span_copy(remainder, device_id);
+
+  expiration_time = now + DPS_ASSIGNMENT_CACHE_TTL_IN_SECONDS;
+
+  for (int i = 0; i < 4; i++)
+  {
+    record_ptr[DPS_ASSIGNMENT_RECORD_EXPIRATION_OFFSET + i] = (uint8_t)(expiration_time >> (8 * i));
+  }
+
+  checksum = get_dps_assignment_checksum(azure_iot, record);
+
+  for (int i = 0; i < 4; i++)
+  {
+    record_ptr[DPS_ASSIGNMENT_RECORD_CHECKSUM_OFFSET + i] = (uint8_t)(checksum >> (8 * i));
+  }
+
+  EXIT_IF_TRUE(
+      azure_iot->config->dps_assignment_cache.save(record_ptr, (size_t)length) != 0,
+      RESULT_ERROR,
+      "Failed saving DPS assignment.");
+
+  return RESULT_OK;
 }
 
-/* --- Implementation of internal functions --- */
+/*
+ * @brief           Saves the TLS session of the connected MQTT client, replacing the one saved
+ * from a previous connection to the same broker.
+ * @param[in]       azure_iot    A pointer to an initialized instance of azure_iot_t.
+ * @param[in,out]   tls_session  The TLS session saved for the broker the MQTT client is connected
+ * to (DPS or IoT Hub).
+ *
+ * @return          Nothing.
+ */
+static void save_tls_session(azure_iot_t* azure_iot, mqtt_client_tls_session_t* tls_session)
+{
+  mqtt_client_tls_session_t new_tls_session;
+
+  if (azure_iot->config->mqtt_client_interface.mqtt_client_get_tls_session == NULL)
+  {
+    return;
+  }
+
+  new_tls_session = azure_iot->config->mqtt_client_interface.mqtt_client_get_tls_session(
+      azure_iot->mqtt_client_handle);
+
+  // The MQTT client may return the very session it resumed.
+  if (new_tls_session != *tls_session)
+  {
+    free_tls_session(azure_iot, tls_session);
+    *tls_session = new_tls_session;
+  }
+}
 
 /*
- * @brief           Gets the number of seconds since UNIX epoch until now.
- * @return uint32_t Number of seconds.
+ * @brief           Releases a saved TLS session, so the next connection does a full TLS handshake.
+ * @param[in]       azure_iot    A pointer to an initialized instance of azure_iot_t.
+ * @param[in,out]   tls_session  The TLS session to release, set to NULL.
+ *
+ * @return          Nothing.
  */
-static uint32_t get_current_unix_time()
+static void free_tls_session(azure_iot_t* azure_iot, mqtt_client_tls_session_t* tls_session)
 {
-  time_t now = time(NULL);
-  return (now == INDEFINITE_TIME ? 0 : (uint32_t)(now));
+  if (*tls_session != NULL)
+  {
+    azure_iot->config->mqtt_client_interface.mqtt_client_free_tls_session(*tls_session);
+    *tls_session = NULL;
+  }
+}
+
+/*
+ * @brief           Changes the state of the Azure IoT client, updating its metrics and notifying
+ * `on_state_changed`.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       state      The state to change to.
+ *
+ * @return          Nothing.
+ */
+static void set_state(azure_iot_t* azure_iot, azure_iot_client_state_t state)
+{
+  azure_iot_metrics_t* metrics = &azure_iot->metrics;
+  azure_iot_client_state_t previous_state = azure_iot->state;
+  int64_t now_msec;
+  uint32_t duration_msec;
+
+  if (state == previous_state)
+  {
+    return;
+  }
+
+  now_msec = get_current_time_msec(azure_iot);
+  duration_msec = (uint32_t)(now_msec - azure_iot->state_entered_time_msec);
+
+  azure_iot->state = state;
+  azure_iot->state_entered_time_msec = now_msec;
+  metrics->state_duration_msec[previous_state] += duration_msec;
+
+  switch (state)
+  {
+    case azure_iot_state_started:
+      reset_start_metrics(azure_iot, now_msec);
+      break;
+    case azure_iot_state_connecting_to_dps:
+      metrics->connection_count++;
+      break;
+    case azure_iot_state_connecting_to_hub:
+      metrics->connection_count++;
+
+      if (metrics->ready_count > 0)
+      {
+        metrics->reconnect_count++;
+      }
+
+      break;
+    case azure_iot_state_provisioning_querying:
+      metrics->dps_query_count++;
+      break;
+    case azure_iot_state_ready:
+      if (metrics->ready_count > 0)
+      {
+        metrics->last_reconnect_duration_msec
+            = (uint32_t)(now_msec - azure_iot->ready_left_time_msec);
+      }
+
+      metrics->ready_count++;
+      break;
+    case azure_iot_state_refreshing_sas:
+      metrics->sas_token_renewal_count++;
+      break;
+    case azure_iot_state_error:
+      metrics->error_count++;
+      break;
+    default:
+      break;
+  }
+
+  if (previous_state == azure_iot_state_ready)
+  {
+    azure_iot->ready_left_time_msec = now_msec;
+  }
+
+  if (metrics->state_entered_msec[state] < 0)
+  {
+    metrics->state_entered_msec[state] = (int32_t)(now_msec - metrics->start_time_msec);
+  }
+
+  if (azure_iot->config->on_state_changed != NULL)
+  {
+    azure_iot->config->on_state_changed(previous_state, state, duration_msec);
+  }
+}
+
+/*
+ * @brief           Resets the metrics relative to the start of the Azure IoT client.
+ * @param[in]       azure_iot  A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       now_msec   The time the client is started at.
+ *
+ * @return          Nothing.
+ */
+static void reset_start_metrics(azure_iot_t* azure_iot, int64_t now_msec)
+{
+  azure_iot->metrics.start_time_msec = now_msec;
+
+  for (int i = 0; i < AZURE_IOT_CLIENT_STATE_COUNT; i++)
+  {
+    azure_iot->metrics.state_entered_msec[i] = -1;
+  }
+
+  for (int i = 0; i < IOT_HUB_SUBSCRIPTION_COUNT; i++)
+  {
+    azure_iot->metrics.subscription_completed_msec[i] = -1;
+  }
+}
+
+/*
+ * @brief           Publishes an MQTT message with the MQTT client, counting it in the metrics.
+ * @param[in]       azure_iot     A pointer to an initialized instance of azure_iot_t.
+ * @param[in]       mqtt_message  The message to publish.
+ *
+ * @return int      The packet ID on success, or NEGATIVE if any failure occurs.
+ */
+static int publish_mqtt_message(azure_iot_t* azure_iot, mqtt_message_t* mqtt_message)
+{
+  int packet_id = azure_iot->config->mqtt_client_interface.mqtt_client_publish(
+      azure_iot->mqtt_client_handle, mqtt_message);
+
+  if (packet_id < 0)
+  {
+    azure_iot->metrics.publish_failure_count++;
+  }
+  else
+  {
+    azure_iot->metrics.bytes_sent
+        += (uint32_t)(az_span_size(mqtt_message->topic) + az_span_size(mqtt_message->payload));
+  }
+
+  return packet_id;
 }
 
 /*
@@ -1023,25 +2556,21 @@ static int get_mqtt_client_config_for_dps(
 
   data_buffer_span = azure_iot->data_buffer;
 
-  password_span = split_az_span(data_buffer_span, MQTT_PASSWORD_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(password_span, AZ_SPAN_EMPTY),
-      RESULT_ERROR,
-      "Failed reserving buffer for password_span.");
-
   if (!az_span_is_content_equal(azure_iot->config->device_key, AZ_SPAN_EMPTY))
   {
+    // The password is generated in the free space of the data buffer, and only its actual length
+    // is then reserved.
     password_length = generate_sas_token_for_dps(
         &azure_iot->dps_client,
         azure_iot->config->device_key,
         azure_iot->config->sas_token_lifetime_in_minutes,
-        data_buffer_span,
         azure_iot->config->data_manipulation_functions,
-        password_span,
+        data_buffer_span,
         &azure_iot->sas_token_expiration_time);
     EXIT_IF_TRUE(
         password_length == 0, RESULT_ERROR, "Failed creating mqtt password for DPS connection.");
 
+    password_span = split_az_span(data_buffer_span, password_length + 1, &data_buffer_span);
     mqtt_client_config->password = password_span;
   }
   else
@@ -1076,6 +2605,7 @@ static int get_mqtt_client_config_for_dps(
 
   mqtt_client_config->client_id = client_id_span;
   mqtt_client_config->username = username_span;
+  mqtt_client_config->tls_session = azure_iot->dps_tls_session;
 
   return RESULT_OK;
 }
@@ -1100,11 +2630,14 @@ static int get_mqtt_client_config_for_iot_hub(
   size_t client_id_length;
   size_t username_length;
   size_t password_length;
+  uint32_t now;
   az_result azrc;
 
   azure_iot->iot_hub_client_options = az_iot_hub_client_options_default();
   azure_iot->iot_hub_client_options.user_agent = azure_iot->config->user_agent;
   azure_iot->iot_hub_client_options.model_id = azure_iot->config->model_id;
+  azure_iot->iot_hub_client_options.telemetry_topic_cache
+      = AZ_SPAN_FROM_BUFFER(azure_iot->telemetry_topic_cache);
 
   azrc = az_iot_hub_client_init(
       &azure_iot->iot_hub_client,
@@ -1115,22 +2648,45 @@ static int get_mqtt_client_config_for_iot_hub(
 
   data_buffer_span = azure_iot->data_buffer;
 
-  password_span = split_az_span(data_buffer_span, MQTT_PASSWORD_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(password_span, AZ_SPAN_EMPTY),
-      RESULT_ERROR,
-      "Failed reserving buffer for password_span.");
+  now = get_current_unix_time();
+  EXIT_IF_TRUE(now == 0, RESULT_ERROR, "Failed getting current time for IoT Hub connection.");
 
-  password_length = generate_sas_token_for_iot_hub(
-      &azure_iot->iot_hub_client,
-      azure_iot->config->device_key,
-      azure_iot->config->sas_token_lifetime_in_minutes,
-      data_buffer_span,
-      azure_iot->config->data_manipulation_functions,
-      password_span,
-      &azure_iot->sas_token_expiration_time);
-  EXIT_IF_TRUE(
-      password_length == 0, RESULT_ERROR, "Failed creating mqtt password for IoT Hub connection.");
+  // A token generated ahead of a renewal is used unless it is about to expire itself. Either way,
+  // the password is written to the free space of the data buffer, and only its actual length is
+  // then reserved.
+  if (azure_iot->next_sas_token_length > 0
+      && azure_iot->next_sas_token_length < (size_t)az_span_size(data_buffer_span)
+      && (azure_iot->next_sas_token_expiration_time - now) >= SAS_TOKEN_REFRESH_THRESHOLD_IN_SECS)
+  {
+    (void)memcpy(
+        az_span_ptr(data_buffer_span),
+        azure_iot->next_sas_token,
+        azure_iot->next_sas_token_length + 1);
+    password_length = azure_iot->next_sas_token_length;
+    azure_iot->sas_token_expiration_time = azure_iot->next_sas_token_expiration_time;
+  }
+  else
+  {
+    password_length = generate_sas_token_for_iot_hub(
+        &azure_iot->iot_hub_client,
+        azure_iot->config->device_key,
+        azure_iot->config->sas_token_lifetime_in_minutes,
+        azure_iot->config->data_manipulation_functions,
+        data_buffer_span,
+        &azure_iot->sas_token_expiration_time);
+    EXIT_IF_TRUE(
+        password_length == 0,
+        RESULT_ERROR,
+        "Failed creating mqtt password for IoT Hub connection.");
+  }
+
+  password_span = split_az_span(data_buffer_span, password_length + 1, &data_buffer_span);
+
+  azure_iot->next_sas_token_length = 0;
+  azure_iot->sas_token_pregeneration_retry_time = 0;
+  azure_iot->sas_token_pregeneration_retry_delay = 0;
+  azure_iot->sas_token_renewal_time
+      = get_sas_token_renewal_time(azure_iot, azure_iot->sas_token_expiration_time);
 
   client_id_span = split_az_span(data_buffer_span, MQTT_CLIENT_ID_BUFFER_SIZE, &data_buffer_span);
   EXIT_IF_TRUE(
@@ -1160,29 +2716,83 @@ static int get_mqtt_client_config_for_iot_hub(
   mqtt_client_config->client_id = client_id_span;
   mqtt_client_config->username = username_span;
   mqtt_client_config->password = password_span;
+  mqtt_client_config->tls_session = azure_iot->iot_hub_tls_session;
+
+  return RESULT_OK;
+}
+
+/*
+ * @brief           Base64-decodes the device key, to sign SAS signatures with
+ * `sign_sas_signature`.
+ * @param[in]       device_key                  az_span containing the device key.
+ * @param[in]       data_manipulation_functions Set of user-defined functions needed for the
+ * generation of the SAS token.
+ * @param[out]      signing_key                 The decoded key and the HMAC-SHA256 function to
+ * sign with.
+ *
+ * @return int      0 on success, non-zero if any failure occurs.
+ */
+static int decode_sas_signing_key(
+    az_span device_key,
+    data_manipulation_functions_t data_manipulation_functions,
+    sas_signing_key_t* signing_key)
+{
+  int result;
+
+  signing_key->hmac_sha256_encrypt = data_manipulation_functions.hmac_sha256_encrypt;
+
+  result = data_manipulation_functions.base64_decode(
+      az_span_ptr(device_key),
+      az_span_size(device_key),
+      signing_key->decoded_key,
+      sizeof(signing_key->decoded_key),
+      &signing_key->decoded_key_length);
+  EXIT_IF_TRUE(result != 0, RESULT_ERROR, "Failed decoding SAS key.");
 
   return RESULT_OK;
 }
 
+/*
+ * @brief           HMAC-SHA256 signs a SAS signature, as requested by
+ * az_iot_hub_client_sas_get_signed_password() and
+ * az_iot_provisioning_client_sas_get_signed_password().
+ * @param[in]       context      A pointer to the `sas_signing_key_t` to sign with.
+ * @param[in]       data         The SAS signature.
+ * @param[out]      signed_data  Buffer where to write the HMAC-SHA256 of `data`.
+ *
+ * @return az_result AZ_OK on success, or an error if the user-defined function fails.
+ */
+static az_result sign_sas_signature(void* context, az_span data, az_span signed_data)
+{
+  sas_signing_key_t* signing_key = (sas_signing_key_t*)context;
+
+  int result = signing_key->hmac_sha256_encrypt(
+      signing_key->decoded_key,
+      signing_key->decoded_key_length,
+      az_span_ptr(data),
+      az_span_size(data),
+      az_span_ptr(signed_data),
+      az_span_size(signed_data));
+  EXIT_IF_TRUE(result != 0, AZ_ERROR_NOT_SUPPORTED, "Failed encrypting SAS signature.");
+
+  return AZ_OK;
+}
+
 /*
  * @brief           Generates a SAS token used as password for connecting with Azure Device
  * Provisioning.
  * @remarks         The SAS token generation depends on the following steps:
  *                  1. Calculate the expiration time, as current unix time since epoch plus the
  * token duration, in minutes.
- *                  2. Generate the SAS signature;
- *                    a. Generate the DPS-specific secret string (a.k.a., "signature");
- *                    b. base64-decode the encryption key (device key);
- *                    c. Encrypt (HMAC-SHA256) the signature using the base64-decoded encryption
- * key; d. base64-encode the encrypted signature, which gives the final SAS signature (sig);
+ *                  2. base64-decode the encryption key (device key);
  *                  3. Compose the final SAS token with the DPS audience (sr), SAS signature (sig)
- * and expiration time (se).
+ * and expiration time (se). The DPS-specific secret string (a.k.a., "signature") is generated in
+ * `sas_token` itself, encrypted (HMAC-SHA256) using the base64-decoded encryption key, and replaced
+ * by its base64-encoded value.
  * @param[in]       provisioning_client         A pointer to an initialized instance of
  * az_iot_provisioning_client.
  * @param[in]       device_key                  az_span containing the device key.
  * @param[in]       duration_in_minutes         Duration of the SAS token, in minutes.
- * @param[in]       data_buffer_span            az_span with a buffer containing enough space for
- * all the intermediate data generated by this function.
  * @param[in]       data_manipulation_functions Set of user-defined functions needed for the
  * generation of the SAS token.
  * @param[out]      sas_token                   az_span with buffer where to write the resulting SAS
@@ -1196,16 +2806,14 @@ static int generate_sas_token_for_dps(
     az_iot_provisioning_client* provisioning_client,
     az_span device_key,
     unsigned int duration_in_minutes,
-    az_span data_buffer_span,
     data_manipulation_functions_t data_manipulation_functions,
     az_span sas_token,
     uint32_t* expiration_time)
 {
-  int result;
   az_result rc;
   uint32_t current_unix_time;
-  size_t mqtt_password_length, decoded_sas_key_length, length;
-  az_span plain_sas_signature, sas_signature, decoded_sas_key, sas_hmac256_signed_signature;
+  size_t mqtt_password_length;
+  sas_signing_key_t signing_key;
 
   // Step 1.
   current_unix_time = get_current_unix_time();
@@ -1213,76 +2821,23 @@ static int generate_sas_token_for_dps(
 
   *expiration_time = current_unix_time + duration_in_minutes * NUMBER_OF_SECONDS_IN_A_MINUTE;
 
-  // Step 2.a.
-  plain_sas_signature
-      = split_az_span(data_buffer_span, PLAIN_SAS_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(plain_sas_signature, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for plain sas token.");
-
-  rc = az_iot_provisioning_client_sas_get_signature(
-      provisioning_client, *expiration_time, plain_sas_signature, &plain_sas_signature);
-  EXIT_IF_AZ_FAILED(rc, 0, "Could not get the signature for SAS key.");
-
-  // Step 2.b.
-  sas_signature = split_az_span(data_buffer_span, SAS_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(sas_signature, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for sas_signature.");
-
-  decoded_sas_key = split_az_span(data_buffer_span, DECODED_SAS_KEY_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(decoded_sas_key, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for decoded_sas_key.");
-
-  result = data_manipulation_functions.base64_decode(
-      az_span_ptr(device_key),
-      az_span_size(device_key),
-      az_span_ptr(decoded_sas_key),
-      az_span_size(decoded_sas_key),
-      &decoded_sas_key_length);
-  EXIT_IF_TRUE(result != 0, 0, "Failed decoding SAS key.");
-
-  // Step 2.c.
-  sas_hmac256_signed_signature = split_az_span(
-      data_buffer_span, SAS_HMAC256_ENCRYPTED_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
+  // Step 2.
   EXIT_IF_TRUE(
-      az_span_is_content_equal(sas_hmac256_signed_signature, AZ_SPAN_EMPTY),
+      decode_sas_signing_key(device_key, data_manipulation_functions, &signing_key) != RESULT_OK,
       0,
-      "Failed reserving buffer for sas_hmac256_signed_signature.");
-
-  result = data_manipulation_functions.hmac_sha256_encrypt(
-      az_span_ptr(decoded_sas_key),
-      decoded_sas_key_length,
-      az_span_ptr(plain_sas_signature),
-      az_span_size(plain_sas_signature),
-      az_span_ptr(sas_hmac256_signed_signature),
-      az_span_size(sas_hmac256_signed_signature));
-  EXIT_IF_TRUE(result != 0, 0, "Failed encrypting SAS signature.");
-
-  // Step 2.d.
-  result = data_manipulation_functions.base64_encode(
-      az_span_ptr(sas_hmac256_signed_signature),
-      az_span_size(sas_hmac256_signed_signature),
-      az_span_ptr(sas_signature),
-      az_span_size(sas_signature),
-      &length);
-  EXIT_IF_TRUE(result != 0, 0, "Failed encoding SAS signature.");
-
-  sas_signature = az_span_slice(sas_signature, 0, length);
+      "Failed decoding SAS key.");
 
   // Step 3.
-  rc = az_iot_provisioning_client_sas_get_password(
+  rc = az_iot_provisioning_client_sas_get_signed_password(
       provisioning_client,
-      sas_signature,
       *expiration_time,
+      sign_sas_signature,
+      &signing_key,
       AZ_SPAN_EMPTY,
       (char*)az_span_ptr(sas_token),
       az_span_size(sas_token),
       &mqtt_password_length);
+  (void)memset(signing_key.decoded_key, 0, sizeof(signing_key.decoded_key));
   EXIT_IF_AZ_FAILED(rc, 0, "Could not get the password.");
 
   return mqtt_password_length;
@@ -1293,19 +2848,15 @@ static int generate_sas_token_for_dps(
  * @remarks         The SAS token generation depends on the following steps:
  *                  1. Calculate the expiration time, as current unix time since epoch plus the
  * token duration, in minutes.
- *                  2. Generate the SAS signature;
- *                    a. Generate the DPS-specific secret string (a.k.a., "signature");
- *                    b. base64-decode the encryption key (device key);
- *                    c. Encrypt (HMAC-SHA256) the signature using the base64-decoded encryption
- * key; d. base64-encode the encrypted signature, which gives the final SAS signature (sig);
- *                  3. Compose the final SAS token with the DPS audience (sr), SAS signature (sig)
- * and expiration time (se).
+ *                  2. base64-decode the encryption key (device key);
+ *                  3. Compose the final SAS token with the IoT Hub audience (sr), SAS signature
+ * (sig) and expiration time (se). The IoT Hub-specific secret string (a.k.a., "signature") is
+ * generated in `sas_token` itself, encrypted (HMAC-SHA256) using the base64-decoded encryption
+ * key, and replaced by its base64-encoded value.
  * @param[in]       iot_hub_client              A pointer to an initialized instance of
  * az_iot_hub_client.
  * @param[in]       device_key                  az_span containing the device key.
  * @param[in]       duration_in_minutes         Duration of the SAS token, in minutes.
- * @param[in]       data_buffer_span            az_span with a buffer containing enough space for
- * all the intermediate data generated by this function.
  * @param[in]       data_manipulation_functions Set of user-defined functions needed for the
  * generation of the SAS token.
  * @param[out]      sas_token                   az_span with buffer where to write the resulting SAS
@@ -1319,16 +2870,14 @@ static int generate_sas_token_for_iot_hub(
     az_iot_hub_client* iot_hub_client,
     az_span device_key,
     unsigned int duration_in_minutes,
-    az_span data_buffer_span,
     data_manipulation_functions_t data_manipulation_functions,
     az_span sas_token,
     uint32_t* expiration_time)
 {
-  int result;
   az_result rc;
   uint32_t current_unix_time;
-  size_t mqtt_password_length, decoded_sas_key_length, length;
-  az_span plain_sas_signature, sas_signature, decoded_sas_key, sas_hmac256_signed_signature;
+  size_t mqtt_password_length;
+  sas_signing_key_t signing_key;
 
   // Step 1.
   current_unix_time = get_current_unix_time();
@@ -1336,76 +2885,23 @@ static int generate_sas_token_for_iot_hub(
 
   *expiration_time = current_unix_time + duration_in_minutes * NUMBER_OF_SECONDS_IN_A_MINUTE;
 
-  // Step 2.a.
-  plain_sas_signature
-      = split_az_span(data_buffer_span, PLAIN_SAS_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(plain_sas_signature, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for plain sas token.");
-
-  rc = az_iot_hub_client_sas_get_signature(
-      iot_hub_client, *expiration_time, plain_sas_signature, &plain_sas_signature);
-  EXIT_IF_AZ_FAILED(rc, 0, "Could not get the signature for SAS key.");
-
-  // Step 2.b.
-  sas_signature = split_az_span(data_buffer_span, SAS_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(sas_signature, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for sas_signature.");
-
-  decoded_sas_key = split_az_span(data_buffer_span, DECODED_SAS_KEY_BUFFER_SIZE, &data_buffer_span);
-  EXIT_IF_TRUE(
-      az_span_is_content_equal(decoded_sas_key, AZ_SPAN_EMPTY),
-      0,
-      "Failed reserving buffer for decoded_sas_key.");
-
-  result = data_manipulation_functions.base64_decode(
-      az_span_ptr(device_key),
-      az_span_size(device_key),
-      az_span_ptr(decoded_sas_key),
-      az_span_size(decoded_sas_key),
-      &decoded_sas_key_length);
-  EXIT_IF_TRUE(result != 0, 0, "Failed decoding SAS key.");
-
-  // Step 2.c.
-  sas_hmac256_signed_signature = split_az_span(
-      data_buffer_span, SAS_HMAC256_ENCRYPTED_SIGNATURE_BUFFER_SIZE, &data_buffer_span);
+  // Step 2.
   EXIT_IF_TRUE(
-      az_span_is_content_equal(sas_hmac256_signed_signature, AZ_SPAN_EMPTY),
+      decode_sas_signing_key(device_key, data_manipulation_functions, &signing_key) != RESULT_OK,
       0,
-      "Failed reserving buffer for sas_hmac256_signed_signature.");
-
-  result = data_manipulation_functions.hmac_sha256_encrypt(
-      az_span_ptr(decoded_sas_key),
-      decoded_sas_key_length,
-      az_span_ptr(plain_sas_signature),
-      az_span_size(plain_sas_signature),
-      az_span_ptr(sas_hmac256_signed_signature),
-      az_span_size(sas_hmac256_signed_signature));
-  EXIT_IF_TRUE(result != 0, 0, "Failed encrypting SAS signature.");
-
-  // Step 2.d.
-  result = data_manipulation_functions.base64_encode(
-      az_span_ptr(sas_hmac256_signed_signature),
-      az_span_size(sas_hmac256_signed_signature),
-      az_span_ptr(sas_signature),
-      az_span_size(sas_signature),
-      &length);
-  EXIT_IF_TRUE(result != 0, 0, "Failed encoding SAS signature.");
-
-  sas_signature = az_span_slice(sas_signature, 0, length);
+      "Failed decoding SAS key.");
 
   // Step 3.
-  rc = az_iot_hub_client_sas_get_password(
+  rc = az_iot_hub_client_sas_get_signed_password(
       iot_hub_client,
       *expiration_time,
-      sas_signature,
+      sign_sas_signature,
+      &signing_key,
       AZ_SPAN_EMPTY,
       (char*)az_span_ptr(sas_token),
       az_span_size(sas_token),
       &mqtt_password_length);
+  (void)memset(signing_key.decoded_key, 0, sizeof(signing_key.decoded_key));
   EXIT_IF_AZ_FAILED(rc, 0, "Could not get the password.");
 
   return mqtt_password_length;
@@ -148,6 +148,13 @@ int azure_pnp_send_telemetry(azure_iot_t* azure_iot)
   {
     size_t payload_size;
 
+    if (azure_iot_get_telemetry_window_space(azure_iot, azure_iot_telemetry_priority_routine)
+        == 0)
+    {
+      // Previous messages are still awaiting acknowledgement; try again on the next call.
+      return RESULT_OK;
+    }
+
     last_telemetry_send_time = now;
 
     if (generate_telemetry_payload(data_buffer, DATA_BUFFER_SIZE, &payload_size) != RESULT_OK)
@@ -156,7 +163,13 @@ int azure_pnp_send_telemetry(azure_iot_t* azure_iot)
       return RESULT_ERROR;
     }
 
-    if (azure_iot_send_telemetry(azure_iot, az_span_create(data_buffer, payload_size)) != 0)
+    if (azure_iot_send_telemetry_at_least_once(
+            azure_iot,
+            az_span_create(data_buffer, payload_size),
+            azure_iot_telemetry_priority_routine,
+            NULL,
+            NULL)
+        != 0)
     {
       LogError("Failed sending telemetry.");
       return RESULT_ERROR;
@@ -166,7 +179,7 @@ int azure_pnp_send_telemetry(azure_iot_t* azure_iot)
   return RESULT_OK;
 }
 
-int azure_pnp_send_device_info(azure_iot_t* azure_iot, uint32_t request_id)
+int azure_pnp_send_device_info(azure_iot_t* azure_iot)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
 
@@ -177,8 +190,7 @@ int azure_pnp_send_device_info(azure_iot_t* azure_iot, uint32_t request_id)
       &azure_iot->iot_hub_client, data_buffer, DATA_BUFFER_SIZE, &length);
   EXIT_IF_TRUE(result != RESULT_OK, RESULT_ERROR, "Failed generating telemetry payload.");
 
-  result = azure_iot_send_properties_update(
-      azure_iot, request_id, az_span_create(data_buffer, length));
+  result = azure_iot_send_properties_update(azure_iot, az_span_create(data_buffer, length), NULL);
   EXIT_IF_TRUE(result != RESULT_OK, RESULT_ERROR, "Failed sending reported properties update.");
 
   return RESULT_OK;
@@ -223,10 +235,7 @@ int azure_pnp_handle_command_request(azure_iot_t* azure_iot, command_request_t c
       azure_iot, command.request_id, response_code, AZ_SPAN_EMPTY);
 }
 
-int azure_pnp_handle_properties_update(
-    azure_iot_t* azure_iot,
-    az_span properties,
-    uint32_t request_id)
+int azure_pnp_handle_properties_update(azure_iot_t* azure_iot, az_span properties)
 {
   _az_PRECONDITION_NOT_NULL(azure_iot);
   _az_PRECONDITION_VALID_SPAN(properties, 1, false);
@@ -239,8 +248,7 @@ int azure_pnp_handle_properties_update(
   EXIT_IF_TRUE(
       result != RESULT_OK, RESULT_ERROR, "Failed consuming/generating properties ack payload.");
 
-  result = azure_iot_send_properties_update(
-      azure_iot, request_id, az_span_create(data_buffer, length));
+  result = azure_iot_send_properties_update(azure_iot, az_span_create(data_buffer, length), NULL);
   EXIT_IF_TRUE(result != RESULT_OK, RESULT_ERROR, "Failed sending reported properties update.");
 
   return RESULT_OK;
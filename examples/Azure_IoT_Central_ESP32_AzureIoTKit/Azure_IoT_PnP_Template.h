@@ -34,12 +34,9 @@ const az_span azure_pnp_get_model_id();
  *
  * @param[in]    azure_iot     A pointer the azure_iot_t instance with the state of the Azure IoT
  * client.
- * @param[in]    request_id    An unique identification number to correlate the response with when
- *                             `on_properties_update_completed` (set in azure_iot_config_t) is
- * invoked.
  * @return       int           0 if the function succeeds, non-zero if any error occurs.
  */
-int azure_pnp_send_device_info(azure_iot_t* azure_iot, uint32_t request_id);
+int azure_pnp_send_device_info(azure_iot_t* azure_iot);
 
 /*
  * @brief     Sets with which minimum frequency this module should send telemetry to Azure IoT
@@ -96,16 +93,12 @@ int azure_pnp_handle_command_request(azure_iot_t* azure_iot, command_request_t c
  * @param[in]    azure_iot     A pointer to a azure_iot_t instance, previously initialized
  *                             with `azure_iot_init`.
  * @param[in]    properties    Raw properties writable-properties payload received from Azure.
- * @param[in]    request_id    The request ID of the response that is sent to the Azure IoT Central.
  *                             In Azure IoT Plug and Play, a response to a writable-property update
- * is itself a reported-property (device-side property) update, so it gets a a response from Azure
- * with the same request ID provided here as argument.
+ * is itself a reported-property (device-side property) update, so it gets a response from Azure
+ * too, passed to `on_properties_update_completed` (set in azure_iot_config_t).
  *
  * return        int           0 on success, non-zero if any failure occurs.
  */
-int azure_pnp_handle_properties_update(
-    azure_iot_t* azure_iot,
-    az_span properties,
-    uint32_t request_id);
+int azure_pnp_handle_properties_update(azure_iot_t* azure_iot, az_span properties);
 
 #endif // AZURE_IOT_PNP_TEMPLATE_H
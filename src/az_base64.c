@@ -21,45 +21,133 @@ typedef enum
 static char const _az_base64_encode_array[65]
     = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-static AZ_NODISCARD int32_t _az_base64_encode(uint8_t* three_bytes)
+// Marks characters outside of the alphabet in the decode tables below.
+#define _az_BASE64_INVALID_CHAR 0x80
+
+// Maps every character to its 6-bit value, or to 0xFF if it is not part of the alphabet.
+static uint8_t const _az_base64_decode_table[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+  0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Same as _az_base64_decode_table, with '-' and '_' in place of '+' and '/'.
+static uint8_t const _az_base64_url_decode_table[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+  0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+  0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Encodes each group of three bytes into four characters. Returns the end of the text written.
+static uint8_t* _az_base64_encode_blocks(
+    uint8_t* destination_ptr,
+    uint8_t const* source_ptr,
+    int32_t block_count)
 {
-  int32_t i = (*three_bytes << 16) | (*(three_bytes + 1) << 8) | *(three_bytes + 2);
+  uint8_t const* source_end = source_ptr + (block_count * 3);
 
-  int32_t i0 = _az_base64_encode_array[i >> 18];
-  int32_t i1 = _az_base64_encode_array[(i >> 12) & 0x3F];
-  int32_t i2 = _az_base64_encode_array[(i >> 6) & 0x3F];
-  int32_t i3 = _az_base64_encode_array[i & 0x3F];
+  while (source_ptr < source_end)
+  {
+    uint8_t const b0 = source_ptr[0];
+    uint8_t const b1 = source_ptr[1];
+    uint8_t const b2 = source_ptr[2];
 
-  return i0 | (i1 << 8) | (i2 << 16) | (i3 << 24);
-}
+    destination_ptr[0] = (uint8_t)_az_base64_encode_array[b0 >> 2];
+    destination_ptr[1] = (uint8_t)_az_base64_encode_array[((b0 & 0x03) << 4) | (b1 >> 4)];
+    destination_ptr[2] = (uint8_t)_az_base64_encode_array[((b1 & 0x0F) << 2) | (b2 >> 6)];
+    destination_ptr[3] = (uint8_t)_az_base64_encode_array[b2 & 0x3F];
 
-static AZ_NODISCARD int32_t _az_base64_encode_and_pad_one(uint8_t* two_bytes)
-{
-  int32_t i = (*two_bytes << 16) | (*(two_bytes + 1) << 8);
+    destination_ptr += 4;
+    source_ptr += 3;
+  }
 
-  int32_t i0 = _az_base64_encode_array[i >> 18];
-  int32_t i1 = _az_base64_encode_array[(i >> 12) & 0x3F];
-  int32_t i2 = _az_base64_encode_array[(i >> 6) & 0x3F];
+  return destination_ptr;
+}
 
-  return i0 | (i1 << 8) | (i2 << 16) | (_az_ENCODING_PAD << 24);
+// Encodes the last one or two bytes with padding. Returns the end of the text written.
+static uint8_t* _az_base64_encode_and_pad(
+    uint8_t* destination_ptr,
+    uint8_t const* source_ptr,
+    int32_t source_length)
+{
+  switch (source_length)
+  {
+    case 1:
+      destination_ptr[0] = (uint8_t)_az_base64_encode_array[source_ptr[0] >> 2];
+      destination_ptr[1] = (uint8_t)_az_base64_encode_array[(source_ptr[0] & 0x03) << 4];
+      destination_ptr[2] = _az_ENCODING_PAD;
+      destination_ptr[3] = _az_ENCODING_PAD;
+      return destination_ptr + 4;
+    case 2:
+      destination_ptr[0] = (uint8_t)_az_base64_encode_array[source_ptr[0] >> 2];
+      destination_ptr[1] = (uint8_t)
+          _az_base64_encode_array[((source_ptr[0] & 0x03) << 4) | (source_ptr[1] >> 4)];
+      destination_ptr[2] = (uint8_t)_az_base64_encode_array[(source_ptr[1] & 0x0F) << 2];
+      destination_ptr[3] = _az_ENCODING_PAD;
+      return destination_ptr + 4;
+    default:
+      return destination_ptr;
+  }
 }
 
-static AZ_NODISCARD int32_t _az_base64_encode_and_pad_two(uint8_t* one_byte)
+// Decodes each group of four characters into three bytes.
+// Invalid characters have the high bit set in the decode table. Rather than branching on every
+// character, that bit is accumulated and returned so the caller checks it once.
+// The destination never gets ahead of the source, since every block of 4 characters is read before
+// its 3 bytes are written.
+static uint8_t _az_base64_decode_blocks(
+    uint8_t* destination_ptr,
+    uint8_t const* source_ptr,
+    int32_t block_count,
+    uint8_t const* decode_table)
 {
-  int32_t i = (*one_byte << 8);
+  uint8_t const* source_end = source_ptr + (block_count * 4);
+  uint8_t invalid = 0;
 
-  int32_t i0 = _az_base64_encode_array[i >> 10];
-  int32_t i1 = _az_base64_encode_array[(i >> 4) & 0x3F];
+  while (source_ptr < source_end)
+  {
+    uint8_t const c0 = decode_table[source_ptr[0]];
+    uint8_t const c1 = decode_table[source_ptr[1]];
+    uint8_t const c2 = decode_table[source_ptr[2]];
+    uint8_t const c3 = decode_table[source_ptr[3]];
 
-  return i0 | (i1 << 8) | (_az_ENCODING_PAD << 16) | (_az_ENCODING_PAD << 24);
-}
+    invalid |= c0 | c1 | c2 | c3;
 
-static void _az_base64_write_int_as_four_bytes(uint8_t* destination, int32_t value)
-{
-  *(destination + 3) = (uint8_t)((value >> 24) & 0xFF);
-  *(destination + 2) = (uint8_t)((value >> 16) & 0xFF);
-  *(destination + 1) = (uint8_t)((value >> 8) & 0xFF);
-  *(destination + 0) = (uint8_t)(value & 0xFF);
+    destination_ptr[0] = (uint8_t)((c0 << 2) | (c1 >> 4));
+    destination_ptr[1] = (uint8_t)((c1 << 4) | (c2 >> 2));
+    destination_ptr[2] = (uint8_t)((c2 << 6) | c3);
+
+    destination_ptr += 3;
+    source_ptr += 4;
+  }
+
+  return invalid;
 }
 
 AZ_NODISCARD az_result
@@ -80,31 +168,10 @@ az_base64_encode(az_span destination_base64_text, az_span source_bytes, int32_t*
     return AZ_ERROR_NOT_ENOUGH_SPACE;
   }
 
-  int32_t source_index = 0;
-  int32_t result = 0;
-
-  while (source_index < source_length - 2)
-  {
-    result = _az_base64_encode(source_ptr + source_index);
-    _az_base64_write_int_as_four_bytes(destination_ptr, result);
-    destination_ptr += 4;
-    source_index += 3;
-  }
-
-  if (source_index == source_length - 1)
-  {
-    result = _az_base64_encode_and_pad_two(source_ptr + source_index);
-    _az_base64_write_int_as_four_bytes(destination_ptr, result);
-    destination_ptr += 4;
-    source_index += 1;
-  }
-  else if (source_index == source_length - 2)
-  {
-    result = _az_base64_encode_and_pad_one(source_ptr + source_index);
-    _az_base64_write_int_as_four_bytes(destination_ptr, result);
-    destination_ptr += 4;
-    source_index += 2;
-  }
+  int32_t const block_count = source_length / 3;
+  destination_ptr = _az_base64_encode_blocks(destination_ptr, source_ptr, block_count);
+  destination_ptr = _az_base64_encode_and_pad(
+      destination_ptr, source_ptr + (block_count * 3), source_length - (block_count * 3));
 
   *out_written = (int32_t)(destination_ptr - az_span_ptr(destination_base64_text));
   return AZ_OK;
@@ -116,89 +183,6 @@ AZ_NODISCARD int32_t az_base64_get_max_encoded_size(int32_t source_bytes_size)
   return (((source_bytes_size + 2) / 3) * 4);
 }
 
-static int32_t _get_base64_decoded_char(int32_t c, _az_base64_mode mode)
-{
-  if (mode == _az_base64_mode_url)
-  {
-    if (c == '+' || c == '/')
-    {
-      return -1; // can't use + or / with URL encoding
-    }
-
-    if (c == '-')
-    {
-      c = '+'; // - becomes a +
-    }
-    else if (c == '_')
-    {
-      c = '/'; // _ becomes a /
-    }
-  }
-
-  if (c >= 'A' && c <= 'Z')
-  {
-    return (c - 'A');
-  }
-
-  if (c >= 'a' && c <= 'z')
-  {
-    return 26 + (c - 'a');
-  }
-
-  if (c >= '0' && c <= '9')
-  {
-    return 52 + (c - '0');
-  }
-
-  if (c == '+')
-  {
-    return 62;
-  }
-
-  if (c == '/')
-  {
-    return 63;
-  }
-
-  return -1;
-}
-
-static AZ_NODISCARD int32_t
-_az_base64_decode_four_bytes(uint8_t* encoded_bytes, _az_base64_mode mode)
-{
-  int32_t i0 = *encoded_bytes;
-  int32_t i1 = *(encoded_bytes + 1);
-  int32_t i2 = *(encoded_bytes + 2);
-  int32_t i3 = *(encoded_bytes + 3);
-
-  i0 = _get_base64_decoded_char(i0, mode);
-  i1 = _get_base64_decoded_char(i1, mode);
-  i2 = _get_base64_decoded_char(i2, mode);
-  i3 = _get_base64_decoded_char(i3, mode);
-
-  if (i0 == -1 || i1 == -1 || i2 == -1 || i3 == -1)
-  {
-    return -1;
-  }
-
-  i0 <<= 18;
-  i1 <<= 12;
-  i2 <<= 6;
-
-  i0 |= i3;
-  i1 |= i2;
-
-  i0 |= i1;
-  return i0;
-}
-
-static void _az_base64_write_three_low_order_bytes(uint8_t* destination, int32_t value)
-{
-  *destination = (uint8_t)(value >> 16);
-  *(destination + 1) = (uint8_t)(value >> 8);
-  *(destination + 2) = (uint8_t)(value);
-}
-
 static az_result _az_base64_decode(
     az_span destination_bytes,
     az_span source_base64_url_text,
@@ -206,62 +190,50 @@ static az_result _az_base64_decode(
     _az_base64_mode mode)
 {
   int32_t source_length = az_span_size(source_base64_url_text);
-  uint8_t* source_ptr = az_span_ptr(source_base64_url_text);
+  uint8_t const* source_ptr = az_span_ptr(source_base64_url_text);
 
   int32_t destination_length = az_span_size(destination_bytes);
   uint8_t* destination_ptr = az_span_ptr(destination_bytes);
 
-  if (destination_length < az_base64_get_max_decoded_size(source_length) - 2)
-  {
-    return AZ_ERROR_NOT_ENOUGH_SPACE;
-  }
+  uint8_t const* decode_table
+      = mode == _az_base64_mode_url ? _az_base64_url_decode_table : _az_base64_decode_table;
 
-  int32_t source_index = 0;
-  int32_t destination_index = 0;
+  // All but the last (up to) four characters are decoded in full blocks. The last block might hold
+  // padding, or have it omitted with url encoding.
+  int32_t const block_count = (source_length - 1) / 4;
 
-  while (source_index < source_length - 4)
+  if (destination_length < az_base64_get_max_decoded_size(source_length) - 2
+      || destination_length < block_count * 3)
   {
-    int32_t result = _az_base64_decode_four_bytes(source_ptr + source_index, mode);
-    if (result < 0)
-    {
-      return AZ_ERROR_UNEXPECTED_CHAR;
-    }
-    _az_base64_write_three_low_order_bytes(destination_ptr, result);
-    destination_ptr += 3;
-    destination_index += 3;
-    source_index += 4;
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
   }
 
+  uint8_t invalid
+      = _az_base64_decode_blocks(destination_ptr, source_ptr, block_count, decode_table);
+  destination_ptr += block_count * 3;
+  source_ptr += block_count * 4;
+
   // If using standard base64 decoding, there is a precondition guaranteeing size is divisible by 4.
   // Otherwise with url encoding, we can assume padding characters.
   // If length is divisible by four, do nothing. Else, we assume up to two padding characters.
-  int32_t source_length_mod_four = source_length % 4;
-  int32_t i0 = *(source_ptr + source_index);
-  int32_t i1 = *(source_ptr + source_index + 1);
-  int32_t i2 = source_length_mod_four == 2 ? _az_ENCODING_PAD : *(source_ptr + source_index + 2);
-  int32_t i3 = source_length_mod_four == 2 || source_length_mod_four == 3
-      ? _az_ENCODING_PAD
-      : *(source_ptr + source_index + 3);
+  int32_t const source_length_mod_four = source_length % 4;
+  int32_t const destination_index = block_count * 3;
 
-  i0 = _get_base64_decoded_char(i0, mode);
-  i1 = _get_base64_decoded_char(i1, mode);
-
-  i0 <<= 18;
-  i1 <<= 12;
+  uint8_t const c0 = decode_table[source_ptr[0]];
+  uint8_t const c1 = decode_table[source_ptr[1]];
+  uint8_t const i2 = source_length_mod_four == 2 ? _az_ENCODING_PAD : source_ptr[2];
+  uint8_t const i3 = source_length_mod_four == 2 || source_length_mod_four == 3
+      ? _az_ENCODING_PAD
+      : source_ptr[3];
 
-  i0 |= i1;
+  invalid |= c0 | c1;
 
   if (i3 != _az_ENCODING_PAD)
   {
-    i2 = _get_base64_decoded_char(i2, mode);
-    i3 = _get_base64_decoded_char(i3, mode);
-
-    i2 <<= 6;
+    uint8_t const c2 = decode_table[i2];
+    uint8_t const c3 = decode_table[i3];
 
-    i0 |= i3;
-    i0 |= i2;
-
-    if (i0 < 0)
+    if ((invalid | c2 | c3) & _az_BASE64_INVALID_CHAR)
     {
       return AZ_ERROR_UNEXPECTED_CHAR;
     }
@@ -269,18 +241,16 @@ static az_result _az_base64_decode(
     {
       return AZ_ERROR_NOT_ENOUGH_SPACE;
     }
-    _az_base64_write_three_low_order_bytes(destination_ptr, i0);
+    destination_ptr[0] = (uint8_t)((c0 << 2) | (c1 >> 4));
+    destination_ptr[1] = (uint8_t)((c1 << 4) | (c2 >> 2));
+    destination_ptr[2] = (uint8_t)((c2 << 6) | c3);
     destination_ptr += 3;
   }
   else if (i2 != _az_ENCODING_PAD)
   {
-    i2 = _get_base64_decoded_char(i2, mode);
-
-    i2 <<= 6;
+    uint8_t const c2 = decode_table[i2];
 
-    i0 |= i2;
-
-    if (i0 < 0)
+    if ((invalid | c2) & _az_BASE64_INVALID_CHAR)
     {
       return AZ_ERROR_UNEXPECTED_CHAR;
     }
@@ -288,13 +258,13 @@ static az_result _az_base64_decode(
     {
       return AZ_ERROR_NOT_ENOUGH_SPACE;
     }
-    *(destination_ptr + 1) = (uint8_t)(i0 >> 8);
-    *destination_ptr = (uint8_t)(i0 >> 16);
+    destination_ptr[0] = (uint8_t)((c0 << 2) | (c1 >> 4));
+    destination_ptr[1] = (uint8_t)((c1 << 4) | (c2 >> 2));
     destination_ptr += 2;
   }
   else
   {
-    if (i0 < 0)
+    if (invalid & _az_BASE64_INVALID_CHAR)
     {
       return AZ_ERROR_UNEXPECTED_CHAR;
     }
@@ -302,7 +272,7 @@ static az_result _az_base64_decode(
     {
       return AZ_ERROR_NOT_ENOUGH_SPACE;
     }
-    *destination_ptr = (uint8_t)(i0 >> 16);
+    destination_ptr[0] = (uint8_t)((c0 << 2) | (c1 >> 4));
     destination_ptr += 1;
   }
 
@@ -362,3 +332,317 @@ AZ_NODISCARD int32_t az_base64_url_get_max_decoded_size(int32_t source_base64_ur
   _az_PRECONDITION(source_base64_url_text_size >= 0);
   return (source_base64_url_text_size / 4) * 3;
 }
+
+AZ_NODISCARD az_result az_base64_decode_in_place(az_span base64_text, int32_t* out_written)
+{
+  _az_PRECONDITION_VALID_SPAN(base64_text, 4, false);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  int32_t source_length = az_span_size(base64_text);
+
+  if (source_length == 0 || source_length % 4 != 0)
+  {
+    return AZ_ERROR_UNEXPECTED_END;
+  }
+
+  // Every block is read before its shorter decoded form is written, so the destination can alias
+  // the source.
+  return _az_base64_decode(base64_text, base64_text, out_written, _az_base64_mode_standard);
+}
+
+AZ_NODISCARD az_result az_base64_url_decode_in_place(az_span base64_url_text, int32_t* out_written)
+{
+  _az_PRECONDITION_VALID_SPAN(base64_url_text, 2, false);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  int32_t source_length = az_span_size(base64_url_text);
+
+  if (source_length == 0 || source_length % 4 == 1)
+  {
+    return AZ_ERROR_UNEXPECTED_END;
+  }
+
+  return _az_base64_decode(base64_url_text, base64_url_text, out_written, _az_base64_mode_url);
+}
+
+void az_base64_stream_encoder_init(az_base64_stream_encoder* encoder)
+{
+  _az_PRECONDITION_NOT_NULL(encoder);
+
+  encoder->_internal.carry_length = 0;
+}
+
+AZ_NODISCARD az_result az_base64_stream_encode(
+    az_base64_stream_encoder* ref_encoder,
+    az_span destination_base64_text,
+    az_span source_bytes,
+    int32_t* out_written)
+{
+  _az_PRECONDITION_NOT_NULL(ref_encoder);
+  _az_PRECONDITION_VALID_SPAN(destination_base64_text, 0, true);
+  _az_PRECONDITION_VALID_SPAN(source_bytes, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  int32_t source_length = az_span_size(source_bytes);
+  uint8_t const* source_ptr = az_span_ptr(source_bytes);
+  uint8_t* destination_ptr = az_span_ptr(destination_base64_text);
+  uint8_t* carry = ref_encoder->_internal.carry;
+  int32_t carry_length = ref_encoder->_internal.carry_length;
+
+  _az_PRECONDITION_RANGE(0, source_length, _az_MAX_SAFE_ENCODED_LENGTH - carry_length);
+
+  if (az_span_size(destination_base64_text) < ((carry_length + source_length) / 3) * 4)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  // Complete the group started by the previous chunk first.
+  if (carry_length > 0 && carry_length + source_length >= 3)
+  {
+    uint8_t group[3] = { carry[0], carry[1], 0 };
+    int32_t taken = 3 - carry_length;
+
+    for (int32_t i = 0; i < taken; i++)
+    {
+      group[carry_length + i] = source_ptr[i];
+    }
+
+    destination_ptr = _az_base64_encode_blocks(destination_ptr, group, 1);
+    source_ptr += taken;
+    source_length -= taken;
+    carry_length = 0;
+  }
+
+  int32_t const block_count = source_length / 3;
+  destination_ptr = _az_base64_encode_blocks(destination_ptr, source_ptr, block_count);
+  source_ptr += block_count * 3;
+  source_length -= block_count * 3;
+
+  for (int32_t i = 0; i < source_length; i++)
+  {
+    carry[carry_length++] = source_ptr[i];
+  }
+
+  ref_encoder->_internal.carry_length = carry_length;
+  *out_written = (int32_t)(destination_ptr - az_span_ptr(destination_base64_text));
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_base64_stream_encode_final(
+    az_base64_stream_encoder* ref_encoder,
+    az_span destination_base64_text,
+    int32_t* out_written)
+{
+  _az_PRECONDITION_NOT_NULL(ref_encoder);
+  _az_PRECONDITION_VALID_SPAN(destination_base64_text, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  int32_t const carry_length = ref_encoder->_internal.carry_length;
+
+  if (carry_length > 0 && az_span_size(destination_base64_text) < 4)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  uint8_t* destination_ptr = az_span_ptr(destination_base64_text);
+  *out_written = (int32_t)(
+      _az_base64_encode_and_pad(destination_ptr, ref_encoder->_internal.carry, carry_length)
+      - destination_ptr);
+
+  ref_encoder->_internal.carry_length = 0;
+  return AZ_OK;
+}
+
+static void _az_base64_stream_decoder_init(az_base64_stream_decoder* decoder, bool is_url)
+{
+  _az_PRECONDITION_NOT_NULL(decoder);
+
+  decoder->_internal.carry_length = 0;
+  decoder->_internal.padding_length = 0;
+  decoder->_internal.is_url = is_url;
+  decoder->_internal.is_finished = false;
+}
+
+void az_base64_stream_decoder_init(az_base64_stream_decoder* decoder)
+{
+  _az_base64_stream_decoder_init(decoder, false);
+}
+
+void az_base64_url_stream_decoder_init(az_base64_stream_decoder* decoder)
+{
+  _az_base64_stream_decoder_init(decoder, true);
+}
+
+// Writes the bytes held by a group of 2 to 4 decoded characters. Returns the end of the data
+// written.
+static uint8_t* _az_base64_write_decoded_group(
+    uint8_t* destination_ptr,
+    uint8_t const* group,
+    int32_t group_length)
+{
+  destination_ptr[0] = (uint8_t)((group[0] << 2) | (group[1] >> 4));
+
+  if (group_length > 2)
+  {
+    destination_ptr[1] = (uint8_t)((group[1] << 4) | (group[2] >> 2));
+  }
+
+  if (group_length > 3)
+  {
+    destination_ptr[2] = (uint8_t)((group[2] << 6) | group[3]);
+  }
+
+  return destination_ptr + group_length - 1;
+}
+
+AZ_NODISCARD az_result az_base64_stream_decode(
+    az_base64_stream_decoder* ref_decoder,
+    az_span destination_bytes,
+    az_span source_base64_text,
+    int32_t* out_written)
+{
+  _az_PRECONDITION_NOT_NULL(ref_decoder);
+  _az_PRECONDITION_VALID_SPAN(destination_bytes, 0, true);
+  _az_PRECONDITION_VALID_SPAN(source_base64_text, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  uint8_t const* source_ptr = az_span_ptr(source_base64_text);
+  uint8_t const* source_end = source_ptr + az_span_size(source_base64_text);
+  uint8_t* destination_ptr = az_span_ptr(destination_bytes);
+
+  uint8_t const* decode_table = ref_decoder->_internal.is_url ? _az_base64_url_decode_table
+                                                               : _az_base64_decode_table;
+  uint8_t* carry = ref_decoder->_internal.carry;
+  int32_t carry_length = ref_decoder->_internal.carry_length;
+  int32_t padding_length = ref_decoder->_internal.padding_length;
+
+  int32_t const group_count
+      = (carry_length + padding_length + az_span_size(source_base64_text)) / 4;
+  if (az_span_size(destination_bytes) < group_count * 3)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  uint8_t invalid = 0;
+
+  while (source_ptr < source_end)
+  {
+    if (ref_decoder->_internal.is_finished)
+    {
+      return AZ_ERROR_UNEXPECTED_CHAR;
+    }
+
+    if (carry_length == 0 && padding_length == 0)
+    {
+      // Decode full groups directly from the source. Only the last one can hold valid padding,
+      // which is left to the per-character path below; padding anywhere else is invalid.
+      int32_t block_count = (int32_t)(source_end - source_ptr) / 4;
+
+      if (block_count > 0 && source_ptr[(block_count * 4) - 1] == _az_ENCODING_PAD)
+      {
+        block_count--;
+      }
+
+      invalid |= _az_base64_decode_blocks(destination_ptr, source_ptr, block_count, decode_table);
+      destination_ptr += block_count * 3;
+      source_ptr += block_count * 4;
+
+      if (source_ptr == source_end)
+      {
+        break;
+      }
+    }
+
+    uint8_t const c = *source_ptr++;
+
+    if (c == _az_ENCODING_PAD)
+    {
+      // Padding can only take the place of the third and fourth characters of a group.
+      if (carry_length < 2)
+      {
+        return AZ_ERROR_UNEXPECTED_CHAR;
+      }
+
+      padding_length++;
+    }
+    else
+    {
+      if (padding_length > 0)
+      {
+        return AZ_ERROR_UNEXPECTED_CHAR;
+      }
+
+      carry[carry_length] = decode_table[c];
+      invalid |= carry[carry_length];
+      carry_length++;
+    }
+
+    if (carry_length + padding_length == 4)
+    {
+      if (invalid & _az_BASE64_INVALID_CHAR)
+      {
+        return AZ_ERROR_UNEXPECTED_CHAR;
+      }
+
+      // The group holds 3 bytes, or fewer when it ends with padding, after which the text is over.
+      destination_ptr = _az_base64_write_decoded_group(destination_ptr, carry, carry_length);
+      ref_decoder->_internal.is_finished = padding_length > 0;
+      carry_length = 0;
+      padding_length = 0;
+    }
+  }
+
+  if (invalid & _az_BASE64_INVALID_CHAR)
+  {
+    return AZ_ERROR_UNEXPECTED_CHAR;
+  }
+
+  ref_decoder->_internal.carry_length = carry_length;
+  ref_decoder->_internal.padding_length = padding_length;
+  *out_written = (int32_t)(destination_ptr - az_span_ptr(destination_bytes));
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_base64_stream_decode_final(
+    az_base64_stream_decoder* ref_decoder,
+    az_span destination_bytes,
+    int32_t* out_written)
+{
+  _az_PRECONDITION_NOT_NULL(ref_decoder);
+  _az_PRECONDITION_VALID_SPAN(destination_bytes, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_written);
+
+  int32_t const carry_length = ref_decoder->_internal.carry_length;
+  int32_t written = 0;
+
+  // Padding can be omitted with base 64 url text, but not left incomplete (such as "AB=").
+  if (ref_decoder->_internal.padding_length > 0)
+  {
+    return AZ_ERROR_UNEXPECTED_END;
+  }
+
+  if (carry_length > 0)
+  {
+    // Only base 64 url text can omit padding, and a single character never holds a whole byte.
+    if (!ref_decoder->_internal.is_url || carry_length < 2)
+    {
+      return AZ_ERROR_UNEXPECTED_END;
+    }
+
+    if (az_span_size(destination_bytes) < carry_length - 1)
+    {
+      return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+
+    written = (int32_t)(
+        _az_base64_write_decoded_group(
+            az_span_ptr(destination_bytes), ref_decoder->_internal.carry, carry_length)
+        - az_span_ptr(destination_bytes));
+  }
+
+  ref_decoder->_internal.carry_length = 0;
+  ref_decoder->_internal.padding_length = 0;
+  ref_decoder->_internal.is_finished = true;
+  *out_written = written;
+  return AZ_OK;
+}
@@ -19,6 +19,7 @@
 #include <az_result.h>
 #include <az_span.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <_az_cfg_prefix.h>
@@ -119,6 +120,200 @@ AZ_NODISCARD az_result az_base64_url_decode(
  */
 AZ_NODISCARD int32_t az_base64_url_get_max_decoded_size(int32_t source_base64_url_text_size);
 
+/**
+ * @brief Decodes the span of UTF-8 encoded text represented as base 64 into binary data, in place.
+ *
+ * @details Decoded data is always shorter than the text it comes from, so it is written over the
+ * start of \p base64_text. Use this when the text is not needed after decoding, to avoid a
+ * separate destination buffer.
+ *
+ * @param base64_text The #az_span that contains the base 64 text to be decoded, and receives the
+ * decoded binary data.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written at
+ * the start of \p base64_text.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_UNEXPECTED_CHAR The input \p base64_text contains characters outside of the
+ * expected base 64 range or has invalid padding. The content of \p base64_text is unspecified.
+ * @retval #AZ_ERROR_UNEXPECTED_END The input \p base64_text is incomplete (that is, it is not of a
+ * size which is a multiple of 4).
+ */
+AZ_NODISCARD az_result az_base64_decode_in_place(az_span base64_text, int32_t* out_written);
+
+/**
+ * @brief Decodes the span of UTF-8 encoded text represented as base 64 url into binary data, in
+ * place.
+ *
+ * @details Decoded data is always shorter than the text it comes from, so it is written over the
+ * start of \p base64_url_text.
+ *
+ * @param base64_url_text The #az_span that contains the base 64 url text to be decoded, and
+ * receives the decoded binary data.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written at
+ * the start of \p base64_url_text.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_UNEXPECTED_CHAR The input \p base64_url_text contains characters outside of
+ * the expected base 64 range or has invalid padding. The content of \p base64_url_text is
+ * unspecified.
+ * @retval #AZ_ERROR_UNEXPECTED_END The input \p base64_url_text is incomplete (that is, it is of a
+ * size which is length % 4 == 1 characters).
+ */
+AZ_NODISCARD az_result az_base64_url_decode_in_place(az_span base64_url_text, int32_t* out_written);
+
+/**
+ * @brief Incrementally encodes binary data, given in chunks of any size, into base 64 text.
+ *
+ * @details Bytes that do not complete a group of three are carried over to the next call to
+ * az_base64_stream_encode(), or encoded with padding by az_base64_stream_encode_final().
+ */
+typedef struct
+{
+  struct
+  {
+    uint8_t carry[2];
+    int32_t carry_length;
+  } _internal;
+} az_base64_stream_encoder;
+
+/**
+ * @brief Incrementally decodes base 64 or base 64 url text, given in chunks of any size, into
+ * binary data.
+ *
+ * @details Characters that do not complete a group of four are carried over to the next call to
+ * az_base64_stream_decode(). This allows decoding text split across buffers, such as the segments
+ * of a chunked JSON string or data received from a network stream, without first copying it into a
+ * contiguous buffer.
+ */
+typedef struct
+{
+  struct
+  {
+    uint8_t carry[4];
+    int32_t carry_length;
+    int32_t padding_length;
+    bool is_url;
+    bool is_finished;
+  } _internal;
+} az_base64_stream_decoder;
+
+/**
+ * @brief Initializes an #az_base64_stream_encoder.
+ *
+ * @param[out] encoder The #az_base64_stream_encoder to initialize.
+ */
+void az_base64_stream_encoder_init(az_base64_stream_encoder* encoder);
+
+/**
+ * @brief Encodes a chunk of binary data.
+ *
+ * @details Only complete groups of four characters are written. Up to two trailing bytes are kept
+ * by \p ref_encoder until more data is given, or az_base64_stream_encode_final() is called.
+ *
+ * @param[in,out] ref_encoder The #az_base64_stream_encoder keeping the state of the stream.
+ * @param destination_base64_text The output #az_span where the encoded base 64 text is written.
+ * @param[in] source_bytes The input #az_span with the next chunk of binary data. Can be empty.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written into
+ * \p destination_base64_text.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The \p destination_base64_text is not large enough to contain
+ * the encoded text. Nothing is consumed from \p source_bytes in that case.
+ */
+AZ_NODISCARD az_result az_base64_stream_encode(
+    az_base64_stream_encoder* ref_encoder,
+    az_span destination_base64_text,
+    az_span source_bytes,
+    int32_t* out_written);
+
+/**
+ * @brief Completes the stream, writing the bytes kept by the encoder with padding.
+ *
+ * @param[in,out] ref_encoder The #az_base64_stream_encoder keeping the state of the stream.
+ * @param destination_base64_text The output #az_span where the encoded base 64 text is written. At
+ * most 4 characters are written.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written into
+ * \p destination_base64_text.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The \p destination_base64_text is not large enough to contain
+ * the encoded text.
+ */
+AZ_NODISCARD az_result az_base64_stream_encode_final(
+    az_base64_stream_encoder* ref_encoder,
+    az_span destination_base64_text,
+    int32_t* out_written);
+
+/**
+ * @brief Initializes an #az_base64_stream_decoder for base 64 text.
+ *
+ * @param[out] decoder The #az_base64_stream_decoder to initialize.
+ */
+void az_base64_stream_decoder_init(az_base64_stream_decoder* decoder);
+
+/**
+ * @brief Initializes an #az_base64_stream_decoder for base 64 url text.
+ *
+ * @details As with az_base64_url_decode(), padding characters are optional.
+ *
+ * @param[out] decoder The #az_base64_stream_decoder to initialize.
+ */
+void az_base64_url_stream_decoder_init(az_base64_stream_decoder* decoder);
+
+/**
+ * @brief Decodes a chunk of base 64 or base 64 url text.
+ *
+ * @details Only complete groups of four characters are decoded. Up to three trailing characters
+ * are kept by \p ref_decoder until more text is given, or az_base64_stream_decode_final() is
+ * called.
+ *
+ * @param[in,out] ref_decoder The #az_base64_stream_decoder keeping the state of the stream.
+ * @param destination_bytes The output #az_span where the decoded binary data is written.
+ * @param[in] source_base64_text The input #az_span with the next chunk of text. Can be empty.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written into
+ * \p destination_bytes.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The \p destination_bytes is not large enough to contain
+ * the decoded data. Nothing is consumed from \p source_base64_text in that case.
+ * @retval #AZ_ERROR_UNEXPECTED_CHAR The text contains characters outside of the expected base 64
+ * range, invalid padding, or text after the padding. The stream cannot be continued.
+ */
+AZ_NODISCARD az_result az_base64_stream_decode(
+    az_base64_stream_decoder* ref_decoder,
+    az_span destination_bytes,
+    az_span source_base64_text,
+    int32_t* out_written);
+
+/**
+ * @brief Completes the stream, checking that the text decoded was complete.
+ *
+ * @details With base 64 url text, the characters kept by the decoder are decoded as if the
+ * padding was present.
+ *
+ * @param[in,out] ref_decoder The #az_base64_stream_decoder keeping the state of the stream.
+ * @param destination_bytes The output #az_span where the decoded binary data is written. At most 2
+ * bytes are written.
+ * @param[out] out_written A pointer to an `int32_t` that receives the number of bytes written into
+ * \p destination_bytes.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK Success.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The \p destination_bytes is not large enough to contain
+ * the decoded data.
+ * @retval #AZ_ERROR_UNEXPECTED_END The text decoded is incomplete, or ends with incomplete
+ * padding.
+ */
+AZ_NODISCARD az_result az_base64_stream_decode_final(
+    az_base64_stream_decoder* ref_decoder,
+    az_span destination_bytes,
+    int32_t* out_written);
+
 #include <_az_cfg_suffix.h>
 
 #endif // _az_BASE64_H
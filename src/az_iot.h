@@ -19,6 +19,12 @@
 #include <az_iot_common.h>
 #include <az_iot_hub_client.h>
 #include <az_iot_hub_client_properties.h>
+#include <az_iot_hub_client_properties_shadow.h>
+#include <az_iot_hub_client_received_topic.h>
+#include <az_iot_hub_client_request_tracker.h>
+#include <az_iot_hub_client_telemetry_batch.h>
+#include <az_iot_message_compression.h>
+#include <az_iot_message_store.h>
 #include <az_iot_provisioning_client.h>
 
 #endif // _az_IOT_CORE_H
@@ -2,7 +2,9 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdint.h>
+#include <string.h>
 
+#include <az_base64.h>
 #include <az_result.h>
 #include <az_span.h>
 #include <az_precondition_internal.h>
@@ -11,6 +13,7 @@
 #include <az_iot_common.h>
 #include <az_iot_common_internal.h>
 
+#include <az_hex_private.h>
 #include <az_log_internal.h>
 #include <az_retry_internal.h>
 
@@ -18,6 +21,7 @@
 
 static const az_span hub_client_param_separator_span = AZ_SPAN_LITERAL_FROM_STR("&");
 static const az_span hub_client_param_equals_span = AZ_SPAN_LITERAL_FROM_STR("=");
+static const az_span sig_parameter_string = AZ_SPAN_LITERAL_FROM_STR("&sig=");
 
 AZ_NODISCARD az_result az_iot_message_properties_init(
     az_iot_message_properties* properties,
@@ -31,6 +35,8 @@ AZ_NODISCARD az_result az_iot_message_properties_init(
   properties->_internal.properties_buffer = buffer;
   properties->_internal.properties_written = written_length;
   properties->_internal.current_property_index = 0;
+  properties->_internal.index = NULL;
+  properties->_internal.index_count = 0;
 
   return AZ_OK;
 }
@@ -65,6 +71,166 @@ az_iot_message_properties_append(az_iot_message_properties* properties, az_span
   az_span_copy(remainder, value);
 
   properties->_internal.properties_written += required_length;
+  properties->_internal.index = NULL;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_message_properties_append_all(
+    az_iot_message_properties* properties,
+    az_span const* names,
+    az_span const* values,
+    int32_t count)
+{
+  _az_PRECONDITION_NOT_NULL(properties);
+  _az_PRECONDITION_NOT_NULL(names);
+  _az_PRECONDITION_NOT_NULL(values);
+  _az_PRECONDITION(count > 0);
+
+  int32_t prop_length = properties->_internal.properties_written;
+
+  az_span remainder = az_span_slice_to_end(properties->_internal.properties_buffer, prop_length);
+
+  // Each property takes its '=', and all but the first of the properties its '&'.
+  int32_t required_length = prop_length > 0 ? count * 2 : count * 2 - 1;
+
+  for (int32_t i = 0; i < count; i++)
+  {
+    _az_PRECONDITION_VALID_SPAN(names[i], 1, false);
+    _az_PRECONDITION_VALID_SPAN(values[i], 1, false);
+
+    required_length += az_span_size(names[i]) + az_span_size(values[i]);
+  }
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, required_length);
+
+  for (int32_t i = 0; i < count; i++)
+  {
+    if (prop_length > 0 || i > 0)
+    {
+      remainder = az_span_copy_u8(remainder, *az_span_ptr(hub_client_param_separator_span));
+    }
+
+    remainder = az_span_copy(remainder, names[i]);
+    remainder = az_span_copy_u8(remainder, *az_span_ptr(hub_client_param_equals_span));
+    remainder = az_span_copy(remainder, values[i]);
+  }
+
+  properties->_internal.properties_written += required_length;
+  properties->_internal.index = NULL;
+
+  return AZ_OK;
+}
+
+// Orders names by size first, so most comparisons do not need to look at their content.
+static int32_t _az_iot_message_properties_compare_name(
+    az_iot_message_properties const* properties,
+    az_iot_message_properties_index_entry const* entry,
+    az_span name)
+{
+  if (entry->_internal.name_size != az_span_size(name))
+  {
+    return entry->_internal.name_size < az_span_size(name) ? -1 : 1;
+  }
+
+  return (int32_t)memcmp(
+      az_span_ptr(properties->_internal.properties_buffer) + entry->_internal.name_offset,
+      az_span_ptr(name),
+      (size_t)az_span_size(name));
+}
+
+AZ_NODISCARD az_result az_iot_message_properties_build_index(
+    az_iot_message_properties* properties,
+    az_iot_message_properties_index_entry* entries,
+    int32_t capacity)
+{
+  _az_PRECONDITION_NOT_NULL(properties);
+  _az_PRECONDITION_NOT_NULL(entries);
+  _az_PRECONDITION(capacity > 0);
+
+  az_span const buffer = properties->_internal.properties_buffer;
+  az_span remaining = az_span_slice(buffer, 0, properties->_internal.properties_written);
+  int32_t count = 0;
+
+  properties->_internal.index = NULL;
+
+  // Tokenized as az_iot_message_properties_find() does, so both find the same values.
+  while (az_span_size(remaining) != 0)
+  {
+    int32_t index = 0;
+    az_span name = _az_span_token(remaining, hub_client_param_equals_span, &remaining, &index);
+    if (index == -1)
+    {
+      break;
+    }
+
+    az_span value = _az_span_token(remaining, hub_client_param_separator_span, &remaining, &index);
+
+    if (count == capacity)
+    {
+      return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+
+    az_iot_message_properties_index_entry entry;
+    entry._internal.name_offset = (int32_t)(az_span_ptr(name) - az_span_ptr(buffer));
+    entry._internal.name_size = az_span_size(name);
+    entry._internal.value_size = az_span_size(value);
+
+    // Insertion sort, which keeps properties with the same name in order so the first one is
+    // found. Messages carry few properties, mostly appended in no particular order.
+    int32_t position = count;
+    while (position > 0
+           && _az_iot_message_properties_compare_name(properties, &entries[position - 1], name) > 0)
+    {
+      entries[position] = entries[position - 1];
+      position--;
+    }
+
+    entries[position] = entry;
+    count++;
+  }
+
+  properties->_internal.index = entries;
+  properties->_internal.index_count = count;
+
+  return AZ_OK;
+}
+
+static az_result _az_iot_message_properties_find_in_index(
+    az_iot_message_properties const* properties,
+    az_span name,
+    az_span* out_value)
+{
+  az_iot_message_properties_index_entry const* const entries = properties->_internal.index;
+  int32_t low = 0;
+  int32_t high = properties->_internal.index_count;
+
+  // Finds the first entry not ordered before name.
+  while (low < high)
+  {
+    int32_t const middle = low + (high - low) / 2;
+
+    if (_az_iot_message_properties_compare_name(properties, &entries[middle], name) < 0)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  if (low == properties->_internal.index_count
+      || _az_iot_message_properties_compare_name(properties, &entries[low], name) != 0)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  int32_t const value_offset = entries[low]._internal.name_offset + az_span_size(name) + 1;
+  *out_value = az_span_slice(
+      properties->_internal.properties_buffer,
+      value_offset,
+      value_offset + entries[low]._internal.value_size);
 
   return AZ_OK;
 }
@@ -78,6 +244,11 @@ AZ_NODISCARD az_result az_iot_message_properties_find(
   _az_PRECONDITION_VALID_SPAN(name, 1, false);
   _az_PRECONDITION_NOT_NULL(out_value);
 
+  if (properties->_internal.index != NULL)
+  {
+    return _az_iot_message_properties_find_in_index(properties, name, out_value);
+  }
+
   az_span remaining = az_span_slice(
       properties->_internal.properties_buffer, 0, properties->_internal.properties_written);
 
@@ -217,3 +388,52 @@ _az_span_copy_url_encode(az_span destination, az_span source, az_span* out_remai
   *out_remainder = az_span_slice(destination, length, az_span_size(destination));
   return AZ_OK;
 }
+
+AZ_NODISCARD az_result _az_iot_sas_copy_signed_signature(
+    az_span destination,
+    az_span signature,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span* out_remainder)
+{
+  uint8_t signed_signature_buffer[AZ_IOT_SAS_HMAC_SHA256_SIZE];
+  az_span signed_signature = AZ_SPAN_FROM_BUFFER(signed_signature_buffer);
+  int32_t const base64_size = az_base64_get_max_encoded_size(AZ_IOT_SAS_HMAC_SHA256_SIZE);
+  int32_t length = 0;
+
+  // The signature can precede destination in the same buffer, so it is signed first.
+  _az_RETURN_IF_FAILED(hmac_sha256(hmac_sha256_context, signature, signed_signature));
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, az_span_size(sig_parameter_string) + base64_size);
+  destination = az_span_copy(destination, sig_parameter_string);
+  _az_RETURN_IF_FAILED(az_base64_encode(destination, signed_signature, &length));
+  (void)memset(signed_signature_buffer, 0, sizeof(signed_signature_buffer));
+
+  // Url-encodes the base64 text in place, from its end, so each byte is read before the expansion
+  // of the bytes preceding it can overwrite it.
+  az_span const base64_signature = az_span_slice(destination, 0, length);
+  int32_t const encoded_length = _az_span_url_encode_calc_length(base64_signature);
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, encoded_length);
+
+  uint8_t* const ptr = az_span_ptr(destination);
+  int32_t write_index = encoded_length;
+
+  for (int32_t read_index = length - 1; read_index >= 0; read_index--)
+  {
+    uint8_t const c = ptr[read_index];
+
+    if (c == '+' || c == '/' || c == '=')
+    {
+      ptr[--write_index] = _az_number_to_upper_hex(c & 0x0F);
+      ptr[--write_index] = _az_number_to_upper_hex((uint8_t)(c >> 4));
+      ptr[--write_index] = '%';
+    }
+    else
+    {
+      ptr[--write_index] = c;
+    }
+  }
+
+  *out_remainder = az_span_slice_to_end(destination, encoded_length);
+  return AZ_OK;
+}
@@ -148,6 +148,22 @@ typedef enum
 /// #AZ_SPAN_FROM_STR macro as a parameter, where needed.
 #define AZ_IOT_MESSAGE_COMPONENT_NAME "%24.sub"
 
+/**
+ * @brief An entry of the index built by az_iot_message_properties_build_index().
+ *
+ * @remarks Storage for these is provided by the application. The fields are managed by the
+ * properties.
+ */
+typedef struct
+{
+  struct
+  {
+    int32_t name_offset;
+    int32_t name_size;
+    int32_t value_size;
+  } _internal;
+} az_iot_message_properties_index_entry;
+
 /**
  * @brief Telemetry or C2D properties.
  *
@@ -159,6 +175,9 @@ typedef struct
     az_span properties_buffer;
     int32_t properties_written;
     uint32_t current_property_index;
+    // Sorted by name, or `NULL` if the properties are not indexed.
+    az_iot_message_properties_index_entry* index;
+    int32_t index_count;
   } _internal;
 } az_iot_message_properties;
 
@@ -205,10 +224,64 @@ AZ_NODISCARD az_result az_iot_message_properties_append(
     az_span name,
     az_span value);
 
+/**
+ * @brief Appends several name-value properties to the list of properties.
+ *
+ * @details The space needed by all the properties is checked once, before any is appended, so
+ * either all or none of them are appended.
+ *
+ * @note The properties must adhere to the character restrictions listed in the below link.
+ * https://docs.microsoft.com/azure/iot-hub/iot-hub-devguide-messages-construct
+ *
+ * @param[in] properties The #az_iot_message_properties to use for this call.
+ * @param[in] names The names of the properties. Each must be a valid, non-empty span.
+ * @param[in] values The values of the properties, in the same order as \p names. Each must be a
+ * valid, non-empty span.
+ * @param[in] count The number of elements in \p names and \p values.
+ * @pre \p properties must not be `NULL`.
+ * @pre \p names must not be `NULL`.
+ * @pre \p values must not be `NULL`.
+ * @pre \p count must be greater than 0.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The operation was performed successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE There was not enough space to append the properties.
+ */
+AZ_NODISCARD az_result az_iot_message_properties_append_all(
+    az_iot_message_properties* properties,
+    az_span const* names,
+    az_span const* values,
+    int32_t count);
+
+/**
+ * @brief Indexes the properties by name, so subsequent calls to az_iot_message_properties_find()
+ * do not parse them again.
+ *
+ * @details The properties are parsed once, and the offsets of their names and values are kept,
+ * sorted by name, in \p entries. az_iot_message_properties_find() then looks names up with a
+ * binary search. The index is discarded when a property is appended.
+ *
+ * @param[in] properties The #az_iot_message_properties to use for this call.
+ * @param[in] entries Storage for the index. It must remain valid while \p properties is indexed.
+ * @param[in] capacity The number of elements in \p entries.
+ * @pre \p properties must not be `NULL`.
+ * @pre \p entries must not be `NULL`.
+ * @pre \p capacity must be greater than 0.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The properties were indexed successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE There are more than \p capacity properties. The properties
+ * are not indexed, and az_iot_message_properties_find() keeps parsing them.
+ */
+AZ_NODISCARD az_result az_iot_message_properties_build_index(
+    az_iot_message_properties* properties,
+    az_iot_message_properties_index_entry* entries,
+    int32_t capacity);
+
 /**
  * @brief Finds the value of a property.
  * @remark This will return the first value of the property with the given name if multiple
  * properties with the same name exist.
+ * @remark If the properties were indexed with az_iot_message_properties_build_index(), the
+ * property is found without parsing the properties.
  *
  * @param[in] properties The #az_iot_message_properties to use for this call.
  * @param[in] name The name of the property to search for.
@@ -290,6 +363,26 @@ AZ_NODISCARD int32_t az_iot_calculate_retry_delay(
     int32_t max_retry_delay_msec,
     int32_t random_jitter_msec);
 
+/**
+ * @brief The size, in bytes, of an HMAC-SHA256 signature.
+ */
+#define AZ_IOT_SAS_HMAC_SHA256_SIZE 32
+
+/**
+ * @brief Signs the signature of a SAS token with HMAC-SHA256, using the decoded SAS key.
+ *
+ * @details Implementations typically keep the key, or a precomputed HMAC state for it, in
+ * \p context.
+ *
+ * @param[in] context The context passed along with the function.
+ * @param[in] data The bytes to sign.
+ * @param[out] signed_data The buffer, of #AZ_IOT_SAS_HMAC_SHA256_SIZE bytes, the HMAC-SHA256 of
+ * \p data is written into.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ */
+typedef az_result (*az_iot_sas_hmac_sha256_fn)(void* context, az_span data, az_span signed_data);
+
 #include <_az_cfg_suffix.h>
 
 #endif // _az_IOT_CORE_H
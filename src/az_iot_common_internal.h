@@ -18,6 +18,8 @@
 #include <az_result.h>
 #include <az_span.h>
 
+#include <az_iot_common.h>
+
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -54,6 +56,30 @@ AZ_NODISCARD int32_t _az_iot_u64toa_size(uint64_t number);
 AZ_NODISCARD az_result
 _az_span_copy_url_encode(az_span destination, az_span source, az_span* out_remainder);
 
+/**
+ * @brief Signs `signature` with `hmac_sha256`, then writes the `&sig=` parameter of a SAS token
+ * with the url-encoded base64 of the result into `destination`, returning the free remaining of
+ * `destination`.
+ *
+ * @details `signature` may overlap `destination`, as it is signed before `destination` is written.
+ * The signed bytes are base64-encoded and url-encoded in place, so besides `destination` only
+ * #AZ_IOT_SAS_HMAC_SHA256_SIZE bytes of stack are used.
+ *
+ * @param[in] destination The span where the signed signature is written to.
+ * @param[in] signature The bytes to sign.
+ * @param[in] hmac_sha256 The function signing `signature`.
+ * @param[in] hmac_sha256_context The context passed to `hmac_sha256`.
+ * @param[out] out_remainder A slice of `destination` with the non-used buffer portion of
+ * `destination`.
+ * @return An `az_result` value.
+ */
+AZ_NODISCARD az_result _az_iot_sas_copy_signed_signature(
+    az_span destination,
+    az_span signature,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span* out_remainder);
+
 #include <_az_cfg_suffix.h>
 
 #endif // _az_IOT_CORE_INTERNAL_H
@@ -32,7 +32,8 @@ AZ_NODISCARD az_iot_hub_client_options az_iot_hub_client_options_default()
                                       .user_agent = client_sdk_version_default_value,
                                       .model_id = AZ_SPAN_EMPTY,
                                       .component_names = NULL,
-                                      .component_names_length = 0 };
+                                      .component_names_length = 0,
+                                      .telemetry_topic_cache = AZ_SPAN_EMPTY };
 }
 
 AZ_NODISCARD az_result az_iot_hub_client_init(
@@ -48,6 +49,24 @@ AZ_NODISCARD az_result az_iot_hub_client_init(
   client->_internal.iot_hub_hostname = iot_hub_hostname;
   client->_internal.device_id = device_id;
   client->_internal.options = options == NULL ? az_iot_hub_client_options_default() : *options;
+  client->_internal.telemetry_topic_prefix = AZ_SPAN_EMPTY;
+
+  if (az_span_size(client->_internal.options.telemetry_topic_cache) > 0)
+  {
+    az_span topic_cache = client->_internal.options.telemetry_topic_cache;
+    size_t topic_prefix_length;
+
+    // With no properties, the telemetry topic is exactly its static part.
+    _az_RETURN_IF_FAILED(az_iot_hub_client_telemetry_get_publish_topic(
+        client,
+        NULL,
+        (char*)az_span_ptr(topic_cache),
+        (size_t)az_span_size(topic_cache),
+        &topic_prefix_length));
+
+    client->_internal.telemetry_topic_prefix
+        = az_span_slice(topic_cache, 0, (int32_t)topic_prefix_length);
+  }
 
   return AZ_OK;
 }
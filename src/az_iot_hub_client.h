@@ -69,6 +69,16 @@ typedef struct
    * The number of component names in the `component_names` array.
    */
   int32_t component_names_length;
+
+  /**
+   * Optional buffer in which az_iot_hub_client_init() builds the static part of the telemetry
+   * topic (`devices/{device_id}[/modules/{module_id}]/messages/events/`) once, so
+   * az_iot_hub_client_telemetry_get_publish_topic() only copies it and appends the message
+   * properties. It must hold at least the length of that string plus one byte for a null
+   * terminator, and remain valid for the lifetime of the client. Leave as #AZ_SPAN_EMPTY to build
+   * the whole topic on every call.
+   */
+  az_span telemetry_topic_cache;
 } az_iot_hub_client_options;
 
 /**
@@ -81,6 +91,7 @@ typedef struct
     az_span iot_hub_hostname;
     az_span device_id;
     az_iot_hub_client_options options;
+    az_span telemetry_topic_prefix;
   } _internal;
 } az_iot_hub_client;
 
@@ -110,6 +121,9 @@ AZ_NODISCARD az_iot_hub_client_options az_iot_hub_client_options_default();
  * @pre \p iot_hub_hostname must be a valid span of size greater than 0.
  * @pre \p device_id must be a valid span of size greater than 0.
  * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The client was initialized successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The `telemetry_topic_cache` in \p options is not empty and
+ * too small for the static part of the telemetry topic.
  */
 AZ_NODISCARD az_result az_iot_hub_client_init(
     az_iot_hub_client* client,
@@ -293,6 +307,61 @@ AZ_NODISCARD az_result az_iot_hub_client_sas_get_password(
     size_t mqtt_password_size,
     size_t* out_mqtt_password_length);
 
+/**
+ * @brief Gets the MQTT password, signing it with an application-provided HMAC-SHA256 function.
+ * @note The MQTT password must be an empty string if X509 Client certificates are used. Use this
+ * API only when authenticating with SAS tokens.
+ *
+ * @details Replaces the sequence of az_iot_hub_client_sas_get_signature(), signing, Base64
+ * encoding and az_iot_hub_client_sas_get_password(). The signature is built in \p mqtt_password,
+ * where it is signed and then overwritten by the encoded result, so no other buffer is needed.
+ *
+ * @code
+ * static az_result sign(void* context, az_span data, az_span signed_data)
+ * {
+ *   hmac_256(az_span_ptr(data), az_span_size(data), (char const*)context,
+ *     az_span_ptr(signed_data));
+ *   return AZ_OK;
+ * }
+ *
+ * char password[256];
+ * az_iot_hub_client_sas_get_signed_password(&client, expiration_time_in_seconds, sign,
+ *   decoded_sas_key, AZ_SPAN_EMPTY, password, sizeof(password), NULL);
+ * @endcode
+ *
+ * @param[in] client The #az_iot_hub_client to use for this call.
+ * @param[in] token_expiration_epoch_time The time, in seconds, from 1/1/1970.
+ * @param[in] hmac_sha256 The function computing the HMAC-SHA256 of the signature with the
+ * SharedAccessKey.
+ * @param[in] hmac_sha256_context The context passed to \p hmac_sha256. Can be `NULL`.
+ * @param[in] key_name The Shared Access Key Name (Policy Name). This is optional. For security
+ * reasons we recommend using one key per device instead of using a global policy key.
+ * @param[out] mqtt_password A char buffer with sufficient capacity to hold the MQTT password, and
+ * the signature while it is being signed.
+ * @param[in] mqtt_password_size The size, in bytes of \p mqtt_password.
+ * @param[out] out_mqtt_password_length __[nullable]__ Contains the string length, in bytes, of \p
+ * mqtt_password. Can be `NULL`.
+ * @pre \p client must not be `NULL`.
+ * @pre \p token_expiration_epoch_time must be greater than 0.
+ * @pre \p hmac_sha256 must not be `NULL`.
+ * @pre \p mqtt_password must not be `NULL`.
+ * @pre \p mqtt_password_size must be greater than 0.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The operation was successful. In this case, \p mqtt_password will contain a
+ * null-terminated string with the password that needs to be passed to the MQTT client.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The \p mqtt_password does not have enough size.
+ * @retval Other Failures returned by \p hmac_sha256.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_sas_get_signed_password(
+    az_iot_hub_client const* client,
+    uint64_t token_expiration_epoch_time,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span key_name,
+    char* mqtt_password,
+    size_t mqtt_password_size,
+    size_t* out_mqtt_password_length);
+
 /*
  *
  * Telemetry APIs
@@ -734,6 +803,9 @@ typedef struct
   az_iot_status status; /**< The operation status. */
   az_span request_id; /**< Request ID matches the ID specified when issuing the initial request to
                          properties. */
+  az_span version; /**< The version of the reported properties after the update. Only set when
+                      `message_type == AZ_IOT_HUB_CLIENT_PROPERTIES_MESSAGE_TYPE_ACKNOWLEDGEMENT`
+                      and the update succeeded, otherwise #AZ_SPAN_EMPTY. */
 } az_iot_hub_client_properties_message;
 
 /**
@@ -56,6 +56,10 @@ AZ_NODISCARD az_result az_iot_hub_client_properties_parse_received_topic(
   out_message->message_type
       = (az_iot_hub_client_properties_message_type)hub_twin_response.response_type;
   out_message->status = hub_twin_response.status;
+  out_message->version
+      = hub_twin_response.response_type == AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_REPORTED_PROPERTIES
+      ? hub_twin_response.version
+      : AZ_SPAN_EMPTY;
 
   return AZ_OK;
 }
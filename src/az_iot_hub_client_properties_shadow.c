@@ -0,0 +1,392 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+
+#include <az_iot_hub_client_properties.h>
+#include <az_iot_hub_client_properties_shadow.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+#include <az_span_private.h>
+
+#include <_az_cfg.h>
+
+// FNV-1a, used to detect changes of string values without keeping a copy of them.
+static uint32_t _az_iot_hub_client_properties_shadow_hash(az_span value)
+{
+  uint32_t hash = 2166136261U;
+  uint8_t const* ptr = az_span_ptr(value);
+  int32_t size = az_span_size(value);
+
+  for (int32_t i = 0; i < size; i++)
+  {
+    hash ^= ptr[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static bool _az_iot_hub_client_properties_shadow_entry_differs(
+    az_iot_hub_client_properties_shadow_entry const* entry,
+    double baseline_value,
+    uint32_t baseline_string_hash)
+{
+  if (entry->_internal.kind == AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_STRING)
+  {
+    return entry->_internal.string_hash != baseline_string_hash;
+  }
+
+  double difference = entry->_internal.value - baseline_value;
+  if (difference < 0)
+  {
+    difference = -difference;
+  }
+
+  return difference > entry->_internal.deadband;
+}
+
+// Whether the entry has to be written by the next update. While an update is in flight, values
+// are compared with the ones sent, since those are expected to become the acknowledged ones.
+static bool _az_iot_hub_client_properties_shadow_entry_is_changed(
+    az_iot_hub_client_properties_shadow_entry const* entry)
+{
+  if (entry->_internal.is_sent)
+  {
+    return _az_iot_hub_client_properties_shadow_entry_differs(
+        entry, entry->_internal.sent_value, entry->_internal.sent_string_hash);
+  }
+
+  return !entry->_internal.is_acknowledged
+      || _az_iot_hub_client_properties_shadow_entry_differs(
+             entry, entry->_internal.acknowledged_value, entry->_internal.acknowledged_string_hash);
+}
+
+static AZ_NODISCARD az_result _az_iot_hub_client_properties_shadow_get_entry(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    az_iot_hub_client_properties_shadow_value_kind kind,
+    az_iot_hub_client_properties_shadow_entry** out_entry)
+{
+  _az_PRECONDITION_NOT_NULL(ref_shadow);
+  _az_PRECONDITION_VALID_SPAN(property_name, 1, false);
+
+  az_iot_hub_client_properties_shadow_entry* entries = ref_shadow->_internal.entries;
+
+  for (int32_t i = 0; i < ref_shadow->_internal.count; i++)
+  {
+    if (az_span_is_content_equal(entries[i]._internal.property_name, property_name)
+        && az_span_is_content_equal(entries[i]._internal.component_name, component_name))
+    {
+      if (entries[i]._internal.kind != kind)
+      {
+        return AZ_ERROR_ARG;
+      }
+
+      *out_entry = &entries[i];
+      return AZ_OK;
+    }
+  }
+
+  if (ref_shadow->_internal.count == ref_shadow->_internal.capacity)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  az_iot_hub_client_properties_shadow_entry* entry = &entries[ref_shadow->_internal.count];
+  ref_shadow->_internal.count++;
+
+  *entry = (az_iot_hub_client_properties_shadow_entry){ 0 };
+  entry->_internal.component_name = component_name;
+  entry->_internal.property_name = property_name;
+  entry->_internal.kind = kind;
+
+  *out_entry = entry;
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_init(
+    az_iot_hub_client_properties_shadow* shadow,
+    az_iot_hub_client_properties_shadow_entry* entries,
+    int32_t capacity)
+{
+  _az_PRECONDITION_NOT_NULL(shadow);
+  _az_PRECONDITION_NOT_NULL(entries);
+  _az_PRECONDITION(capacity > 0);
+
+  shadow->_internal.entries = entries;
+  shadow->_internal.capacity = capacity;
+  shadow->_internal.count = 0;
+  shadow->_internal.is_update_in_flight = false;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_double(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    double value,
+    int32_t fractional_digits,
+    double deadband)
+{
+  _az_PRECONDITION(_az_isfinite(value));
+  _az_PRECONDITION_RANGE(0, fractional_digits, _az_MAX_SUPPORTED_FRACTIONAL_DIGITS);
+  _az_PRECONDITION(deadband >= 0);
+
+  az_iot_hub_client_properties_shadow_entry* entry;
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_properties_shadow_get_entry(
+      ref_shadow,
+      component_name,
+      property_name,
+      AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_NUMBER,
+      &entry));
+
+  entry->_internal.value = value;
+  entry->_internal.fractional_digits = fractional_digits;
+  entry->_internal.deadband = deadband;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_bool(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    bool value)
+{
+  az_iot_hub_client_properties_shadow_entry* entry;
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_properties_shadow_get_entry(
+      ref_shadow,
+      component_name,
+      property_name,
+      AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_BOOLEAN,
+      &entry));
+
+  entry->_internal.value = value ? 1 : 0;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_string(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    az_span value)
+{
+  az_iot_hub_client_properties_shadow_entry* entry;
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_properties_shadow_get_entry(
+      ref_shadow,
+      component_name,
+      property_name,
+      AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_STRING,
+      &entry));
+
+  entry->_internal.string_value = value;
+  entry->_internal.string_hash = _az_iot_hub_client_properties_shadow_hash(value);
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD bool az_iot_hub_client_properties_shadow_has_changes(
+    az_iot_hub_client_properties_shadow const* shadow)
+{
+  _az_PRECONDITION_NOT_NULL(shadow);
+
+  for (int32_t i = 0; i < shadow->_internal.count; i++)
+  {
+    if (_az_iot_hub_client_properties_shadow_entry_is_changed(&shadow->_internal.entries[i]))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+AZ_NODISCARD int32_t az_iot_hub_client_properties_shadow_get_change_count(
+    az_iot_hub_client_properties_shadow const* shadow)
+{
+  _az_PRECONDITION_NOT_NULL(shadow);
+
+  int32_t change_count = 0;
+
+  for (int32_t i = 0; i < shadow->_internal.count; i++)
+  {
+    if (_az_iot_hub_client_properties_shadow_entry_is_changed(&shadow->_internal.entries[i]))
+    {
+      change_count++;
+    }
+  }
+
+  return change_count;
+}
+
+static AZ_NODISCARD az_result _az_iot_hub_client_properties_shadow_write_entry(
+    az_json_writer* ref_json_writer,
+    az_iot_hub_client_properties_shadow_entry* ref_entry)
+{
+  _az_RETURN_IF_FAILED(
+      az_json_writer_append_property_name(ref_json_writer, ref_entry->_internal.property_name));
+
+  switch (ref_entry->_internal.kind)
+  {
+    case AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_NUMBER:
+      _az_RETURN_IF_FAILED(az_json_writer_append_double(
+          ref_json_writer, ref_entry->_internal.value, ref_entry->_internal.fractional_digits));
+      break;
+    case AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_BOOLEAN:
+      _az_RETURN_IF_FAILED(
+          az_json_writer_append_bool(ref_json_writer, ref_entry->_internal.value != 0));
+      break;
+    default:
+      _az_RETURN_IF_FAILED(
+          az_json_writer_append_string(ref_json_writer, ref_entry->_internal.string_value));
+      break;
+  }
+
+  ref_entry->_internal.sent_value = ref_entry->_internal.value;
+  ref_entry->_internal.sent_string_hash = ref_entry->_internal.string_hash;
+  ref_entry->_internal.is_sent = true;
+
+  return AZ_OK;
+}
+
+// Entries are marked as sent as they are written, which the caller rolls back if writing fails.
+static AZ_NODISCARD az_result _az_iot_hub_client_properties_shadow_write_changed_entries(
+    az_iot_hub_client const* client,
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_json_writer* ref_json_writer,
+    int32_t* out_property_count)
+{
+  az_iot_hub_client_properties_shadow_entry* entries = ref_shadow->_internal.entries;
+  int32_t const count = ref_shadow->_internal.count;
+  int32_t property_count = 0;
+
+  _az_RETURN_IF_FAILED(az_json_writer_append_begin_object(ref_json_writer));
+
+  for (int32_t i = 0; i < count; i++)
+  {
+    // Entries of a component are written together, when its first changed entry is found. Those
+    // are marked as sent, so they are skipped when reached later on.
+    if (entries[i]._internal.is_sent
+        || !_az_iot_hub_client_properties_shadow_entry_is_changed(&entries[i]))
+    {
+      continue;
+    }
+
+    az_span component_name = entries[i]._internal.component_name;
+    bool is_component = az_span_size(component_name) > 0;
+
+    if (is_component)
+    {
+      _az_RETURN_IF_FAILED(az_iot_hub_client_properties_writer_begin_component(
+          client, ref_json_writer, component_name));
+    }
+
+    for (int32_t j = i; j < count; j++)
+    {
+      if (!entries[j]._internal.is_sent
+          && az_span_is_content_equal(entries[j]._internal.component_name, component_name)
+          && _az_iot_hub_client_properties_shadow_entry_is_changed(&entries[j]))
+      {
+        _az_RETURN_IF_FAILED(
+            _az_iot_hub_client_properties_shadow_write_entry(ref_json_writer, &entries[j]));
+        property_count++;
+      }
+    }
+
+    if (is_component)
+    {
+      _az_RETURN_IF_FAILED(
+          az_iot_hub_client_properties_writer_end_component(client, ref_json_writer));
+    }
+  }
+
+  _az_RETURN_IF_FAILED(az_json_writer_append_end_object(ref_json_writer));
+
+  *out_property_count = property_count;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_write_changes(
+    az_iot_hub_client const* client,
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_json_writer* ref_json_writer,
+    int32_t* out_property_count)
+{
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION_NOT_NULL(ref_shadow);
+  _az_PRECONDITION_NOT_NULL(ref_json_writer);
+  _az_PRECONDITION_NOT_NULL(out_property_count);
+
+  if (ref_shadow->_internal.is_update_in_flight)
+  {
+    return AZ_ERROR_NOT_SUPPORTED;
+  }
+
+  int32_t property_count = 0;
+  az_result const result = _az_iot_hub_client_properties_shadow_write_changed_entries(
+      client, ref_shadow, ref_json_writer, &property_count);
+
+  if (az_result_failed(result))
+  {
+    // The entries written before the failure are not in flight, so they are still changed.
+    for (int32_t i = 0; i < ref_shadow->_internal.count; i++)
+    {
+      ref_shadow->_internal.entries[i]._internal.is_sent = false;
+    }
+
+    return result;
+  }
+
+  ref_shadow->_internal.is_update_in_flight = property_count > 0;
+  *out_property_count = property_count;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_complete_update(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_iot_status status)
+{
+  _az_PRECONDITION_NOT_NULL(ref_shadow);
+
+  bool const is_accepted = az_iot_status_succeeded(status);
+
+  for (int32_t i = 0; i < ref_shadow->_internal.count; i++)
+  {
+    az_iot_hub_client_properties_shadow_entry* entry = &ref_shadow->_internal.entries[i];
+
+    if (entry->_internal.is_sent)
+    {
+      if (is_accepted)
+      {
+        entry->_internal.acknowledged_value = entry->_internal.sent_value;
+        entry->_internal.acknowledged_string_hash = entry->_internal.sent_string_hash;
+        entry->_internal.is_acknowledged = true;
+      }
+
+      entry->_internal.is_sent = false;
+    }
+  }
+
+  ref_shadow->_internal.is_update_in_flight = false;
+
+  return AZ_OK;
+}
+
+void az_iot_hub_client_properties_shadow_reset(az_iot_hub_client_properties_shadow* ref_shadow)
+{
+  _az_PRECONDITION_NOT_NULL(ref_shadow);
+
+  for (int32_t i = 0; i < ref_shadow->_internal.count; i++)
+  {
+    ref_shadow->_internal.entries[i]._internal.is_acknowledged = false;
+    ref_shadow->_internal.entries[i]._internal.is_sent = false;
+  }
+
+  ref_shadow->_internal.is_update_in_flight = false;
+}
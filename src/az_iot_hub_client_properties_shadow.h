@@ -0,0 +1,322 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for the reported properties shadow, which writes only changed properties.
+ *
+ * @details The shadow keeps, for each reported property, the last value acknowledged by IoT Hub
+ * and the current value set by the application. az_iot_hub_client_properties_shadow_write_changes()
+ * serializes only the properties whose current value differs from the acknowledged one, so the
+ * PATCH published to the topic from az_iot_hub_client_properties_get_reported_publish_topic() does
+ * not repeat properties the service already has.
+ *
+ * A typical flow is:
+ *
+ * @code
+ * az_iot_hub_client_properties_shadow_set_double(&shadow, AZ_SPAN_EMPTY, temp_name, temp, 1, 0.5);
+ *
+ * if (az_iot_hub_client_properties_shadow_has_changes(&shadow))
+ * {
+ *   az_iot_hub_client_properties_shadow_write_changes(&client, &shadow, &jw, &property_count);
+ *   // Publish the payload to the reported properties topic.
+ * }
+ *
+ * // Once the response to the PATCH is received:
+ * az_iot_hub_client_properties_shadow_complete_update(&shadow, status);
+ * @endcode
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_HUB_CLIENT_PROPERTIES_SHADOW_H
+#define _az_IOT_HUB_CLIENT_PROPERTIES_SHADOW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_json.h>
+#include <az_result.h>
+#include <az_span.h>
+
+#include <az_iot_common.h>
+#include <az_iot_hub_client.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The kind of value held by a reported property in the shadow.
+ */
+typedef enum
+{
+  AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_NUMBER = 1, ///< A JSON number.
+  AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_BOOLEAN = 2, ///< A JSON boolean.
+  AZ_IOT_HUB_CLIENT_PROPERTIES_SHADOW_VALUE_STRING = 3, ///< A JSON string.
+} az_iot_hub_client_properties_shadow_value_kind;
+
+/**
+ * @brief The state of a single reported property in the shadow.
+ *
+ * @remarks Storage for these is provided by the application to
+ * az_iot_hub_client_properties_shadow_init(). The fields are managed by the shadow.
+ */
+typedef struct
+{
+  struct
+  {
+    az_span component_name;
+    az_span property_name;
+    az_iot_hub_client_properties_shadow_value_kind kind;
+    int32_t fractional_digits;
+    double deadband;
+    double value;
+    az_span string_value;
+    uint32_t string_hash;
+    double acknowledged_value;
+    uint32_t acknowledged_string_hash;
+    double sent_value;
+    uint32_t sent_string_hash;
+    bool is_acknowledged;
+    bool is_sent;
+  } _internal;
+} az_iot_hub_client_properties_shadow_entry;
+
+/**
+ * @brief Tracks reported properties to serialize only the ones that changed.
+ */
+typedef struct
+{
+  struct
+  {
+    az_iot_hub_client_properties_shadow_entry* entries;
+    int32_t capacity;
+    int32_t count;
+    bool is_update_in_flight;
+  } _internal;
+} az_iot_hub_client_properties_shadow;
+
+/**
+ * @brief Initializes an #az_iot_hub_client_properties_shadow.
+ *
+ * @param[out] shadow The #az_iot_hub_client_properties_shadow to initialize.
+ * @param[in] entries Storage for the tracked properties. It must remain valid for the lifetime of
+ * \p shadow.
+ * @param[in] capacity The number of elements in \p entries, which is the maximum number of
+ * distinct properties tracked.
+ *
+ * @pre \p shadow must not be `NULL`.
+ * @pre \p entries must not be `NULL`.
+ * @pre \p capacity must be greater than 0.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The shadow was initialized successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_init(
+    az_iot_hub_client_properties_shadow* shadow,
+    az_iot_hub_client_properties_shadow_entry* entries,
+    int32_t capacity);
+
+/**
+ * @brief Sets the current value of a numeric reported property.
+ *
+ * @details The property is considered changed when no value has been acknowledged yet, or when the
+ * current value differs from the acknowledged one by more than \p deadband.
+ *
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to update.
+ * @param[in] component_name The name of the component the property belongs to, or #AZ_SPAN_EMPTY
+ * for the root component. Must remain valid for the lifetime of \p ref_shadow.
+ * @param[in] property_name The name of the property. Must remain valid for the lifetime of
+ * \p ref_shadow.
+ * @param[in] value The current value of the property. Must be finite.
+ * @param[in] fractional_digits The number of digits after the decimal point written for the value.
+ * Must be between 0 and 15, inclusive.
+ * @param[in] deadband The largest difference from the acknowledged value that is not reported. Use
+ * 0 to report every change.
+ *
+ * @pre \p ref_shadow must not be `NULL`.
+ * @pre \p property_name must be a valid, non-empty #az_span.
+ * @pre \p deadband must not be negative.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The value was set successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The property is not tracked yet and the shadow is full.
+ * @retval #AZ_ERROR_ARG The property is already tracked with a different kind of value.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_double(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    double value,
+    int32_t fractional_digits,
+    double deadband);
+
+/**
+ * @brief Sets the current value of a boolean reported property.
+ *
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to update.
+ * @param[in] component_name The name of the component the property belongs to, or #AZ_SPAN_EMPTY
+ * for the root component. Must remain valid for the lifetime of \p ref_shadow.
+ * @param[in] property_name The name of the property. Must remain valid for the lifetime of
+ * \p ref_shadow.
+ * @param[in] value The current value of the property.
+ *
+ * @pre \p ref_shadow must not be `NULL`.
+ * @pre \p property_name must be a valid, non-empty #az_span.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The value was set successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The property is not tracked yet and the shadow is full.
+ * @retval #AZ_ERROR_ARG The property is already tracked with a different kind of value.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_bool(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    bool value);
+
+/**
+ * @brief Sets the current value of a string reported property.
+ *
+ * @details Only a 32-bit FNV-1a hash of acknowledged strings is kept, so the shadow does not need
+ * storage for them. As a consequence, a value whose hash equals the one of the acknowledged value
+ * is taken as unchanged and is not written. For distinct values this happens with a probability of
+ * about 1 in 4 billion per change; the value is written again on its next change, or after
+ * az_iot_hub_client_properties_shadow_reset(). Where a missed string change is not acceptable,
+ * report the property in a separate PATCH written with an #az_json_writer instead.
+ *
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to update.
+ * @param[in] component_name The name of the component the property belongs to, or #AZ_SPAN_EMPTY
+ * for the root component. Must remain valid for the lifetime of \p ref_shadow.
+ * @param[in] property_name The name of the property. Must remain valid for the lifetime of
+ * \p ref_shadow.
+ * @param[in] value The current value of the property, not JSON escaped. Must remain valid until
+ * the next call to az_iot_hub_client_properties_shadow_write_changes().
+ *
+ * @pre \p ref_shadow must not be `NULL`.
+ * @pre \p property_name must be a valid, non-empty #az_span.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The value was set successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The property is not tracked yet and the shadow is full.
+ * @retval #AZ_ERROR_ARG The property is already tracked with a different kind of value.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_set_string(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_span component_name,
+    az_span property_name,
+    az_span value);
+
+/**
+ * @brief Checks whether any property changed since it was last acknowledged.
+ *
+ * @param[in] shadow The #az_iot_hub_client_properties_shadow to query.
+ *
+ * @pre \p shadow must not be `NULL`.
+ *
+ * @return `true` if az_iot_hub_client_properties_shadow_write_changes() would write at least one
+ * property, `false` otherwise.
+ */
+AZ_NODISCARD bool az_iot_hub_client_properties_shadow_has_changes(
+    az_iot_hub_client_properties_shadow const* shadow);
+
+/**
+ * @brief Gets the number of properties that changed since they were last acknowledged.
+ *
+ * @details Use to flush the changes early once enough of them are pending, instead of waiting for
+ * more changes to coalesce.
+ *
+ * @param[in] shadow The #az_iot_hub_client_properties_shadow to query.
+ *
+ * @pre \p shadow must not be `NULL`.
+ *
+ * @return The number of properties az_iot_hub_client_properties_shadow_write_changes() would
+ * write.
+ */
+AZ_NODISCARD int32_t az_iot_hub_client_properties_shadow_get_change_count(
+    az_iot_hub_client_properties_shadow const* shadow);
+
+/**
+ * @brief Checks whether an update written by az_iot_hub_client_properties_shadow_write_changes()
+ * is waiting for az_iot_hub_client_properties_shadow_complete_update().
+ *
+ * @param[in] shadow The #az_iot_hub_client_properties_shadow to query.
+ *
+ * @pre \p shadow must not be `NULL`.
+ *
+ * @return `true` if an update is in flight, `false` otherwise.
+ */
+AZ_NODISCARD AZ_INLINE bool az_iot_hub_client_properties_shadow_is_update_in_flight(
+    az_iot_hub_client_properties_shadow const* shadow)
+{
+  return shadow->_internal.is_update_in_flight;
+}
+
+/**
+ * @brief Writes a reported properties JSON payload with only the changed properties.
+ *
+ * @details The whole JSON object is written, including the metadata of each component. The
+ * properties written are marked as sent until
+ * az_iot_hub_client_properties_shadow_complete_update() is called. If writing fails, no property
+ * is marked as sent, so all the changed properties are written by the next call.
+ *
+ * @param[in] client The #az_iot_hub_client to use for this call.
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to serialize.
+ * @param[in,out] ref_json_writer An initialized #az_json_writer with nothing written to it yet.
+ * @param[out] out_property_count The number of properties written. If 0, the payload is an empty
+ * JSON object and does not need to be published.
+ *
+ * @pre \p client must not be `NULL`.
+ * @pre \p ref_shadow must not be `NULL`.
+ * @pre \p ref_json_writer must not be `NULL`.
+ * @pre \p out_property_count must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The payload was written successfully.
+ * @retval #AZ_ERROR_NOT_SUPPORTED The previous update has not been completed with
+ * az_iot_hub_client_properties_shadow_complete_update().
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The buffer of \p ref_json_writer is too small.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_write_changes(
+    az_iot_hub_client const* client,
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_json_writer* ref_json_writer,
+    int32_t* out_property_count);
+
+/**
+ * @brief Completes the update written by the last call to
+ * az_iot_hub_client_properties_shadow_write_changes().
+ *
+ * @details If \p status indicates success, the values sent become the acknowledged values.
+ * Otherwise they are discarded, so the properties are written again by the next update.
+ *
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to update.
+ * @param[in] status The status of the response received for the reported properties PATCH.
+ *
+ * @pre \p ref_shadow must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The update was completed successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_properties_shadow_complete_update(
+    az_iot_hub_client_properties_shadow* ref_shadow,
+    az_iot_status status);
+
+/**
+ * @brief Forgets all acknowledged values, so every property is written by the next update.
+ *
+ * @details Use when the acknowledged state is no longer known to match the service, for example
+ * after the reported properties were changed by other means.
+ *
+ * @param[in,out] ref_shadow The #az_iot_hub_client_properties_shadow to reset.
+ *
+ * @pre \p ref_shadow must not be `NULL`.
+ */
+void az_iot_hub_client_properties_shadow_reset(az_iot_hub_client_properties_shadow* ref_shadow);
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_HUB_CLIENT_PROPERTIES_SHADOW_H
@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_iot_hub_client_received_topic.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+
+#include <_az_cfg.h>
+
+// The prefixes are matched as a trie: the first byte selects the branch, and topics under
+// "$iothub/" are told apart by the byte that follows it.
+static const az_span hub_topic_prefix = AZ_SPAN_LITERAL_FROM_STR("$iothub/");
+static const az_span twin_topic_segment = AZ_SPAN_LITERAL_FROM_STR("twin/");
+static const az_span methods_topic_segment = AZ_SPAN_LITERAL_FROM_STR("methods/");
+static const az_span c2d_topic_prefix = AZ_SPAN_LITERAL_FROM_STR("devices/");
+
+static bool _az_iot_hub_client_topic_has_prefix(az_span topic, int32_t offset, az_span prefix)
+{
+  return az_span_size(topic) - offset >= az_span_size(prefix)
+      && az_span_is_content_equal(
+             az_span_slice(topic, offset, offset + az_span_size(prefix)), prefix);
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_parse_received_topic(
+    az_iot_hub_client const* client,
+    az_span received_topic,
+    az_iot_hub_client_received_topic* out_received_topic)
+{
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION_VALID_SPAN(received_topic, 1, false);
+  _az_PRECONDITION_NOT_NULL(out_received_topic);
+
+  uint8_t const* topic_ptr = az_span_ptr(received_topic);
+
+  if (topic_ptr[0] == '$')
+  {
+    int32_t const offset = az_span_size(hub_topic_prefix);
+
+    if (!_az_iot_hub_client_topic_has_prefix(received_topic, 0, hub_topic_prefix)
+        || az_span_size(received_topic) == offset)
+    {
+      return AZ_ERROR_IOT_TOPIC_NO_MATCH;
+    }
+
+    if (topic_ptr[offset] == 't'
+        && _az_iot_hub_client_topic_has_prefix(received_topic, offset, twin_topic_segment))
+    {
+      out_received_topic->type = AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_PROPERTIES;
+      return az_iot_hub_client_properties_parse_received_topic(
+          client, received_topic, &out_received_topic->parsed.properties_message);
+    }
+
+    if (topic_ptr[offset] == 'm'
+        && _az_iot_hub_client_topic_has_prefix(received_topic, offset, methods_topic_segment))
+    {
+      out_received_topic->type = AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_COMMAND;
+      return az_iot_hub_client_commands_parse_received_topic(
+          client, received_topic, &out_received_topic->parsed.command_request);
+    }
+  }
+  else if (
+      topic_ptr[0] == 'd' && _az_iot_hub_client_topic_has_prefix(received_topic, 0, c2d_topic_prefix))
+  {
+    out_received_topic->type = AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_C2D;
+    return az_iot_hub_client_c2d_parse_received_topic(
+        client, received_topic, &out_received_topic->parsed.c2d_request);
+  }
+
+  return AZ_ERROR_IOT_TOPIC_NO_MATCH;
+}
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for classifying any MQTT topic received from IoT Hub in a single call.
+ *
+ * @details Instead of trying each feature's parser in turn, an application subscribed to several
+ * IoT Hub features can call az_iot_hub_client_parse_received_topic() once. The topic is
+ * classified by its prefix and only the matching parser runs:
+ *
+ * @code
+ * az_iot_hub_client_received_topic received_topic;
+ * if (az_result_succeeded(
+ *         az_iot_hub_client_parse_received_topic(&client, topic, &received_topic)))
+ * {
+ *   switch (received_topic.type)
+ *   {
+ *     case AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_C2D:
+ *       // Use received_topic.parsed.c2d_request.
+ *       break;
+ *     case AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_COMMAND:
+ *       // Use received_topic.parsed.command_request.
+ *       break;
+ *     case AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_PROPERTIES:
+ *       // Use received_topic.parsed.properties_message.
+ *       break;
+ *   }
+ * }
+ * @endcode
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_HUB_CLIENT_RECEIVED_TOPIC_H
+#define _az_IOT_HUB_CLIENT_RECEIVED_TOPIC_H
+
+#include <az_result.h>
+#include <az_span.h>
+
+#include <az_iot_hub_client.h>
+#include <az_iot_hub_client_properties.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The kind of message a received topic belongs to.
+ */
+typedef enum
+{
+  AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_C2D = 1, ///< A cloud-to-device message.
+  AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_COMMAND = 2, ///< A command (direct method) request.
+  AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_PROPERTIES = 3, ///< A properties (device twin) message.
+} az_iot_hub_client_received_topic_type;
+
+/**
+ * @brief A received topic parsed by az_iot_hub_client_parse_received_topic().
+ *
+ * @remarks Only the member of `parsed` selected by `type` is set.
+ */
+typedef struct
+{
+  az_iot_hub_client_received_topic_type type; ///< The kind of message received.
+
+  /**
+   * @brief The parsed topic.
+   */
+  union
+  {
+    az_iot_hub_client_c2d_request c2d_request; ///< Set for
+                                               ///< #AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_C2D.
+    az_iot_hub_client_command_request command_request; ///< Set for
+                                                       ///< #AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_COMMAND.
+    az_iot_hub_client_properties_message
+        properties_message; ///< Set for #AZ_IOT_HUB_CLIENT_RECEIVED_TOPIC_PROPERTIES.
+  } parsed;
+} az_iot_hub_client_received_topic;
+
+/**
+ * @brief Attempts to parse any received topic from IoT Hub.
+ *
+ * @details The topic is classified by its `$iothub/twin/`, `$iothub/methods/` or `devices/`
+ * prefix, then parsed by az_iot_hub_client_properties_parse_received_topic(),
+ * az_iot_hub_client_commands_parse_received_topic() or
+ * az_iot_hub_client_c2d_parse_received_topic() respectively. Topics with none of these prefixes
+ * are rejected without further scanning.
+ *
+ * @param[in] client The #az_iot_hub_client to use for this call.
+ * @param[in] received_topic An #az_span containing the received topic.
+ * @param[out] out_received_topic If the message is recognized, the #az_iot_hub_client_received_topic
+ * containing the kind of message and its parsed topic.
+ *
+ * @pre \p client must not be `NULL`.
+ * @pre \p received_topic must be a valid, non-empty #az_span.
+ * @pre \p out_received_topic must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The topic was parsed successfully.
+ * @retval #AZ_ERROR_IOT_TOPIC_NO_MATCH If the topic is not a C2D, command or properties topic.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_parse_received_topic(
+    az_iot_hub_client const* client,
+    az_span received_topic,
+    az_iot_hub_client_received_topic* out_received_topic);
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_HUB_CLIENT_RECEIVED_TOPIC_H
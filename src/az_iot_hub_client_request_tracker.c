@@ -0,0 +1,262 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_iot_hub_client_request_tracker.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+#include <az_span_internal.h>
+
+#include <_az_cfg.h>
+
+// A request id of 0 marks an empty slot, which is why generated ids skip 0.
+#define _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY 0
+
+// Requests are placed by linear probing from the slot selected by the low bits of their id. Ids
+// are generated sequentially, so consecutive requests land in consecutive slots without probing.
+AZ_INLINE int32_t _az_iot_hub_client_request_tracker_home_slot(
+    az_iot_hub_client_request_tracker const* tracker,
+    uint32_t request_id)
+{
+  return (int32_t)(request_id & (uint32_t)(tracker->_internal.capacity - 1));
+}
+
+AZ_INLINE int32_t _az_iot_hub_client_request_tracker_next_slot(
+    az_iot_hub_client_request_tracker const* tracker,
+    int32_t slot)
+{
+  return (slot + 1) & (tracker->_internal.capacity - 1);
+}
+
+static int32_t _az_iot_hub_client_request_tracker_find(
+    az_iot_hub_client_request_tracker const* tracker,
+    uint32_t request_id)
+{
+  int32_t slot = _az_iot_hub_client_request_tracker_home_slot(tracker, request_id);
+
+  // At least one slot is always empty, so the probe terminates.
+  while (tracker->_internal.entries[slot]._internal.request_id
+         != _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY)
+  {
+    if (tracker->_internal.entries[slot]._internal.request_id == request_id)
+    {
+      return slot;
+    }
+
+    slot = _az_iot_hub_client_request_tracker_next_slot(tracker, slot);
+  }
+
+  return -1;
+}
+
+// Empties a slot, shifting back the following entries of its probe sequence so no tombstones are
+// needed and lookups stay short.
+static void _az_iot_hub_client_request_tracker_remove_slot(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    int32_t slot)
+{
+  az_iot_hub_client_request_tracker_entry* const entries = ref_tracker->_internal.entries;
+  int32_t next = slot;
+
+  while (true)
+  {
+    next = _az_iot_hub_client_request_tracker_next_slot(ref_tracker, next);
+
+    if (entries[next]._internal.request_id == _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY)
+    {
+      break;
+    }
+
+    int32_t home = _az_iot_hub_client_request_tracker_home_slot(
+        ref_tracker, entries[next]._internal.request_id);
+
+    // The entry at next may move to slot only if its home is not cyclically within (slot, next].
+    bool const home_between = slot <= next ? (slot < home && home <= next)
+                                           : (slot < home || home <= next);
+
+    if (!home_between)
+    {
+      entries[slot] = entries[next];
+      slot = next;
+    }
+  }
+
+  entries[slot]._internal.request_id = _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY;
+  ref_tracker->_internal.count--;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_init(
+    az_iot_hub_client_request_tracker* tracker,
+    az_iot_hub_client_request_tracker_entry* entries,
+    int32_t capacity)
+{
+  _az_PRECONDITION_NOT_NULL(tracker);
+  _az_PRECONDITION_NOT_NULL(entries);
+  _az_PRECONDITION(capacity > 1 && (capacity & (capacity - 1)) == 0);
+
+  for (int32_t i = 0; i < capacity; i++)
+  {
+    entries[i]._internal.request_id = _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY;
+  }
+
+  tracker->_internal.entries = entries;
+  tracker->_internal.capacity = capacity;
+  tracker->_internal.count = 0;
+  tracker->_internal.last_request_id = _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_get_next_request_id(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    az_span destination,
+    az_span* out_request_id,
+    uint32_t* out_request_id_value)
+{
+  _az_PRECONDITION_NOT_NULL(ref_tracker);
+  _az_PRECONDITION_VALID_SPAN(destination, 1, false);
+  _az_PRECONDITION_NOT_NULL(out_request_id);
+
+  uint32_t request_id = ref_tracker->_internal.last_request_id + 1;
+  if (request_id == _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY)
+  {
+    request_id++;
+  }
+
+  az_span remainder;
+  _az_RETURN_IF_FAILED(az_span_u32toa(destination, request_id, &remainder));
+
+  ref_tracker->_internal.last_request_id = request_id;
+
+  *out_request_id = az_span_slice(destination, 0, _az_span_diff(remainder, destination));
+
+  if (out_request_id_value != NULL)
+  {
+    *out_request_id_value = request_id;
+  }
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_add(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    uint32_t request_id,
+    int64_t deadline_msec,
+    az_iot_hub_client_request_callback callback,
+    void* context)
+{
+  _az_PRECONDITION_NOT_NULL(ref_tracker);
+  _az_PRECONDITION(request_id != _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY);
+  _az_PRECONDITION_NOT_NULL(callback);
+
+  if (ref_tracker->_internal.count >= ref_tracker->_internal.capacity - 1)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  az_iot_hub_client_request_tracker_entry* const entries = ref_tracker->_internal.entries;
+  int32_t slot = _az_iot_hub_client_request_tracker_home_slot(ref_tracker, request_id);
+
+  while (entries[slot]._internal.request_id != _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY)
+  {
+    if (entries[slot]._internal.request_id == request_id)
+    {
+      return AZ_ERROR_ARG;
+    }
+
+    slot = _az_iot_hub_client_request_tracker_next_slot(ref_tracker, slot);
+  }
+
+  entries[slot]._internal.request_id = request_id;
+  entries[slot]._internal.deadline_msec = deadline_msec;
+  entries[slot]._internal.callback = callback;
+  entries[slot]._internal.context = context;
+  ref_tracker->_internal.count++;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_complete(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    az_span request_id,
+    az_iot_status status)
+{
+  _az_PRECONDITION_NOT_NULL(ref_tracker);
+
+  uint32_t request_id_value;
+  _az_RETURN_IF_FAILED(az_span_atou32(request_id, &request_id_value));
+
+  if (request_id_value == _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  int32_t slot = _az_iot_hub_client_request_tracker_find(ref_tracker, request_id_value);
+  if (slot == -1)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  az_iot_hub_client_request_tracker_entry const entry = ref_tracker->_internal.entries[slot];
+  _az_iot_hub_client_request_tracker_remove_slot(ref_tracker, slot);
+
+  entry._internal.callback(entry._internal.context, request_id_value, status);
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_remove(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    uint32_t request_id)
+{
+  _az_PRECONDITION_NOT_NULL(ref_tracker);
+
+  int32_t slot = request_id == _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY
+      ? -1
+      : _az_iot_hub_client_request_tracker_find(ref_tracker, request_id);
+
+  if (slot == -1)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  _az_iot_hub_client_request_tracker_remove_slot(ref_tracker, slot);
+
+  return AZ_OK;
+}
+
+int32_t az_iot_hub_client_request_tracker_sweep(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    int64_t now_msec)
+{
+  _az_PRECONDITION_NOT_NULL(ref_tracker);
+
+  int32_t timed_out_count = 0;
+  int32_t slot = 0;
+
+  while (slot < ref_tracker->_internal.capacity && ref_tracker->_internal.count > 0)
+  {
+    az_iot_hub_client_request_tracker_entry const entry = ref_tracker->_internal.entries[slot];
+
+    if (entry._internal.request_id != _az_IOT_HUB_CLIENT_REQUEST_ID_EMPTY
+        && entry._internal.deadline_msec <= now_msec)
+    {
+      // Removing may shift a later entry of the probe sequence back into this slot, so the slot
+      // is examined again. No entry is ever shifted from a slot not yet examined into one that
+      // was, so none is skipped.
+      _az_iot_hub_client_request_tracker_remove_slot(ref_tracker, slot);
+      timed_out_count++;
+
+      entry._internal.callback(
+          entry._internal.context, entry._internal.request_id, AZ_IOT_STATUS_TIMEOUT);
+    }
+    else
+    {
+      slot++;
+    }
+  }
+
+  return timed_out_count;
+}
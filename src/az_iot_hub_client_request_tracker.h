@@ -0,0 +1,250 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for correlating IoT Hub responses with the requests that caused them.
+ *
+ * @details Requests such as a properties document GET or a reported properties PATCH carry a
+ * `$rid` that IoT Hub echoes back in its response. The tracker generates those request ids and
+ * keeps the outstanding ones in a fixed-capacity, open-addressed table, so a response is matched
+ * to its callback in constant time and requests that are never answered are completed with
+ * #AZ_IOT_STATUS_TIMEOUT once their deadline passes.
+ *
+ * A typical flow is:
+ *
+ * @code
+ * uint8_t request_id_buffer[AZ_IOT_HUB_CLIENT_REQUEST_ID_MAX_SIZE];
+ * az_span request_id;
+ * uint32_t request_id_value;
+ *
+ * az_iot_hub_client_request_tracker_get_next_request_id(
+ *     &tracker, AZ_SPAN_FROM_BUFFER(request_id_buffer), &request_id, &request_id_value);
+ * az_iot_hub_client_request_tracker_add(
+ *     &tracker, request_id_value, now_msec + timeout_msec, on_response, context);
+ * // Get the publish topic with request_id and publish the request.
+ *
+ * // When a response is received:
+ * az_iot_hub_client_request_tracker_complete(&tracker, properties_message.request_id, status);
+ *
+ * // Periodically:
+ * az_iot_hub_client_request_tracker_sweep(&tracker, now_msec);
+ * @endcode
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_HUB_CLIENT_REQUEST_TRACKER_H
+#define _az_IOT_HUB_CLIENT_REQUEST_TRACKER_H
+
+#include <stdint.h>
+
+#include <az_result.h>
+#include <az_span.h>
+
+#include <az_iot_common.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The size, in bytes, of a buffer large enough for any request id written by
+ * az_iot_hub_client_request_tracker_get_next_request_id().
+ */
+#define AZ_IOT_HUB_CLIENT_REQUEST_ID_MAX_SIZE 10
+
+/**
+ * @brief Callback invoked when a tracked request completes.
+ *
+ * @param[in] context The context given to az_iot_hub_client_request_tracker_add().
+ * @param[in] request_id The id of the request.
+ * @param[in] status The status of the response, or #AZ_IOT_STATUS_TIMEOUT if no response was
+ * received before the request's deadline.
+ */
+typedef void (*az_iot_hub_client_request_callback)(
+    void* context,
+    uint32_t request_id,
+    az_iot_status status);
+
+/**
+ * @brief A slot of the request tracker table.
+ *
+ * @remarks Storage for these is provided by the application to
+ * az_iot_hub_client_request_tracker_init(). The fields are managed by the tracker.
+ */
+typedef struct
+{
+  struct
+  {
+    uint32_t request_id;
+    int64_t deadline_msec;
+    az_iot_hub_client_request_callback callback;
+    void* context;
+  } _internal;
+} az_iot_hub_client_request_tracker_entry;
+
+/**
+ * @brief Generates request ids and tracks the outstanding requests.
+ */
+typedef struct
+{
+  struct
+  {
+    az_iot_hub_client_request_tracker_entry* entries;
+    int32_t capacity;
+    int32_t count;
+    uint32_t last_request_id;
+  } _internal;
+} az_iot_hub_client_request_tracker;
+
+/**
+ * @brief Initializes an #az_iot_hub_client_request_tracker.
+ *
+ * @param[out] tracker The #az_iot_hub_client_request_tracker to initialize.
+ * @param[in] entries Storage for the table. It must remain valid for the lifetime of \p tracker.
+ * @param[in] capacity The number of elements in \p entries. Must be a power of two. At most
+ * `capacity - 1` requests are tracked at once, so every lookup ends at an empty slot.
+ *
+ * @pre \p tracker must not be `NULL`.
+ * @pre \p entries must not be `NULL`.
+ * @pre \p capacity must be a power of two greater than 1.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The tracker was initialized successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_init(
+    az_iot_hub_client_request_tracker* tracker,
+    az_iot_hub_client_request_tracker_entry* entries,
+    int32_t capacity);
+
+/**
+ * @brief Generates the next request id and writes it as the decimal text used for `$rid`.
+ *
+ * @details Ids increase monotonically, skipping 0 when they wrap around.
+ *
+ * @param[in,out] ref_tracker The #az_iot_hub_client_request_tracker to use for this call.
+ * @param[in] destination The buffer the request id text is written into. See
+ * #AZ_IOT_HUB_CLIENT_REQUEST_ID_MAX_SIZE.
+ * @param[out] out_request_id The slice of \p destination holding the request id, to pass to the
+ * publish topic functions.
+ * @param[out] out_request_id_value Optional. The numeric value of the request id, to pass to
+ * az_iot_hub_client_request_tracker_add(). Can be `NULL`.
+ *
+ * @pre \p ref_tracker must not be `NULL`.
+ * @pre \p destination must be a valid, non-empty #az_span.
+ * @pre \p out_request_id must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The request id was written successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE \p destination is too small for the request id.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_get_next_request_id(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    az_span destination,
+    az_span* out_request_id,
+    uint32_t* out_request_id_value);
+
+/**
+ * @brief Starts tracking an outstanding request.
+ *
+ * @param[in,out] ref_tracker The #az_iot_hub_client_request_tracker to use for this call.
+ * @param[in] request_id The id of the request. Must not be 0.
+ * @param[in] deadline_msec The time, in milliseconds on the same clock given to
+ * az_iot_hub_client_request_tracker_sweep(), after which the request times out.
+ * @param[in] callback The callback to invoke when the request completes or times out.
+ * @param[in] context The context passed to \p callback. Can be `NULL`.
+ *
+ * @pre \p ref_tracker must not be `NULL`.
+ * @pre \p request_id must not be 0.
+ * @pre \p callback must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The request is tracked.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The tracker already holds `capacity - 1` requests.
+ * @retval #AZ_ERROR_ARG A request with the same id is already tracked.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_add(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    uint32_t request_id,
+    int64_t deadline_msec,
+    az_iot_hub_client_request_callback callback,
+    void* context);
+
+/**
+ * @brief Completes the tracked request a response belongs to.
+ *
+ * @details The request stops being tracked before its callback is invoked, so the callback may
+ * add new requests.
+ *
+ * @param[in,out] ref_tracker The #az_iot_hub_client_request_tracker to use for this call.
+ * @param[in] request_id The `$rid` of the response, as parsed from its topic.
+ * @param[in] status The status of the response.
+ *
+ * @pre \p ref_tracker must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The request was completed and its callback invoked.
+ * @retval #AZ_ERROR_ITEM_NOT_FOUND The request is not tracked, for example because it already
+ * timed out.
+ * @retval #AZ_ERROR_UNEXPECTED_CHAR \p request_id is not a request id generated as a number.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_complete(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    az_span request_id,
+    az_iot_status status);
+
+/**
+ * @brief Stops tracking a request without invoking its callback.
+ *
+ * @details Use when the request could not be published after it was added.
+ *
+ * @param[in,out] ref_tracker The #az_iot_hub_client_request_tracker to use for this call.
+ * @param[in] request_id The id of the request.
+ *
+ * @pre \p ref_tracker must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The request is no longer tracked.
+ * @retval #AZ_ERROR_ITEM_NOT_FOUND The request is not tracked.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_request_tracker_remove(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    uint32_t request_id);
+
+/**
+ * @brief Times out the tracked requests whose deadline has passed.
+ *
+ * @details The callback of each expired request is invoked with #AZ_IOT_STATUS_TIMEOUT.
+ *
+ * @param[in,out] ref_tracker The #az_iot_hub_client_request_tracker to use for this call.
+ * @param[in] now_msec The current time, in milliseconds.
+ *
+ * @pre \p ref_tracker must not be `NULL`.
+ *
+ * @return The number of requests that timed out.
+ */
+int32_t az_iot_hub_client_request_tracker_sweep(
+    az_iot_hub_client_request_tracker* ref_tracker,
+    int64_t now_msec);
+
+/**
+ * @brief Gets the number of requests currently tracked.
+ *
+ * @param[in] tracker The #az_iot_hub_client_request_tracker to query.
+ *
+ * @pre \p tracker must not be `NULL`.
+ *
+ * @return The number of outstanding requests.
+ */
+AZ_NODISCARD AZ_INLINE int32_t
+az_iot_hub_client_request_tracker_get_count(az_iot_hub_client_request_tracker const* tracker)
+{
+  return tracker->_internal.count;
+}
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_HUB_CLIENT_REQUEST_TRACKER_H
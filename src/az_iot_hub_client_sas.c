@@ -33,6 +33,72 @@ static const az_span sr_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SR);
 static const az_span sig_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SIG);
 static const az_span se_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SE);
 
+// Copies the url-encoded resource of the SAS token, "<hostname>/devices/<device-id>" followed by
+// "/modules/<module-id>" for modules.
+static az_result _az_iot_hub_client_sas_copy_resource(
+    az_iot_hub_client const* client,
+    az_span destination,
+    az_span* out_remainder)
+{
+  _az_RETURN_IF_FAILED(
+      _az_span_copy_url_encode(destination, client->_internal.iot_hub_hostname, &destination));
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, az_span_size(devices_string));
+  destination = az_span_copy(destination, devices_string);
+
+  _az_RETURN_IF_FAILED(
+      _az_span_copy_url_encode(destination, client->_internal.device_id, &destination));
+
+  if (az_span_size(client->_internal.options.module_id) > 0)
+  {
+    _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, az_span_size(modules_string));
+    destination = az_span_copy(destination, modules_string);
+
+    _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
+        destination, client->_internal.options.module_id, &destination));
+  }
+
+  *out_remainder = destination;
+
+  return AZ_OK;
+}
+
+// Copies the parameters following the signature: "&se=" expiration_time_secs, plus, if key_name
+// size > 0, "&skn=" key_name, and the null terminator.
+static az_result _az_iot_hub_client_sas_copy_password_suffix(
+    az_span destination,
+    uint64_t token_expiration_epoch_time,
+    az_span key_name,
+    az_span* out_remainder)
+{
+  // Expiration
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(
+      destination, 1 /* AMPERSAND */ + az_span_size(se_string) + 1 /* EQUAL_SIGN */);
+  destination = az_span_copy_u8(destination, AMPERSAND);
+  destination = az_span_copy(destination, se_string);
+  destination = az_span_copy_u8(destination, EQUAL_SIGN);
+
+  _az_RETURN_IF_FAILED(az_span_u64toa(destination, token_expiration_epoch_time, &destination));
+
+  if (az_span_size(key_name) > 0)
+  {
+    // Key Name
+    _az_RETURN_IF_NOT_ENOUGH_SIZE(
+        destination,
+        1 /* AMPERSAND */ + az_span_size(skn_string) + 1 /* EQUAL_SIGN */ + az_span_size(key_name));
+    destination = az_span_copy_u8(destination, AMPERSAND);
+    destination = az_span_copy(destination, skn_string);
+    destination = az_span_copy_u8(destination, EQUAL_SIGN);
+    destination = az_span_copy(destination, key_name);
+  }
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, 1 /* NULL TERMINATOR */);
+
+  *out_remainder = az_span_copy_u8(destination, STRING_NULL_TERMINATOR);
+
+  return AZ_OK;
+}
+
 AZ_NODISCARD az_result az_iot_hub_client_sas_get_signature(
     az_iot_hub_client const* client,
     uint64_t token_expiration_epoch_time,
@@ -47,23 +113,7 @@ AZ_NODISCARD az_result az_iot_hub_client_sas_get_signature(
   az_span remainder = signature;
   int32_t signature_size = az_span_size(signature);
 
-  _az_RETURN_IF_FAILED(
-      _az_span_copy_url_encode(remainder, client->_internal.iot_hub_hostname, &remainder));
-
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, az_span_size(devices_string));
-  remainder = az_span_copy(remainder, devices_string);
-
-  _az_RETURN_IF_FAILED(
-      _az_span_copy_url_encode(remainder, client->_internal.device_id, &remainder));
-
-  if (az_span_size(client->_internal.options.module_id) > 0)
-  {
-    _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, az_span_size(modules_string));
-    remainder = az_span_copy(remainder, modules_string);
-
-    _az_RETURN_IF_FAILED(
-        _az_span_copy_url_encode(remainder, client->_internal.options.module_id, &remainder));
-  }
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_sas_copy_resource(client, remainder, &remainder));
 
   _az_RETURN_IF_NOT_ENOUGH_SIZE(
       remainder,
@@ -105,25 +155,9 @@ AZ_NODISCARD az_result az_iot_hub_client_sas_get_password(
   mqtt_password_span = az_span_copy(mqtt_password_span, sr_string);
   mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
 
-  _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
-      mqtt_password_span, client->_internal.iot_hub_hostname, &mqtt_password_span));
-
-  // Device ID
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, az_span_size(devices_string));
-  mqtt_password_span = az_span_copy(mqtt_password_span, devices_string);
-
-  _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
-      mqtt_password_span, client->_internal.device_id, &mqtt_password_span));
-
-  // Module ID
-  if (az_span_size(client->_internal.options.module_id) > 0)
-  {
-    _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, az_span_size(modules_string));
-    mqtt_password_span = az_span_copy(mqtt_password_span, modules_string);
-
-    _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
-        mqtt_password_span, client->_internal.options.module_id, &mqtt_password_span));
-  }
+  // Device ID and Module ID
+  _az_RETURN_IF_FAILED(
+      _az_iot_hub_client_sas_copy_resource(client, mqtt_password_span, &mqtt_password_span));
 
   // Signature
   _az_RETURN_IF_NOT_ENOUGH_SIZE(
@@ -136,31 +170,68 @@ AZ_NODISCARD az_result az_iot_hub_client_sas_get_password(
   _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
       mqtt_password_span, base64_hmac_sha256_signature, &mqtt_password_span));
 
-  // Expiration
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(
-      mqtt_password_span, 1 /* AMPERSAND */ + az_span_size(se_string) + 1 /* EQUAL_SIGN */);
-  mqtt_password_span = az_span_copy_u8(mqtt_password_span, AMPERSAND);
-  mqtt_password_span = az_span_copy(mqtt_password_span, se_string);
+  // Expiration and Key Name
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_sas_copy_password_suffix(
+      mqtt_password_span, token_expiration_epoch_time, key_name, &mqtt_password_span));
+
+  if (out_mqtt_password_length != NULL)
+  {
+    *out_mqtt_password_length
+        = mqtt_password_size - (size_t)az_span_size(mqtt_password_span) - 1 /* NULL TERMINATOR */;
+  }
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_sas_get_signed_password(
+    az_iot_hub_client const* client,
+    uint64_t token_expiration_epoch_time,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span key_name,
+    char* mqtt_password,
+    size_t mqtt_password_size,
+    size_t* out_mqtt_password_length)
+{
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION(token_expiration_epoch_time > 0);
+  _az_PRECONDITION_NOT_NULL(hmac_sha256);
+  _az_PRECONDITION_NOT_NULL(mqtt_password);
+  _az_PRECONDITION(mqtt_password_size > 0);
+
+  az_span mqtt_password_span = az_span_create((uint8_t*)mqtt_password, (int32_t)mqtt_password_size);
+
+  // SharedAccessSignature
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, az_span_size(sr_string) + 1 /* EQUAL_SIGN */);
+  mqtt_password_span = az_span_copy(mqtt_password_span, sr_string);
   mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
 
+  // The resource, already in place, followed by LF and the expiration time is the signature. Once
+  // signed, the signature parameter overwrites everything after the resource.
+  az_span signature = mqtt_password_span;
   _az_RETURN_IF_FAILED(
-      az_span_u64toa(mqtt_password_span, token_expiration_epoch_time, &mqtt_password_span));
+      _az_iot_hub_client_sas_copy_resource(client, mqtt_password_span, &mqtt_password_span));
 
-  if (az_span_size(key_name) > 0)
-  {
-    // Key Name
-    _az_RETURN_IF_NOT_ENOUGH_SIZE(
-        mqtt_password_span,
-        1 /* AMPERSAND */ + az_span_size(skn_string) + 1 /* EQUAL_SIGN */ + az_span_size(key_name));
-    mqtt_password_span = az_span_copy_u8(mqtt_password_span, AMPERSAND);
-    mqtt_password_span = az_span_copy(mqtt_password_span, skn_string);
-    mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
-    mqtt_password_span = az_span_copy(mqtt_password_span, key_name);
-  }
+  az_span remainder = mqtt_password_span;
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(
+      remainder,
+      1 + // LF
+          _az_iot_u64toa_size(token_expiration_epoch_time));
 
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, 1 /* NULL TERMINATOR */);
+  remainder = az_span_copy_u8(remainder, LF);
+
+  _az_RETURN_IF_FAILED(az_span_u64toa(remainder, token_expiration_epoch_time, &remainder));
+
+  signature = az_span_slice(signature, 0, az_span_size(signature) - az_span_size(remainder));
+  _az_LOG_WRITE(AZ_LOG_IOT_SAS_TOKEN, signature);
+
+  // Signature
+  _az_RETURN_IF_FAILED(_az_iot_sas_copy_signed_signature(
+      mqtt_password_span, signature, hmac_sha256, hmac_sha256_context, &mqtt_password_span));
 
-  mqtt_password_span = az_span_copy_u8(mqtt_password_span, STRING_NULL_TERMINATOR);
+  // Expiration and Key Name
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_sas_copy_password_suffix(
+      mqtt_password_span, token_expiration_epoch_time, key_name, &mqtt_password_span));
 
   if (out_mqtt_password_length != NULL)
   {
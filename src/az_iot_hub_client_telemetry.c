@@ -17,6 +17,40 @@ static const az_span telemetry_topic_prefix = AZ_SPAN_LITERAL_FROM_STR("devices/
 static const az_span telemetry_topic_modules_mid = AZ_SPAN_LITERAL_FROM_STR("/modules/");
 static const az_span telemetry_topic_suffix = AZ_SPAN_LITERAL_FROM_STR("/messages/events/");
 
+// Builds the topic from the static part cached by az_iot_hub_client_init(), so only the message
+// properties are appended.
+static AZ_NODISCARD az_result _az_iot_hub_client_telemetry_get_publish_topic_from_prefix(
+    az_iot_hub_client const* client,
+    az_iot_message_properties const* properties,
+    az_span mqtt_topic_span,
+    size_t* out_mqtt_topic_length)
+{
+  az_span const topic_prefix = client->_internal.telemetry_topic_prefix;
+  int32_t const properties_length
+      = properties == NULL ? 0 : properties->_internal.properties_written;
+  int32_t const required_length = az_span_size(topic_prefix) + properties_length;
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(
+      mqtt_topic_span, required_length + (int32_t)sizeof(null_terminator));
+
+  az_span remainder = az_span_copy(mqtt_topic_span, topic_prefix);
+
+  if (properties_length > 0)
+  {
+    remainder = az_span_copy(
+        remainder, az_span_slice(properties->_internal.properties_buffer, 0, properties_length));
+  }
+
+  az_span_copy_u8(remainder, null_terminator);
+
+  if (out_mqtt_topic_length)
+  {
+    *out_mqtt_topic_length = (size_t)required_length;
+  }
+
+  return AZ_OK;
+}
+
 AZ_NODISCARD az_result az_iot_hub_client_telemetry_get_publish_topic(
     az_iot_hub_client const* client,
     az_iot_message_properties const* properties,
@@ -31,6 +65,13 @@ AZ_NODISCARD az_result az_iot_hub_client_telemetry_get_publish_topic(
   const az_span* const module_id = &(client->_internal.options.module_id);
 
   az_span mqtt_topic_span = az_span_create((uint8_t*)mqtt_topic, (int32_t)mqtt_topic_size);
+
+  if (az_span_size(client->_internal.telemetry_topic_prefix) > 0)
+  {
+    return _az_iot_hub_client_telemetry_get_publish_topic_from_prefix(
+        client, properties, mqtt_topic_span, out_mqtt_topic_length);
+  }
+
   int32_t required_length = az_span_size(telemetry_topic_prefix)
       + az_span_size(client->_internal.device_id) + az_span_size(telemetry_topic_suffix);
   int32_t module_id_length = az_span_size(*module_id);
@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+
+#include <az_iot_hub_client_telemetry_batch.h>
+#include <az_json.h>
+#include <az_json_private.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+#include <az_span_internal.h>
+#include <az_span_private.h>
+
+#include <_az_cfg.h>
+
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_init(
+    az_iot_hub_client_telemetry_batch* batch,
+    az_span const* field_names,
+    int32_t field_count,
+    double* sample_buffer,
+    int32_t sample_capacity,
+    int32_t fractional_digits)
+{
+  _az_PRECONDITION_NOT_NULL(batch);
+  _az_PRECONDITION_NOT_NULL(field_names);
+  _az_PRECONDITION(field_count > 0);
+  _az_PRECONDITION_NOT_NULL(sample_buffer);
+  _az_PRECONDITION(sample_capacity > 0);
+  _az_PRECONDITION_RANGE(0, fractional_digits, _az_MAX_SUPPORTED_FRACTIONAL_DIGITS);
+
+  batch->_internal.field_names = field_names;
+  batch->_internal.field_count = field_count;
+  batch->_internal.samples = sample_buffer;
+  batch->_internal.capacity = sample_capacity;
+  batch->_internal.oldest_index = 0;
+  batch->_internal.count = 0;
+  batch->_internal.fractional_digits = fractional_digits;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_add_sample(
+    az_iot_hub_client_telemetry_batch* ref_batch,
+    double const* values,
+    bool* out_overwritten_oldest)
+{
+  _az_PRECONDITION_NOT_NULL(ref_batch);
+  _az_PRECONDITION_NOT_NULL(values);
+
+  int32_t const field_count = ref_batch->_internal.field_count;
+  int32_t const capacity = ref_batch->_internal.capacity;
+  bool const is_full = ref_batch->_internal.count == capacity;
+
+  int32_t slot = (ref_batch->_internal.oldest_index + ref_batch->_internal.count) % capacity;
+  double* sample = ref_batch->_internal.samples + (slot * field_count);
+
+  for (int32_t i = 0; i < field_count; i++)
+  {
+    // Non-finite numbers cannot be written as JSON.
+    _az_PRECONDITION(_az_isfinite(values[i]));
+    sample[i] = values[i];
+  }
+
+  if (is_full)
+  {
+    ref_batch->_internal.oldest_index = (ref_batch->_internal.oldest_index + 1) % capacity;
+  }
+  else
+  {
+    ref_batch->_internal.count++;
+  }
+
+  if (out_overwritten_oldest != NULL)
+  {
+    *out_overwritten_oldest = is_full;
+  }
+
+  return AZ_OK;
+}
+
+static double _az_iot_hub_client_telemetry_batch_get_value(
+    az_iot_hub_client_telemetry_batch const* batch,
+    int32_t sample_index,
+    int32_t field_index)
+{
+  int32_t slot = (batch->_internal.oldest_index + sample_index) % batch->_internal.capacity;
+  return batch->_internal.samples[(slot * batch->_internal.field_count) + field_index];
+}
+
+// Writes the payload with the given number of samples. When sample_count is 0, this writes the
+// skeleton of the payload (field names and empty arrays), whose size is the fixed cost of a batch.
+static AZ_NODISCARD az_result _az_iot_hub_client_telemetry_batch_write(
+    az_iot_hub_client_telemetry_batch const* batch,
+    az_span destination,
+    int32_t sample_count,
+    az_span* out_payload)
+{
+  az_json_writer jw;
+  _az_RETURN_IF_FAILED(az_json_writer_init(&jw, destination, NULL));
+  _az_RETURN_IF_FAILED(az_json_writer_append_begin_object(&jw));
+
+  for (int32_t field_index = 0; field_index < batch->_internal.field_count; field_index++)
+  {
+    _az_RETURN_IF_FAILED(
+        az_json_writer_append_property_name(&jw, batch->_internal.field_names[field_index]));
+    _az_RETURN_IF_FAILED(az_json_writer_append_begin_array(&jw));
+
+    for (int32_t sample_index = 0; sample_index < sample_count; sample_index++)
+    {
+      _az_RETURN_IF_FAILED(az_json_writer_append_double(
+          &jw,
+          _az_iot_hub_client_telemetry_batch_get_value(batch, sample_index, field_index),
+          batch->_internal.fractional_digits));
+    }
+
+    _az_RETURN_IF_FAILED(az_json_writer_append_end_array(&jw));
+  }
+
+  _az_RETURN_IF_FAILED(az_json_writer_append_end_object(&jw));
+
+  *out_payload = az_json_writer_get_bytes_used_in_destination(&jw);
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_get_payload(
+    az_iot_hub_client_telemetry_batch const* batch,
+    az_span destination,
+    int32_t max_size,
+    az_span* out_payload,
+    int32_t* out_sample_count)
+{
+  _az_PRECONDITION_NOT_NULL(batch);
+  _az_PRECONDITION_VALID_SPAN(destination, 1, false);
+  _az_PRECONDITION(max_size > 0);
+  _az_PRECONDITION_NOT_NULL(out_payload);
+  _az_PRECONDITION_NOT_NULL(out_sample_count);
+
+  // The payload may not grow into the space the JSON writer requires past the last token.
+  int32_t size_limit = az_span_size(destination) - AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK;
+  if (max_size < size_limit)
+  {
+    size_limit = max_size;
+  }
+
+  az_span payload = AZ_SPAN_EMPTY;
+  _az_RETURN_IF_FAILED(_az_iot_hub_client_telemetry_batch_write(batch, destination, 0, &payload));
+
+  int32_t payload_size = az_span_size(payload);
+  if (payload_size > size_limit)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  // Each sample adds the text of its values, plus one comma per field for all but the first
+  // sample. Measure the same text az_json_writer_append_double() writes, to find how many samples
+  // fit exactly.
+  uint8_t number_buffer[_az_MAX_SIZE_FOR_WRITING_DOUBLE];
+  az_span const number_span = AZ_SPAN_FROM_BUFFER(number_buffer);
+  int32_t sample_count = 0;
+
+  for (; sample_count < batch->_internal.count; sample_count++)
+  {
+    int32_t sample_size = sample_count > 0 ? batch->_internal.field_count : 0;
+
+    for (int32_t field_index = 0; field_index < batch->_internal.field_count; field_index++)
+    {
+      az_span remainder;
+      _az_RETURN_IF_FAILED(az_span_dtoa(
+          number_span,
+          _az_iot_hub_client_telemetry_batch_get_value(batch, sample_count, field_index),
+          batch->_internal.fractional_digits,
+          &remainder));
+      sample_size += _az_span_diff(remainder, number_span);
+    }
+
+    if (payload_size + sample_size > size_limit)
+    {
+      break;
+    }
+
+    payload_size += sample_size;
+  }
+
+  if (sample_count == 0 && batch->_internal.count > 0)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  if (sample_count > 0)
+  {
+    _az_RETURN_IF_FAILED(
+        _az_iot_hub_client_telemetry_batch_write(batch, destination, sample_count, &payload));
+  }
+
+  *out_payload = payload;
+  *out_sample_count = sample_count;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_remove_samples(
+    az_iot_hub_client_telemetry_batch* ref_batch,
+    int32_t sample_count)
+{
+  _az_PRECONDITION_NOT_NULL(ref_batch);
+  _az_PRECONDITION_RANGE(0, sample_count, ref_batch->_internal.count);
+
+  ref_batch->_internal.oldest_index
+      = (ref_batch->_internal.oldest_index + sample_count) % ref_batch->_internal.capacity;
+  ref_batch->_internal.count -= sample_count;
+
+  return AZ_OK;
+}
@@ -0,0 +1,192 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for the batched telemetry writer.
+ *
+ * @details Samples made of a fixed set of numeric fields are buffered in a bounded ring and
+ * serialized in a column-oriented form, where each field name is written once followed by the
+ * array of its values:
+ *
+ * @code
+ * {"temperature":[21.5,21.6,21.8],"humidity":[40.1,40.0,39.8]}
+ * @endcode
+ *
+ * The payload is sized exactly against a byte budget (such as the IoT Hub device-to-cloud message
+ * size limit), so a single publish carries as many of the oldest buffered samples as fit.
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_HUB_CLIENT_TELEMETRY_BATCH_H
+#define _az_IOT_HUB_CLIENT_TELEMETRY_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_result.h>
+#include <az_span.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The maximum size, in bytes, of a device-to-cloud message accepted by IoT Hub.
+ */
+#define AZ_IOT_HUB_CLIENT_TELEMETRY_MAX_MESSAGE_SIZE (256 * 1024)
+
+/**
+ * @brief The number of bytes the destination of
+ * az_iot_hub_client_telemetry_batch_get_payload() must hold beyond the payload itself.
+ *
+ * @details #az_json_writer requires some free space past the end of every token it appends. A
+ * payload is never allowed to grow into this area, so a destination of `max_size +
+ * AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK` bytes can be filled up to `max_size`.
+ */
+#define AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK 64
+
+/**
+ * @brief A bounded ring of telemetry samples, serialized as column-oriented JSON.
+ *
+ * @remarks Each sample holds one `double` value per field. When the ring is full, adding a sample
+ * overwrites the oldest one.
+ */
+typedef struct
+{
+  struct
+  {
+    az_span const* field_names;
+    int32_t field_count;
+    double* samples;
+    int32_t capacity;
+    int32_t oldest_index;
+    int32_t count;
+    int32_t fractional_digits;
+  } _internal;
+} az_iot_hub_client_telemetry_batch;
+
+/**
+ * @brief Initializes an #az_iot_hub_client_telemetry_batch.
+ *
+ * @param[out] batch The #az_iot_hub_client_telemetry_batch to initialize.
+ * @param[in] field_names An array of the JSON property names of each field of a sample. The array
+ * and the spans it points to must remain valid for the lifetime of \p batch.
+ * @param[in] field_count The number of elements in \p field_names.
+ * @param[in] sample_buffer Storage for the buffered samples. It must hold at least
+ * `sample_capacity * field_count` values and remain valid for the lifetime of \p batch.
+ * @param[in] sample_capacity The maximum number of samples buffered at once.
+ * @param[in] fractional_digits The number of digits after the decimal point written for each
+ * value. Must be between 0 and 15, inclusive.
+ *
+ * @pre \p batch must not be `NULL`.
+ * @pre \p field_names must not be `NULL`.
+ * @pre \p field_count must be greater than 0.
+ * @pre \p sample_buffer must not be `NULL`.
+ * @pre \p sample_capacity must be greater than 0.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The batch was initialized successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_init(
+    az_iot_hub_client_telemetry_batch* batch,
+    az_span const* field_names,
+    int32_t field_count,
+    double* sample_buffer,
+    int32_t sample_capacity,
+    int32_t fractional_digits);
+
+/**
+ * @brief Adds a sample to the batch, overwriting the oldest sample if the batch is full.
+ *
+ * @param[in,out] ref_batch The #az_iot_hub_client_telemetry_batch to add the sample to.
+ * @param[in] values An array with one finite value per field, in the order of the field names
+ * given to az_iot_hub_client_telemetry_batch_init().
+ * @param[out] out_overwritten_oldest Optional. Set to `true` if the oldest sample was dropped to
+ * make room for this one. Can be `NULL`.
+ *
+ * @pre \p ref_batch must not be `NULL`.
+ * @pre \p values must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The sample was added successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_add_sample(
+    az_iot_hub_client_telemetry_batch* ref_batch,
+    double const* values,
+    bool* out_overwritten_oldest);
+
+/**
+ * @brief Gets the number of samples currently buffered.
+ *
+ * @param[in] batch The #az_iot_hub_client_telemetry_batch to query.
+ *
+ * @pre \p batch must not be `NULL`.
+ *
+ * @return The number of buffered samples.
+ */
+AZ_NODISCARD AZ_INLINE int32_t
+az_iot_hub_client_telemetry_batch_get_sample_count(az_iot_hub_client_telemetry_batch const* batch)
+{
+  return batch->_internal.count;
+}
+
+/**
+ * @brief Writes the oldest buffered samples into a column-oriented JSON payload.
+ *
+ * @details As many samples as fit within \p max_size bytes are written, oldest first. The samples
+ * stay in the batch until az_iot_hub_client_telemetry_batch_remove_samples() is called, so a
+ * failed publish can be retried with the same payload.
+ *
+ * @param[in] batch The #az_iot_hub_client_telemetry_batch to serialize.
+ * @param[in] destination The buffer the JSON payload is written into. See
+ * #AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK.
+ * @param[in] max_size The maximum size of the payload, in bytes. Use
+ * #AZ_IOT_HUB_CLIENT_TELEMETRY_MAX_MESSAGE_SIZE for the IoT Hub limit.
+ * @param[out] out_payload The #az_span pointing to the JSON payload within \p destination.
+ * @param[out] out_sample_count The number of samples included in \p out_payload.
+ *
+ * @pre \p batch must not be `NULL`.
+ * @pre \p destination must be a valid, non-empty #az_span.
+ * @pre \p max_size must be greater than 0.
+ * @pre \p out_payload must not be `NULL`.
+ * @pre \p out_sample_count must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The payload was written successfully. If the batch is empty, the payload holds
+ * empty arrays and \p out_sample_count is 0.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE Not even a single sample fits within the limits.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_get_payload(
+    az_iot_hub_client_telemetry_batch const* batch,
+    az_span destination,
+    int32_t max_size,
+    az_span* out_payload,
+    int32_t* out_sample_count);
+
+/**
+ * @brief Removes the oldest samples from the batch.
+ *
+ * @details Typically called with the sample count returned by
+ * az_iot_hub_client_telemetry_batch_get_payload() once the payload has been published.
+ *
+ * @param[in,out] ref_batch The #az_iot_hub_client_telemetry_batch to remove samples from.
+ * @param[in] sample_count The number of samples to remove. Must not exceed the number of
+ * buffered samples.
+ *
+ * @pre \p ref_batch must not be `NULL`.
+ * @pre \p sample_count must be between 0 and the number of buffered samples, inclusive.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The samples were removed successfully.
+ */
+AZ_NODISCARD az_result az_iot_hub_client_telemetry_batch_remove_samples(
+    az_iot_hub_client_telemetry_batch* ref_batch,
+    int32_t sample_count);
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_HUB_CLIENT_TELEMETRY_BATCH_H
@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_iot_message_compression.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+
+#include <_az_cfg.h>
+
+// Compressed data is a sequence of groups of up to 8 tokens, each group preceded by a byte whose
+// bits, from the least significant one, tell whether the corresponding token is a literal byte
+// (0) or a match (1). A match takes 2 bytes: the 12 upper bits hold its offset back from the
+// current position minus 1, and the 4 lower bits its length minus _az_COMPRESSION_MIN_MATCH.
+#define _az_COMPRESSION_MIN_MATCH 3
+#define _az_COMPRESSION_MAX_MATCH (_az_COMPRESSION_MIN_MATCH + 15)
+
+// Property names of the IoT Plug and Play sample models and Azure IoT Central, and JSON tokens
+// frequent in telemetry and property payloads.
+static const az_span default_dictionary = AZ_SPAN_LITERAL_FROM_STR(
+    "{\"deviceInformation\":{\"__t\":\"c\",\"manufacturer\":\"\",\"model\":\"\",\"swVersion\":\"\","
+    "\"osName\":\"\",\"processorArchitecture\":\"\",\"processorManufacturer\":\"\","
+    "\"totalStorage\":\"totalMemory\":\"telemetryFrequencySecs\":{\"value\":\"ac\":200,\"av\":"
+    "\"ad\":\"success\"},\"status\":\"state\":\"battery\":\"timestamp\":\"20\",\"id\":\"name\":"
+    "\"type\":\"unit\":\"data\":true,false,null,\"magnetometerX\":,\"magnetometerY\":,"
+    "\"magnetometerZ\":,\"pitch\":,\"roll\":,\"accelerometerX\":,\"accelerometerY\":,"
+    "\"accelerometerZ\":{\"temperature\":,\"humidity\":,\"light\":,\"pressure\":,\"altitude\":"
+    "0.00,-0.00,");
+
+static const az_span default_content_encoding
+    = AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_MESSAGE_COMPRESSION_CONTENT_ENCODING);
+
+static const az_span content_encoding_property_name
+    = AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING);
+
+AZ_NODISCARD az_iot_message_compression_options az_iot_message_compression_options_default()
+{
+  return (az_iot_message_compression_options){ .dictionary = default_dictionary,
+                                               .content_encoding = default_content_encoding };
+}
+
+// Only the end of the dictionary fits in the window.
+static az_span _az_iot_message_compression_get_dictionary(
+    az_iot_message_compression_options const* options)
+{
+  int32_t const size = az_span_size(options->dictionary);
+
+  return size > AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE
+      ? az_span_slice_to_end(options->dictionary, size - AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE)
+      : options->dictionary;
+}
+
+// Positions index the dictionary followed by the data.
+AZ_INLINE uint8_t _az_iot_message_compression_get_byte(
+    uint8_t const* dictionary,
+    int32_t dictionary_size,
+    uint8_t const* data,
+    int32_t position)
+{
+  return position < dictionary_size ? dictionary[position] : data[position - dictionary_size];
+}
+
+AZ_NODISCARD az_result az_iot_message_compress(
+    az_iot_message_compression_options const* options,
+    az_span source,
+    az_span destination,
+    az_iot_message_properties* ref_properties,
+    az_span* out_compressed)
+{
+  _az_PRECONDITION_VALID_SPAN(source, 1, false);
+  _az_PRECONDITION_VALID_SPAN(destination, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_compressed);
+
+  az_iot_message_compression_options const default_options
+      = az_iot_message_compression_options_default();
+
+  if (options == NULL)
+  {
+    options = &default_options;
+  }
+
+  az_span const dictionary_span = _az_iot_message_compression_get_dictionary(options);
+  uint8_t const* const dictionary = az_span_ptr(dictionary_span);
+  int32_t const dictionary_size = az_span_size(dictionary_span);
+  uint8_t const* const data = az_span_ptr(source);
+  int32_t const source_size = az_span_size(source);
+  uint8_t* const out = az_span_ptr(destination);
+
+  // Compression is only worth it if the result is smaller than the source.
+  int32_t const out_limit
+      = az_span_size(destination) < source_size ? az_span_size(destination) : source_size - 1;
+  int32_t out_size = 0;
+  int32_t flags_index = 0;
+  int32_t flag_bit = 8;
+
+  for (int32_t index = 0; index < source_size;)
+  {
+    if (flag_bit == 8)
+    {
+      if (out_size >= out_limit)
+      {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+      }
+
+      flags_index = out_size++;
+      out[flags_index] = 0;
+      flag_bit = 0;
+    }
+
+    int32_t const position = dictionary_size + index;
+    int32_t const window_start = position > AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE
+        ? position - AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE
+        : 0;
+    int32_t const max_length = source_size - index < _az_COMPRESSION_MAX_MATCH
+        ? source_size - index
+        : _az_COMPRESSION_MAX_MATCH;
+    int32_t match_length = 0;
+    int32_t match_position = 0;
+
+    // Searches back from the nearest byte. A match may run past the current position, which the
+    // decoder reproduces by copying byte by byte.
+    for (int32_t candidate = position - 1;
+         candidate >= window_start && match_length < max_length;
+         candidate--)
+    {
+      // A candidate can only be longer than the best match so far if it matches the byte after it.
+      if (_az_iot_message_compression_get_byte(
+              dictionary, dictionary_size, data, candidate + match_length)
+          != data[index + match_length])
+      {
+        continue;
+      }
+
+      int32_t length = 0;
+
+      while (length < max_length
+             && _az_iot_message_compression_get_byte(
+                    dictionary, dictionary_size, data, candidate + length)
+                 == data[index + length])
+      {
+        length++;
+      }
+
+      if (length > match_length)
+      {
+        match_length = length;
+        match_position = candidate;
+      }
+    }
+
+    if (match_length >= _az_COMPRESSION_MIN_MATCH)
+    {
+      if (out_size + 2 > out_limit)
+      {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+      }
+
+      int32_t const offset = position - match_position - 1;
+      out[out_size++] = (uint8_t)(offset >> 4);
+      out[out_size++]
+          = (uint8_t)(((offset & 0x0F) << 4) | (match_length - _az_COMPRESSION_MIN_MATCH));
+      out[flags_index] |= (uint8_t)(1 << flag_bit);
+      index += match_length;
+    }
+    else
+    {
+      if (out_size + 1 > out_limit)
+      {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+      }
+
+      out[out_size++] = data[index];
+      index++;
+    }
+
+    flag_bit++;
+  }
+
+  if (ref_properties != NULL)
+  {
+    _az_RETURN_IF_FAILED(az_iot_message_properties_append(
+        ref_properties, content_encoding_property_name, options->content_encoding));
+  }
+
+  *out_compressed = az_span_slice(destination, 0, out_size);
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_message_decompress(
+    az_iot_message_compression_options const* options,
+    az_span source,
+    az_span destination,
+    az_span* out_decompressed)
+{
+  _az_PRECONDITION_VALID_SPAN(source, 0, true);
+  _az_PRECONDITION_VALID_SPAN(destination, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_decompressed);
+
+  az_iot_message_compression_options const default_options
+      = az_iot_message_compression_options_default();
+
+  if (options == NULL)
+  {
+    options = &default_options;
+  }
+
+  az_span const dictionary_span = _az_iot_message_compression_get_dictionary(options);
+  uint8_t const* const dictionary = az_span_ptr(dictionary_span);
+  int32_t const dictionary_size = az_span_size(dictionary_span);
+  uint8_t const* const in = az_span_ptr(source);
+  int32_t const in_size = az_span_size(source);
+  uint8_t* const out = az_span_ptr(destination);
+  int32_t const out_capacity = az_span_size(destination);
+  int32_t in_index = 0;
+  int32_t out_size = 0;
+
+  while (in_index < in_size)
+  {
+    uint8_t const flags = in[in_index++];
+
+    for (int32_t flag_bit = 0; flag_bit < 8 && in_index < in_size; flag_bit++)
+    {
+      if ((flags & (1 << flag_bit)) == 0)
+      {
+        if (out_size == out_capacity)
+        {
+          return AZ_ERROR_NOT_ENOUGH_SPACE;
+        }
+
+        out[out_size++] = in[in_index++];
+        continue;
+      }
+
+      if (in_index + 2 > in_size)
+      {
+        return AZ_ERROR_UNEXPECTED_END;
+      }
+
+      int32_t const offset = ((in[in_index] << 4) | (in[in_index + 1] >> 4)) + 1;
+      int32_t const length = (in[in_index + 1] & 0x0F) + _az_COMPRESSION_MIN_MATCH;
+      in_index += 2;
+
+      if (offset > dictionary_size + out_size)
+      {
+        return AZ_ERROR_ARG;
+      }
+
+      if (length > out_capacity - out_size)
+      {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+      }
+
+      for (int32_t i = 0; i < length; i++)
+      {
+        int32_t const position = dictionary_size + out_size - offset;
+        out[out_size++]
+            = _az_iot_message_compression_get_byte(dictionary, dictionary_size, out, position);
+      }
+    }
+  }
+
+  *out_decompressed = az_span_slice(destination, 0, out_size);
+
+  return AZ_OK;
+}
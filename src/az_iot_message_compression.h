@@ -0,0 +1,152 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for compressing message payloads before they are published.
+ *
+ * @details Payloads are compressed with LZSS over a window of the last
+ * #AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE bytes. The window starts out filled with a static
+ * dictionary of the JSON property names and tokens common in IoT Plug and Play telemetry, so even
+ * payloads of a few dozen bytes compress well. Compressing needs no memory besides the destination
+ * buffer, and decompressing needs none besides the dictionary and the destination buffer.
+ *
+ * The content encoding of a compressed payload is set by adding the
+ * #AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING property, so the receiving side knows how to
+ * decompress it. IoT Hub cannot route on the body of such messages.
+ *
+ * A typical flow is:
+ *
+ * @code
+ * az_iot_message_properties properties;
+ * az_iot_message_properties_init(&properties, AZ_SPAN_FROM_BUFFER(properties_buffer), 0);
+ *
+ * az_span compressed_payload;
+ * if (az_result_succeeded(az_iot_message_compress(
+ *         NULL, payload, compressed_buffer, &properties, &compressed_payload)))
+ * {
+ *   // Get the telemetry topic with properties, and publish compressed_payload.
+ * }
+ * else
+ * {
+ *   // Publish payload as is.
+ * }
+ * @endcode
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_MESSAGE_COMPRESSION_H
+#define _az_IOT_MESSAGE_COMPRESSION_H
+
+#include <stdint.h>
+
+#include <az_result.h>
+#include <az_span.h>
+
+#include <az_iot_common.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The number of preceding bytes, including the dictionary, that compressed data can refer
+ * to.
+ */
+#define AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE 4096
+
+/**
+ * @brief The content encoding of payloads compressed with the default dictionary.
+ * @note It can be used with IoT message property APIs by wrapping the macro in a
+ * #AZ_SPAN_FROM_STR macro as a parameter, where needed.
+ */
+#define AZ_IOT_MESSAGE_COMPRESSION_CONTENT_ENCODING "az-lzss1"
+
+/**
+ * @brief Message compression options.
+ */
+typedef struct
+{
+  /**
+   * The dictionary the window starts out filled with. Only its last
+   * #AZ_IOT_MESSAGE_COMPRESSION_WINDOW_SIZE bytes are used. Can be #AZ_SPAN_EMPTY.
+   */
+  az_span dictionary;
+
+  /**
+   * The value of the #AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING property added to compressed
+   * messages. It must identify the dictionary, so use a different value with a custom
+   * dictionary.
+   */
+  az_span content_encoding;
+} az_iot_message_compression_options;
+
+/**
+ * @brief Gets the default message compression options.
+ * @details Call this to obtain an initialized #az_iot_message_compression_options structure that
+ * can be afterwards modified and passed to az_iot_message_compress() and
+ * az_iot_message_decompress().
+ *
+ * @return The default dictionary, and #AZ_IOT_MESSAGE_COMPRESSION_CONTENT_ENCODING.
+ */
+AZ_NODISCARD az_iot_message_compression_options az_iot_message_compression_options_default();
+
+/**
+ * @brief Compresses a message payload.
+ *
+ * @param[in] options A reference to an #az_iot_message_compression_options structure. Can be
+ * `NULL` for the default options.
+ * @param[in] source The payload to compress.
+ * @param[in] destination The buffer the compressed payload is written into.
+ * @param[in,out] ref_properties Optional. The properties of the message, to which the
+ * #AZ_IOT_MESSAGE_PROPERTIES_CONTENT_ENCODING property is added. Can be `NULL`.
+ * @param[out] out_compressed The slice of \p destination holding the compressed payload.
+ *
+ * @pre \p source must be a valid, non-empty #az_span.
+ * @pre \p destination must be a valid #az_span.
+ * @pre \p out_compressed must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The payload was compressed successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The compressed payload would not be smaller than \p source,
+ * or does not fit in \p destination, or there is no space left in \p ref_properties. The payload
+ * should be published uncompressed, without the content encoding property.
+ */
+AZ_NODISCARD az_result az_iot_message_compress(
+    az_iot_message_compression_options const* options,
+    az_span source,
+    az_span destination,
+    az_iot_message_properties* ref_properties,
+    az_span* out_compressed);
+
+/**
+ * @brief Decompresses a payload compressed with az_iot_message_compress().
+ *
+ * @param[in] options A reference to the #az_iot_message_compression_options the payload was
+ * compressed with. Can be `NULL` for the default options.
+ * @param[in] source The compressed payload.
+ * @param[in] destination The buffer the payload is written into.
+ * @param[out] out_decompressed The slice of \p destination holding the payload.
+ *
+ * @pre \p source must be a valid #az_span.
+ * @pre \p destination must be a valid #az_span.
+ * @pre \p out_decompressed must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The payload was decompressed successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The payload does not fit in \p destination.
+ * @retval #AZ_ERROR_UNEXPECTED_END \p source is truncated.
+ * @retval #AZ_ERROR_ARG \p source refers to data outside of the window.
+ */
+AZ_NODISCARD az_result az_iot_message_decompress(
+    az_iot_message_compression_options const* options,
+    az_span source,
+    az_span destination,
+    az_span* out_decompressed);
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_MESSAGE_COMPRESSION_H
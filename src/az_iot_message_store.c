@@ -0,0 +1,559 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <az_iot_message_store.h>
+#include <az_precondition_internal.h>
+#include <az_result_internal.h>
+
+#include <_az_cfg.h>
+
+// A record is laid out as:
+//   [0]     magic
+//   [1]     state, 0xFF while pending and 0x00 once popped or evicted
+//   [2..3]  message length, little endian
+//   [4..7]  sequence number, little endian
+//   [8..9]  CRC-16/CCITT of every byte of the record except the state and the CRC itself
+//   [10..]  message
+#define _az_IOT_MESSAGE_STORE_RECORD_MAGIC 0xA5
+#define _az_IOT_MESSAGE_STORE_STATE_OFFSET 1
+#define _az_IOT_MESSAGE_STORE_STATE_PENDING 0xFF
+#define _az_IOT_MESSAGE_STORE_STATE_CONSUMED 0x00
+#define _az_IOT_MESSAGE_STORE_CRC_OFFSET 8
+#define _az_IOT_MESSAGE_STORE_CRC_INITIAL_VALUE 0xFFFF
+#define _az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE 32
+
+typedef struct
+{
+  int32_t length;
+  uint32_t sequence;
+  bool is_pending;
+} _az_iot_message_store_record;
+
+// CRC-16/CCITT, processed four bits at a time to keep the table small.
+static const uint16_t _az_iot_message_store_crc_table[16]
+    = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF };
+
+static uint16_t _az_iot_message_store_crc_update(uint16_t crc, uint8_t const* data, int32_t size)
+{
+  for (int32_t i = 0; i < size; i++)
+  {
+    crc = (uint16_t)((crc << 4) ^ _az_iot_message_store_crc_table[(crc >> 12) ^ (data[i] >> 4)]);
+    crc = (uint16_t)((crc << 4) ^ _az_iot_message_store_crc_table[(crc >> 12) ^ (data[i] & 0x0F)]);
+  }
+
+  return crc;
+}
+
+static uint16_t _az_iot_message_store_header_crc(uint8_t const* header)
+{
+  uint16_t crc = _az_iot_message_store_crc_update(_az_IOT_MESSAGE_STORE_CRC_INITIAL_VALUE, header, 1);
+  return _az_iot_message_store_crc_update(
+      crc,
+      header + _az_IOT_MESSAGE_STORE_STATE_OFFSET + 1,
+      _az_IOT_MESSAGE_STORE_CRC_OFFSET - _az_IOT_MESSAGE_STORE_STATE_OFFSET - 1);
+}
+
+static az_result _az_iot_message_store_ram_read(
+    void* context,
+    int32_t offset,
+    uint8_t* buffer,
+    int32_t size)
+{
+  (void)memcpy(buffer, (uint8_t*)context + offset, (size_t)size);
+  return AZ_OK;
+}
+
+static az_result _az_iot_message_store_ram_write(
+    void* context,
+    int32_t offset,
+    uint8_t const* data,
+    int32_t size)
+{
+  (void)memcpy((uint8_t*)context + offset, data, (size_t)size);
+  return AZ_OK;
+}
+
+AZ_INLINE int32_t
+_az_iot_message_store_offset(az_iot_message_store const* store, int64_t position)
+{
+  return (int32_t)(position % store->_internal.backend.size);
+}
+
+// Reads the header of the record at offset, which must be a header's worth of bytes before limit.
+static az_result _az_iot_message_store_read_header(
+    az_iot_message_store const* store,
+    int32_t offset,
+    int32_t limit,
+    uint8_t* header,
+    _az_iot_message_store_record* out_record)
+{
+  _az_RETURN_IF_FAILED(store->_internal.backend.read(
+      store->_internal.backend.context, offset, header, AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE));
+
+  out_record->length = (int32_t)(header[2] | (header[3] << 8));
+  out_record->sequence = (uint32_t)header[4] | ((uint32_t)header[5] << 8)
+      | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24);
+  out_record->is_pending
+      = header[_az_IOT_MESSAGE_STORE_STATE_OFFSET] == _az_IOT_MESSAGE_STORE_STATE_PENDING;
+
+  if (header[0] != _az_IOT_MESSAGE_STORE_RECORD_MAGIC || out_record->length == 0
+      || out_record->length > limit - offset - AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  return AZ_OK;
+}
+
+// Checks whether a complete record with a matching CRC, ending no further than limit, is at
+// offset.
+static az_result _az_iot_message_store_validate_record(
+    az_iot_message_store const* store,
+    int32_t offset,
+    int32_t limit,
+    _az_iot_message_store_record* out_record)
+{
+  uint8_t header[AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE];
+  _az_RETURN_IF_FAILED(_az_iot_message_store_read_header(store, offset, limit, header, out_record));
+
+  uint16_t crc = _az_iot_message_store_header_crc(header);
+  uint8_t chunk[_az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE];
+  int32_t chunk_offset = offset + AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE;
+  int32_t remaining = out_record->length;
+
+  while (remaining > 0)
+  {
+    int32_t const chunk_size
+        = remaining < _az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE ? remaining
+                                                            : _az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE;
+    _az_RETURN_IF_FAILED(store->_internal.backend.read(
+        store->_internal.backend.context, chunk_offset, chunk, chunk_size));
+    crc = _az_iot_message_store_crc_update(crc, chunk, chunk_size);
+    chunk_offset += chunk_size;
+    remaining -= chunk_size;
+  }
+
+  if (crc
+      != (uint16_t)(header[_az_IOT_MESSAGE_STORE_CRC_OFFSET]
+                    | (header[_az_IOT_MESSAGE_STORE_CRC_OFFSET + 1] << 8)))
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  return AZ_OK;
+}
+
+// Finds the first valid record at or after offset and ending no further than limit. Candidates are
+// located by their magic byte, so invalid or partially written bytes are skipped quickly.
+static az_result _az_iot_message_store_find_record(
+    az_iot_message_store const* store,
+    int32_t offset,
+    int32_t limit,
+    int32_t* out_offset,
+    _az_iot_message_store_record* out_record)
+{
+  uint8_t chunk[_az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE];
+
+  while (limit - offset >= AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE)
+  {
+    int32_t const chunk_size = limit - offset < _az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE
+        ? limit - offset
+        : _az_IOT_MESSAGE_STORE_SCAN_CHUNK_SIZE;
+    _az_RETURN_IF_FAILED(
+        store->_internal.backend.read(store->_internal.backend.context, offset, chunk, chunk_size));
+
+    int32_t i = 0;
+    while (i < chunk_size && chunk[i] != _az_IOT_MESSAGE_STORE_RECORD_MAGIC)
+    {
+      i++;
+    }
+
+    offset += i;
+
+    if (i == chunk_size || limit - offset < AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE)
+    {
+      continue;
+    }
+
+    az_result const result
+        = _az_iot_message_store_validate_record(store, offset, limit, out_record);
+
+    if (result != AZ_ERROR_ITEM_NOT_FOUND)
+    {
+      *out_offset = offset;
+      return result;
+    }
+
+    offset++;
+  }
+
+  return AZ_ERROR_ITEM_NOT_FOUND;
+}
+
+// Moves the head to the first pending record at or after position, skipping the padding left
+// before the end of the storage and anything that is not a valid pending record.
+static az_result _az_iot_message_store_seek_head(az_iot_message_store* ref_store, int64_t position)
+{
+  int32_t const size = ref_store->_internal.backend.size;
+
+  while (position < ref_store->_internal.tail_position)
+  {
+    int32_t const offset = _az_iot_message_store_offset(ref_store, position);
+    int64_t const remaining = ref_store->_internal.tail_position - position;
+    int32_t const limit
+        = remaining < (int64_t)(size - offset) ? offset + (int32_t)remaining : size;
+
+    int32_t record_offset;
+    _az_iot_message_store_record record;
+    az_result const result
+        = _az_iot_message_store_find_record(ref_store, offset, limit, &record_offset, &record);
+
+    if (result == AZ_ERROR_ITEM_NOT_FOUND)
+    {
+      position += limit - offset;
+      continue;
+    }
+
+    _az_RETURN_IF_FAILED(result);
+
+    position += record_offset - offset;
+
+    if (record.is_pending)
+    {
+      ref_store->_internal.head_position = position;
+      return AZ_OK;
+    }
+
+    position += AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE + record.length;
+  }
+
+  ref_store->_internal.head_position = ref_store->_internal.tail_position;
+  ref_store->_internal.count = 0;
+
+  return AZ_OK;
+}
+
+// Marks the record at the head as consumed and moves the head to the next pending record.
+static az_result _az_iot_message_store_remove_head(
+    az_iot_message_store* ref_store,
+    int32_t record_length)
+{
+  uint8_t const state = _az_IOT_MESSAGE_STORE_STATE_CONSUMED;
+  _az_RETURN_IF_FAILED(ref_store->_internal.backend.write(
+      ref_store->_internal.backend.context,
+      _az_iot_message_store_offset(ref_store, ref_store->_internal.head_position)
+          + _az_IOT_MESSAGE_STORE_STATE_OFFSET,
+      &state,
+      1));
+
+  ref_store->_internal.count--;
+
+  return _az_iot_message_store_seek_head(
+      ref_store,
+      ref_store->_internal.head_position + AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE
+          + record_length);
+}
+
+// Discards the record at the head after it was found corrupted. Its length cannot be trusted, so
+// the next valid record is searched for from the following byte.
+static az_result _az_iot_message_store_discard_head(az_iot_message_store* ref_store)
+{
+  if (ref_store->_internal.count > 0)
+  {
+    ref_store->_internal.count--;
+  }
+
+  return _az_iot_message_store_seek_head(ref_store, ref_store->_internal.head_position + 1);
+}
+
+// Rebuilds the head, tail and count from the records found on the backend. The newest record,
+// pending or not, ends at the tail, and the oldest pending record is the head.
+static az_result _az_iot_message_store_recover(az_iot_message_store* ref_store)
+{
+  int32_t const size = ref_store->_internal.backend.size;
+  bool found_record = false;
+  bool found_pending_record = false;
+  uint32_t newest_sequence = 0;
+  uint32_t oldest_pending_sequence = 0;
+  int32_t tail_offset = 0;
+  int32_t head_offset = 0;
+  int32_t count = 0;
+  int32_t offset = 0;
+
+  while (true)
+  {
+    _az_iot_message_store_record record;
+    az_result const result
+        = _az_iot_message_store_find_record(ref_store, offset, size, &offset, &record);
+
+    if (result == AZ_ERROR_ITEM_NOT_FOUND)
+    {
+      break;
+    }
+
+    _az_RETURN_IF_FAILED(result);
+
+    int32_t const end_offset = offset + AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE + record.length;
+
+    // Sequence numbers are compared as a signed distance, so they may wrap around.
+    if (!found_record || (int32_t)(record.sequence - newest_sequence) > 0)
+    {
+      found_record = true;
+      newest_sequence = record.sequence;
+      tail_offset = end_offset;
+    }
+
+    if (record.is_pending)
+    {
+      count++;
+
+      if (!found_pending_record || (int32_t)(record.sequence - oldest_pending_sequence) < 0)
+      {
+        found_pending_record = true;
+        oldest_pending_sequence = record.sequence;
+        head_offset = offset;
+      }
+    }
+
+    offset = end_offset;
+  }
+
+  int64_t tail_position = tail_offset;
+  if (count > 0 && head_offset >= tail_offset)
+  {
+    tail_position += size;
+  }
+
+  // The rest of the block at the tail may hold a partially written record, so writing resumes at
+  // the next block, which is erased first.
+  if (ref_store->_internal.backend.erase != NULL)
+  {
+    int32_t const block_size = ref_store->_internal.backend.erase_block_size;
+    tail_position = ((tail_position + block_size - 1) / block_size) * block_size;
+  }
+
+  ref_store->_internal.tail_position = tail_position;
+  ref_store->_internal.head_position = count > 0 ? head_offset : tail_position;
+  ref_store->_internal.count = count;
+  ref_store->_internal.next_sequence = found_record ? newest_sequence + 1 : 0;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_iot_message_store_backend az_iot_message_store_ram_backend_create(az_span buffer)
+{
+  _az_PRECONDITION_VALID_SPAN(buffer, 1, false);
+
+  az_iot_message_store_backend backend;
+  backend.read = _az_iot_message_store_ram_read;
+  backend.write = _az_iot_message_store_ram_write;
+  backend.erase = NULL;
+  backend.size = az_span_size(buffer);
+  backend.erase_block_size = 0;
+  backend.context = az_span_ptr(buffer);
+
+  return backend;
+}
+
+AZ_NODISCARD az_result az_iot_message_store_init(
+    az_iot_message_store* store,
+    az_iot_message_store_backend const* backend)
+{
+  _az_PRECONDITION_NOT_NULL(store);
+  _az_PRECONDITION_NOT_NULL(backend);
+  _az_PRECONDITION_NOT_NULL(backend->read);
+  _az_PRECONDITION_NOT_NULL(backend->write);
+  _az_PRECONDITION(backend->size > AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE);
+  _az_PRECONDITION(
+      backend->erase == NULL
+      || (backend->erase_block_size > 0 && backend->size % backend->erase_block_size == 0));
+
+  store->_internal.backend = *backend;
+
+  return _az_iot_message_store_recover(store);
+}
+
+AZ_NODISCARD az_result
+az_iot_message_store_append(az_iot_message_store* ref_store, az_span message)
+{
+  _az_PRECONDITION_NOT_NULL(ref_store);
+  _az_PRECONDITION_VALID_SPAN(message, 1, false);
+
+  az_iot_message_store_backend const* backend = &ref_store->_internal.backend;
+  int32_t const message_size = az_span_size(message);
+
+  if (message_size > AZ_IOT_MESSAGE_STORE_MAX_MESSAGE_SIZE
+      || message_size > backend->size - AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  int32_t const record_size = AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE + message_size;
+  int64_t position;
+  int32_t offset;
+  int32_t reserved_size;
+
+  while (true)
+  {
+    position = ref_store->_internal.tail_position;
+    offset = _az_iot_message_store_offset(ref_store, position);
+
+    // Records never wrap around the end of the storage; the space left there is padding.
+    if (offset + record_size > backend->size)
+    {
+      position += backend->size - offset;
+      offset = 0;
+    }
+
+    // With erasable storage, the whole of every block the record enters must be free.
+    reserved_size = record_size;
+    if (backend->erase != NULL)
+    {
+      int32_t const block_size = backend->erase_block_size;
+      reserved_size = ((offset + record_size + block_size - 1) / block_size) * block_size - offset;
+    }
+
+    if (ref_store->_internal.head_position == ref_store->_internal.tail_position
+        || position + reserved_size - ref_store->_internal.head_position <= backend->size)
+    {
+      break;
+    }
+
+    // Evict the oldest message.
+    _az_RETURN_IF_FAILED(az_iot_message_store_pop(ref_store));
+  }
+
+  if (backend->erase != NULL)
+  {
+    int32_t const block_size = backend->erase_block_size;
+
+    for (int32_t block_offset = ((offset + block_size - 1) / block_size) * block_size;
+         block_offset < offset + reserved_size;
+         block_offset += block_size)
+    {
+      _az_RETURN_IF_FAILED(backend->erase(backend->context, block_offset, block_size));
+    }
+  }
+
+  uint32_t const sequence = ref_store->_internal.next_sequence;
+  uint8_t header[AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE];
+  header[0] = _az_IOT_MESSAGE_STORE_RECORD_MAGIC;
+  header[_az_IOT_MESSAGE_STORE_STATE_OFFSET] = _az_IOT_MESSAGE_STORE_STATE_PENDING;
+  header[2] = (uint8_t)message_size;
+  header[3] = (uint8_t)(message_size >> 8);
+  header[4] = (uint8_t)sequence;
+  header[5] = (uint8_t)(sequence >> 8);
+  header[6] = (uint8_t)(sequence >> 16);
+  header[7] = (uint8_t)(sequence >> 24);
+
+  uint16_t const crc = _az_iot_message_store_crc_update(
+      _az_iot_message_store_header_crc(header), az_span_ptr(message), message_size);
+  header[_az_IOT_MESSAGE_STORE_CRC_OFFSET] = (uint8_t)crc;
+  header[_az_IOT_MESSAGE_STORE_CRC_OFFSET + 1] = (uint8_t)(crc >> 8);
+
+  _az_RETURN_IF_FAILED(
+      backend->write(backend->context, offset, header, AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE));
+  _az_RETURN_IF_FAILED(backend->write(
+      backend->context,
+      offset + AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE,
+      az_span_ptr(message),
+      message_size));
+
+  if (ref_store->_internal.head_position == ref_store->_internal.tail_position)
+  {
+    ref_store->_internal.head_position = position;
+  }
+
+  ref_store->_internal.tail_position = position + record_size;
+  ref_store->_internal.next_sequence = sequence + 1;
+  ref_store->_internal.count++;
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_message_store_peek(
+    az_iot_message_store* ref_store,
+    az_span destination,
+    az_span* out_message)
+{
+  _az_PRECONDITION_NOT_NULL(ref_store);
+  _az_PRECONDITION_NOT_NULL(out_message);
+
+  while (ref_store->_internal.head_position != ref_store->_internal.tail_position)
+  {
+    int32_t const offset
+        = _az_iot_message_store_offset(ref_store, ref_store->_internal.head_position);
+    uint8_t header[AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE];
+    _az_iot_message_store_record record;
+    az_result result = _az_iot_message_store_read_header(
+        ref_store, offset, ref_store->_internal.backend.size, header, &record);
+
+    if (az_result_succeeded(result))
+    {
+      if (record.length > az_span_size(destination))
+      {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+      }
+
+      _az_RETURN_IF_FAILED(ref_store->_internal.backend.read(
+          ref_store->_internal.backend.context,
+          offset + AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE,
+          az_span_ptr(destination),
+          record.length));
+
+      uint16_t const crc = _az_iot_message_store_crc_update(
+          _az_iot_message_store_header_crc(header), az_span_ptr(destination), record.length);
+
+      if (crc
+          == (uint16_t)(header[_az_IOT_MESSAGE_STORE_CRC_OFFSET]
+                        | (header[_az_IOT_MESSAGE_STORE_CRC_OFFSET + 1] << 8)))
+      {
+        *out_message = az_span_slice(destination, 0, record.length);
+        return AZ_OK;
+      }
+    }
+    else if (result != AZ_ERROR_ITEM_NOT_FOUND)
+    {
+      return result;
+    }
+
+    // The record was corrupted after the head moved to it.
+    _az_RETURN_IF_FAILED(_az_iot_message_store_discard_head(ref_store));
+  }
+
+  return AZ_ERROR_ITEM_NOT_FOUND;
+}
+
+AZ_NODISCARD az_result az_iot_message_store_pop(az_iot_message_store* ref_store)
+{
+  _az_PRECONDITION_NOT_NULL(ref_store);
+
+  if (ref_store->_internal.head_position == ref_store->_internal.tail_position)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  uint8_t header[AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE];
+  _az_iot_message_store_record record;
+  az_result const result = _az_iot_message_store_read_header(
+      ref_store,
+      _az_iot_message_store_offset(ref_store, ref_store->_internal.head_position),
+      ref_store->_internal.backend.size,
+      header,
+      &record);
+
+  if (result == AZ_ERROR_ITEM_NOT_FOUND)
+  {
+    // The record was corrupted after the head moved to it.
+    return _az_iot_message_store_discard_head(ref_store);
+  }
+
+  _az_RETURN_IF_FAILED(result);
+
+  return _az_iot_message_store_remove_head(ref_store, record.length);
+}
@@ -0,0 +1,272 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/**
+ * @file
+ *
+ * @brief Definition for a store-and-forward queue of outbound messages.
+ *
+ * @details Messages that cannot be published while the device is offline are appended to a
+ * fixed-size ring of records kept on a pluggable backing store, and are forwarded oldest first
+ * once the device reconnects. When the ring is full, the oldest messages are evicted to make room
+ * for new ones.
+ *
+ * Each record is protected by a CRC, and delivered or evicted records are marked in place, so a
+ * store kept on persistent memory (such as a flash partition or a memory-mapped file) is recovered
+ * by az_iot_message_store_init() after a restart. Records are only ever written sequentially and
+ * marked by clearing bits, so the backend can be NOR flash.
+ *
+ * A typical flow is:
+ *
+ * @code
+ * // While offline:
+ * az_iot_message_store_append(&store, message);
+ *
+ * // Once connected, at the desired rate:
+ * az_span message;
+ * if (az_result_succeeded(az_iot_message_store_peek(&store, destination, &message)))
+ * {
+ *   // Publish message.
+ *   az_iot_message_store_pop(&store);
+ * }
+ * @endcode
+ *
+ * @note You MUST NOT use any symbols (macros, functions, structures, enums, etc.)
+ * prefixed with an underscore ('_') directly in your application code. These symbols
+ * are part of Azure SDK's internal implementation; we do not document these symbols
+ * and they are subject to change in future versions of the SDK which would break your code.
+ */
+
+#ifndef _az_IOT_MESSAGE_STORE_H
+#define _az_IOT_MESSAGE_STORE_H
+
+#include <stdint.h>
+
+#include <az_result.h>
+#include <az_span.h>
+
+#include <_az_cfg_prefix.h>
+
+/**
+ * @brief The number of bytes of backing storage used by each record in addition to its message.
+ */
+#define AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE 10
+
+/**
+ * @brief The maximum size, in bytes, of a message that can be appended to a store.
+ */
+#define AZ_IOT_MESSAGE_STORE_MAX_MESSAGE_SIZE UINT16_MAX
+
+/**
+ * @brief Reads bytes from the backing storage.
+ *
+ * @param[in] context The context of the #az_iot_message_store_backend.
+ * @param[in] offset The offset, in bytes, from the beginning of the backing storage.
+ * @param[out] buffer The buffer to read into.
+ * @param[in] size The number of bytes to read.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ */
+typedef az_result (
+    *az_iot_message_store_read_fn)(void* context, int32_t offset, uint8_t* buffer, int32_t size);
+
+/**
+ * @brief Writes bytes to the backing storage.
+ *
+ * @param[in] context The context of the #az_iot_message_store_backend.
+ * @param[in] offset The offset, in bytes, from the beginning of the backing storage.
+ * @param[in] data The bytes to write.
+ * @param[in] size The number of bytes to write.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ */
+typedef az_result (*az_iot_message_store_write_fn)(
+    void* context,
+    int32_t offset,
+    uint8_t const* data,
+    int32_t size);
+
+/**
+ * @brief Erases a block of the backing storage before it is written again.
+ *
+ * @param[in] context The context of the #az_iot_message_store_backend.
+ * @param[in] offset The offset, in bytes, of the block. A multiple of `erase_block_size`.
+ * @param[in] size The size of the block, `erase_block_size`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ */
+typedef az_result (*az_iot_message_store_erase_fn)(void* context, int32_t offset, int32_t size);
+
+/**
+ * @brief The backing storage of an #az_iot_message_store.
+ *
+ * @remarks A store on RAM, or on a memory-mapped file, can use
+ * az_iot_message_store_ram_backend_create(). A flash partition needs `read`, `write` and `erase`
+ * implemented on top of the platform's flash API.
+ */
+typedef struct
+{
+  /**
+   * Reads from the backing storage.
+   */
+  az_iot_message_store_read_fn read;
+
+  /**
+   * Writes to the backing storage. Written bytes are either erased, or were last written as
+   * `0xFF` and are now written as `0x00`.
+   */
+  az_iot_message_store_write_fn write;
+
+  /**
+   * Optional. Erases a block of the backing storage. Can be `NULL` for storage that can be
+   * overwritten, such as RAM.
+   */
+  az_iot_message_store_erase_fn erase;
+
+  /**
+   * The size, in bytes, of the backing storage. If `erase` is set, it must be a multiple of
+   * `erase_block_size`.
+   */
+  int32_t size;
+
+  /**
+   * The size, in bytes, of the blocks erased by `erase`. Ignored if `erase` is `NULL`.
+   */
+  int32_t erase_block_size;
+
+  /**
+   * The context passed to `read`, `write` and `erase`.
+   */
+  void* context;
+} az_iot_message_store_backend;
+
+/**
+ * @brief A store-and-forward queue of messages kept on an #az_iot_message_store_backend.
+ */
+typedef struct
+{
+  struct
+  {
+    az_iot_message_store_backend backend;
+    // Positions only ever increase; the offset in the backing storage is the position modulo its
+    // size.
+    int64_t head_position;
+    int64_t tail_position;
+    int32_t count;
+    uint32_t next_sequence;
+  } _internal;
+} az_iot_message_store;
+
+/**
+ * @brief Creates an #az_iot_message_store_backend that keeps the store in memory.
+ *
+ * @param[in] buffer The memory used as backing storage. It must remain valid for the lifetime of
+ * the stores using the backend. It can be the mapping of a file, for a store that persists across
+ * restarts.
+ *
+ * @pre \p buffer must be a valid, non-empty #az_span.
+ *
+ * @return The #az_iot_message_store_backend.
+ */
+AZ_NODISCARD az_iot_message_store_backend az_iot_message_store_ram_backend_create(az_span buffer);
+
+/**
+ * @brief Initializes an #az_iot_message_store, recovering the messages found on its backend.
+ *
+ * @details The backing storage is scanned for valid records, so messages appended and not yet
+ * popped before a restart are forwarded after it. Invalid or partially written records are
+ * ignored. To start with an empty store, clear or erase the backing storage before calling this
+ * function.
+ *
+ * @param[out] store The #az_iot_message_store to initialize.
+ * @param[in] backend The backing storage of the store. Its callbacks and context must remain
+ * valid for the lifetime of \p store.
+ *
+ * @pre \p store must not be `NULL`.
+ * @pre \p backend must not be `NULL`.
+ * @pre `backend->read` and `backend->write` must not be `NULL`.
+ * @pre `backend->size` must be greater than #AZ_IOT_MESSAGE_STORE_RECORD_HEADER_SIZE.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The store was initialized successfully.
+ * @retval Other Failures returned by the backend.
+ */
+AZ_NODISCARD az_result az_iot_message_store_init(
+    az_iot_message_store* store,
+    az_iot_message_store_backend const* backend);
+
+/**
+ * @brief Appends a message to the store, evicting the oldest messages if needed to make room.
+ *
+ * @param[in,out] ref_store The #az_iot_message_store to use for this call.
+ * @param[in] message The message to append.
+ *
+ * @pre \p ref_store must not be `NULL`.
+ * @pre \p message must be a valid, non-empty #az_span.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The message was appended successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The message is larger than
+ * #AZ_IOT_MESSAGE_STORE_MAX_MESSAGE_SIZE or than the backing storage can ever hold.
+ * @retval Other Failures returned by the backend.
+ */
+AZ_NODISCARD az_result
+az_iot_message_store_append(az_iot_message_store* ref_store, az_span message);
+
+/**
+ * @brief Reads the oldest message of the store, without removing it.
+ *
+ * @details Records that fail their CRC check are discarded.
+ *
+ * @param[in,out] ref_store The #az_iot_message_store to use for this call.
+ * @param[in] destination The buffer the message is read into.
+ * @param[out] out_message The slice of \p destination holding the message.
+ *
+ * @pre \p ref_store must not be `NULL`.
+ * @pre \p out_message must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The message was read successfully.
+ * @retval #AZ_ERROR_ITEM_NOT_FOUND The store is empty.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE \p destination is too small for the message. The message can
+ * be removed with az_iot_message_store_pop().
+ * @retval Other Failures returned by the backend.
+ */
+AZ_NODISCARD az_result az_iot_message_store_peek(
+    az_iot_message_store* ref_store,
+    az_span destination,
+    az_span* out_message);
+
+/**
+ * @brief Removes the oldest message of the store.
+ *
+ * @details Call once the message read by az_iot_message_store_peek() has been forwarded.
+ *
+ * @param[in,out] ref_store The #az_iot_message_store to use for this call.
+ *
+ * @pre \p ref_store must not be `NULL`.
+ *
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The message was removed successfully.
+ * @retval #AZ_ERROR_ITEM_NOT_FOUND The store is empty.
+ * @retval Other Failures returned by the backend.
+ */
+AZ_NODISCARD az_result az_iot_message_store_pop(az_iot_message_store* ref_store);
+
+/**
+ * @brief Gets the number of messages in the store.
+ *
+ * @param[in] store The #az_iot_message_store to query.
+ *
+ * @pre \p store must not be `NULL`.
+ *
+ * @return The number of messages.
+ */
+AZ_NODISCARD AZ_INLINE int32_t az_iot_message_store_get_count(az_iot_message_store const* store)
+{
+  return store->_internal.count;
+}
+
+#include <_az_cfg_suffix.h>
+
+#endif // _az_IOT_MESSAGE_STORE_H
@@ -246,6 +246,50 @@ AZ_INLINE az_iot_status _az_iot_status_from_extended_status(uint32_t extended_st
   return (az_iot_status)(extended_status / 1000);
 }
 
+// Reads the next token as a string. If ref_destination is NULL, the string is a slice of the
+// payload, otherwise it is copied into ref_destination, which is advanced past it.
+AZ_INLINE az_result _az_iot_provisioning_client_parse_string(
+    az_json_reader* jr,
+    az_span* ref_destination,
+    az_span* out_value)
+{
+  _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
+  if (jr->token.kind != AZ_JSON_TOKEN_STRING)
+  {
+    return AZ_ERROR_ITEM_NOT_FOUND;
+  }
+
+  if (ref_destination == NULL)
+  {
+    *out_value = jr->token.slice;
+  }
+  else
+  {
+    _az_RETURN_IF_NOT_ENOUGH_SIZE(*ref_destination, jr->token.size);
+    *out_value = az_span_slice(*ref_destination, 0, jr->token.size);
+    *ref_destination = az_json_token_copy_into_span(&jr->token, *ref_destination);
+  }
+
+  return AZ_OK;
+}
+
+// Error details are only kept if the payload is parsed in place, they are not copied.
+AZ_INLINE az_result _az_iot_provisioning_client_parse_error_string(
+    az_json_reader* jr,
+    az_span const* destination,
+    az_span* out_value)
+{
+  az_span value;
+  _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_string(jr, NULL, &value));
+
+  if (destination == NULL)
+  {
+    *out_value = value;
+  }
+
+  return AZ_OK;
+}
+
 /*
 Documented at
 https://docs.microsoft.com/rest/api/iot-dps/device/runtime-registration/register-device#deviceregistrationresult
@@ -278,6 +322,7 @@ AZ_INLINE az_result _az_iot_provisioning_client_parse_payload_error_code(
 
 AZ_INLINE az_result _az_iot_provisioning_client_payload_registration_state_parse(
     az_json_reader* jr,
+    az_span* ref_destination,
     az_iot_provisioning_client_registration_state* out_state)
 {
   if (jr->token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT)
@@ -294,41 +339,25 @@ AZ_INLINE az_result _az_iot_provisioning_client_payload_registration_state_parse
   {
     if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("assignedHub")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
-      if (jr->token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_state->assigned_hub_hostname = jr->token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_string(
+          jr, ref_destination, &out_state->assigned_hub_hostname));
       found_assigned_hub = true;
     }
     else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("deviceId")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
-      if (jr->token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_state->device_id = jr->token.slice;
+      _az_RETURN_IF_FAILED(
+          _az_iot_provisioning_client_parse_string(jr, ref_destination, &out_state->device_id));
       found_device_id = true;
     }
     else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("errorMessage")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
-      if (jr->token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_state->error_message = jr->token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_error_string(
+          jr, ref_destination, &out_state->error_message));
     }
     else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("lastUpdatedDateTimeUtc")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
-      if (jr->token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_state->error_timestamp = jr->token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_error_string(
+          jr, ref_destination, &out_state->error_timestamp));
     }
     else if (az_result_succeeded(
                  _az_iot_provisioning_client_parse_payload_error_code(jr, out_state)))
@@ -350,30 +379,31 @@ AZ_INLINE az_result _az_iot_provisioning_client_payload_registration_state_parse
   return AZ_OK;
 }
 
+// The status is compared as a token, so it can straddle payload chunks.
 AZ_NODISCARD static az_result _az_iot_provisioning_client_parse_operation_status(
-    az_span response_operation_status,
+    az_json_token const* response_operation_status,
     az_iot_provisioning_client_operation_status* out_operation_status)
 {
-  _az_PRECONDITION_VALID_SPAN(response_operation_status, 0, false);
+  _az_PRECONDITION_NOT_NULL(response_operation_status);
   _az_PRECONDITION_NOT_NULL(out_operation_status);
 
-  if (az_span_is_content_equal(response_operation_status, AZ_SPAN_FROM_STR("assigning")))
+  if (az_json_token_is_text_equal(response_operation_status, AZ_SPAN_FROM_STR("assigning")))
   {
     *out_operation_status = AZ_IOT_PROVISIONING_STATUS_ASSIGNING;
   }
-  else if (az_span_is_content_equal(response_operation_status, AZ_SPAN_FROM_STR("assigned")))
+  else if (az_json_token_is_text_equal(response_operation_status, AZ_SPAN_FROM_STR("assigned")))
   {
     *out_operation_status = AZ_IOT_PROVISIONING_STATUS_ASSIGNED;
   }
-  else if (az_span_is_content_equal(response_operation_status, AZ_SPAN_FROM_STR("failed")))
+  else if (az_json_token_is_text_equal(response_operation_status, AZ_SPAN_FROM_STR("failed")))
   {
     *out_operation_status = AZ_IOT_PROVISIONING_STATUS_FAILED;
   }
-  else if (az_span_is_content_equal(response_operation_status, AZ_SPAN_FROM_STR("unassigned")))
+  else if (az_json_token_is_text_equal(response_operation_status, AZ_SPAN_FROM_STR("unassigned")))
   {
     *out_operation_status = AZ_IOT_PROVISIONING_STATUS_UNASSIGNED;
   }
-  else if (az_span_is_content_equal(response_operation_status, AZ_SPAN_FROM_STR("disabled")))
+  else if (az_json_token_is_text_equal(response_operation_status, AZ_SPAN_FROM_STR("disabled")))
   {
     *out_operation_status = AZ_IOT_PROVISIONING_STATUS_DISABLED;
   }
@@ -385,16 +415,15 @@ AZ_NODISCARD static az_result _az_iot_provisioning_client_parse_operation_status
   return AZ_OK;
 }
 
+// If ref_destination is NULL, the strings of out_response are slices of the payload, otherwise
+// they are copied into ref_destination.
 AZ_INLINE az_result az_iot_provisioning_client_parse_payload(
-    az_span received_payload,
+    az_json_reader* jr,
+    az_span* ref_destination,
     az_iot_provisioning_client_register_response* out_response)
 {
-  // Parse the payload:
-  az_json_reader jr;
-  _az_RETURN_IF_FAILED(az_json_reader_init(&jr, received_payload, NULL));
-
-  _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-  if (jr.token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT)
+  _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
+  if (jr->token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT)
   {
     return AZ_ERROR_UNEXPECTED_CHAR;
   }
@@ -405,73 +434,57 @@ AZ_INLINE az_result az_iot_provisioning_client_parse_payload(
   bool found_operation_status = false;
   bool found_error = false;
 
-  while (az_result_succeeded(az_json_reader_next_token(&jr))
-         && jr.token.kind != AZ_JSON_TOKEN_END_OBJECT)
+  while (az_result_succeeded(az_json_reader_next_token(jr))
+         && jr->token.kind != AZ_JSON_TOKEN_END_OBJECT)
   {
-    if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("operationId")))
+    if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("operationId")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-      if (jr.token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_response->operation_id = jr.token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_string(
+          jr, ref_destination, &out_response->operation_id));
       found_operation_id = true;
     }
-    else if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("status")))
+    else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("status")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-      if (jr.token.kind != AZ_JSON_TOKEN_STRING)
+      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
+      if (jr->token.kind != AZ_JSON_TOKEN_STRING)
       {
         return AZ_ERROR_ITEM_NOT_FOUND;
       }
       _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_operation_status(
-          jr.token.slice, &out_response->operation_status));
+          &jr->token, &out_response->operation_status));
 
       found_operation_status = true;
     }
-    else if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("registrationState")))
+    else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("registrationState")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
+      _az_RETURN_IF_FAILED(az_json_reader_next_token(jr));
       _az_RETURN_IF_FAILED(_az_iot_provisioning_client_payload_registration_state_parse(
-          &jr, &out_response->registration_state));
+          jr, ref_destination, &out_response->registration_state));
     }
-    else if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("trackingId")))
+    else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("trackingId")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-      if (jr.token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_response->registration_state.error_tracking_id = jr.token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_error_string(
+          jr, ref_destination, &out_response->registration_state.error_tracking_id));
     }
-    else if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("message")))
+    else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("message")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-      if (jr.token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_response->registration_state.error_message = jr.token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_error_string(
+          jr, ref_destination, &out_response->registration_state.error_message));
     }
-    else if (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR("timestampUtc")))
+    else if (az_json_token_is_text_equal(&jr->token, AZ_SPAN_FROM_STR("timestampUtc")))
     {
-      _az_RETURN_IF_FAILED(az_json_reader_next_token(&jr));
-      if (jr.token.kind != AZ_JSON_TOKEN_STRING)
-      {
-        return AZ_ERROR_ITEM_NOT_FOUND;
-      }
-      out_response->registration_state.error_timestamp = jr.token.slice;
+      _az_RETURN_IF_FAILED(_az_iot_provisioning_client_parse_error_string(
+          jr, ref_destination, &out_response->registration_state.error_timestamp));
     }
     else if (az_result_succeeded(_az_iot_provisioning_client_parse_payload_error_code(
-                 &jr, &out_response->registration_state)))
+                 jr, &out_response->registration_state)))
     {
       found_error = true;
     }
     else
     {
       // ignore other tokens
-      _az_RETURN_IF_FAILED(az_json_reader_skip_children(&jr));
+      _az_RETURN_IF_FAILED(az_json_reader_skip_children(jr));
     }
   }
 
@@ -513,20 +526,10 @@ Stage 3:
  {"errorCode":401002,"trackingId":"8ad0463c-6427-4479-9dfa-3e8bb7003e9b","message":"Invalid
   certificate.","timestampUtc":"2020-04-10T05:24:22.4718526Z"}
 */
-AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_payload(
-    az_iot_provisioning_client const* client,
+static az_result _az_iot_provisioning_client_parse_received_topic(
     az_span received_topic,
-    az_span received_payload,
     az_iot_provisioning_client_register_response* out_response)
 {
-  (void)client;
-
-  _az_PRECONDITION_NOT_NULL(client);
-  _az_PRECONDITION_VALID_SPAN(client->_internal.global_device_endpoint, 1, false);
-  _az_PRECONDITION_VALID_SPAN(received_topic, 1, false);
-  _az_PRECONDITION_VALID_SPAN(received_payload, 1, false);
-  _az_PRECONDITION_NOT_NULL(out_response);
-
   az_span str_dps_registrations_res = _az_iot_provisioning_get_dps_registrations_res();
   int32_t idx = az_span_find(received_topic, str_dps_registrations_res);
   if (idx != 0)
@@ -535,7 +538,6 @@ AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_paylo
   }
 
   _az_LOG_WRITE(AZ_LOG_MQTT_RECEIVED_TOPIC, received_topic);
-  _az_LOG_WRITE(AZ_LOG_MQTT_RECEIVED_PAYLOAD, received_payload);
 
   // Parse the status.
   az_span remainder = az_span_slice_to_end(received_topic, az_span_size(str_dps_registrations_res));
@@ -559,7 +561,65 @@ AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_paylo
     out_response->retry_after_seconds = 0;
   }
 
-  _az_RETURN_IF_FAILED(az_iot_provisioning_client_parse_payload(received_payload, out_response));
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_payload(
+    az_iot_provisioning_client const* client,
+    az_span received_topic,
+    az_span received_payload,
+    az_iot_provisioning_client_register_response* out_response)
+{
+  (void)client;
+
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION_VALID_SPAN(client->_internal.global_device_endpoint, 1, false);
+  _az_PRECONDITION_VALID_SPAN(received_topic, 1, false);
+  _az_PRECONDITION_VALID_SPAN(received_payload, 1, false);
+  _az_PRECONDITION_NOT_NULL(out_response);
+
+  _az_RETURN_IF_FAILED(
+      _az_iot_provisioning_client_parse_received_topic(received_topic, out_response));
+
+  _az_LOG_WRITE(AZ_LOG_MQTT_RECEIVED_PAYLOAD, received_payload);
+
+  az_json_reader jr;
+  _az_RETURN_IF_FAILED(az_json_reader_init(&jr, received_payload, NULL));
+  _az_RETURN_IF_FAILED(az_iot_provisioning_client_parse_payload(&jr, NULL, out_response));
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_payload_chunks(
+    az_iot_provisioning_client const* client,
+    az_span received_topic,
+    az_span received_payload_chunks[],
+    int32_t number_of_chunks,
+    az_span destination,
+    az_iot_provisioning_client_register_response* out_response)
+{
+  (void)client;
+
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION_VALID_SPAN(client->_internal.global_device_endpoint, 1, false);
+  _az_PRECONDITION_VALID_SPAN(received_topic, 1, false);
+  _az_PRECONDITION_NOT_NULL(received_payload_chunks);
+  _az_PRECONDITION(number_of_chunks > 0);
+  _az_PRECONDITION_VALID_SPAN(destination, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_response);
+
+  _az_RETURN_IF_FAILED(
+      _az_iot_provisioning_client_parse_received_topic(received_topic, out_response));
+
+  for (int32_t i = 0; i < number_of_chunks; i++)
+  {
+    _az_LOG_WRITE(AZ_LOG_MQTT_RECEIVED_PAYLOAD, received_payload_chunks[i]);
+  }
+
+  az_json_reader jr;
+  _az_RETURN_IF_FAILED(
+      az_json_reader_chunked_init(&jr, received_payload_chunks, number_of_chunks, NULL));
+  _az_RETURN_IF_FAILED(az_iot_provisioning_client_parse_payload(&jr, &destination, out_response));
 
   return AZ_OK;
 }
@@ -214,6 +214,126 @@ AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_password(
     size_t mqtt_password_size,
     size_t* out_mqtt_password_length);
 
+/**
+ * @brief Gets the MQTT password, signing it with an application-provided HMAC-SHA256 function.
+ * @remark The MQTT password must be an empty string if X509 Client certificates are used. Use this
+ * API only when authenticating with SAS tokens.
+ *
+ * @details Replaces the sequence of az_iot_provisioning_client_sas_get_signature(), signing,
+ * Base64 encoding and az_iot_provisioning_client_sas_get_password(). The signature is built in
+ * \p mqtt_password, where it is signed and then overwritten by the encoded result, so no other
+ * buffer is needed.
+ *
+ * @param[in] client The #az_iot_provisioning_client to use for this call.
+ * @param[in] token_expiration_epoch_time The time, in seconds, from 1/1/1970.
+ * @param[in] hmac_sha256 The function computing the HMAC-SHA256 of the signature with the
+ * SharedAccessKey.
+ * @param[in] hmac_sha256_context The context passed to \p hmac_sha256. Can be `NULL`.
+ * @param[in] key_name The Shared Access Key Name (Policy Name). This is optional. For security
+ * reasons we recommend using one key per device instead of using a global policy key.
+ * @param[out] mqtt_password A buffer with sufficient capacity to hold the MQTT password, and the
+ * signature while it is being signed. If successful, contains a null-terminated string with the
+ * password that needs to be passed to the MQTT client.
+ * @param[in] mqtt_password_size The size, in bytes of \p mqtt_password.
+ * @param[out] out_mqtt_password_length __[nullable]__ Contains the string length, in bytes, of \p
+ * mqtt_password. Can be `NULL`.
+ * @pre \p client must not be `NULL`.
+ * @pre \p token_expiration_epoch_time must be greater than 0.
+ * @pre \p hmac_sha256 must not be `NULL`.
+ * @pre \p mqtt_password must not be `NULL`.
+ * @pre \p mqtt_password_size must be greater than 0.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The password was created successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The buffer is too small.
+ * @retval Other Failures returned by \p hmac_sha256.
+ */
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_signed_password(
+    az_iot_provisioning_client const* client,
+    uint64_t token_expiration_epoch_time,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span key_name,
+    char* mqtt_password,
+    size_t mqtt_password_size,
+    size_t* out_mqtt_password_length);
+
+/**
+ * @brief The size, in bytes, of a device key derived from a group enrollment key.
+ */
+#define AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE 44
+
+/**
+ * @brief Derives the device key of a registration id from the key of its group enrollment.
+ *
+ * @details The derived key is the Base64 encoded value of HMAC-SHA256(registration_id,
+ * group enrollment key). It can be used as the SharedAccessKey of the device.
+ *
+ * The group enrollment key is only known to \p hmac_sha256, which is called once, with
+ * \p registration_id as `data`, and must write the HMAC-SHA256 of it into the
+ * #AZ_IOT_SAS_HMAC_SHA256_SIZE bytes of `signed_data`. As the key is the same for every
+ * registration id, \p hmac_sha256_context can hold the SHA-256 states reached after hashing the
+ * inner and outer padded key blocks, and each call can resume from copies of them, as
+ * `AzIoTSasSigner` in the Azure_IoT_Adu_ESP32 example does.
+ *
+ * @param[in] registration_id The registration id of the device.
+ * @param[in] hmac_sha256 The function computing the HMAC-SHA256 of \p registration_id with the
+ * group enrollment key.
+ * @param[in] hmac_sha256_context The context passed to \p hmac_sha256. Can be `NULL`.
+ * @param[in] derived_key A buffer with at least #AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE
+ * bytes.
+ * @param[out] out_derived_key The slice of \p derived_key holding the derived key.
+ * @pre \p registration_id must be a valid span of size greater than 0.
+ * @pre \p hmac_sha256 must not be `NULL`.
+ * @pre \p derived_key must be a valid span.
+ * @pre \p out_derived_key must not be `NULL`.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The key was derived successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE \p derived_key is too small.
+ * @retval Other Failures returned by \p hmac_sha256.
+ */
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_derive_device_key(
+    az_span registration_id,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span derived_key,
+    az_span* out_derived_key);
+
+/**
+ * @brief Derives the device keys of several registration ids from the key of their group
+ * enrollment.
+ *
+ * @details Same as calling az_iot_provisioning_client_sas_derive_device_key() for each
+ * registration id, with the keys written one after the other into \p derived_keys.
+ *
+ * @param[in] registration_ids The registration ids of the devices.
+ * @param[in] registration_id_count The number of elements in \p registration_ids and
+ * \p out_derived_keys.
+ * @param[in] hmac_sha256 The function computing the HMAC-SHA256 of a registration id with the group
+ * enrollment key.
+ * @param[in] hmac_sha256_context The context passed to \p hmac_sha256. Can be `NULL`.
+ * @param[in] derived_keys A buffer with at least \p registration_id_count times
+ * #AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE bytes.
+ * @param[out] out_derived_keys The slices of \p derived_keys holding the derived key of each
+ * registration id.
+ * @pre \p registration_ids must not be `NULL`.
+ * @pre \p registration_id_count must be greater than 0.
+ * @pre \p hmac_sha256 must not be `NULL`.
+ * @pre \p derived_keys must be a valid span.
+ * @pre \p out_derived_keys must not be `NULL`.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The keys were derived successfully.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE \p derived_keys is too small. No key is derived.
+ * @retval Other Failures returned by \p hmac_sha256. The keys preceding the failing registration
+ * id are derived.
+ */
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_derive_device_keys(
+    az_span const* registration_ids,
+    int32_t registration_id_count,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span derived_keys,
+    az_span* out_derived_keys);
+
 /*
  *
  * Register APIs
@@ -365,6 +485,42 @@ AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_paylo
     az_span received_payload,
     az_iot_provisioning_client_register_response* out_response);
 
+/**
+ * @brief Attempts to parse a received message's topic, and its payload received in chunks.
+ *
+ * @details The payload does not need to be contiguous, so it can be parsed as received from an
+ * MQTT client that delivers large messages in several parts. The operation id, IoT Hub hostname
+ * and device id are copied into \p destination, so the payload chunks can be reused as soon as
+ * this function returns. The error message, tracking id and timestamp are not copied, and are left
+ * empty.
+ *
+ * @param[in] client The #az_iot_provisioning_client to use for this call.
+ * @param[in] received_topic An #az_span containing the received MQTT topic.
+ * @param[in] received_payload_chunks An array of #az_span containing the received MQTT payload,
+ * in order.
+ * @param[in] number_of_chunks The number of elements in \p received_payload_chunks.
+ * @param[in] destination The buffer the strings of \p out_response are copied into.
+ * @param[out] out_response If the message is register-operation related, this will contain the
+ * #az_iot_provisioning_client_register_response.
+ * @pre \p client must not be `NULL`.
+ * @pre \p received_topic must be a valid span of size greater than or equal to 0.
+ * @pre \p received_payload_chunks must not be `NULL`, and must not contain empty spans.
+ * @pre \p number_of_chunks must be greater than 0.
+ * @pre \p destination must be a valid span.
+ * @pre \p out_response must not be `NULL`.
+ * @return An #az_result value indicating the result of the operation.
+ * @retval #AZ_OK The topic and payload were parsed successfully.
+ * @retval #AZ_ERROR_IOT_TOPIC_NO_MATCH If the topic is not matching the expected format.
+ * @retval #AZ_ERROR_NOT_ENOUGH_SPACE The strings do not fit in \p destination.
+ */
+AZ_NODISCARD az_result az_iot_provisioning_client_parse_received_topic_and_payload_chunks(
+    az_iot_provisioning_client const* client,
+    az_span received_topic,
+    az_span received_payload_chunks[],
+    int32_t number_of_chunks,
+    az_span destination,
+    az_iot_provisioning_client_register_response* out_response);
+
 /**
  * @brief Checks if the status indicates that the service has an authoritative result of the
  * register operation. The operation may have completed in either success or error. Completed
@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // SPDX-License-Identifier: MIT
 
+#include <az_base64.h>
 #include <az_precondition.h>
 #include <az_span.h>
 #include <az_log_internal.h>
@@ -30,6 +31,64 @@ static const az_span sig_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SIG);
 static const az_span skn_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SKN);
 static const az_span se_string = AZ_SPAN_LITERAL_FROM_STR(SAS_TOKEN_SE);
 
+// Copies the url-encoded resource string of the SAS token:
+// <scope-id>/registrations/<registration-id>
+static az_result _az_iot_provisioning_client_sas_copy_resource(
+    az_iot_provisioning_client const* client,
+    az_span destination,
+    az_span* out_remainder)
+{
+  _az_RETURN_IF_FAILED(
+      _az_span_copy_url_encode(destination, client->_internal.id_scope, &destination));
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, az_span_size(resources_string));
+  destination = az_span_copy(destination, resources_string);
+
+  _az_RETURN_IF_FAILED(
+      _az_span_copy_url_encode(destination, client->_internal.registration_id, out_remainder));
+
+  return AZ_OK;
+}
+
+// Copies the parameters following the signature: "&se=<expiration-time>" plus, if key_name is not
+// empty, "&skn=<key-name>", and the null terminator.
+static az_result _az_iot_provisioning_client_sas_copy_password_suffix(
+    az_span destination,
+    uint64_t token_expiration_epoch_time,
+    az_span key_name,
+    az_span* out_remainder)
+{
+  // Expiration
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(
+      destination,
+      1 /* AMPERSAND */ + az_span_size(se_string)
+          + 1 /* EQUAL_SIGN */ + _az_iot_u64toa_size(token_expiration_epoch_time));
+  destination = az_span_copy_u8(destination, AMPERSAND);
+  destination = az_span_copy(destination, se_string);
+  destination = az_span_copy_u8(destination, EQUAL_SIGN);
+  _az_RETURN_IF_FAILED(az_span_u64toa(destination, token_expiration_epoch_time, &destination));
+
+  if (az_span_size(key_name) > 0)
+  {
+    // Key Name
+    _az_RETURN_IF_NOT_ENOUGH_SIZE(
+        destination,
+        1 // AMPERSAND
+            + az_span_size(skn_string) + 1 // EQUAL_SIGN
+            + az_span_size(key_name));
+
+    destination = az_span_copy_u8(destination, AMPERSAND);
+    destination = az_span_copy(destination, skn_string);
+    destination = az_span_copy_u8(destination, EQUAL_SIGN);
+    destination = az_span_copy(destination, key_name);
+  }
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(destination, 1 /* NULL TERMINATOR */);
+  *out_remainder = az_span_copy_u8(destination, STRING_NULL_TERMINATOR);
+
+  return AZ_OK;
+}
+
 AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_signature(
     az_iot_provisioning_client const* client,
     uint64_t token_expiration_epoch_time,
@@ -49,13 +108,8 @@ AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_signature(
   az_span remainder = signature;
   int32_t signature_size = az_span_size(signature);
 
-  _az_RETURN_IF_FAILED(_az_span_copy_url_encode(remainder, client->_internal.id_scope, &remainder));
-
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, az_span_size(resources_string));
-  remainder = az_span_copy(remainder, resources_string);
-
   _az_RETURN_IF_FAILED(
-      _az_span_copy_url_encode(remainder, client->_internal.registration_id, &remainder));
+      _az_iot_provisioning_client_sas_copy_resource(client, remainder, &remainder));
 
   _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, 1 /* LF */);
   remainder = az_span_copy_u8(remainder, LF);
@@ -98,14 +152,8 @@ AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_password(
   mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
 
   // Resource string
-  _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
-      mqtt_password_span, client->_internal.id_scope, &mqtt_password_span));
-
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, az_span_size(resources_string));
-  mqtt_password_span = az_span_copy(mqtt_password_span, resources_string);
-
-  _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
-      mqtt_password_span, client->_internal.registration_id, &mqtt_password_span));
+  _az_RETURN_IF_FAILED(_az_iot_provisioning_client_sas_copy_resource(
+      client, mqtt_password_span, &mqtt_password_span));
 
   // Signature
   _az_RETURN_IF_NOT_ENOUGH_SIZE(
@@ -117,35 +165,64 @@ AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_password(
   _az_RETURN_IF_FAILED(_az_span_copy_url_encode(
       mqtt_password_span, base64_hmac_sha256_signature, &mqtt_password_span));
 
-  // Expiration
+  // Expiration and Key Name
+  _az_RETURN_IF_FAILED(_az_iot_provisioning_client_sas_copy_password_suffix(
+      mqtt_password_span, token_expiration_epoch_time, key_name, &mqtt_password_span));
 
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(
-      mqtt_password_span,
-      1 /* AMPERSAND */ + az_span_size(se_string)
-          + 1 /* EQUAL_SIGN */ + _az_iot_u64toa_size(token_expiration_epoch_time));
-  mqtt_password_span = az_span_copy_u8(mqtt_password_span, AMPERSAND);
-  mqtt_password_span = az_span_copy(mqtt_password_span, se_string);
+  if (out_mqtt_password_length != NULL)
+  {
+    *out_mqtt_password_length
+        = (mqtt_password_size - (size_t)az_span_size(mqtt_password_span) - 1 /* NULL TERMINATOR */);
+  }
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_signed_password(
+    az_iot_provisioning_client const* client,
+    uint64_t token_expiration_epoch_time,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span key_name,
+    char* mqtt_password,
+    size_t mqtt_password_size,
+    size_t* out_mqtt_password_length)
+{
+  _az_PRECONDITION_NOT_NULL(client);
+  _az_PRECONDITION(token_expiration_epoch_time > 0);
+  _az_PRECONDITION_NOT_NULL(hmac_sha256);
+  _az_PRECONDITION_NOT_NULL(mqtt_password);
+  _az_PRECONDITION(mqtt_password_size > 0);
+
+  az_span mqtt_password_span = az_span_create((uint8_t*)mqtt_password, (int32_t)mqtt_password_size);
+
+  // SharedAccessSignature
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, az_span_size(sr_string) + 1 /* EQUAL SIGN */);
+  mqtt_password_span = az_span_copy(mqtt_password_span, sr_string);
   mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
-  _az_RETURN_IF_FAILED(
-      az_span_u64toa(mqtt_password_span, token_expiration_epoch_time, &mqtt_password_span));
 
-  if (az_span_size(key_name) > 0)
-  {
-    // Key Name
-    _az_RETURN_IF_NOT_ENOUGH_SIZE(
-        mqtt_password_span,
-        1 // AMPERSAND
-            + az_span_size(skn_string) + 1 // EQUAL_SIGN
-            + az_span_size(key_name));
+  // The resource string, already in place, followed by LF and the expiration time is the
+  // signature. Once signed, the signature parameter overwrites everything after the resource.
+  az_span signature = mqtt_password_span;
+  _az_RETURN_IF_FAILED(_az_iot_provisioning_client_sas_copy_resource(
+      client, mqtt_password_span, &mqtt_password_span));
 
-    mqtt_password_span = az_span_copy_u8(mqtt_password_span, AMPERSAND);
-    mqtt_password_span = az_span_copy(mqtt_password_span, skn_string);
-    mqtt_password_span = az_span_copy_u8(mqtt_password_span, EQUAL_SIGN);
-    mqtt_password_span = az_span_copy(mqtt_password_span, key_name);
-  }
+  az_span remainder = mqtt_password_span;
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(remainder, 1 /* LF */);
+  remainder = az_span_copy_u8(remainder, LF);
+
+  _az_RETURN_IF_FAILED(az_span_u64toa(remainder, token_expiration_epoch_time, &remainder));
+
+  signature = az_span_slice(signature, 0, az_span_size(signature) - az_span_size(remainder));
+  _az_LOG_WRITE(AZ_LOG_IOT_SAS_TOKEN, signature);
+
+  // Signature
+  _az_RETURN_IF_FAILED(_az_iot_sas_copy_signed_signature(
+      mqtt_password_span, signature, hmac_sha256, hmac_sha256_context, &mqtt_password_span));
 
-  _az_RETURN_IF_NOT_ENOUGH_SIZE(mqtt_password_span, 1 /* NULL TERMINATOR */);
-  mqtt_password_span = az_span_copy_u8(mqtt_password_span, STRING_NULL_TERMINATOR);
+  // Expiration and Key Name
+  _az_RETURN_IF_FAILED(_az_iot_provisioning_client_sas_copy_password_suffix(
+      mqtt_password_span, token_expiration_epoch_time, key_name, &mqtt_password_span));
 
   if (out_mqtt_password_length != NULL)
   {
@@ -155,3 +232,66 @@ AZ_NODISCARD az_result az_iot_provisioning_client_sas_get_password(
 
   return AZ_OK;
 }
+
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_derive_device_key(
+    az_span registration_id,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span derived_key,
+    az_span* out_derived_key)
+{
+  _az_PRECONDITION_VALID_SPAN(registration_id, 1, false);
+  _az_PRECONDITION_NOT_NULL(hmac_sha256);
+  _az_PRECONDITION_VALID_SPAN(derived_key, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_derived_key);
+
+  uint8_t signed_registration_id_buffer[AZ_IOT_SAS_HMAC_SHA256_SIZE];
+  int32_t length = 0;
+
+  _az_RETURN_IF_NOT_ENOUGH_SIZE(derived_key, AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE);
+
+  _az_RETURN_IF_FAILED(hmac_sha256(
+      hmac_sha256_context, registration_id, AZ_SPAN_FROM_BUFFER(signed_registration_id_buffer)));
+
+  _az_RETURN_IF_FAILED(
+      az_base64_encode(derived_key, AZ_SPAN_FROM_BUFFER(signed_registration_id_buffer), &length));
+
+  *out_derived_key = az_span_slice(derived_key, 0, length);
+
+  return AZ_OK;
+}
+
+AZ_NODISCARD az_result az_iot_provisioning_client_sas_derive_device_keys(
+    az_span const* registration_ids,
+    int32_t registration_id_count,
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* hmac_sha256_context,
+    az_span derived_keys,
+    az_span* out_derived_keys)
+{
+  _az_PRECONDITION_NOT_NULL(registration_ids);
+  _az_PRECONDITION(registration_id_count > 0);
+  _az_PRECONDITION_NOT_NULL(hmac_sha256);
+  _az_PRECONDITION_VALID_SPAN(derived_keys, 0, true);
+  _az_PRECONDITION_NOT_NULL(out_derived_keys);
+
+  if (registration_id_count
+      > az_span_size(derived_keys) / AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  for (int32_t i = 0; i < registration_id_count; i++)
+  {
+    _az_RETURN_IF_FAILED(az_iot_provisioning_client_sas_derive_device_key(
+        registration_ids[i],
+        hmac_sha256,
+        hmac_sha256_context,
+        derived_keys,
+        &out_derived_keys[i]));
+
+    derived_keys = az_span_slice_to_end(derived_keys, az_span_size(out_derived_keys[i]));
+  }
+
+  return AZ_OK;
+}
@@ -0,0 +1,660 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Azure IoT client simulator.
+ *
+ * Runs the Azure IoT client of the Azure IoT Central ESP32 sample (AzureIoT.cpp) on the host,
+ * against a simulated MQTT broker in virtual time, in one of these scenarios:
+ *
+ *   time-to-ready       Time from start until the client is connected and subscribed.
+ *   telemetry-window    Delivery of QoS 1 telemetry through the in-flight window, with PUBACKs
+ *                       lost and the connection cut.
+ *   command-round-trip  Command round-trip time while telemetry saturates a slow uplink.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "AzureIoT.h"
+
+#define START_TIME 1700000000
+#define MAX_EVENTS 4096
+#define MAX_COMMANDS 1024
+
+typedef enum
+{
+  event_connack,
+  event_suback,
+  event_puback,
+  event_command
+} event_kind;
+
+typedef struct
+{
+  int64_t time_msec;
+  event_kind kind;
+  int packet_id;
+  int connection;
+} broker_event;
+
+typedef struct
+{
+  // Round-trip time between the device and the broker.
+  int64_t round_trip_msec;
+  // Round trips taken to connect (TCP, TLS and MQTT CONNECT).
+  int connect_round_trips;
+  // Uplink bandwidth, or 0 for unlimited. When limited, packets are sent one after the other, and
+  // reach the broker when their last byte is sent.
+  double uplink_bytes_per_msec;
+  // Whether PUBACKs are lost.
+  bool drop_pubacks;
+} broker_options;
+
+static broker_options broker;
+static broker_event events[MAX_EVENTS];
+static int event_count;
+static int64_t now_msec;
+static int64_t uplink_free_time_msec;
+static int connection;
+static int next_packet_id;
+static int qos1_publish_count;
+
+static azure_iot_t azure_iot;
+static azure_iot_config_t config;
+static uint8_t data_buffer[1500];
+
+// Invoked with every message published and the time it reaches the broker.
+static void (*on_published)(mqtt_message_t const* mqtt_message, int64_t arrival_time_msec);
+
+/*
+ * Simulated broker and clock.
+ */
+
+extern "C" time_t time(time_t* out_time)
+{
+  time_t current_time = (time_t)(START_TIME + now_msec / 1000);
+
+  if (out_time != NULL)
+  {
+    *out_time = current_time;
+  }
+
+  return current_time;
+}
+
+static int64_t get_time_msec(void) { return now_msec; }
+
+static void schedule(int64_t time_msec, event_kind kind, int packet_id)
+{
+  if (event_count < MAX_EVENTS)
+  {
+    broker_event* event = &events[event_count++];
+    event->time_msec = time_msec;
+    event->kind = kind;
+    event->packet_id = packet_id;
+    event->connection = connection;
+  }
+}
+
+static int mqtt_client_init(mqtt_client_config_t* mqtt_client_config, mqtt_client_handle_t* handle)
+{
+  (void)mqtt_client_config;
+  *handle = (mqtt_client_handle_t)&azure_iot;
+  connection++;
+  schedule(now_msec + broker.round_trip_msec * broker.connect_round_trips, event_connack, 0);
+  return 0;
+}
+
+static int mqtt_client_deinit(mqtt_client_handle_t handle)
+{
+  (void)handle;
+  return 0;
+}
+
+static int mqtt_client_publish(mqtt_client_handle_t handle, mqtt_message_t* mqtt_message)
+{
+  (void)handle;
+  int packet_id = ++next_packet_id;
+  int64_t arrival_time_msec = now_msec + broker.round_trip_msec / 2;
+
+  if (broker.uplink_bytes_per_msec > 0)
+  {
+    // Topic, payload, and about 4 bytes of fixed header, length and packet id.
+    int32_t size = az_span_size(mqtt_message->topic) + az_span_size(mqtt_message->payload) + 4;
+    int64_t start_msec = uplink_free_time_msec > now_msec ? uplink_free_time_msec : now_msec;
+    uplink_free_time_msec = start_msec + (int64_t)(size / broker.uplink_bytes_per_msec + 0.999);
+    arrival_time_msec = uplink_free_time_msec;
+  }
+
+  if (mqtt_message->qos == mqtt_qos_at_least_once)
+  {
+    qos1_publish_count++;
+
+    if (!broker.drop_pubacks)
+    {
+      schedule(arrival_time_msec + broker.round_trip_msec / 2, event_puback, packet_id);
+    }
+  }
+
+  if (on_published != NULL)
+  {
+    on_published(mqtt_message, arrival_time_msec);
+  }
+
+  return packet_id;
+}
+
+static int mqtt_client_subscribe(mqtt_client_handle_t handle, az_span topic, mqtt_qos_t qos)
+{
+  (void)handle;
+  (void)topic;
+  (void)qos;
+  int packet_id = ++next_packet_id;
+  schedule(now_msec + broker.round_trip_msec, event_suback, packet_id);
+  return packet_id;
+}
+
+// No crypto library is linked, so the SAS password is made of fixed bytes.
+static int base64_decode(
+    uint8_t* data,
+    size_t data_length,
+    uint8_t* decoded,
+    size_t size,
+    size_t* length)
+{
+  (void)data;
+  (void)data_length;
+  *length = size < 32 ? size : 32;
+  memset(decoded, 1, *length);
+  return 0;
+}
+
+static int base64_encode(
+    uint8_t* data,
+    size_t data_length,
+    uint8_t* encoded,
+    size_t size,
+    size_t* length)
+{
+  (void)data;
+  (void)data_length;
+  *length = size < 44 ? size : 44;
+  memset(encoded, 'A', *length);
+  return 0;
+}
+
+static int hmac_sha256(
+    const uint8_t* key,
+    size_t key_length,
+    const uint8_t* payload,
+    size_t payload_length,
+    uint8_t* signed_payload,
+    size_t signed_payload_size)
+{
+  (void)key;
+  (void)key_length;
+  (void)payload;
+  (void)payload_length;
+  memset(signed_payload, 2, signed_payload_size);
+  return 0;
+}
+
+static void log_nothing(log_level_t log_level, char const* const format, ...)
+{
+  (void)log_level;
+  (void)format;
+}
+
+static void on_properties_update_completed(
+    uint32_t request_id,
+    az_iot_status status_code,
+    int32_t version)
+{
+  (void)request_id;
+  (void)status_code;
+  (void)version;
+}
+
+static void on_properties_received(az_span properties) { (void)properties; }
+
+static void on_command_request_received(command_request_t command)
+{
+  (void)azure_iot_send_command_response(&azure_iot, command.request_id, 200, AZ_SPAN_EMPTY);
+}
+
+// Delivers the events due now on the current connection, then drops every event not in the future.
+static void deliver_events(void)
+{
+  for (int i = 0; i < event_count; i++)
+  {
+    broker_event event = events[i];
+
+    if (event.time_msec != now_msec || event.connection != connection)
+    {
+      continue;
+    }
+
+    switch (event.kind)
+    {
+      case event_connack:
+        (void)azure_iot_mqtt_client_connected(&azure_iot);
+        break;
+      case event_suback:
+        (void)azure_iot_mqtt_client_subscribe_completed(&azure_iot, event.packet_id);
+        break;
+      case event_puback:
+        (void)azure_iot_mqtt_client_publish_completed(&azure_iot, event.packet_id);
+        break;
+      case event_command:
+      {
+        char topic[64];
+        mqtt_message_t mqtt_message;
+        int length = snprintf(
+            topic, sizeof(topic), "$iothub/methods/POST/reboot/?$rid=%d", event.packet_id);
+
+        mqtt_message.topic = az_span_create((uint8_t*)topic, length);
+        mqtt_message.payload = AZ_SPAN_FROM_STR("{}");
+        mqtt_message.qos = mqtt_qos_at_most_once;
+        (void)azure_iot_mqtt_client_message_received(&azure_iot, &mqtt_message);
+        break;
+      }
+    }
+  }
+
+  int kept_count = 0;
+
+  for (int i = 0; i < event_count; i++)
+  {
+    if (events[i].time_msec > now_msec)
+    {
+      events[kept_count++] = events[i];
+    }
+  }
+
+  event_count = kept_count;
+}
+
+// Runs the client for one millisecond of virtual time.
+static void step(void)
+{
+  azure_iot_do_work(&azure_iot);
+  deliver_events();
+}
+
+// Starts a client connecting straight to IoT Hub, through a broker with the given options.
+static void start(broker_options const* options)
+{
+  broker = *options;
+  event_count = 0;
+  now_msec = 0;
+  uplink_free_time_msec = 0;
+  connection = 0;
+  next_packet_id = 0;
+  qos1_publish_count = 0;
+  on_published = NULL;
+  set_logging_function(log_nothing);
+
+  memset(&config, 0, sizeof(config));
+  config.user_agent = AZ_SPAN_FROM_STR("c%2F1.0.0(simulator)");
+  config.model_id = AZ_SPAN_FROM_STR("dtmi:azureiot:devkit:simulator;1");
+  config.use_device_provisioning = false;
+  config.iot_hub_fqdn = AZ_SPAN_FROM_STR("myiothub.azure-devices.net");
+  config.device_id = AZ_SPAN_FROM_STR("my_device");
+  config.device_key = AZ_SPAN_FROM_STR("a2V5");
+  config.device_certificate = AZ_SPAN_EMPTY;
+  config.device_certificate_private_key = AZ_SPAN_EMPTY;
+  config.dps_registration_id = AZ_SPAN_EMPTY;
+  config.dps_id_scope = AZ_SPAN_EMPTY;
+  config.data_buffer = AZ_SPAN_FROM_BUFFER(data_buffer);
+  config.mqtt_client_interface.mqtt_client_init = mqtt_client_init;
+  config.mqtt_client_interface.mqtt_client_deinit = mqtt_client_deinit;
+  config.mqtt_client_interface.mqtt_client_publish = mqtt_client_publish;
+  config.mqtt_client_interface.mqtt_client_subscribe = mqtt_client_subscribe;
+  config.data_manipulation_functions.base64_decode = base64_decode;
+  config.data_manipulation_functions.base64_encode = base64_encode;
+  config.data_manipulation_functions.hmac_sha256_encrypt = hmac_sha256;
+  config.on_properties_update_completed = on_properties_update_completed;
+  config.on_properties_received = on_properties_received;
+  config.on_command_request_received = on_command_request_received;
+  config.get_time_msec = get_time_msec;
+
+  azure_iot_init(&azure_iot, &config);
+  (void)azure_iot_start(&azure_iot);
+}
+
+/*
+ * time-to-ready
+ */
+
+// Returns the time the client took to be ready, or -1 if it failed or took over 100 seconds.
+static int64_t measure_time_to_ready(int64_t round_trip_msec)
+{
+  broker_options options = { round_trip_msec, 2, 0, false };
+
+  start(&options);
+
+  for (; now_msec < 100000; now_msec++)
+  {
+    step();
+
+    if (azure_iot_get_status(&azure_iot) == azure_iot_connected)
+    {
+      return now_msec;
+    }
+
+    if (azure_iot_get_status(&azure_iot) == azure_iot_error)
+    {
+      break;
+    }
+  }
+
+  return -1;
+}
+
+static int run_time_to_ready(int64_t round_trip_msec)
+{
+  static const int64_t default_round_trips_msec[] = { 20, 150, 600 };
+  int64_t const* round_trips_msec = default_round_trips_msec;
+  int count = (int)(sizeof(default_round_trips_msec) / sizeof(default_round_trips_msec[0]));
+
+  if (round_trip_msec > 0)
+  {
+    round_trips_msec = &round_trip_msec;
+    count = 1;
+  }
+
+  printf("Time to ready, CONNECT acknowledged after 2 RTT and each SUBSCRIBE after 1 RTT:\n");
+
+  for (int i = 0; i < count; i++)
+  {
+    int64_t ready_msec = measure_time_to_ready(round_trips_msec[i]);
+
+    if (ready_msec < 0)
+    {
+      printf("  RTT %4lld ms: not ready\n", (long long)round_trips_msec[i]);
+      return 1;
+    }
+
+    printf("  RTT %4lld ms: %5lld ms\n", (long long)round_trips_msec[i], (long long)ready_msec);
+  }
+
+  return 0;
+}
+
+/*
+ * telemetry-window
+ */
+
+#define TELEMETRY_WINDOW_MESSAGE_COUNT 12
+#define TELEMETRY_WINDOW_DROP_START_MSEC 100
+#define TELEMETRY_WINDOW_DISCONNECT_MSEC 300
+#define TELEMETRY_WINDOW_END_MSEC 2000
+
+static int telemetry_completed_count;
+
+static void on_telemetry_completed(void* context)
+{
+  (void)context;
+  telemetry_completed_count++;
+}
+
+static int run_telemetry_window(void)
+{
+  broker_options options = { 20, 2, 0, false };
+  int sent_count = 0;
+
+  start(&options);
+  telemetry_completed_count = 0;
+
+  for (; now_msec < TELEMETRY_WINDOW_END_MSEC; now_msec++)
+  {
+    step();
+
+    if (now_msec == TELEMETRY_WINDOW_DROP_START_MSEC)
+    {
+      broker.drop_pubacks = true;
+    }
+    else if (now_msec == TELEMETRY_WINDOW_DISCONNECT_MSEC)
+    {
+      broker.drop_pubacks = false;
+      (void)azure_iot_mqtt_client_disconnected(&azure_iot);
+      (void)azure_iot_start(&azure_iot);
+    }
+
+    while (sent_count < TELEMETRY_WINDOW_MESSAGE_COUNT
+           && azure_iot_get_telemetry_window_space(&azure_iot, azure_iot_telemetry_priority_alarm)
+               > 0)
+    {
+      if (azure_iot_send_telemetry_at_least_once(
+              &azure_iot,
+              AZ_SPAN_FROM_STR("{\"temperature\":21.5}"),
+              azure_iot_telemetry_priority_alarm,
+              on_telemetry_completed,
+              NULL)
+          != 0)
+      {
+        printf("Failed sending telemetry with room in the window.\n");
+        return 1;
+      }
+
+      sent_count++;
+    }
+  }
+
+  printf(
+      "%d messages sent through a %d-message window, PUBACKs lost from %d ms, disconnected at %d "
+      "ms:\n",
+      sent_count,
+      TELEMETRY_IN_FLIGHT_WINDOW_SIZE,
+      TELEMETRY_WINDOW_DROP_START_MSEC,
+      TELEMETRY_WINDOW_DISCONNECT_MSEC);
+  printf(
+      "  %d completed, %d QoS 1 publishes (%d retransmissions)\n",
+      telemetry_completed_count,
+      qos1_publish_count,
+      qos1_publish_count - sent_count);
+
+  // Fill the window without acknowledging anything, and try one more.
+  broker.drop_pubacks = true;
+  int accepted_count = 0;
+
+  while (accepted_count <= TELEMETRY_IN_FLIGHT_WINDOW_SIZE
+         && azure_iot_send_telemetry_at_least_once(
+                &azure_iot,
+                AZ_SPAN_FROM_STR("{\"temperature\":21.5}"),
+                azure_iot_telemetry_priority_alarm,
+                NULL,
+                NULL)
+             == 0)
+  {
+    accepted_count++;
+  }
+
+  printf(
+      "  send into a full window: %s\n",
+      accepted_count == TELEMETRY_IN_FLIGHT_WINDOW_SIZE ? "rejected" : "accepted");
+
+  return telemetry_completed_count == sent_count
+          && accepted_count == TELEMETRY_IN_FLIGHT_WINDOW_SIZE
+      ? 0
+      : 1;
+}
+
+/*
+ * command-round-trip
+ */
+
+#define COMMAND_ROUND_TRIP_END_MSEC 20000
+#define COMMAND_PERIOD_MSEC 250
+#define READING_PERIOD_MSEC 10
+#define READING_SIZE 480
+
+static int64_t command_sent_time_msec[MAX_COMMANDS];
+static double command_round_trips_msec[MAX_COMMANDS];
+static int command_sent_count;
+static int command_round_trip_count;
+static long telemetry_bytes;
+
+static void on_command_round_trip_published(
+    mqtt_message_t const* mqtt_message,
+    int64_t arrival_time_msec)
+{
+  az_span topic = mqtt_message->topic;
+  az_span response_prefix = AZ_SPAN_FROM_STR("$iothub/methods/res/");
+
+  if (az_span_find(topic, response_prefix) == 0)
+  {
+    // The topic published by the client is null-terminated.
+    int32_t rid_index = az_span_find(topic, AZ_SPAN_FROM_STR("$rid="));
+    long request_id = rid_index > 0
+        ? strtol((char const*)az_span_ptr(topic) + rid_index + 5, NULL, 10)
+        : -1;
+
+    if (request_id >= 0 && request_id < command_sent_count
+        && command_round_trip_count < MAX_COMMANDS)
+    {
+      command_round_trips_msec[command_round_trip_count++]
+          = (double)(arrival_time_msec - command_sent_time_msec[request_id]);
+    }
+  }
+  else if (az_span_find(topic, AZ_SPAN_FROM_STR("devices/")) == 0)
+  {
+    telemetry_bytes += az_span_size(mqtt_message->payload);
+  }
+}
+
+static int compare_doubles(void const* a, void const* b)
+{
+  double const x = *(double const*)a;
+  double const y = *(double const*)b;
+  return (x > y) - (x < y);
+}
+
+static int run_command_round_trip(bool use_qos0)
+{
+  // 25 kB/s uplink, 10 ms one-way latency.
+  broker_options options = { 20, 1, 25.0, false };
+  static uint8_t reading[READING_SIZE];
+
+  memset(reading, 'x', sizeof(reading));
+  start(&options);
+  on_published = on_command_round_trip_published;
+  command_sent_count = 0;
+  command_round_trip_count = 0;
+  telemetry_bytes = 0;
+
+  for (; now_msec < COMMAND_ROUND_TRIP_END_MSEC; now_msec++)
+  {
+    step();
+
+    if (azure_iot_get_status(&azure_iot) != azure_iot_connected)
+    {
+      continue;
+    }
+
+    if (now_msec % COMMAND_PERIOD_MSEC == 0 && command_sent_count < MAX_COMMANDS)
+    {
+      command_sent_time_msec[command_sent_count] = now_msec;
+      schedule(now_msec + broker.round_trip_msec / 2, event_command, command_sent_count);
+      command_sent_count++;
+    }
+
+    if (now_msec % READING_PERIOD_MSEC == 0)
+    {
+      if (use_qos0)
+      {
+        (void)azure_iot_send_telemetry(&azure_iot, AZ_SPAN_FROM_BUFFER(reading));
+      }
+      else if (
+          azure_iot_get_telemetry_window_space(&azure_iot, azure_iot_telemetry_priority_routine)
+          > 0)
+      {
+        (void)azure_iot_send_telemetry_at_least_once(
+            &azure_iot,
+            AZ_SPAN_FROM_BUFFER(reading),
+            azure_iot_telemetry_priority_routine,
+            NULL,
+            NULL);
+      }
+    }
+  }
+
+  if (command_round_trip_count == 0)
+  {
+    printf("No command response was published.\n");
+    return 1;
+  }
+
+  qsort(
+      command_round_trips_msec,
+      (size_t)command_round_trip_count,
+      sizeof(double),
+      compare_doubles);
+
+  printf(
+      "Command every %d ms, %d-byte reading every %d ms, %.0f kB/s uplink, %lld ms RTT, %d s:\n",
+      COMMAND_PERIOD_MSEC,
+      READING_SIZE,
+      READING_PERIOD_MSEC,
+      options.uplink_bytes_per_msec,
+      (long long)options.round_trip_msec,
+      COMMAND_ROUND_TRIP_END_MSEC / 1000);
+  printf(
+      "  %s: %d commands, round trip p50 %.0f ms, p99 %.0f ms, max %.0f ms, telemetry %.1f kB/s\n",
+      use_qos0 ? "QoS 0 telemetry" : "QoS 1 routine telemetry",
+      command_round_trip_count,
+      command_round_trips_msec[command_round_trip_count / 2],
+      command_round_trips_msec[command_round_trip_count * 99 / 100],
+      command_round_trips_msec[command_round_trip_count - 1],
+      (double)telemetry_bytes / COMMAND_ROUND_TRIP_END_MSEC);
+
+  return 0;
+}
+
+static int usage(char const* program)
+{
+  fprintf(
+      stderr,
+      "Usage: %s time-to-ready [--rtt-ms MS]\n"
+      "       %s telemetry-window\n"
+      "       %s command-round-trip [--qos0]\n",
+      program,
+      program,
+      program);
+  return 2;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc == 2 && strcmp(argv[1], "time-to-ready") == 0)
+  {
+    return run_time_to_ready(0);
+  }
+  else if (argc == 4 && strcmp(argv[1], "time-to-ready") == 0 && strcmp(argv[2], "--rtt-ms") == 0
+           && atoi(argv[3]) > 0)
+  {
+    return run_time_to_ready(atoi(argv[3]));
+  }
+  else if (argc == 2 && strcmp(argv[1], "telemetry-window") == 0)
+  {
+    return run_telemetry_window();
+  }
+  else if (argc == 2 && strcmp(argv[1], "command-round-trip") == 0)
+  {
+    return run_command_round_trip(false);
+  }
+  else if (argc == 3 && strcmp(argv[1], "command-round-trip") == 0
+           && strcmp(argv[2], "--qos0") == 0)
+  {
+    return run_command_round_trip(true);
+  }
+
+  return usage(argv[0]);
+}
@@ -0,0 +1,387 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Message compression benchmark.
+ *
+ * Measures the compression ratio of az_iot_message_compress() on telemetry payloads in the format
+ * of the ESP32 Azure IoT Kit PnP template, with random sensor readings, with and without the
+ * default dictionary, and the throughput of az_iot_message_compress() and
+ * az_iot_message_decompress(). Every payload is checked to decompress back to itself first.
+ *
+ * Built with -DBENCHMARK_WITH_ZLIB (and linked with zlib), it also gives the ratio of raw deflate
+ * at level 9, for reference.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#ifdef BENCHMARK_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#define DEFAULT_ITERATIONS 2000
+#define PAYLOAD_BUFFER_SIZE 2048
+#define BATCH_MESSAGE_COUNT 4
+#define DOUBLE_DECIMAL_PLACE_DIGITS 2
+
+#define RETURN_IF_FAILED(exp)          \
+  do                                   \
+  {                                    \
+    az_result const _result = (exp);   \
+    if (az_result_failed(_result))     \
+    {                                  \
+      return _result;                  \
+    }                                  \
+  } while (0)
+
+typedef enum
+{
+  payload_two_values,
+  payload_pnp_message,
+  payload_pnp_batch,
+} payload_kind;
+
+typedef struct
+{
+  const char* name;
+  payload_kind kind;
+} benchmark_case;
+
+static const benchmark_case cases[] = {
+  { "2 values", payload_two_values },
+  { "13-value PnP message", payload_pnp_message },
+  { "batch of 4 messages", payload_pnp_batch },
+};
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t get_random(uint32_t range)
+{
+  random_state = random_state * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(random_state >> 33) % range;
+}
+
+static double get_random_reading(int32_t min, int32_t max)
+{
+  return min + (double)get_random((uint32_t)(max - min) * 100) / 100;
+}
+
+static az_result append_double_property(az_json_writer* jw, const char* name, double value)
+{
+  RETURN_IF_FAILED(az_json_writer_append_property_name(jw, az_span_create_from_str((char*)name)));
+  return az_json_writer_append_double(jw, value, DOUBLE_DECIMAL_PLACE_DIGITS);
+}
+
+static az_result append_int32_property(az_json_writer* jw, const char* name, int32_t value)
+{
+  RETURN_IF_FAILED(az_json_writer_append_property_name(jw, az_span_create_from_str((char*)name)));
+  return az_json_writer_append_int32(jw, value);
+}
+
+// Writes a message like the ones of generate_telemetry_payload() in the PnP template.
+static az_result append_pnp_message(az_json_writer* jw, bool is_complete)
+{
+  RETURN_IF_FAILED(az_json_writer_append_begin_object(jw));
+  RETURN_IF_FAILED(append_double_property(jw, "temperature", get_random_reading(15, 35)));
+  RETURN_IF_FAILED(append_double_property(jw, "humidity", get_random_reading(20, 90)));
+
+  if (is_complete)
+  {
+    RETURN_IF_FAILED(append_double_property(jw, "light", get_random_reading(0, 2000)));
+    RETURN_IF_FAILED(append_double_property(jw, "pressure", get_random_reading(950, 1050)));
+    RETURN_IF_FAILED(append_double_property(jw, "altitude", get_random_reading(0, 1000)));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "magnetometerX", (int32_t)get_random(2000) - 1000));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "magnetometerY", (int32_t)get_random(2000) - 1000));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "magnetometerZ", (int32_t)get_random(2000) - 1000));
+    RETURN_IF_FAILED(append_int32_property(jw, "pitch", (int32_t)get_random(180) - 90));
+    RETURN_IF_FAILED(append_int32_property(jw, "roll", (int32_t)get_random(360) - 180));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "accelerometerX", (int32_t)get_random(4000) - 2000));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "accelerometerY", (int32_t)get_random(4000) - 2000));
+    RETURN_IF_FAILED(
+        append_int32_property(jw, "accelerometerZ", (int32_t)get_random(4000) - 2000));
+  }
+
+  return az_json_writer_append_end_object(jw);
+}
+
+static az_result generate_payload(payload_kind kind, az_span buffer, az_span* out_payload)
+{
+  az_json_writer jw;
+
+  RETURN_IF_FAILED(az_json_writer_init(&jw, buffer, NULL));
+
+  if (kind == payload_pnp_batch)
+  {
+    RETURN_IF_FAILED(az_json_writer_append_begin_array(&jw));
+
+    for (int i = 0; i < BATCH_MESSAGE_COUNT; i++)
+    {
+      RETURN_IF_FAILED(append_pnp_message(&jw, true));
+    }
+
+    RETURN_IF_FAILED(az_json_writer_append_end_array(&jw));
+  }
+  else
+  {
+    RETURN_IF_FAILED(append_pnp_message(&jw, kind == payload_pnp_message));
+  }
+
+  *out_payload = az_json_writer_get_bytes_used_in_destination(&jw);
+  return AZ_OK;
+}
+
+// Gets the size of the compressed payload, or of the payload itself if it does not get smaller.
+static int32_t get_compressed_size(
+    az_iot_message_compression_options const* options,
+    az_span payload,
+    az_span buffer,
+    az_span* out_compressed)
+{
+  az_result result = az_iot_message_compress(options, payload, buffer, NULL, out_compressed);
+
+  if (result == AZ_ERROR_NOT_ENOUGH_SPACE)
+  {
+    *out_compressed = AZ_SPAN_EMPTY;
+    return az_span_size(payload);
+  }
+
+  return az_result_succeeded(result) ? az_span_size(*out_compressed) : -1;
+}
+
+#ifdef BENCHMARK_WITH_ZLIB
+static int32_t get_deflate_size(az_span payload)
+{
+  uint8_t buffer[PAYLOAD_BUFFER_SIZE * 2];
+  z_stream stream = { 0 };
+
+  if (deflateInit2(&stream, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    return -1;
+  }
+
+  stream.next_in = az_span_ptr(payload);
+  stream.avail_in = (uInt)az_span_size(payload);
+  stream.next_out = buffer;
+  stream.avail_out = (uInt)sizeof(buffer);
+
+  int result = deflate(&stream, Z_FINISH);
+  int32_t size = (int32_t)stream.total_out;
+  (void)deflateEnd(&stream);
+
+  return result == Z_STREAM_END ? size : -1;
+}
+#endif
+
+typedef struct
+{
+  az_span payload;
+  az_span compressed;
+  uint8_t payload_buffer[PAYLOAD_BUFFER_SIZE];
+  uint8_t compressed_buffer[PAYLOAD_BUFFER_SIZE];
+} sample;
+
+static double get_elapsed_seconds(clock_t start_clock)
+{
+  return (double)(clock() - start_clock) / CLOCKS_PER_SEC;
+}
+
+// Generates the samples, checks they decompress back to themselves, and prints their ratios.
+static bool measure_ratios(
+    benchmark_case const* bench,
+    az_iot_message_compression_options const* options,
+    sample* samples,
+    long count)
+{
+  az_iot_message_compression_options no_dictionary_options = *options;
+  long long payload_size = 0;
+  long long dictionary_size = 0;
+  long long no_dictionary_size = 0;
+#ifdef BENCHMARK_WITH_ZLIB
+  long long deflate_size = 0;
+#endif
+
+  no_dictionary_options.dictionary = AZ_SPAN_EMPTY;
+
+  for (long n = 0; n < count; n++)
+  {
+    sample* s = &samples[n];
+    uint8_t buffer[PAYLOAD_BUFFER_SIZE];
+    az_span decompressed;
+
+    if (az_result_failed(
+            generate_payload(bench->kind, AZ_SPAN_FROM_BUFFER(s->payload_buffer), &s->payload)))
+    {
+      fprintf(stderr, "%s: failed generating the payload.\n", bench->name);
+      return false;
+    }
+
+    int32_t size = get_compressed_size(
+        options, s->payload, AZ_SPAN_FROM_BUFFER(s->compressed_buffer), &s->compressed);
+
+    if (size < 0
+        || (az_span_size(s->compressed) > 0
+            && (az_result_failed(az_iot_message_decompress(
+                    options, s->compressed, AZ_SPAN_FROM_BUFFER(buffer), &decompressed))
+                || !az_span_is_content_equal(decompressed, s->payload))))
+    {
+      fprintf(stderr, "%s: the payload does not decompress back to itself.\n", bench->name);
+      return false;
+    }
+
+    az_span ignored;
+    payload_size += az_span_size(s->payload);
+    dictionary_size += size;
+    no_dictionary_size += get_compressed_size(
+        &no_dictionary_options, s->payload, AZ_SPAN_FROM_BUFFER(buffer), &ignored);
+#ifdef BENCHMARK_WITH_ZLIB
+    deflate_size += get_deflate_size(s->payload);
+#endif
+  }
+
+  printf(
+      "  %-22s %5lld B %7.0f%% %7.0f%%",
+      bench->name,
+      payload_size / count,
+      100.0 * (double)dictionary_size / (double)payload_size,
+      100.0 * (double)no_dictionary_size / (double)payload_size);
+#ifdef BENCHMARK_WITH_ZLIB
+  printf(" %7.0f%%", 100.0 * (double)deflate_size / (double)payload_size);
+#endif
+  printf("\n");
+
+  return true;
+}
+
+// Gets the payload bytes compressed per second, with the dictionary.
+static double measure_compression(
+    az_iot_message_compression_options const* options,
+    sample* samples,
+    long count)
+{
+  uint8_t buffer[PAYLOAD_BUFFER_SIZE];
+  long long bytes = 0;
+  clock_t start_clock = clock();
+
+  for (long n = 0; n < count; n++)
+  {
+    az_span compressed;
+    (void)get_compressed_size(
+        options, samples[n].payload, AZ_SPAN_FROM_BUFFER(buffer), &compressed);
+    bytes += az_span_size(samples[n].payload);
+  }
+
+  return (double)bytes / get_elapsed_seconds(start_clock);
+}
+
+// Gets the payload bytes decompressed per second, for the payloads that got smaller.
+static double measure_decompression(
+    az_iot_message_compression_options const* options,
+    sample* samples,
+    long count,
+    int repeat_count)
+{
+  uint8_t buffer[PAYLOAD_BUFFER_SIZE];
+  long long bytes = 0;
+  clock_t start_clock = clock();
+
+  for (int r = 0; r < repeat_count; r++)
+  {
+    for (long n = 0; n < count; n++)
+    {
+      az_span decompressed;
+
+      if (az_span_size(samples[n].compressed) > 0
+          && az_result_succeeded(az_iot_message_decompress(
+              options, samples[n].compressed, AZ_SPAN_FROM_BUFFER(buffer), &decompressed)))
+      {
+        bytes += az_span_size(decompressed);
+      }
+    }
+  }
+
+  return (double)bytes / get_elapsed_seconds(start_clock);
+}
+
+int main(int argc, char* argv[])
+{
+  long iterations = DEFAULT_ITERATIONS;
+
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0)
+  {
+    iterations = strtol(argv[2], NULL, 10);
+  }
+
+  if (iterations <= 0 || (argc != 1 && argc != 3))
+  {
+    fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+    return 2;
+  }
+
+  az_iot_message_compression_options options = az_iot_message_compression_options_default();
+  size_t case_count = sizeof(cases) / sizeof(cases[0]);
+  sample* samples[sizeof(cases) / sizeof(cases[0])];
+
+  printf(
+      "Compressed size, as a share of the payload size, %ld random payloads each:\n", iterations);
+  printf("  %-22s %7s %8s %8s", "payload", "size", "dict", "no dict");
+#ifdef BENCHMARK_WITH_ZLIB
+  printf(" %8s", "deflate");
+#endif
+  printf("\n");
+
+  for (size_t i = 0; i < case_count; i++)
+  {
+    samples[i] = malloc((size_t)iterations * sizeof(sample));
+
+    if (samples[i] == NULL)
+    {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+    }
+
+    if (!measure_ratios(&cases[i], &options, samples[i], iterations))
+    {
+      return 1;
+    }
+  }
+
+  printf("Throughput with the dictionary:\n");
+
+  for (size_t i = 0; i < case_count; i++)
+  {
+    double compression_rate = measure_compression(&options, samples[i], iterations);
+    double decompression_rate = measure_decompression(&options, samples[i], iterations, 20);
+    double payload_size = 0;
+
+    for (long n = 0; n < iterations; n++)
+    {
+      payload_size += (double)az_span_size(samples[i][n].payload) / (double)iterations;
+    }
+
+    printf(
+        "  %-22s compression %5.1f MB/s (%4.0f us per payload), decompression %4.0f MB/s\n",
+        cases[i].name,
+        compression_rate / 1e6,
+        payload_size / compression_rate * 1e6,
+        decompression_rate / 1e6);
+
+    free(samples[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,288 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Message store benchmark.
+ *
+ * Measures how fast an az_iot_message_store full of messages is drained with
+ * az_iot_message_store_peek() and az_iot_message_store_pop(), as a device does once it reconnects,
+ * and how long az_iot_message_store_init() takes to recover the full store after a restart. The
+ * store is kept on RAM, and on a simulated NOR flash with erase blocks. The drained messages are
+ * checked to be the appended ones, oldest first, before timing.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define STORE_SIZE (64 * 1024)
+#define ERASE_BLOCK_SIZE 4096
+#define MAX_MESSAGE_SIZE 1024
+#define DEFAULT_ITERATIONS 200
+
+typedef struct
+{
+  const char* name;
+  int32_t message_size;
+} benchmark_case;
+
+static const benchmark_case cases[] = {
+  { "64-byte messages", 64 },
+  { "256-byte messages", 256 },
+  { "1024-byte messages", 1024 },
+};
+
+static uint8_t storage[STORE_SIZE];
+static volatile uint8_t message_sink;
+
+// NOR flash: a write can only clear bits, and an erase sets a whole block back to 0xFF.
+static az_result flash_read(void* context, int32_t offset, uint8_t* buffer, int32_t size)
+{
+  (void)memcpy(buffer, (uint8_t*)context + offset, (size_t)size);
+  return AZ_OK;
+}
+
+static az_result flash_write(void* context, int32_t offset, uint8_t const* data, int32_t size)
+{
+  uint8_t* flash = (uint8_t*)context + offset;
+
+  for (int32_t i = 0; i < size; i++)
+  {
+    flash[i] &= data[i];
+  }
+
+  return AZ_OK;
+}
+
+static az_result flash_erase(void* context, int32_t offset, int32_t size)
+{
+  (void)memset((uint8_t*)context + offset, 0xFF, (size_t)size);
+  return AZ_OK;
+}
+
+static az_iot_message_store_backend get_backend(bool use_flash)
+{
+  if (!use_flash)
+  {
+    return az_iot_message_store_ram_backend_create(AZ_SPAN_FROM_BUFFER(storage));
+  }
+
+  az_iot_message_store_backend backend;
+  backend.read = flash_read;
+  backend.write = flash_write;
+  backend.erase = flash_erase;
+  backend.size = STORE_SIZE;
+  backend.erase_block_size = ERASE_BLOCK_SIZE;
+  backend.context = storage;
+
+  return backend;
+}
+
+static void fill_message(uint8_t* message, int32_t size, uint32_t sequence)
+{
+  for (int32_t i = 0; i < size; i++)
+  {
+    message[i] = (uint8_t)(sequence * 31 + (uint32_t)i);
+  }
+}
+
+// Starts an empty store and appends messages until one evicts the oldest. Returns the number of
+// messages held, or -1 on failure, and the sequence of the oldest one.
+static int32_t fill_store(
+    az_iot_message_store* store,
+    bool use_flash,
+    int32_t message_size,
+    uint32_t* out_first_sequence)
+{
+  az_iot_message_store_backend backend = get_backend(use_flash);
+  uint8_t message[MAX_MESSAGE_SIZE];
+  uint32_t sequence = 0;
+
+  (void)memset(storage, use_flash ? 0xFF : 0x00, sizeof(storage));
+
+  if (az_result_failed(az_iot_message_store_init(store, &backend)))
+  {
+    return -1;
+  }
+
+  while (az_iot_message_store_get_count(store) == (int32_t)sequence)
+  {
+    fill_message(message, message_size, sequence++);
+
+    if (az_result_failed(
+            az_iot_message_store_append(store, az_span_create(message, message_size))))
+    {
+      return -1;
+    }
+  }
+
+  *out_first_sequence = sequence - (uint32_t)az_iot_message_store_get_count(store);
+
+  return az_iot_message_store_get_count(store);
+}
+
+// Drains the store, checking the messages are the appended ones oldest first if check is set.
+static bool drain_store(
+    az_iot_message_store* store,
+    int32_t message_size,
+    uint32_t first_sequence,
+    bool check)
+{
+  uint8_t buffer[MAX_MESSAGE_SIZE];
+  uint8_t expected[MAX_MESSAGE_SIZE];
+  uint32_t sequence = first_sequence;
+  az_span message;
+  az_result result;
+
+  while (az_result_succeeded(
+      result = az_iot_message_store_peek(store, AZ_SPAN_FROM_BUFFER(buffer), &message)))
+  {
+    if (check)
+    {
+      fill_message(expected, message_size, sequence++);
+
+      if (az_span_size(message) != message_size
+          || memcmp(az_span_ptr(message), expected, (size_t)message_size) != 0)
+      {
+        return false;
+      }
+    }
+
+    message_sink = az_span_ptr(message)[0];
+
+    if (az_result_failed(az_iot_message_store_pop(store)))
+    {
+      return false;
+    }
+  }
+
+  return result == AZ_ERROR_ITEM_NOT_FOUND && az_iot_message_store_get_count(store) == 0;
+}
+
+// Measures the recovery and the drain of a full store, in microseconds per store. Returns false on
+// failure.
+static bool measure(
+    bool use_flash,
+    int32_t message_size,
+    long iterations,
+    double* out_drain_usec,
+    double* out_recovery_usec)
+{
+  az_iot_message_store store;
+  az_iot_message_store_backend backend = get_backend(use_flash);
+  clock_t drain_clocks = 0;
+  clock_t recovery_clocks = 0;
+
+  for (long i = 0; i < iterations; i++)
+  {
+    uint32_t first_sequence;
+    int32_t count = fill_store(&store, use_flash, message_size, &first_sequence);
+
+    if (count <= 0)
+    {
+      return false;
+    }
+
+    clock_t start_clock = clock();
+
+    if (az_result_failed(az_iot_message_store_init(&store, &backend)))
+    {
+      return false;
+    }
+
+    recovery_clocks += clock() - start_clock;
+
+    if (az_iot_message_store_get_count(&store) != count)
+    {
+      return false;
+    }
+
+    start_clock = clock();
+
+    if (!drain_store(&store, message_size, first_sequence, false))
+    {
+      return false;
+    }
+
+    drain_clocks += clock() - start_clock;
+  }
+
+  *out_drain_usec = (double)drain_clocks / CLOCKS_PER_SEC * 1e6 / (double)iterations;
+  *out_recovery_usec = (double)recovery_clocks / CLOCKS_PER_SEC * 1e6 / (double)iterations;
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  long iterations = DEFAULT_ITERATIONS;
+
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0)
+  {
+    iterations = strtol(argv[2], NULL, 10);
+  }
+
+  if (iterations <= 0 || (argc != 1 && argc != 3))
+  {
+    fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+    return 2;
+  }
+
+  printf(
+      "Full store drain and recovery, %ld iterations, %d KiB store, %d-byte flash erase blocks:\n",
+      iterations,
+      STORE_SIZE / 1024,
+      ERASE_BLOCK_SIZE);
+  printf(
+      "  %-8s %-18s %6s %11s %13s %11s\n",
+      "backend",
+      "messages",
+      "count",
+      "drain",
+      "throughput",
+      "recovery");
+
+  for (int use_flash = 0; use_flash <= 1; use_flash++)
+  {
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+      benchmark_case const* bench = &cases[i];
+      az_iot_message_store store;
+      uint32_t first_sequence;
+      double drain_usec;
+      double recovery_usec;
+      int32_t count = fill_store(&store, use_flash, bench->message_size, &first_sequence);
+
+      if (count <= 0 || !drain_store(&store, bench->message_size, first_sequence, true))
+      {
+        fprintf(stderr, "%s: the drained messages differ from the appended ones.\n", bench->name);
+        return 1;
+      }
+
+      if (!measure(use_flash, bench->message_size, iterations, &drain_usec, &recovery_usec))
+      {
+        fprintf(stderr, "%s: failed to recover or drain the store.\n", bench->name);
+        return 1;
+      }
+
+      printf(
+          "  %-8s %-18s %6d %8.1f us %8.1f MB/s %8.1f us\n",
+          use_flash ? "flash" : "RAM",
+          bench->name,
+          (int)count,
+          drain_usec,
+          (double)count * bench->message_size / drain_usec,
+          recovery_usec);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,509 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Group enrollment key derivation benchmark.
+ *
+ * Measures the cost of az_iot_provisioning_client_sas_derive_device_keys() with two
+ * az_iot_sas_hmac_sha256_fn callbacks built on the same SHA-256 code:
+ *  - a plain one, computing HMAC-SHA256 from the group key on each call;
+ *  - the reference one, keeping in its context the SHA-256 states reached after hashing the
+ *    ipad and opad key blocks, so each call resumes from copies of them.
+ * Both are checked against RFC 4231 test vectors, and the keys derived with them are checked to
+ * be identical and to match precomputed ones, before timing them.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+// The base64 encoded group enrollment key: the bytes 1 to 64.
+#define GROUP_KEY \
+  "AQIDBAUGBwgJCgsMDQ4PEBESExQVFhcYGRobHB0eHyAhIiMkJSYnKCkqKywtLi8wMTIzNDU2Nzg5Ojs8PT4/QA=="
+#define REGISTRATION_ID_FORMAT "factory-device-%06ld"
+#define REGISTRATION_ID_BUFFER_SIZE 32
+#define DEFAULT_ITERATIONS 100000
+#define BATCH_SIZE 1000
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_HASH_SIZE 32
+
+typedef struct
+{
+  uint32_t h[8];
+  uint64_t length;
+  uint8_t block[SHA256_BLOCK_SIZE];
+  size_t block_length;
+} sha256_state;
+
+// The context of hmac_sha256_plain().
+typedef struct
+{
+  uint8_t key[SHA256_BLOCK_SIZE];
+} hmac_sha256_plain_context;
+
+// The context of hmac_sha256_precomputed().
+typedef struct
+{
+  sha256_state inner;
+  sha256_state outer;
+} hmac_sha256_precomputed_context;
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static volatile int32_t derived_key_size_sink;
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(uint32_t h[8], uint8_t const block[SHA256_BLOCK_SIZE])
+{
+  uint32_t w[64];
+  uint32_t v[8];
+
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16
+        | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+  }
+
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  memcpy(v, h, sizeof(v));
+
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t s1 = ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25);
+    uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    uint32_t t1 = v[7] + s1 + ch + sha256_k[i] + w[i];
+    uint32_t s0 = ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22);
+    uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+
+    v[7] = v[6];
+    v[6] = v[5];
+    v[5] = v[4];
+    v[4] = v[3] + t1;
+    v[3] = v[2];
+    v[2] = v[1];
+    v[1] = v[0];
+    v[0] = t1 + s0 + maj;
+  }
+
+  for (int i = 0; i < 8; i++)
+  {
+    h[i] += v[i];
+  }
+}
+
+static void sha256_init(sha256_state* state)
+{
+  static const uint32_t initial_h[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+
+  memcpy(state->h, initial_h, sizeof(initial_h));
+  state->length = 0;
+  state->block_length = 0;
+}
+
+static void sha256_update(sha256_state* state, uint8_t const* data, size_t size)
+{
+  state->length += size;
+
+  while (size > 0)
+  {
+    size_t chunk = SHA256_BLOCK_SIZE - state->block_length;
+
+    if (chunk > size)
+    {
+      chunk = size;
+    }
+
+    memcpy(state->block + state->block_length, data, chunk);
+    state->block_length += chunk;
+    data += chunk;
+    size -= chunk;
+
+    if (state->block_length == SHA256_BLOCK_SIZE)
+    {
+      sha256_compress(state->h, state->block);
+      state->block_length = 0;
+    }
+  }
+}
+
+static void sha256_final(sha256_state* state, uint8_t hash[SHA256_HASH_SIZE])
+{
+  uint64_t bit_length = state->length * 8;
+
+  state->block[state->block_length++] = 0x80;
+
+  if (state->block_length > SHA256_BLOCK_SIZE - 8)
+  {
+    memset(state->block + state->block_length, 0, SHA256_BLOCK_SIZE - state->block_length);
+    sha256_compress(state->h, state->block);
+    state->block_length = 0;
+  }
+
+  memset(state->block + state->block_length, 0, SHA256_BLOCK_SIZE - 8 - state->block_length);
+
+  for (int i = 0; i < 8; i++)
+  {
+    state->block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bit_length >> (i * 8));
+  }
+
+  sha256_compress(state->h, state->block);
+
+  for (int i = 0; i < 8; i++)
+  {
+    hash[i * 4] = (uint8_t)(state->h[i] >> 24);
+    hash[i * 4 + 1] = (uint8_t)(state->h[i] >> 16);
+    hash[i * 4 + 2] = (uint8_t)(state->h[i] >> 8);
+    hash[i * 4 + 3] = (uint8_t)state->h[i];
+  }
+}
+
+// Writes the key padded to a block, hashing it first if it is longer than a block.
+static void get_padded_key(az_span key, uint8_t padded_key[SHA256_BLOCK_SIZE])
+{
+  memset(padded_key, 0, SHA256_BLOCK_SIZE);
+
+  if (az_span_size(key) > SHA256_BLOCK_SIZE)
+  {
+    sha256_state state;
+
+    sha256_init(&state);
+    sha256_update(&state, az_span_ptr(key), (size_t)az_span_size(key));
+    sha256_final(&state, padded_key);
+  }
+  else
+  {
+    memcpy(padded_key, az_span_ptr(key), (size_t)az_span_size(key));
+  }
+}
+
+// Writes the SHA-256 state reached after hashing the padded key XORed with pad.
+static void get_keyed_state(
+    uint8_t const padded_key[SHA256_BLOCK_SIZE],
+    uint8_t pad,
+    sha256_state* out_state)
+{
+  uint8_t block[SHA256_BLOCK_SIZE];
+
+  for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+  {
+    block[i] = padded_key[i] ^ pad;
+  }
+
+  sha256_init(out_state);
+  sha256_update(out_state, block, sizeof(block));
+}
+
+// Completes an HMAC-SHA256 from copies of its inner and outer keyed states.
+static az_result hmac_sha256_resume(
+    sha256_state const* inner,
+    sha256_state const* outer,
+    az_span data,
+    az_span signed_data)
+{
+  sha256_state state;
+  uint8_t inner_hash[SHA256_HASH_SIZE];
+
+  if (az_span_size(signed_data) < SHA256_HASH_SIZE)
+  {
+    return AZ_ERROR_NOT_ENOUGH_SPACE;
+  }
+
+  state = *inner;
+  sha256_update(&state, az_span_ptr(data), (size_t)az_span_size(data));
+  sha256_final(&state, inner_hash);
+
+  state = *outer;
+  sha256_update(&state, inner_hash, sizeof(inner_hash));
+  sha256_final(&state, az_span_ptr(signed_data));
+
+  return AZ_OK;
+}
+
+// Computes HMAC-SHA256 from the key on each call: four compressions for a short id.
+static az_result hmac_sha256_plain(void* context, az_span data, az_span signed_data)
+{
+  hmac_sha256_plain_context const* plain = (hmac_sha256_plain_context const*)context;
+  sha256_state inner;
+  sha256_state outer;
+
+  get_keyed_state(plain->key, 0x36, &inner);
+  get_keyed_state(plain->key, 0x5c, &outer);
+
+  return hmac_sha256_resume(&inner, &outer, data, signed_data);
+}
+
+static void hmac_sha256_plain_init(hmac_sha256_plain_context* context, az_span key)
+{
+  get_padded_key(key, context->key);
+}
+
+/*
+ * The reference callback: the keyed states are computed once by hmac_sha256_precomputed_init(),
+ * so a short id costs two compressions. The context holds no copy of the key itself.
+ */
+static az_result hmac_sha256_precomputed(void* context, az_span data, az_span signed_data)
+{
+  hmac_sha256_precomputed_context const* precomputed
+      = (hmac_sha256_precomputed_context const*)context;
+
+  return hmac_sha256_resume(&precomputed->inner, &precomputed->outer, data, signed_data);
+}
+
+static void hmac_sha256_precomputed_init(hmac_sha256_precomputed_context* context, az_span key)
+{
+  uint8_t padded_key[SHA256_BLOCK_SIZE];
+
+  get_padded_key(key, padded_key);
+  get_keyed_state(padded_key, 0x36, &context->inner);
+  get_keyed_state(padded_key, 0x5c, &context->outer);
+  memset(padded_key, 0, sizeof(padded_key));
+}
+
+static bool check_hmac_vector(
+    az_iot_sas_hmac_sha256_fn hmac_sha256,
+    void* context,
+    az_span data,
+    uint8_t const expected[SHA256_HASH_SIZE])
+{
+  uint8_t signed_data[SHA256_HASH_SIZE];
+
+  return az_result_succeeded(hmac_sha256(context, data, AZ_SPAN_FROM_BUFFER(signed_data)))
+      && memcmp(signed_data, expected, SHA256_HASH_SIZE) == 0;
+}
+
+// Checks both callbacks against test cases 2 (short key) and 6 (key longer than a block) of
+// RFC 4231.
+static bool check_rfc4231_vectors(void)
+{
+  static const uint8_t expected_2[SHA256_HASH_SIZE] = {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43,
+  };
+  static const uint8_t expected_6[SHA256_HASH_SIZE] = {
+    0x60, 0xe4, 0x31, 0x59, 0x1e, 0xe0, 0xb6, 0x7f, 0x0d, 0x8a, 0x26, 0xaa, 0xcb, 0xf5, 0xb7, 0x7f,
+    0x8e, 0x0b, 0xc6, 0x21, 0x37, 0x28, 0xc5, 0x14, 0x05, 0x46, 0x04, 0x0f, 0x0e, 0xe3, 0x7f, 0x54,
+  };
+  uint8_t key_6[131];
+  hmac_sha256_plain_context plain;
+  hmac_sha256_precomputed_context precomputed;
+  az_span data_2 = AZ_SPAN_FROM_STR("what do ya want for nothing?");
+  az_span data_6 = AZ_SPAN_FROM_STR("Test Using Larger Than Block-Size Key - Hash Key First");
+
+  memset(key_6, 0xaa, sizeof(key_6));
+
+  hmac_sha256_plain_init(&plain, AZ_SPAN_FROM_STR("Jefe"));
+  hmac_sha256_precomputed_init(&precomputed, AZ_SPAN_FROM_STR("Jefe"));
+
+  if (!check_hmac_vector(hmac_sha256_plain, &plain, data_2, expected_2)
+      || !check_hmac_vector(hmac_sha256_precomputed, &precomputed, data_2, expected_2))
+  {
+    return false;
+  }
+
+  hmac_sha256_plain_init(&plain, AZ_SPAN_FROM_BUFFER(key_6));
+  hmac_sha256_precomputed_init(&precomputed, AZ_SPAN_FROM_BUFFER(key_6));
+
+  return check_hmac_vector(hmac_sha256_plain, &plain, data_6, expected_6)
+      && check_hmac_vector(hmac_sha256_precomputed, &precomputed, data_6, expected_6);
+}
+
+// Fills the registration ids of the batch starting at first_index.
+static void get_registration_ids(
+    long first_index,
+    char ids_buffer[BATCH_SIZE][REGISTRATION_ID_BUFFER_SIZE],
+    az_span registration_ids[BATCH_SIZE])
+{
+  for (int i = 0; i < BATCH_SIZE; i++)
+  {
+    int length = snprintf(
+        ids_buffer[i], REGISTRATION_ID_BUFFER_SIZE, REGISTRATION_ID_FORMAT, first_index + i);
+    registration_ids[i] = az_span_create((uint8_t*)ids_buffer[i], length);
+  }
+}
+
+// Checks the keys derived with both callbacks are identical for a batch of ids, and match the
+// keys of the first and last of them, computed with Python's hmac and base64 modules.
+static bool check_same_keys(
+    hmac_sha256_plain_context* plain,
+    hmac_sha256_precomputed_context* precomputed)
+{
+  static char ids_buffer[BATCH_SIZE][REGISTRATION_ID_BUFFER_SIZE];
+  static az_span registration_ids[BATCH_SIZE];
+  static uint8_t keys_buffer[BATCH_SIZE * AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE];
+  static uint8_t precomputed_keys_buffer[sizeof(keys_buffer)];
+  az_span keys[BATCH_SIZE];
+  az_span precomputed_keys[BATCH_SIZE];
+
+  get_registration_ids(99999 - (BATCH_SIZE - 1), ids_buffer, registration_ids);
+
+  if (az_result_failed(az_iot_provisioning_client_sas_derive_device_keys(
+          registration_ids,
+          BATCH_SIZE,
+          hmac_sha256_plain,
+          plain,
+          AZ_SPAN_FROM_BUFFER(keys_buffer),
+          keys))
+      || az_result_failed(az_iot_provisioning_client_sas_derive_device_keys(
+          registration_ids,
+          BATCH_SIZE,
+          hmac_sha256_precomputed,
+          precomputed,
+          AZ_SPAN_FROM_BUFFER(precomputed_keys_buffer),
+          precomputed_keys)))
+  {
+    return false;
+  }
+
+  for (int i = 0; i < BATCH_SIZE; i++)
+  {
+    if (!az_span_is_content_equal(keys[i], precomputed_keys[i]))
+    {
+      return false;
+    }
+  }
+
+  if (!az_span_is_content_equal(
+          keys[BATCH_SIZE - 1], AZ_SPAN_FROM_STR("dtrNQtnMU6QSlK7WnDu0IL4/IeDD3ZbMjiFwX4EC7/s=")))
+  {
+    return false;
+  }
+
+  get_registration_ids(0, ids_buffer, registration_ids);
+
+  return az_result_succeeded(az_iot_provisioning_client_sas_derive_device_keys(
+             registration_ids,
+             1,
+             hmac_sha256_precomputed,
+             precomputed,
+             AZ_SPAN_FROM_BUFFER(keys_buffer),
+             keys))
+      && az_span_is_content_equal(
+             keys[0], AZ_SPAN_FROM_STR("PmM/9Vf6yvIM/kor8ugZviHvMlMPkl8QK1Msu1+MNQw="));
+}
+
+// Returns the time per id in nanoseconds, or a negative value if a derivation failed. The
+// registration ids are formatted outside of the timed section.
+static double measure(az_iot_sas_hmac_sha256_fn hmac_sha256, void* context, long iterations)
+{
+  static char ids_buffer[BATCH_SIZE][REGISTRATION_ID_BUFFER_SIZE];
+  static az_span registration_ids[BATCH_SIZE];
+  static uint8_t keys_buffer[BATCH_SIZE * AZ_IOT_PROVISIONING_CLIENT_DERIVED_DEVICE_KEY_SIZE];
+  az_span keys[BATCH_SIZE];
+  clock_t elapsed_clock = 0;
+
+  for (long first_index = 0; first_index < iterations; first_index += BATCH_SIZE)
+  {
+    long count = iterations - first_index < BATCH_SIZE ? iterations - first_index : BATCH_SIZE;
+
+    get_registration_ids(first_index, ids_buffer, registration_ids);
+
+    clock_t start_clock = clock();
+
+    if (az_result_failed(az_iot_provisioning_client_sas_derive_device_keys(
+            registration_ids,
+            (int32_t)count,
+            hmac_sha256,
+            context,
+            AZ_SPAN_FROM_BUFFER(keys_buffer),
+            keys)))
+    {
+      return -1;
+    }
+
+    elapsed_clock += clock() - start_clock;
+    derived_key_size_sink = az_span_size(keys[count - 1]);
+  }
+
+  return (double)elapsed_clock / CLOCKS_PER_SEC * 1e9 / (double)iterations;
+}
+
+int main(int argc, char* argv[])
+{
+  long iterations = DEFAULT_ITERATIONS;
+  uint8_t group_key_buffer[SHA256_BLOCK_SIZE];
+  int32_t group_key_length = 0;
+  hmac_sha256_plain_context plain;
+  hmac_sha256_precomputed_context precomputed;
+
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0)
+  {
+    iterations = strtol(argv[2], NULL, 10);
+  }
+
+  if (iterations <= 0 || (argc != 1 && argc != 3))
+  {
+    fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+    return 2;
+  }
+
+  if (!check_rfc4231_vectors())
+  {
+    fprintf(stderr, "The HMAC-SHA256 callbacks do not match the RFC 4231 test vectors.\n");
+    return 1;
+  }
+
+  if (az_result_failed(az_base64_decode(
+          AZ_SPAN_FROM_BUFFER(group_key_buffer), AZ_SPAN_FROM_STR(GROUP_KEY), &group_key_length)))
+  {
+    fprintf(stderr, "Failed to decode the group enrollment key.\n");
+    return 1;
+  }
+
+  az_span group_key = az_span_create(group_key_buffer, group_key_length);
+
+  hmac_sha256_plain_init(&plain, group_key);
+  hmac_sha256_precomputed_init(&precomputed, group_key);
+
+  if (!check_same_keys(&plain, &precomputed))
+  {
+    fprintf(stderr, "The derived device keys differ between callbacks or from the expected.\n");
+    return 1;
+  }
+
+  double plain_nsec = measure(hmac_sha256_plain, &plain, iterations);
+  double precomputed_nsec = measure(hmac_sha256_precomputed, &precomputed, iterations);
+
+  if (plain_nsec < 0 || precomputed_nsec < 0)
+  {
+    fprintf(stderr, "Failed to derive the device keys.\n");
+    return 1;
+  }
+
+  printf(
+      "Device key derivation cost, %ld registration ids of %d characters, %d-byte group key:\n",
+      iterations,
+      (int)strlen("factory-device-000000"),
+      (int)group_key_length);
+  printf("  keyed states computed per id   %7.1f ns\n", plain_nsec);
+  printf("  keyed states in the context    %7.1f ns\n", precomputed_nsec);
+
+  return 0;
+}
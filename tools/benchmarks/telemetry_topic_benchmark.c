@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Telemetry topic benchmark.
+ *
+ * Measures the cost of az_iot_hub_client_telemetry_get_publish_topic() with and without the
+ * telemetry topic cache of az_iot_hub_client_options, for device and module clients, with and
+ * without message properties. The topics built both ways are checked to be identical first.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define IOT_HUB_HOSTNAME "myiothub.azure-devices.net"
+#define DEVICE_ID "sensor-0123456789abc"
+#define MODULE_ID "telemetry-module"
+#define DEFAULT_ITERATIONS 10000000
+#define TOPIC_BUFFER_SIZE 128
+
+typedef struct
+{
+  const char* name;
+  bool use_module_id;
+  bool use_properties;
+} benchmark_case;
+
+static const benchmark_case cases[] = {
+  { "no properties", false, false },
+  { "with \"k=v\"", false, true },
+  { "module id, no properties", true, false },
+  { "module id, with \"k=v\"", true, true },
+};
+
+static uint8_t topic_cache[TOPIC_BUFFER_SIZE];
+static char properties_buffer[] = "k=v";
+static volatile size_t topic_length_sink;
+
+static bool init_client(az_iot_hub_client* client, benchmark_case const* bench, bool use_cache)
+{
+  az_iot_hub_client_options options = az_iot_hub_client_options_default();
+
+  if (bench->use_module_id)
+  {
+    options.module_id = AZ_SPAN_FROM_STR(MODULE_ID);
+  }
+
+  if (use_cache)
+  {
+    options.telemetry_topic_cache = AZ_SPAN_FROM_BUFFER(topic_cache);
+  }
+
+  return az_result_succeeded(az_iot_hub_client_init(
+      client, AZ_SPAN_FROM_STR(IOT_HUB_HOSTNAME), AZ_SPAN_FROM_STR(DEVICE_ID), &options));
+}
+
+// Returns the time per call in nanoseconds, or a negative value if a call failed.
+static double measure(
+    az_iot_hub_client const* client,
+    az_iot_message_properties const* properties,
+    long iterations)
+{
+  char topic[TOPIC_BUFFER_SIZE];
+  size_t topic_length;
+  clock_t start_clock = clock();
+
+  for (long i = 0; i < iterations; i++)
+  {
+    if (az_result_failed(az_iot_hub_client_telemetry_get_publish_topic(
+            client, properties, topic, sizeof(topic), &topic_length)))
+    {
+      return -1;
+    }
+
+    topic_length_sink = topic_length;
+  }
+
+  return (double)(clock() - start_clock) / CLOCKS_PER_SEC * 1e9 / (double)iterations;
+}
+
+// Checks the cached client builds the same topic, and fails the same way, for every topic size.
+static bool check_same_topics(
+    az_iot_hub_client const* client,
+    az_iot_hub_client const* cached_client,
+    az_iot_message_properties const* properties)
+{
+  for (size_t size = 1; size <= TOPIC_BUFFER_SIZE; size++)
+  {
+    char topic[TOPIC_BUFFER_SIZE];
+    char cached_topic[TOPIC_BUFFER_SIZE];
+    size_t topic_length = 0;
+    size_t cached_topic_length = 0;
+
+    az_result result = az_iot_hub_client_telemetry_get_publish_topic(
+        client, properties, topic, size, &topic_length);
+    az_result cached_result = az_iot_hub_client_telemetry_get_publish_topic(
+        cached_client, properties, cached_topic, size, &cached_topic_length);
+
+    if (result != cached_result
+        || (az_result_succeeded(result)
+            && (topic_length != cached_topic_length
+                || memcmp(topic, cached_topic, topic_length + 1) != 0)))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  long iterations = DEFAULT_ITERATIONS;
+
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0)
+  {
+    iterations = strtol(argv[2], NULL, 10);
+  }
+
+  if (iterations <= 0 || (argc != 1 && argc != 3))
+  {
+    fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+    return 2;
+  }
+
+  printf(
+      "Telemetry topic build cost, %ld iterations, %d-character device id:\n",
+      iterations,
+      (int)strlen(DEVICE_ID));
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    benchmark_case const* bench = &cases[i];
+    az_iot_hub_client client;
+    az_iot_hub_client cached_client;
+    az_iot_message_properties properties;
+    az_iot_message_properties const* properties_ptr = NULL;
+
+    if (bench->use_properties)
+    {
+      if (az_result_failed(az_iot_message_properties_init(
+              &properties,
+              AZ_SPAN_FROM_BUFFER(properties_buffer),
+              (int32_t)strlen(properties_buffer))))
+      {
+        fprintf(stderr, "Failed to initialize the message properties.\n");
+        return 1;
+      }
+
+      properties_ptr = &properties;
+    }
+
+    if (!init_client(&client, bench, false) || !init_client(&cached_client, bench, true))
+    {
+      fprintf(stderr, "Failed to initialize the hub clients.\n");
+      return 1;
+    }
+
+    if (!check_same_topics(&client, &cached_client, properties_ptr))
+    {
+      fprintf(stderr, "%s: the cached topic differs from the uncached one.\n", bench->name);
+      return 1;
+    }
+
+    double uncached_nsec = measure(&client, properties_ptr, iterations);
+    double cached_nsec = measure(&cached_client, properties_ptr, iterations);
+
+    if (uncached_nsec < 0 || cached_nsec < 0)
+    {
+      fprintf(stderr, "%s: failed to build the topic.\n", bench->name);
+      return 1;
+    }
+
+    printf("  %-26s %6.1f ns -> %6.1f ns\n", bench->name, uncached_nsec, cached_nsec);
+  }
+
+  return 0;
+}
@@ -0,0 +1,920 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Fleet provisioning load simulator.
+ *
+ * Boots a fleet of simulated devices at once, each with its own az_iot_provisioning_client and
+ * az_iot_hub_client, and drives them through DPS registration, status polling, IoT Hub
+ * connection and subscription. The devices use the topic, payload and password builders and the
+ * response parser of this library; the MQTT broker, the Device Provisioning Service and the IoT
+ * Hub are local stand-ins, run as a discrete event simulation in virtual time, so no network or
+ * cloud access is needed and runs are reproducible.
+ *
+ * The broker handles one packet at a time at a fixed rate, and each packet takes a fixed one-way
+ * latency to reach it and to be delivered, so a fleet booting at once queues on the broker. DPS
+ * assigns devices at a fixed rate, each taking a fixed time, and answers status queries with
+ * "assigning" and a retry-after until the device is assigned.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define GLOBAL_DEVICE_ENDPOINT "global.azure-devices-provisioning.net"
+#define ID_SCOPE "0ne00000000"
+#define IOT_HUB_HOSTNAME "simulated-hub.azure-devices.net"
+#define MQTT_PACKET_BUFFER_SIZE 1024
+#define DEVICE_STRINGS_BUFFER_SIZE 160
+#define HUB_SUBSCRIPTION_COUNT 3
+#define OPERATION_ID_FORMAT "4.5eed.%08d"
+#define SAS_TOKEN_EXPIRATION_TIME 1900000000
+
+typedef struct
+{
+  int32_t device_count;
+  int32_t boot_window_msec;
+  int32_t latency_msec;
+  int32_t broker_packets_per_sec;
+  int32_t dps_assignments_per_sec;
+  int32_t dps_assignment_msec;
+  uint32_t dps_retry_after_sec;
+  bool use_backoff;
+  uint64_t seed;
+} simulation_options;
+
+typedef enum
+{
+  device_state_off,
+  device_state_connecting_to_dps,
+  device_state_subscribing_to_dps,
+  device_state_registering,
+  device_state_waiting_to_query,
+  device_state_querying,
+  device_state_connecting_to_hub,
+  device_state_subscribing_to_hub,
+  device_state_ready,
+  device_state_failed,
+} device_state;
+
+/*
+ * All a device keeps between events. The MQTT packets it builds and receives are transient, and
+ * share a single buffer.
+ */
+typedef struct
+{
+  az_iot_provisioning_client dps_client;
+  az_iot_hub_client hub_client;
+  uint8_t registration_id[16];
+  // Operation id, IoT Hub hostname and device id, copied from the DPS responses.
+  uint8_t strings[DEVICE_STRINGS_BUFFER_SIZE];
+  az_span operation_id;
+  az_span assigned_hub_hostname;
+  az_span device_id;
+  device_state state;
+  int32_t pending_subscriptions;
+  int32_t query_delay_msec;
+  uint32_t jitter_state;
+  int64_t boot_time_usec;
+  int64_t ready_time_usec;
+} device;
+
+/*
+ * What the DPS stand-in knows of a device.
+ */
+typedef struct
+{
+  int64_t assigned_time_usec;
+  bool is_registered;
+  bool is_assigned;
+} dps_record;
+
+typedef enum
+{
+  event_device_boot,
+  event_device_query_timer,
+  event_device_receive_connack,
+  event_device_receive_suback,
+  event_device_receive_dps_response,
+  event_broker_receive_register,
+  event_broker_receive_query,
+} event_kind;
+
+typedef struct
+{
+  int64_t time_usec;
+  uint64_t sequence;
+  int32_t device_index;
+  event_kind kind;
+} event;
+
+static simulation_options options = {
+  .device_count = 5000,
+  .boot_window_msec = 1000,
+  .latency_msec = 40,
+  .broker_packets_per_sec = 20000,
+  .dps_assignments_per_sec = 250,
+  .dps_assignment_msec = 1500,
+  .dps_retry_after_sec = 3,
+  .use_backoff = false,
+  .seed = 1,
+};
+
+static device* devices;
+static dps_record* dps_records;
+
+static event* events;
+static int32_t event_count;
+static int32_t event_capacity;
+static uint64_t event_sequence;
+
+static int64_t now_usec;
+static int64_t broker_free_time_usec;
+static int64_t dps_free_time_usec;
+static uint64_t random_state;
+
+static int64_t packet_count;
+static int64_t dps_register_count;
+static int64_t dps_query_count;
+static int32_t* packets_per_second;
+static int32_t packets_per_second_size;
+
+// The MQTT packet being built or received, shared by all devices. A packet is built and checked by
+// its receiver at once, when it is sent or delivered.
+static uint8_t packet_topic[MQTT_PACKET_BUFFER_SIZE];
+static uint8_t packet_payload[MQTT_PACKET_BUFFER_SIZE];
+static size_t packet_topic_length;
+static size_t packet_payload_length;
+
+static void dps_check_register(int32_t device_index);
+static void dps_check_query(int32_t device_index);
+static void dps_build_response(int32_t device_index);
+
+static uint32_t get_random(uint32_t range)
+{
+  // xorshift64
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return (uint32_t)(random_state % range);
+}
+
+static void schedule(int64_t time_usec, int32_t device_index, event_kind kind)
+{
+  if (event_count == event_capacity)
+  {
+    event_capacity = event_capacity == 0 ? 1024 : event_capacity * 2;
+    events = realloc(events, (size_t)event_capacity * sizeof(event));
+
+    if (events == NULL)
+    {
+      fprintf(stderr, "Out of memory.\n");
+      exit(1);
+    }
+  }
+
+  // Min-heap ordered by time, then by scheduling order.
+  event new_event = { time_usec, event_sequence++, device_index, kind };
+  int32_t index = event_count++;
+
+  while (index > 0)
+  {
+    int32_t parent = (index - 1) / 2;
+
+    if (events[parent].time_usec < new_event.time_usec
+        || (events[parent].time_usec == new_event.time_usec
+            && events[parent].sequence < new_event.sequence))
+    {
+      break;
+    }
+
+    events[index] = events[parent];
+    index = parent;
+  }
+
+  events[index] = new_event;
+}
+
+static event take_next_event(void)
+{
+  event next = events[0];
+  event last = events[--event_count];
+  int32_t index = 0;
+
+  for (;;)
+  {
+    int32_t child = 2 * index + 1;
+
+    if (child >= event_count)
+    {
+      break;
+    }
+
+    if (child + 1 < event_count
+        && (events[child + 1].time_usec < events[child].time_usec
+            || (events[child + 1].time_usec == events[child].time_usec
+                && events[child + 1].sequence < events[child].sequence)))
+    {
+      child++;
+    }
+
+    if (last.time_usec < events[child].time_usec
+        || (last.time_usec == events[child].time_usec && last.sequence < events[child].sequence))
+    {
+      break;
+    }
+
+    events[index] = events[child];
+    index = child;
+  }
+
+  events[index] = last;
+  return next;
+}
+
+/*
+ * Sends a packet through the broker, which handles one packet at a time. Returns the time the
+ * packet is delivered to the other end.
+ */
+static int64_t send_through_broker(void)
+{
+  int64_t arrival_time_usec = now_usec + (int64_t)options.latency_msec * 1000;
+  int64_t start_time_usec
+      = arrival_time_usec > broker_free_time_usec ? arrival_time_usec : broker_free_time_usec;
+
+  broker_free_time_usec = start_time_usec + 1000000 / options.broker_packets_per_sec;
+  packet_count++;
+
+  int64_t second = start_time_usec / 1000000;
+
+  if (second >= packets_per_second_size)
+  {
+    int32_t new_size = (int32_t)second * 2 + 16;
+    packets_per_second = realloc(packets_per_second, (size_t)new_size * sizeof(int32_t));
+
+    if (packets_per_second == NULL)
+    {
+      fprintf(stderr, "Out of memory.\n");
+      exit(1);
+    }
+
+    memset(
+        packets_per_second + packets_per_second_size,
+        0,
+        (size_t)(new_size - packets_per_second_size) * sizeof(int32_t));
+    packets_per_second_size = new_size;
+  }
+
+  packets_per_second[second]++;
+
+  return broker_free_time_usec + (int64_t)options.latency_msec * 1000;
+}
+
+/*
+ * A stand-in for HMAC-SHA256, only as costly as needed to exercise the password builders. The
+ * simulated services do not check passwords.
+ */
+static az_result sign(void* context, az_span data, az_span signed_data)
+{
+  (void)context;
+  uint32_t hash = 2166136261u;
+
+  for (int32_t i = 0; i < az_span_size(data); i++)
+  {
+    hash = (hash ^ az_span_ptr(data)[i]) * 16777619u;
+  }
+
+  for (int32_t i = 0; i < az_span_size(signed_data); i++)
+  {
+    hash = (hash ^ (uint32_t)i) * 16777619u;
+    az_span_ptr(signed_data)[i] = (uint8_t)(hash >> 24);
+  }
+
+  return AZ_OK;
+}
+
+static void fail(device* device, char const* step, az_result result)
+{
+  fprintf(
+      stderr,
+      "Device %s failed %s (az_result 0x%08x).\n",
+      (char const*)device->registration_id,
+      step,
+      (unsigned)result);
+  device->state = device_state_failed;
+}
+
+/*
+ * Builds the CONNECT packet credentials, as the device would send them.
+ */
+static az_result build_connect(device* device, bool to_hub)
+{
+  char client_id[128];
+  char user_name[256];
+  char password[256];
+  size_t length;
+  az_result result;
+
+  if (to_hub)
+  {
+    result = az_iot_hub_client_get_client_id(
+        &device->hub_client, client_id, sizeof(client_id), &length);
+
+    if (az_result_succeeded(result))
+    {
+      result = az_iot_hub_client_get_user_name(
+          &device->hub_client, user_name, sizeof(user_name), &length);
+    }
+
+    if (az_result_succeeded(result))
+    {
+      result = az_iot_hub_client_sas_get_signed_password(
+          &device->hub_client,
+          SAS_TOKEN_EXPIRATION_TIME,
+          sign,
+          NULL,
+          AZ_SPAN_EMPTY,
+          password,
+          sizeof(password),
+          &length);
+    }
+  }
+  else
+  {
+    result = az_iot_provisioning_client_get_client_id(
+        &device->dps_client, client_id, sizeof(client_id), &length);
+
+    if (az_result_succeeded(result))
+    {
+      result = az_iot_provisioning_client_get_user_name(
+          &device->dps_client, user_name, sizeof(user_name), &length);
+    }
+
+    if (az_result_succeeded(result))
+    {
+      result = az_iot_provisioning_client_sas_get_signed_password(
+          &device->dps_client,
+          SAS_TOKEN_EXPIRATION_TIME,
+          sign,
+          NULL,
+          AZ_SPAN_EMPTY,
+          password,
+          sizeof(password),
+          &length);
+    }
+  }
+
+  return result;
+}
+
+static void device_boot(int32_t device_index)
+{
+  device* device = &devices[device_index];
+  int length = snprintf(
+      (char*)device->registration_id,
+      sizeof(device->registration_id),
+      "device-%05d",
+      (int)device_index);
+  az_result result = az_iot_provisioning_client_init(
+      &device->dps_client,
+      AZ_SPAN_FROM_STR(GLOBAL_DEVICE_ENDPOINT),
+      AZ_SPAN_FROM_STR(ID_SCOPE),
+      az_span_create(device->registration_id, length),
+      NULL);
+
+  device->boot_time_usec = now_usec;
+  device->jitter_state = (((uint32_t)device_index * 2654435761u) ^ (uint32_t)options.seed) | 1u;
+
+  if (az_result_succeeded(result))
+  {
+    result = build_connect(device, false);
+  }
+
+  if (az_result_failed(result))
+  {
+    fail(device, "connecting to DPS", result);
+    return;
+  }
+
+  device->state = device_state_connecting_to_dps;
+  schedule(send_through_broker(), device_index, event_device_receive_connack);
+}
+
+static void device_receive_connack(int32_t device_index)
+{
+  device* device = &devices[device_index];
+
+  if (device->state == device_state_connecting_to_dps)
+  {
+    // Subscribes to AZ_IOT_PROVISIONING_CLIENT_REGISTER_SUBSCRIBE_TOPIC.
+    device->state = device_state_subscribing_to_dps;
+    schedule(send_through_broker(), device_index, event_device_receive_suback);
+  }
+  else if (device->state == device_state_connecting_to_hub)
+  {
+    // Subscribes to the commands, properties response and writable properties topics.
+    device->state = device_state_subscribing_to_hub;
+    device->pending_subscriptions = HUB_SUBSCRIPTION_COUNT;
+
+    for (int32_t i = 0; i < HUB_SUBSCRIPTION_COUNT; i++)
+    {
+      schedule(send_through_broker(), device_index, event_device_receive_suback);
+    }
+  }
+}
+
+static void device_receive_suback(int32_t device_index)
+{
+  device* device = &devices[device_index];
+
+  if (device->state == device_state_subscribing_to_dps)
+  {
+    az_result result = az_iot_provisioning_client_register_get_publish_topic(
+        &device->dps_client, (char*)packet_topic, sizeof(packet_topic), &packet_topic_length);
+
+    if (az_result_succeeded(result))
+    {
+      result = az_iot_provisioning_client_get_request_payload(
+          &device->dps_client,
+          AZ_SPAN_EMPTY,
+          NULL,
+          packet_payload,
+          sizeof(packet_payload),
+          &packet_payload_length);
+    }
+
+    if (az_result_failed(result))
+    {
+      fail(device, "registering", result);
+      return;
+    }
+
+    dps_check_register(device_index);
+    device->state = device_state_registering;
+    schedule(send_through_broker(), device_index, event_broker_receive_register);
+  }
+  else if (device->state == device_state_subscribing_to_hub && --device->pending_subscriptions == 0)
+  {
+    device->state = device_state_ready;
+    device->ready_time_usec = now_usec;
+  }
+}
+
+static void device_query(int32_t device_index)
+{
+  device* device = &devices[device_index];
+  az_result result = az_iot_provisioning_client_query_status_get_publish_topic(
+      &device->dps_client,
+      device->operation_id,
+      (char*)packet_topic,
+      sizeof(packet_topic),
+      &packet_topic_length);
+
+  if (az_result_failed(result))
+  {
+    fail(device, "querying", result);
+    return;
+  }
+
+  dps_check_query(device_index);
+  device->state = device_state_querying;
+  schedule(send_through_broker(), device_index, event_broker_receive_query);
+}
+
+/*
+ * Waits the retry-after given by DPS, or, with --backoff, a random delay between the retry-after
+ * and three times the previous delay, capped at 30 seconds (decorrelated jitter).
+ */
+static int32_t get_query_delay_msec(device* device, uint32_t retry_after_seconds)
+{
+  int32_t retry_after_msec = (int32_t)retry_after_seconds * 1000;
+  int32_t max_delay_msec = retry_after_msec > 30000 ? retry_after_msec : 30000;
+
+  if (!options.use_backoff)
+  {
+    return retry_after_msec;
+  }
+
+  uint32_t random = device->jitter_state;
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  device->jitter_state = random;
+
+  int32_t previous_delay_msec
+      = device->query_delay_msec > retry_after_msec ? device->query_delay_msec : retry_after_msec;
+  int32_t delay_msec = retry_after_msec
+      + (int32_t)(random % ((uint32_t)(previous_delay_msec * 3 - retry_after_msec) + 1));
+
+  if (delay_msec > max_delay_msec)
+  {
+    delay_msec = max_delay_msec;
+  }
+
+  device->query_delay_msec = delay_msec;
+
+  return delay_msec;
+}
+
+static void device_receive_dps_response(int32_t device_index)
+{
+  device* device = &devices[device_index];
+  az_iot_provisioning_client_register_response response;
+
+  dps_build_response(device_index);
+
+  az_span payload = az_span_create(packet_payload, (int32_t)packet_payload_length);
+  az_span destination = AZ_SPAN_FROM_BUFFER(device->strings);
+
+  // Strings already kept are preserved; the operation id is copied only once.
+  if (az_span_size(device->operation_id) > 0)
+  {
+    destination = az_span_slice_to_end(destination, az_span_size(device->operation_id));
+  }
+
+  az_result result = az_iot_provisioning_client_parse_received_topic_and_payload_chunks(
+      &device->dps_client,
+      az_span_create(packet_topic, (int32_t)packet_topic_length),
+      &payload,
+      1,
+      destination,
+      &response);
+
+  if (az_result_failed(result))
+  {
+    fail(device, "parsing the DPS response", result);
+    return;
+  }
+
+  if (az_span_size(device->operation_id) == 0)
+  {
+    device->operation_id = response.operation_id;
+  }
+
+  if (response.operation_status == AZ_IOT_PROVISIONING_STATUS_ASSIGNED)
+  {
+    device->assigned_hub_hostname = response.registration_state.assigned_hub_hostname;
+    device->device_id = response.registration_state.device_id;
+
+    // Disconnects from DPS, and connects to the IoT Hub.
+    result = az_iot_hub_client_init(
+        &device->hub_client, device->assigned_hub_hostname, device->device_id, NULL);
+
+    if (az_result_succeeded(result))
+    {
+      result = build_connect(device, true);
+    }
+
+    if (az_result_failed(result))
+    {
+      fail(device, "connecting to the IoT Hub", result);
+      return;
+    }
+
+    device->state = device_state_connecting_to_hub;
+    schedule(send_through_broker(), device_index, event_device_receive_connack);
+  }
+  else if (!az_iot_provisioning_client_operation_complete(response.operation_status))
+  {
+    device->state = device_state_waiting_to_query;
+    schedule(
+        now_usec + (int64_t)get_query_delay_msec(device, response.retry_after_seconds) * 1000,
+        device_index,
+        event_device_query_timer);
+  }
+  else
+  {
+    fprintf(
+        stderr,
+        "Device %s failed provisioning (status %d).\n",
+        (char const*)device->registration_id,
+        (int)response.operation_status);
+    device->state = device_state_failed;
+  }
+}
+
+/*
+ * Checks a register request, as the DPS stand-in receives it.
+ */
+static void dps_check_register(int32_t device_index)
+{
+  az_span topic = az_span_create(packet_topic, (int32_t)packet_topic_length);
+  az_span payload = az_span_create(packet_payload, (int32_t)packet_payload_length);
+  az_span registration_id = az_span_create(
+      devices[device_index].registration_id,
+      (int32_t)strlen((char const*)devices[device_index].registration_id));
+
+  if (az_span_find(topic, AZ_SPAN_FROM_STR("$dps/registrations/PUT/iotdps-register/?$rid=")) != 0
+      || az_span_find(payload, registration_id) < 0)
+  {
+    fprintf(stderr, "Unexpected register request.\n");
+    exit(1);
+  }
+}
+
+/*
+ * Checks a status query request, as the DPS stand-in receives it.
+ */
+static void dps_check_query(int32_t device_index)
+{
+  az_span topic = az_span_create(packet_topic, (int32_t)packet_topic_length);
+  char operation_id[64];
+  int length = snprintf(
+      operation_id, sizeof(operation_id), "&operationId=" OPERATION_ID_FORMAT, (int)device_index);
+
+  if (az_span_find(topic, AZ_SPAN_FROM_STR("$dps/registrations/GET/iotdps-get-operationstatus/"))
+          != 0
+      || az_span_find(topic, az_span_create((uint8_t*)operation_id, length)) < 0)
+  {
+    fprintf(stderr, "Unexpected status query request.\n");
+    exit(1);
+  }
+}
+
+/*
+ * Builds the last response of the DPS stand-in to a device, as it is delivered.
+ */
+static void dps_build_response(int32_t device_index)
+{
+  char const* registration_id = (char const*)devices[device_index].registration_id;
+
+  if (dps_records[device_index].is_assigned)
+  {
+    packet_topic_length = (size_t)snprintf(
+        (char*)packet_topic, sizeof(packet_topic), "$dps/registrations/res/200/?$rid=1");
+    packet_payload_length = (size_t)snprintf(
+        (char*)packet_payload,
+        sizeof(packet_payload),
+        "{\"operationId\":\"" OPERATION_ID_FORMAT "\",\"status\":\"assigned\","
+        "\"registrationState\":{"
+        "\"x509\":{},\"registrationId\":\"%s\",\"createdDateTimeUtc\":\"2020-04-10T03:11:13.02Z\","
+        "\"assignedHub\":\"" IOT_HUB_HOSTNAME "\",\"deviceId\":\"%s\",\"status\":\"assigned\","
+        "\"substatus\":\"initialAssignment\",\"lastUpdatedDateTimeUtc\":\"2020-04-10T03:11:13.2Z\","
+        "\"etag\":\"IjYxMDA4ZDQ2LTAwMDAtMDEwMC0wMDAwLTVlOGZlM2QxMDAwMCI=\"}}",
+        (int)device_index,
+        registration_id,
+        registration_id);
+  }
+  else
+  {
+    packet_topic_length = (size_t)snprintf(
+        (char*)packet_topic,
+        sizeof(packet_topic),
+        "$dps/registrations/res/202/?$rid=1&retry-after=%u",
+        (unsigned)options.dps_retry_after_sec);
+    packet_payload_length = (size_t)snprintf(
+        (char*)packet_payload,
+        sizeof(packet_payload),
+        "{\"operationId\":\"" OPERATION_ID_FORMAT "\",\"status\":\"assigning\"}",
+        (int)device_index);
+  }
+}
+
+static void broker_receive_register(int32_t device_index)
+{
+  dps_record* record = &dps_records[device_index];
+  int64_t start_time_usec = now_usec > dps_free_time_usec ? now_usec : dps_free_time_usec;
+
+  // DPS assigns devices one after the other, each taking dps_assignment_msec.
+  dps_free_time_usec = start_time_usec + 1000000 / options.dps_assignments_per_sec;
+  record->assigned_time_usec = dps_free_time_usec + (int64_t)options.dps_assignment_msec * 1000;
+  record->is_registered = true;
+  record->is_assigned = false;
+  dps_register_count++;
+
+  schedule(send_through_broker(), device_index, event_device_receive_dps_response);
+}
+
+static void broker_receive_query(int32_t device_index)
+{
+  dps_record* record = &dps_records[device_index];
+
+  if (!record->is_registered)
+  {
+    fprintf(stderr, "Status query before registration.\n");
+    exit(1);
+  }
+
+  record->is_assigned = now_usec >= record->assigned_time_usec;
+  dps_query_count++;
+
+  schedule(send_through_broker(), device_index, event_device_receive_dps_response);
+}
+
+static int compare_int64(void const* a, void const* b)
+{
+  int64_t x = *(int64_t const*)a;
+  int64_t y = *(int64_t const*)b;
+  return (x > y) - (x < y);
+}
+
+static bool parse_options(int argc, char* argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    long value = i + 1 < argc ? strtol(argv[i + 1], NULL, 10) : 0;
+
+    if (strcmp(argv[i], "--backoff") == 0)
+    {
+      options.use_backoff = true;
+      continue;
+    }
+    else if (i + 1 >= argc || value <= 0 || value > INT32_MAX)
+    {
+      return false;
+    }
+    else if (strcmp(argv[i], "--devices") == 0)
+    {
+      options.device_count = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--boot-window-ms") == 0)
+    {
+      options.boot_window_msec = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--latency-ms") == 0)
+    {
+      options.latency_msec = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--broker-rate") == 0)
+    {
+      options.broker_packets_per_sec = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--dps-rate") == 0)
+    {
+      options.dps_assignments_per_sec = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--dps-assignment-ms") == 0)
+    {
+      options.dps_assignment_msec = (int32_t)value;
+    }
+    else if (strcmp(argv[i], "--retry-after") == 0)
+    {
+      options.dps_retry_after_sec = (uint32_t)value;
+    }
+    else if (strcmp(argv[i], "--seed") == 0)
+    {
+      options.seed = (uint64_t)value;
+    }
+    else
+    {
+      return false;
+    }
+
+    i++;
+  }
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  if (!parse_options(argc, argv))
+  {
+    fprintf(
+        stderr,
+        "Usage: %s [--devices N] [--boot-window-ms MS] [--latency-ms MS] [--broker-rate "
+        "PACKETS_PER_SEC]\n"
+        "       [--dps-rate ASSIGNMENTS_PER_SEC] [--dps-assignment-ms MS] [--retry-after SEC]\n"
+        "       [--backoff] [--seed N]\n",
+        argv[0]);
+    return 2;
+  }
+
+  devices = calloc((size_t)options.device_count, sizeof(device));
+  dps_records = calloc((size_t)options.device_count, sizeof(dps_record));
+
+  if (devices == NULL || dps_records == NULL)
+  {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  random_state = options.seed * 0x9E3779B97F4A7C15ull + 1;
+
+  for (int32_t i = 0; i < options.device_count; i++)
+  {
+    schedule(
+        (int64_t)get_random((uint32_t)options.boot_window_msec * 1000), i, event_device_boot);
+  }
+
+  clock_t start_clock = clock();
+
+  while (event_count > 0)
+  {
+    event next = take_next_event();
+    now_usec = next.time_usec;
+
+    switch (next.kind)
+    {
+      case event_device_boot:
+        device_boot(next.device_index);
+        break;
+      case event_device_query_timer:
+        device_query(next.device_index);
+        break;
+      case event_device_receive_connack:
+        device_receive_connack(next.device_index);
+        break;
+      case event_device_receive_suback:
+        device_receive_suback(next.device_index);
+        break;
+      case event_device_receive_dps_response:
+        device_receive_dps_response(next.device_index);
+        break;
+      case event_broker_receive_register:
+        broker_receive_register(next.device_index);
+        break;
+      case event_broker_receive_query:
+        broker_receive_query(next.device_index);
+        break;
+    }
+  }
+
+  double host_seconds = (double)(clock() - start_clock) / CLOCKS_PER_SEC;
+
+  int64_t* times_to_ready = malloc((size_t)options.device_count * sizeof(int64_t));
+  int32_t ready_count = 0;
+
+  if (times_to_ready == NULL)
+  {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  for (int32_t i = 0; i < options.device_count; i++)
+  {
+    if (devices[i].state == device_state_ready)
+    {
+      times_to_ready[ready_count++] = devices[i].ready_time_usec - devices[i].boot_time_usec;
+    }
+  }
+
+  qsort(times_to_ready, (size_t)ready_count, sizeof(int64_t), compare_int64);
+
+  int32_t peak_packets_per_second = 0;
+
+  for (int32_t i = 0; i < packets_per_second_size; i++)
+  {
+    if (packets_per_second[i] > peak_packets_per_second)
+    {
+      peak_packets_per_second = packets_per_second[i];
+    }
+  }
+
+  printf(
+      "Devices: %d booted over %d ms, %d ready, %d failed.\n",
+      (int)options.device_count,
+      (int)options.boot_window_msec,
+      (int)ready_count,
+      (int)(options.device_count - ready_count));
+
+  if (ready_count > 0)
+  {
+    printf(
+        "Time to ready: p50 %.0f ms, p99 %.0f ms, max %.0f ms.\n",
+        (double)times_to_ready[ready_count / 2] / 1000,
+        (double)times_to_ready[(ready_count * 99) / 100] / 1000,
+        (double)times_to_ready[ready_count - 1] / 1000);
+  }
+
+  printf(
+      "Broker: %lld packets in %.1f s, %.0f per second on average, %d at peak.\n",
+      (long long)packet_count,
+      (double)now_usec / 1000000,
+      now_usec > 0 ? (double)packet_count * 1000000 / (double)now_usec : 0.0,
+      (int)peak_packets_per_second);
+  printf(
+      "DPS: %lld register and %lld status query requests (%.2f queries per device).\n",
+      (long long)dps_register_count,
+      (long long)dps_query_count,
+      (double)dps_query_count / options.device_count);
+  printf(
+      "RAM per device: %u bytes (provisioning client %u, hub client %u, strings %u, state %u), "
+      "plus a shared %u-byte packet buffer.\n",
+      (unsigned)sizeof(device),
+      (unsigned)sizeof(az_iot_provisioning_client),
+      (unsigned)sizeof(az_iot_hub_client),
+      (unsigned)(sizeof(((device*)NULL)->strings) + sizeof(((device*)NULL)->registration_id)),
+      (unsigned)(sizeof(device) - sizeof(az_iot_provisioning_client) - sizeof(az_iot_hub_client)
+                 - sizeof(((device*)NULL)->strings) - sizeof(((device*)NULL)->registration_id)),
+      (unsigned)(sizeof(packet_topic) + sizeof(packet_payload)));
+  printf(
+      "Host: %.0f packets per second simulated, library calls included.\n",
+      host_seconds > 0 ? (double)packet_count / host_seconds : 0.0);
+
+  free(times_to_ready);
+  free(packets_per_second);
+  free(events);
+  free(dps_records);
+  free(devices);
+
+  return ready_count == options.device_count ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the JWS verification of the Azure Device Update sample
+ * (examples/Azure_IoT_Adu_ESP32/SampleAduJWS.cpp).
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+
+#include "SampleAduJWS.h"
+#include "SerialLogger.h"
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+static bool signature_length_rejected;
+
+SerialLogger::SerialLogger() {}
+
+void SerialLogger::Info(String message) { (void)message; }
+
+void SerialLogger::Error(String message)
+{
+  if (strstr(message.c_str(), "Signature length does not match") != NULL)
+  {
+    signature_length_rejected = true;
+  }
+}
+
+SerialLogger Logger;
+
+/* ADU.200703.R, the root key used by the sample, given with a leading zero byte. */
+static uint8_t adu_root_key_n[385]
+    = { 0x00, 0xb2, 0xa3, 0xb2, 0x74, 0x16, 0xfa, 0xbb, 0x20, 0xf9, 0x52, 0x76, 0xe6, 0x27, 0x3e,
+        0x80, 0x41, 0xc6, 0xfe, 0xcf, 0x30, 0xf9, 0xc8, 0x96, 0xf5, 0x59, 0x0a, 0xaa, 0x81, 0xe7,
+        0x51, 0x83, 0x8a, 0xc4, 0xf5, 0x17, 0x3a, 0x2f, 0x2a, 0xe6, 0x57, 0xd4, 0x71, 0xce, 0x8a,
+        0x3d, 0xef, 0x9a, 0x55, 0x76, 0x3e, 0x99, 0xe2, 0xc2, 0xae, 0x4c, 0xee, 0x2d, 0xb8, 0x78,
+        0xf5, 0xa2, 0x4e, 0x28, 0xf2, 0x9c, 0x4e, 0x39, 0x65, 0xbc, 0xec, 0xe4, 0x0d, 0xe5, 0xe3,
+        0x38, 0xa8, 0x59, 0xab, 0x08, 0xa4, 0x1b, 0xb4, 0xf4, 0xa0, 0x52, 0xa3, 0x38, 0xb3, 0x46,
+        0x21, 0x13, 0xcc, 0x3c, 0x68, 0x06, 0xde, 0xfe, 0x00, 0xa6, 0x92, 0x6e, 0xde, 0x4c, 0x47,
+        0x10, 0xd6, 0x1c, 0x9c, 0x24, 0xf5, 0xcd, 0x70, 0xe1, 0xf5, 0x6a, 0x7c, 0x68, 0x13, 0x1d,
+        0xe1, 0xc5, 0xf6, 0xa8, 0x4f, 0x21, 0x9f, 0x86, 0x7c, 0x44, 0xc5, 0x8a, 0x99, 0x1c, 0xc5,
+        0xd3, 0x06, 0x9b, 0x5a, 0x71, 0x9d, 0x09, 0x1c, 0xc3, 0x64, 0x31, 0x6a, 0xc5, 0x17, 0x95,
+        0x1d, 0x5d, 0x2a, 0xf1, 0x55, 0xc7, 0x66, 0xd4, 0xe8, 0xf5, 0xd9, 0xa9, 0x5b, 0x8c, 0xa2,
+        0x6c, 0x62, 0x60, 0x05, 0x37, 0xd7, 0x32, 0xb0, 0x73, 0xcb, 0xf7, 0x4b, 0x36, 0x27, 0x24,
+        0x21, 0x8c, 0x38, 0x0a, 0xb8, 0x18, 0xfe, 0xf5, 0x15, 0x60, 0x35, 0x8b, 0x35, 0xef, 0x1e,
+        0x0f, 0x88, 0xa6, 0x13, 0x8d, 0x7b, 0x7d, 0xef, 0xb3, 0xe7, 0xb0, 0xc9, 0xa6, 0x1c, 0x70,
+        0x7b, 0xcc, 0xf2, 0x29, 0x8b, 0x87, 0xf7, 0xbd, 0x9d, 0xb6, 0x88, 0x6f, 0xac, 0x73, 0xff,
+        0x72, 0xf2, 0xef, 0x48, 0x27, 0x96, 0x72, 0x86, 0x06, 0xa2, 0x5c, 0xe3, 0x7d, 0xce, 0xb0,
+        0x9e, 0xe5, 0xc2, 0xd9, 0x4e, 0xc4, 0xf3, 0x7f, 0x78, 0x07, 0x4b, 0x65, 0x88, 0x45, 0x0c,
+        0x11, 0xe5, 0x96, 0x56, 0x34, 0x88, 0x2d, 0x16, 0x0e, 0x59, 0x42, 0xd2, 0xf7, 0xd9, 0xed,
+        0x1d, 0xed, 0xc9, 0x37, 0x77, 0x44, 0x7e, 0xe3, 0x84, 0x36, 0x9f, 0x58, 0x13, 0xef, 0x6f,
+        0xe4, 0xc3, 0x44, 0xd4, 0x77, 0x06, 0x8a, 0xcf, 0x5b, 0xc8, 0x80, 0x1c, 0xa2, 0x98, 0x65,
+        0x0b, 0x35, 0xdc, 0x73, 0xc8, 0x69, 0xd0, 0x5e, 0xe8, 0x25, 0x43, 0x9e, 0xf6, 0xd8, 0xab,
+        0x05, 0xaf, 0x51, 0x29, 0x23, 0x55, 0x40, 0x58, 0x10, 0xea, 0xb8, 0xe2, 0xcd, 0x5d, 0x79,
+        0xcc, 0xec, 0xdf, 0xb4, 0x5b, 0x98, 0xc7, 0xfa, 0xe3, 0xd2, 0x6c, 0x26, 0xce, 0x2e, 0x2c,
+        0x56, 0xe0, 0xcf, 0x8d, 0xee, 0xfd, 0x93, 0x12, 0x2f, 0x00, 0x49, 0x8d, 0x1c, 0x82, 0x38,
+        0x56, 0xa6, 0x5d, 0x79, 0x44, 0x4a, 0x1a, 0xf3, 0xdc, 0x16, 0x10, 0xb3, 0xc1, 0x2d, 0x27,
+        0x11, 0xfe, 0x1b, 0x98, 0x05, 0xe4, 0xa3, 0x60, 0x31, 0x99 };
+
+/* A test root key, given with a leading zero byte like the ADU root keys. */
+static uint8_t test_root_key_n[385]
+    = { 0x00, 0xbe, 0x8a, 0x26, 0xdb, 0x79, 0xc9, 0xe5, 0x3e, 0x2c, 0xe9, 0x79, 0xa0, 0xfa, 0x5b,
+        0xc9, 0xae, 0xa3, 0x0e, 0x94, 0x74, 0x2c, 0x08, 0x22, 0x6d, 0x33, 0x32, 0x48, 0x2b, 0x74,
+        0x40, 0x4c, 0xb1, 0x60, 0xa2, 0xb9, 0xf3, 0xbe, 0x51, 0x49, 0x83, 0xb3, 0xb9, 0xb1, 0x87,
+        0xf1, 0xad, 0xa8, 0xc7, 0xb7, 0x7c, 0x8e, 0x05, 0x0a, 0xab, 0x1d, 0xd6, 0xce, 0x6b, 0x1d,
+        0x20, 0xe3, 0x0e, 0x87, 0x2f, 0x36, 0x88, 0xfd, 0xf2, 0xeb, 0x07, 0x4a, 0x51, 0x74, 0xec,
+        0x8f, 0xab, 0x68, 0x51, 0xbe, 0x45, 0x79, 0xea, 0x6d, 0xc6, 0x45, 0x1b, 0x79, 0x0e, 0x18,
+        0x99, 0x33, 0x7a, 0xa6, 0x19, 0xb9, 0x43, 0x61, 0x28, 0x15, 0x4e, 0x0d, 0x60, 0xc7, 0xe6,
+        0x35, 0x90, 0x9c, 0x32, 0x8a, 0x75, 0x9c, 0xb8, 0xb6, 0x48, 0x01, 0x66, 0xa0, 0x86, 0xad,
+        0xce, 0x7c, 0x90, 0x4e, 0xc2, 0x83, 0x15, 0x7f, 0xda, 0xa3, 0x4d, 0xbe, 0x8d, 0x17, 0x9d,
+        0x32, 0xbb, 0xb8, 0xc6, 0xd1, 0xd8, 0x02, 0x30, 0xfb, 0xd6, 0x15, 0xf6, 0xdc, 0xfa, 0x89,
+        0xd3, 0xe2, 0x20, 0x6d, 0xc4, 0x84, 0xc8, 0xd1, 0xfc, 0x44, 0x52, 0xc8, 0x39, 0xc9, 0x8a,
+        0x8d, 0x2e, 0x9b, 0x12, 0x0b, 0x1f, 0x94, 0xd0, 0xdb, 0x17, 0x5e, 0xf4, 0x62, 0x46, 0x8d,
+        0xa1, 0x70, 0x31, 0x84, 0x78, 0x26, 0x76, 0x76, 0xd7, 0x9e, 0x5b, 0xae, 0xb1, 0xa4, 0x1b,
+        0xfd, 0x45, 0x84, 0x78, 0xa0, 0xfc, 0xde, 0x32, 0x60, 0x6a, 0x91, 0x04, 0x00, 0x5f, 0x76,
+        0x67, 0x4c, 0x54, 0x8b, 0x7a, 0xae, 0xbe, 0x6a, 0xf3, 0xe1, 0x75, 0xfb, 0x17, 0x03, 0xb5,
+        0xef, 0xb5, 0xcb, 0xb8, 0x96, 0x89, 0x71, 0x7e, 0xcf, 0xc0, 0x51, 0x41, 0x95, 0x47, 0x3b,
+        0xf2, 0xa9, 0xc4, 0x3a, 0x06, 0x62, 0x79, 0xaf, 0x60, 0x0f, 0xa6, 0x0e, 0xe9, 0x7b, 0x04,
+        0x86, 0x63, 0x16, 0x9a, 0x84, 0x4f, 0x52, 0xea, 0x45, 0x3b, 0x1c, 0x65, 0x0d, 0x40, 0xbf,
+        0xc8, 0xa1, 0xb0, 0x5a, 0x78, 0xd6, 0xc1, 0x65, 0xb9, 0x2d, 0xc6, 0xc6, 0xe1, 0x9d, 0xfc,
+        0x19, 0x41, 0x11, 0x62, 0x91, 0x45, 0xb6, 0x95, 0x28, 0x37, 0xf1, 0x9a, 0x9f, 0xdc, 0x19,
+        0x09, 0x58, 0x9a, 0xfc, 0x93, 0xcb, 0x30, 0x46, 0x23, 0xd0, 0xc8, 0xa2, 0x11, 0xd6, 0xc5,
+        0x72, 0x0f, 0xa1, 0xeb, 0xf2, 0xb0, 0x12, 0x3f, 0x38, 0xeb, 0xd9, 0x40, 0x21, 0x47, 0x39,
+        0x1a, 0xcd, 0xa7, 0xbc, 0x75, 0xf4, 0x14, 0x01, 0x31, 0x24, 0x3e, 0xae, 0xeb, 0x7b, 0xde,
+        0x3f, 0x46, 0xf8, 0xfd, 0xc1, 0xa7, 0x44, 0x9a, 0x9c, 0x60, 0x69, 0x0a, 0xf1, 0xd5, 0x7a,
+        0x7f, 0xd8, 0x65, 0xdc, 0xbf, 0x9e, 0xae, 0x12, 0xa4, 0x0d, 0x8b, 0xa7, 0x94, 0xdf, 0x77,
+        0xe8, 0x68, 0xae, 0xe5, 0x5b, 0x6b, 0x6a, 0xd8, 0xa5, 0x3f };
+
+static uint8_t root_key_e[3] = { 0x01, 0x00, 0x01 };
+
+/* A manifest, and its JWS signed by a signing key whose "sjwk" is signed with the test root key. */
+static const char test_manifest[]
+    = "{\"manifestVersion\":\"5\",\"updateId\":{\"provider\":\"Contoso\",\"name\":\"Sensor\","
+      "\"version\":\"1.1\"}}";
+
+static const char test_manifest_jws[]
+    = "eyJhbGciOiJSUzI1NiIsInNqd2siOiJleUpoYkdjaU9pSlNVekkxTmlJc0ltdHBaQ0k2SWtGRVZTNVVSVk5VTGxJaWZR"
+      "LmV5SnJkSGtpT2lKU1UwRWlMQ0p1SWpvaWVIWkpjbEEyU25vd2JYSXZSV1VyU3pCemNuVlFPVzlVVUdOdUsxaFRSMUJ2"
+      "V0dwQk5tUlFXazB2WkN0YU9VaHJOSGhMZGtkeFdGTndWbFZSSzFkWFpXTnlZM2xJVlcweFptSnVkbEJDVXpNMWMydzNa"
+      "R1IzUnpSa1R6Vlpja05OYmtOa2RHWTVVWEZFVDFoblZIbGxOQ3R3Um0xSVkxVTRiQ3Q0ZDFNMVExbzFMMGROYW01Tkwx"
+      "VkdaMjkyWmtSNmR6bEdla2htVlZSTE0zcHlMMEZaV1d0aE9HY3dVRUpLTVRCNGRXTXlXRzVqYzJKRVlsVnhhRXMzV2xn"
+      "NE0yMXFNRTV5Y3lzM056UnNSWHBSV0dkcVp6ZHZhV04xYW1oTmFtOWxhVXBTU3pOMFVGTmFXbnBDY2xselQxcG9ia1Ex"
+      "VGpsYVZsSk9hRFpCV0ZaeVNtRktjR3hwWVV4dE5FNXdObU5ETkRsVmRHeFRXREJJTjI1VVNsSjJjSFV4VkdSUFRpOVJT"
+      "bmQyTlVNd2QzaGtRMlJoWVZkYVF5ODRVa1phVjNSdGFWTmhkM05YWVhWckswcENWWGRuU1ZOcE5uVlZka05xUmpscFdt"
+      "TnlkRGhSUlVacFJXa3lOMjkxZGpSdGFIbGtXVVF5YVV0S1JFMUVNMGhKZUVobloyMTBMM2xHY0d0QlNVeFplbk5rYXpS"
+      "MmVGVTVUVGxYZFZGQlFYWTFhazlRZVd4bmFUVndNalZCTDFaRFVFOU9OMUZYYlhOSlJHa3JVa0YxV1ZGa1VpOWhTR2xL"
+      "UmpkamRsbHBkbTk0TTFOcVExUmtZbWMwVG5OelZtUmxjVXRaU1VaamJHWklkbVExTkZoQlVUUmtVV3BTTUdGUVJ5dEhh"
+      "VUpTV0VoM1JIbFpaSFYxWTFZaUxDSmxJam9pUVZGQlFpSXNJbUZzWnlJNklsSlRNalUySWl3aWEybGtJam9pUVVSVkxs"
+      "UkZVMVF1VXlKOS5LS2pMOWMzdHQtYl9PTGxkMlpOSWJ3MFU5dFJ2QTBHcGNFTEtkZUIyNWFqV01LT3R5Yjc1VjFmSjFT"
+      "ZkFFc1RVd2JicURQVzhDVHAtTWRfeGtaUGtLX19VY0EyUTltOEdBV1NjVnZTQmdTWmtjbmo5T3NkdVF4R3ROaDhDYmJa"
+      "UDR4amZjdEJBcmxUcUIwQ2VnSzZpcG5GRHRwSlktY3dacGItX2VKLS1KaTgwTHhDU0kyczRQNEY1SjBvcUlxWVlhZkxv"
+      "WXhJTGQ0cHRHdUQ3eWdORndKQk8xcW9PQ29wdUE5djBhSE1ROUJyMlVvY0JveGRSaXFnQUhWTUtHaGRsUVVwXzNwYmNN"
+      "WXdVX0w3ZzZYMzFGNnowTU1CNlNiUHdwSERUNG5CLXp6SFlud3VsTFdEdXJtdWpLWEpraXVLb2dQRUJKcGs2YU8waDFW"
+      "bmxRcjV2LThvOVZ4MmRJVVpXTTM4UTlySG1CWDlvQ2I1VFZybWR6WUN5RXRiM0FlVFhkbUZ1U1JqUkRwb3NXMXlIZ3ZX"
+      "R2JLWFR2RXZIYTBZNk5YZktER3R5Zl9mOFhfakpnS1Nmc1FBMmstckNnZ0pZVS03QVdTYmZRQkJOMjUyNkpIemhNX2R1"
+      "MDFMcjJjMWtkUkxVYWV3X1BrYVQ2Q0d6VG56U3ZfeWlTY01KMHNDbCJ9.eyJzaGEyNTYiOiI3UGRpeWxLa29TM0lOVGp"
+      "kcEN2emhVRkVhcU13YmwzbzRyc0Y0cTV6bHZrPSJ9.ncFVyqdUM5A4ZwIHp56xO6x7PHVaAprqK6aQ_W5S2pidLsXrTJ"
+      "ijLLuJbKmDURj0nKb_ay3IX8kJFg-DMsWpaE8gw8v8Lllcrph59TwIJFLxzgcPSRKqmy740urm9-GLM4di48T5OSCvpJ"
+      "7ya_dXsuVa20n2BhUQprS4f_CYByhRYVIt6HM9ydDfo4_Tq64xPWVCNPJyHiYdTldLI3RnJ-lz43FV4ML5PE40Uo1yTU"
+      "a1Vd-EzZ3bfBv9plR2DfPr3JL_fzTXEsuwF68bpmUsoyKE6kTOiTDNQ8zFVFijvblQG_N5DVM1GiRdYqCyEF8xh6XCpj"
+      "sT9Yt-v3B1t34tAi9r_vBvAc6Fn2_R_WchEo0b9kSUOxPuG_JJaDsHHEBe6W8pYUGFjM-FVzaH7_rFUaX2gjaax-9VmE"
+      "jBjRDDShILvljZhN4iHK-igV145Or3KiCByA9-VvV620U2dNIIRtPyOc4fcI3M7Veapf2lmJig8EB7RCc2x6xv9-JMNl"
+      "dE";
+
+static uint8_t scratch_buffer[jwsSCRATCH_BUFFER_SIZE];
+static char jws_buffer[4096];
+
+static int32_t base64_url_encode(char* destination, uint8_t const* source, int32_t source_length)
+{
+  static const char alphabet[]
+      = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  int32_t length = 0;
+
+  for (int32_t i = 0; i < source_length; i += 3)
+  {
+    uint32_t group = (uint32_t)source[i] << 16;
+    int32_t remaining = source_length - i;
+
+    group |= remaining > 1 ? (uint32_t)source[i + 1] << 8 : 0;
+    group |= remaining > 2 ? (uint32_t)source[i + 2] : 0;
+
+    destination[length++] = alphabet[(group >> 18) & 0x3F];
+    destination[length++] = alphabet[(group >> 12) & 0x3F];
+    if (remaining > 1)
+    {
+      destination[length++] = alphabet[(group >> 6) & 0x3F];
+    }
+    if (remaining > 2)
+    {
+      destination[length++] = alphabet[group & 0x3F];
+    }
+  }
+
+  return length;
+}
+
+static int32_t base64_url_encode_text(char* destination, const char* text)
+{
+  return base64_url_encode(destination, (uint8_t const*)text, (int32_t)strlen(text));
+}
+
+/*
+ * Builds a JWS whose "sjwk" names the given root key and has a signature of the given length, into
+ * jws_buffer. Only the "sjwk" is complete, as its signature is verified first.
+ */
+static az_span build_jws(const char* root_key_id, int32_t sjwk_signature_length)
+{
+  char sjwk_header[64];
+  uint8_t sjwk_signature[512];
+  char sjwk[1024];
+  char header[1100];
+  int32_t length = 0;
+
+  (void)snprintf(
+      sjwk_header, sizeof(sjwk_header), "{\"alg\":\"RS256\",\"kid\":\"%s\"}", root_key_id);
+  memset(sjwk_signature, 0x01, sizeof(sjwk_signature));
+
+  length += base64_url_encode_text(sjwk, sjwk_header);
+  sjwk[length++] = '.';
+  length += base64_url_encode_text(
+      sjwk + length, "{\"kty\":\"RSA\",\"n\":\"AQAB\",\"e\":\"AQAB\",\"alg\":\"RS256\"}");
+  sjwk[length++] = '.';
+  length += base64_url_encode(sjwk + length, sjwk_signature, sjwk_signature_length);
+  sjwk[length] = '\0';
+
+  (void)snprintf(header, sizeof(header), "{\"alg\":\"RS256\",\"sjwk\":\"%s\"}", sjwk);
+
+  length = base64_url_encode_text(jws_buffer, header);
+  memcpy(jws_buffer + length, ".e30.AA", 7);
+  length += 7;
+
+  return az_span_create((uint8_t*)jws_buffer, length);
+}
+
+static az_span copy_test_manifest_jws(void)
+{
+  int32_t length = (int32_t)strlen(test_manifest_jws);
+
+  /* The JWS is decoded in place. */
+  memcpy(jws_buffer, test_manifest_jws, (size_t)length);
+  return az_span_create((uint8_t*)jws_buffer, length);
+}
+
+static az_result authenticate(
+    az_span manifest,
+    az_span jws,
+    const char* root_key_id,
+    uint8_t* root_key_n,
+    int32_t root_key_n_length)
+{
+  SampleJWS::RootKey root_key;
+
+  root_key.root_key_id = az_span_create_from_str((char*)root_key_id);
+  root_key.root_key_n = az_span_create(root_key_n, root_key_n_length);
+  root_key.root_key_exponent = AZ_SPAN_FROM_BUFFER(root_key_e);
+
+  signature_length_rejected = false;
+  return SampleJWS::ManifestAuthenticate(
+      manifest, jws, &root_key, 1, AZ_SPAN_FROM_BUFFER(scratch_buffer));
+}
+
+// The signature of a 3072-bit root key is 384 bytes long, while the ADU root keys are given as 385
+// bytes, with a leading zero.
+static int test_adu_root_key_signature_length(void)
+{
+  az_span manifest = AZ_SPAN_FROM_STR("{}");
+
+  CHECK(
+      authenticate(
+          manifest,
+          build_jws("ADU.200703.R", 384),
+          "ADU.200703.R",
+          adu_root_key_n,
+          (int32_t)sizeof(adu_root_key_n))
+      == AZ_ERROR_NOT_SUPPORTED);
+  CHECK(!signature_length_rejected);
+
+  CHECK(
+      authenticate(
+          manifest,
+          build_jws("ADU.200703.R", 383),
+          "ADU.200703.R",
+          adu_root_key_n,
+          (int32_t)sizeof(adu_root_key_n))
+      == AZ_ERROR_NOT_SUPPORTED);
+  CHECK(signature_length_rejected);
+
+  return 0;
+}
+
+static int test_manifest_authenticate_leading_zero_root_key(void)
+{
+  az_span manifest = az_span_create_from_str((char*)test_manifest);
+
+  CHECK(
+      authenticate(
+          manifest,
+          copy_test_manifest_jws(),
+          "ADU.TEST.R",
+          test_root_key_n,
+          (int32_t)sizeof(test_root_key_n))
+      == AZ_OK);
+
+  // Without the leading zero.
+  CHECK(
+      authenticate(
+          manifest,
+          copy_test_manifest_jws(),
+          "ADU.TEST.R",
+          test_root_key_n + 1,
+          (int32_t)sizeof(test_root_key_n) - 1)
+      == AZ_OK);
+
+  CHECK(
+      authenticate(
+          AZ_SPAN_FROM_STR("{\"manifestVersion\":\"4\"}"),
+          copy_test_manifest_jws(),
+          "ADU.TEST.R",
+          test_root_key_n,
+          (int32_t)sizeof(test_root_key_n))
+      != AZ_OK);
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_adu_root_key_signature_length();
+  failures += test_manifest_authenticate_leading_zero_root_key();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
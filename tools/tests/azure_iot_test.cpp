@@ -0,0 +1,407 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the Azure IoT client of the Azure IoT Central ESP32 sample (AzureIoT.cpp).
+ *
+ * The client runs against an MQTT client stand-in that records what is published, and against a
+ * clock the checks advance: time() is replaced for the whole program, as the client reads the unix
+ * time with it.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "AzureIoT.h"
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+#define START_TIME 1700000000
+#define MAX_PUBLISHED_MESSAGES 16
+
+typedef struct
+{
+  char topic[128];
+  mqtt_qos_t qos;
+  int packet_id;
+} published_message;
+
+static time_t current_time;
+static azure_iot_t azure_iot;
+static azure_iot_config_t config;
+static uint8_t data_buffer[1500];
+static published_message published[MAX_PUBLISHED_MESSAGES];
+static int published_count;
+static int next_packet_id;
+static int completed_count;
+static uint32_t completed_request_id;
+static az_iot_status completed_status;
+static int telemetry_completed_count;
+// If not zero, the PUBACK processed by the MQTT client stand-in while publishing.
+static int early_puback_packet_id;
+
+extern "C" time_t time(time_t* out_time)
+{
+  if (out_time != NULL)
+  {
+    *out_time = current_time;
+  }
+
+  return current_time;
+}
+
+static void log_nothing(log_level_t log_level, char const* const format, ...)
+{
+  (void)log_level;
+  (void)format;
+}
+
+static int mqtt_client_init(mqtt_client_config_t* mqtt_client_config, mqtt_client_handle_t* handle)
+{
+  (void)mqtt_client_config;
+  *handle = (mqtt_client_handle_t)&azure_iot;
+  return 0;
+}
+
+static int mqtt_client_deinit(mqtt_client_handle_t handle)
+{
+  (void)handle;
+  return 0;
+}
+
+static int mqtt_client_publish(mqtt_client_handle_t handle, mqtt_message_t* mqtt_message)
+{
+  (void)handle;
+
+  if (published_count < MAX_PUBLISHED_MESSAGES)
+  {
+    published_message* message = &published[published_count];
+
+    (void)snprintf(
+        message->topic,
+        sizeof(message->topic),
+        "%.*s",
+        az_span_size(mqtt_message->topic),
+        (char*)az_span_ptr(mqtt_message->topic));
+    message->qos = mqtt_message->qos;
+    message->packet_id = ++next_packet_id;
+  }
+
+  published_count++;
+
+  if (early_puback_packet_id != 0)
+  {
+    (void)azure_iot_mqtt_client_publish_completed(&azure_iot, early_puback_packet_id);
+  }
+
+  return next_packet_id;
+}
+
+static int mqtt_client_subscribe(mqtt_client_handle_t handle, az_span topic, mqtt_qos_t qos)
+{
+  (void)handle;
+  (void)topic;
+  (void)qos;
+  return ++next_packet_id;
+}
+
+static int base64_decode(
+    uint8_t* data,
+    size_t data_length,
+    uint8_t* decoded,
+    size_t size,
+    size_t* length)
+{
+  (void)data;
+  (void)data_length;
+  *length = size < 32 ? size : 32;
+  memset(decoded, 1, *length);
+  return 0;
+}
+
+static int base64_encode(
+    uint8_t* data,
+    size_t data_length,
+    uint8_t* encoded,
+    size_t size,
+    size_t* length)
+{
+  (void)data;
+  (void)data_length;
+  *length = size < 44 ? size : 44;
+  memset(encoded, 'A', *length);
+  return 0;
+}
+
+static int hmac_sha256(
+    const uint8_t* key,
+    size_t key_length,
+    const uint8_t* payload,
+    size_t payload_length,
+    uint8_t* signed_payload,
+    size_t signed_payload_size)
+{
+  (void)key;
+  (void)key_length;
+  (void)payload;
+  (void)payload_length;
+  memset(signed_payload, 2, signed_payload_size);
+  return 0;
+}
+
+static void on_properties_update_completed(
+    uint32_t request_id,
+    az_iot_status status_code,
+    int32_t version)
+{
+  (void)version;
+  completed_count++;
+  completed_request_id = request_id;
+  completed_status = status_code;
+}
+
+static void on_telemetry_completed(void* context)
+{
+  (void)context;
+  telemetry_completed_count++;
+}
+
+static void on_properties_received(az_span properties) { (void)properties; }
+
+static void on_command_request_received(command_request_t command) { (void)command; }
+
+// Initializes and starts a client connecting straight to IoT Hub, not connected yet.
+static int setup(void)
+{
+  current_time = START_TIME;
+  published_count = 0;
+  next_packet_id = 0;
+  completed_count = 0;
+  telemetry_completed_count = 0;
+  early_puback_packet_id = 0;
+  set_logging_function(log_nothing);
+
+  memset(&config, 0, sizeof(config));
+  config.user_agent = AZ_SPAN_FROM_STR("c%2F1.0.0(host)");
+  config.model_id = AZ_SPAN_FROM_STR("dtmi:azureiot:devkit:test;1");
+  config.use_device_provisioning = false;
+  config.iot_hub_fqdn = AZ_SPAN_FROM_STR("myiothub.azure-devices.net");
+  config.device_id = AZ_SPAN_FROM_STR("my_device");
+  config.device_key = AZ_SPAN_FROM_STR("a2V5");
+  config.device_certificate = AZ_SPAN_EMPTY;
+  config.device_certificate_private_key = AZ_SPAN_EMPTY;
+  config.dps_registration_id = AZ_SPAN_EMPTY;
+  config.dps_id_scope = AZ_SPAN_EMPTY;
+  config.data_buffer = AZ_SPAN_FROM_BUFFER(data_buffer);
+  config.mqtt_client_interface.mqtt_client_init = mqtt_client_init;
+  config.mqtt_client_interface.mqtt_client_deinit = mqtt_client_deinit;
+  config.mqtt_client_interface.mqtt_client_publish = mqtt_client_publish;
+  config.mqtt_client_interface.mqtt_client_subscribe = mqtt_client_subscribe;
+  config.data_manipulation_functions.base64_decode = base64_decode;
+  config.data_manipulation_functions.base64_encode = base64_encode;
+  config.data_manipulation_functions.hmac_sha256_encrypt = hmac_sha256;
+  config.on_properties_update_completed = on_properties_update_completed;
+  config.on_properties_received = on_properties_received;
+  config.on_command_request_received = on_command_request_received;
+
+  azure_iot_init(&azure_iot, &config);
+  CHECK(azure_iot_start(&azure_iot) == 0);
+  azure_iot_do_work(&azure_iot);
+
+  return 0;
+}
+
+// Completes the connection and subscriptions, until the client is ready.
+static int connect(void)
+{
+  CHECK(azure_iot_mqtt_client_connected(&azure_iot) == 0);
+  azure_iot_do_work(&azure_iot);
+
+  for (int i = 0; i < IOT_HUB_SUBSCRIPTION_COUNT; i++)
+  {
+    (void)azure_iot_mqtt_client_subscribe_completed(&azure_iot, next_packet_id - i);
+  }
+
+  azure_iot_do_work(&azure_iot);
+  CHECK(azure_iot_get_status(&azure_iot) == azure_iot_connected);
+
+  return 0;
+}
+
+// Returns the index of the last published message whose topic starts with prefix, or -1.
+static int find_published(char const* prefix)
+{
+  int last = published_count < MAX_PUBLISHED_MESSAGES ? published_count : MAX_PUBLISHED_MESSAGES;
+
+  for (int i = last - 1; i >= 0; i--)
+  {
+    if (strncmp(published[i].topic, prefix, strlen(prefix)) == 0)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static int receive(char const* topic, char const* payload)
+{
+  mqtt_message_t mqtt_message;
+
+  mqtt_message.topic = az_span_create((uint8_t*)topic, (int32_t)strlen(topic));
+  mqtt_message.payload = az_span_create((uint8_t*)payload, (int32_t)strlen(payload));
+  mqtt_message.qos = mqtt_qos_at_most_once;
+
+  return azure_iot_mqtt_client_message_received(&azure_iot, &mqtt_message);
+}
+
+// A properties update queued while not connected only starts timing out once it is published, so
+// a connection coming after PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS gets its real response.
+static int test_properties_update_queued_offline_times_from_publish(void)
+{
+  uint32_t request_id = 0;
+  char response_topic[64];
+
+  CHECK(setup() == 0);
+  CHECK(
+      azure_iot_send_properties_update(
+          &azure_iot, AZ_SPAN_FROM_STR("{\"temperature\":21.5}"), &request_id)
+      == 0);
+  CHECK(request_id != 0);
+  CHECK(find_published("$iothub/twin/PATCH/properties/reported/") == -1);
+
+  current_time += PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS * 2;
+  azure_iot_do_work(&azure_iot);
+  CHECK(connect() == 0);
+
+  CHECK(completed_count == 0);
+  CHECK(find_published("$iothub/twin/PATCH/properties/reported/") != -1);
+
+  (void)snprintf(
+      response_topic,
+      sizeof(response_topic),
+      "$iothub/twin/res/204/?$rid=%lu&$version=2",
+      (unsigned long)request_id);
+  CHECK(receive(response_topic, "") == 0);
+  CHECK(completed_count == 1);
+  CHECK(completed_request_id == request_id);
+  CHECK(completed_status == AZ_IOT_STATUS_NO_CONTENT);
+
+  return 0;
+}
+
+// A published properties update still times out without a response.
+static int test_properties_update_times_out_after_publish(void)
+{
+  uint32_t request_id = 0;
+
+  CHECK(setup() == 0);
+  CHECK(connect() == 0);
+  CHECK(
+      azure_iot_send_properties_update(
+          &azure_iot, AZ_SPAN_FROM_STR("{\"temperature\":21.5}"), &request_id)
+      == 0);
+  CHECK(find_published("$iothub/twin/PATCH/properties/reported/") != -1);
+
+  current_time += PROPERTIES_UPDATE_TIMEOUT_IN_SECONDS - 1;
+  azure_iot_do_work(&azure_iot);
+  CHECK(completed_count == 0);
+
+  current_time += 1;
+  azure_iot_do_work(&azure_iot);
+  CHECK(completed_count == 1);
+  CHECK(completed_request_id == request_id);
+  CHECK(completed_status == AZ_IOT_STATUS_TIMEOUT);
+
+  return 0;
+}
+
+// Sends a QoS 1 telemetry message, returning the packet id it was published with, or -1.
+static int send_telemetry_at_least_once(void)
+{
+  if (azure_iot_send_telemetry_at_least_once(
+          &azure_iot,
+          AZ_SPAN_FROM_STR("{\"temperature\":21.5}"),
+          azure_iot_telemetry_priority_alarm,
+          on_telemetry_completed,
+          NULL)
+      != 0)
+  {
+    return -1;
+  }
+
+  int index = find_published("devices/my_device/messages/events/");
+
+  return index == -1 ? -1 : published[index].packet_id;
+}
+
+// A PUBACK only completes the QoS 1 telemetry message published with its packet id.
+static int test_puback_completes_matching_telemetry_only(void)
+{
+  CHECK(setup() == 0);
+  CHECK(connect() == 0);
+
+  int packet_id = send_telemetry_at_least_once();
+  CHECK(packet_id > 0);
+
+  CHECK(azure_iot_mqtt_client_publish_completed(&azure_iot, packet_id + 100) == 0);
+  CHECK(telemetry_completed_count == 0);
+
+  CHECK(azure_iot_mqtt_client_publish_completed(&azure_iot, packet_id) == 0);
+  CHECK(telemetry_completed_count == 1);
+
+  CHECK(azure_iot_mqtt_client_publish_completed(&azure_iot, packet_id) == 0);
+  CHECK(telemetry_completed_count == 1);
+
+  return 0;
+}
+
+// A PUBACK processed before `mqtt_client_publish` returns completes the message only if it has the
+// packet id then returned.
+static int test_early_puback_completes_matching_telemetry_only(void)
+{
+  CHECK(setup() == 0);
+  CHECK(connect() == 0);
+
+  early_puback_packet_id = next_packet_id + 100;
+  int packet_id = send_telemetry_at_least_once();
+  CHECK(packet_id > 0);
+  CHECK(telemetry_completed_count == 0);
+
+  early_puback_packet_id = 0;
+  CHECK(azure_iot_mqtt_client_publish_completed(&azure_iot, packet_id) == 0);
+  CHECK(telemetry_completed_count == 1);
+
+  early_puback_packet_id = next_packet_id + 1;
+  CHECK(send_telemetry_at_least_once() == early_puback_packet_id);
+  CHECK(telemetry_completed_count == 2);
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_properties_update_queued_offline_times_from_publish();
+  failures += test_properties_update_times_out_after_publish();
+  failures += test_puback_completes_matching_telemetry_only();
+  failures += test_early_puback_completes_matching_telemetry_only();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the base 64 streaming decoder (az_base64_stream_decoder).
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+// Decodes the text split in two chunks at split_index, returning the result of the final step.
+static az_result decode_stream(
+    bool is_url,
+    char const* text,
+    int32_t split_index,
+    uint8_t* destination,
+    int32_t destination_size,
+    int32_t* out_written)
+{
+  az_base64_stream_decoder decoder;
+  az_span source = az_span_create((uint8_t*)text, (int32_t)strlen(text));
+  az_span destination_span = az_span_create(destination, destination_size);
+  int32_t written = 0;
+  int32_t total_written = 0;
+  az_result result;
+
+  if (is_url)
+  {
+    az_base64_url_stream_decoder_init(&decoder);
+  }
+  else
+  {
+    az_base64_stream_decoder_init(&decoder);
+  }
+
+  result = az_base64_stream_decode(
+      &decoder, destination_span, az_span_slice(source, 0, split_index), &written);
+
+  if (az_result_succeeded(result))
+  {
+    total_written += written;
+    result = az_base64_stream_decode(
+        &decoder,
+        az_span_slice_to_end(destination_span, total_written),
+        az_span_slice_to_end(source, split_index),
+        &written);
+  }
+
+  if (az_result_succeeded(result))
+  {
+    total_written += written;
+    result = az_base64_stream_decode_final(
+        &decoder, az_span_slice_to_end(destination_span, total_written), &written);
+  }
+
+  if (az_result_succeeded(result))
+  {
+    total_written += written;
+  }
+
+  *out_written = total_written;
+  return result;
+}
+
+static int test_stream_decode_final_incomplete_padding_fails(void)
+{
+  uint8_t destination[16];
+  int32_t written = 0;
+
+  for (int32_t split_index = 0; split_index <= 3; split_index++)
+  {
+    CHECK(
+        decode_stream(true, "AB=", split_index, destination, sizeof(destination), &written)
+        == AZ_ERROR_UNEXPECTED_END);
+    CHECK(
+        decode_stream(false, "AB=", split_index, destination, sizeof(destination), &written)
+        == AZ_ERROR_UNEXPECTED_END);
+    CHECK(
+        decode_stream(true, "AAECAw=", split_index, destination, sizeof(destination), &written)
+        == AZ_ERROR_UNEXPECTED_END);
+  }
+
+  return 0;
+}
+
+static int test_stream_decode_final_complete_or_omitted_padding_succeeds(void)
+{
+  uint8_t destination[16];
+  int32_t written = 0;
+
+  for (int32_t split_index = 0; split_index <= 4; split_index++)
+  {
+    CHECK(az_result_succeeded(
+        decode_stream(false, "AB==", split_index, destination, sizeof(destination), &written)));
+    CHECK(written == 1 && destination[0] == 0x00);
+
+    CHECK(az_result_succeeded(
+        decode_stream(true, "AB==", split_index, destination, sizeof(destination), &written)));
+    CHECK(written == 1 && destination[0] == 0x00);
+  }
+
+  for (int32_t split_index = 0; split_index <= 2; split_index++)
+  {
+    CHECK(az_result_succeeded(
+        decode_stream(true, "AB", split_index, destination, sizeof(destination), &written)));
+    CHECK(written == 1 && destination[0] == 0x00);
+  }
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_stream_decode_final_incomplete_padding_fails();
+  failures += test_stream_decode_final_complete_or_omitted_padding_succeeds();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
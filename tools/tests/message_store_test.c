@@ -0,0 +1,385 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the store-and-forward message queue (az_iot_message_store).
+ *
+ * The store is kept on RAM, or on a simulated NOR flash that flags writes setting bits and erases
+ * not matching an erase block. Records are corrupted by offset, so the checks rely on their layout
+ * in az_iot_message_store.c: a 10-byte header, starting with a magic byte and ending with a CRC,
+ * then the message.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+#define RECORD_CRC_OFFSET 8
+#define FLASH_SIZE 512
+#define FLASH_ERASE_BLOCK_SIZE 64
+
+static uint8_t storage[FLASH_SIZE];
+static int flash_violation_count;
+
+static az_result flash_read(void* context, int32_t offset, uint8_t* buffer, int32_t size)
+{
+  (void)memcpy(buffer, (uint8_t*)context + offset, (size_t)size);
+  return AZ_OK;
+}
+
+static az_result flash_write(void* context, int32_t offset, uint8_t const* data, int32_t size)
+{
+  uint8_t* flash = (uint8_t*)context + offset;
+
+  for (int32_t i = 0; i < size; i++)
+  {
+    if ((data[i] & ~flash[i]) != 0)
+    {
+      flash_violation_count++;
+    }
+
+    flash[i] &= data[i];
+  }
+
+  return AZ_OK;
+}
+
+static az_result flash_erase(void* context, int32_t offset, int32_t size)
+{
+  if (offset % FLASH_ERASE_BLOCK_SIZE != 0 || size != FLASH_ERASE_BLOCK_SIZE
+      || offset + size > FLASH_SIZE)
+  {
+    flash_violation_count++;
+    return AZ_ERROR_ARG;
+  }
+
+  (void)memset((uint8_t*)context + offset, 0xFF, (size_t)size);
+  return AZ_OK;
+}
+
+// Clears a store of `size` bytes of RAM and returns its backend.
+static az_iot_message_store_backend ram_backend(int32_t size)
+{
+  (void)memset(storage, 0, sizeof(storage));
+  return az_iot_message_store_ram_backend_create(az_span_create(storage, size));
+}
+
+// Erases the simulated flash and returns its backend.
+static az_iot_message_store_backend flash_backend(void)
+{
+  az_iot_message_store_backend backend;
+
+  (void)memset(storage, 0xFF, sizeof(storage));
+  flash_violation_count = 0;
+
+  backend.read = flash_read;
+  backend.write = flash_write;
+  backend.erase = flash_erase;
+  backend.size = FLASH_SIZE;
+  backend.erase_block_size = FLASH_ERASE_BLOCK_SIZE;
+  backend.context = storage;
+
+  return backend;
+}
+
+static void fill_message(uint8_t* message, int32_t size, int sequence)
+{
+  for (int32_t i = 0; i < size; i++)
+  {
+    message[i] = (uint8_t)(sequence * 31 + i);
+  }
+}
+
+static int append(az_iot_message_store* store, int sequence, int32_t size)
+{
+  uint8_t message[64];
+
+  fill_message(message, size, sequence);
+  CHECK(az_iot_message_store_append(store, az_span_create(message, size)) == AZ_OK);
+
+  return 0;
+}
+
+// Checks the oldest message is the one appended with sequence and size, without removing it.
+static int check_oldest(az_iot_message_store* store, int sequence, int32_t size)
+{
+  uint8_t buffer[64];
+  uint8_t expected[64];
+  az_span message;
+
+  fill_message(expected, size, sequence);
+  CHECK(az_iot_message_store_peek(store, AZ_SPAN_FROM_BUFFER(buffer), &message) == AZ_OK);
+  CHECK(az_span_size(message) == size);
+  CHECK(memcmp(az_span_ptr(message), expected, (size_t)size) == 0);
+
+  return 0;
+}
+
+static int pop_oldest(az_iot_message_store* store, int sequence, int32_t size)
+{
+  CHECK(check_oldest(store, sequence, size) == 0);
+  CHECK(az_iot_message_store_pop(store) == AZ_OK);
+
+  return 0;
+}
+
+// Varies the message size, so records end at varying offsets and leave padding at the end.
+static int32_t message_size(int sequence) { return 20 + (sequence % 3) * 7; }
+
+// Messages keep their order as records wrap around the end of the storage, and a store recovered
+// at any point holds the same messages.
+static int test_wraparound_keeps_order(void)
+{
+  az_iot_message_store_backend backend = ram_backend(200);
+  az_iot_message_store store;
+  int oldest = 0;
+  int next = 0;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  while (next < 3)
+  {
+    CHECK(append(&store, next, message_size(next)) == 0);
+    next++;
+  }
+
+  while (next < 60)
+  {
+    az_iot_message_store recovered;
+
+    CHECK(append(&store, next, message_size(next)) == 0);
+    next++;
+    CHECK(az_iot_message_store_get_count(&store) == next - oldest);
+
+    CHECK(az_iot_message_store_init(&recovered, &backend) == AZ_OK);
+    CHECK(az_iot_message_store_get_count(&recovered) == next - oldest);
+    CHECK(check_oldest(&recovered, oldest, message_size(oldest)) == 0);
+
+    CHECK(pop_oldest(&store, oldest, message_size(oldest)) == 0);
+    oldest++;
+  }
+
+  while (oldest < next)
+  {
+    CHECK(pop_oldest(&store, oldest, message_size(oldest)) == 0);
+    oldest++;
+  }
+
+  CHECK(az_iot_message_store_get_count(&store) == 0);
+  CHECK(az_iot_message_store_pop(&store) == AZ_ERROR_ITEM_NOT_FOUND);
+
+  return 0;
+}
+
+// Appending to a full store evicts the oldest messages first, and keeps the newest in order.
+static int test_eviction_drops_oldest_first(void)
+{
+  // Five records of 10 + 30 bytes fill the storage exactly.
+  az_iot_message_store_backend backend = ram_backend(200);
+  az_iot_message_store store;
+  az_iot_message_store recovered;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  for (int i = 0; i < 5; i++)
+  {
+    CHECK(append(&store, i, 30) == 0);
+  }
+
+  CHECK(az_iot_message_store_get_count(&store) == 5);
+
+  for (int i = 5; i < 12; i++)
+  {
+    CHECK(append(&store, i, 30) == 0);
+    CHECK(az_iot_message_store_get_count(&store) == 5);
+    CHECK(check_oldest(&store, i - 4, 30) == 0);
+  }
+
+  CHECK(az_iot_message_store_init(&recovered, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&recovered) == 5);
+
+  for (int i = 7; i < 12; i++)
+  {
+    CHECK(pop_oldest(&recovered, i, 30) == 0);
+  }
+
+  CHECK(az_iot_message_store_get_count(&recovered) == 0);
+
+  return 0;
+}
+
+// Records with a bad CRC or a bad magic byte are skipped by the recovery scan, without losing the
+// valid records after them.
+static int test_recovery_skips_corrupted_records(void)
+{
+  az_iot_message_store_backend backend = ram_backend(400);
+  az_iot_message_store store;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  for (int i = 0; i < 4; i++)
+  {
+    CHECK(append(&store, i, 30) == 0);
+  }
+
+  // Records are 40 bytes each, from offset 0.
+  storage[40 + RECORD_CRC_OFFSET] ^= 0x01;
+  storage[80] = 0x00;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&store) == 2);
+  CHECK(pop_oldest(&store, 0, 30) == 0);
+  CHECK(pop_oldest(&store, 3, 30) == 0);
+  CHECK(az_iot_message_store_get_count(&store) == 0);
+
+  // Appending resumes after the newest record.
+  CHECK(append(&store, 4, 30) == 0);
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&store) == 1);
+  CHECK(pop_oldest(&store, 4, 30) == 0);
+
+  return 0;
+}
+
+// A record torn by a restart during its write is skipped by the recovery scan, and overwritten by
+// the next append.
+static int test_recovery_skips_torn_record(void)
+{
+  az_iot_message_store_backend backend = ram_backend(400);
+  az_iot_message_store store;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(append(&store, i, 30) == 0);
+  }
+
+  // Only the header and the first bytes of the last record were written.
+  (void)memset(&storage[80 + 10 + 8], 0x00, 22);
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&store) == 2);
+
+  CHECK(append(&store, 3, 30) == 0);
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&store) == 3);
+  CHECK(pop_oldest(&store, 0, 30) == 0);
+  CHECK(pop_oldest(&store, 1, 30) == 0);
+  CHECK(pop_oldest(&store, 3, 30) == 0);
+
+  return 0;
+}
+
+// On flash, records straddling erase blocks are written only to erased blocks, erases match whole
+// blocks, writes only clear bits, and a store recovered at any point holds the same messages.
+static int test_erase_block_boundaries(void)
+{
+  az_iot_message_store_backend backend = flash_backend();
+  az_iot_message_store store;
+  int oldest = 0;
+  int next = 0;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  while (next < 80)
+  {
+    az_iot_message_store recovered;
+
+    // Records of 10 + 37 bytes start and end at varying offsets within the 64-byte blocks.
+    CHECK(append(&store, next, 37) == 0);
+    next++;
+
+    // Appends evict the messages of the block they erase.
+    CHECK(az_iot_message_store_get_count(&store) <= next - oldest);
+    oldest = next - az_iot_message_store_get_count(&store);
+
+    CHECK(az_iot_message_store_init(&recovered, &backend) == AZ_OK);
+    CHECK(az_iot_message_store_get_count(&recovered) == next - oldest);
+    CHECK(check_oldest(&recovered, oldest, 37) == 0);
+
+    if (next % 3 == 0)
+    {
+      CHECK(pop_oldest(&store, oldest, 37) == 0);
+      oldest++;
+    }
+  }
+
+  while (oldest < next)
+  {
+    CHECK(pop_oldest(&store, oldest, 37) == 0);
+    oldest++;
+  }
+
+  CHECK(az_iot_message_store_get_count(&store) == 0);
+  CHECK(flash_violation_count == 0);
+
+  return 0;
+}
+
+// Messages popped before a restart stay popped, and the store keeps working after it.
+static int test_pop_after_reinit(void)
+{
+  az_iot_message_store_backend backend = ram_backend(400);
+  az_iot_message_store store;
+
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(append(&store, i, 30) == 0);
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(pop_oldest(&store, i, 30) == 0);
+    CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+    CHECK(az_iot_message_store_get_count(&store) == 2 - i);
+  }
+
+  uint8_t buffer[64];
+  az_span message;
+  CHECK(
+      az_iot_message_store_peek(&store, AZ_SPAN_FROM_BUFFER(buffer), &message)
+      == AZ_ERROR_ITEM_NOT_FOUND);
+  CHECK(az_iot_message_store_pop(&store) == AZ_ERROR_ITEM_NOT_FOUND);
+
+  CHECK(append(&store, 3, 30) == 0);
+  CHECK(az_iot_message_store_init(&store, &backend) == AZ_OK);
+  CHECK(az_iot_message_store_get_count(&store) == 1);
+  CHECK(pop_oldest(&store, 3, 30) == 0);
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_wraparound_keeps_order();
+  failures += test_eviction_drops_oldest_first();
+  failures += test_recovery_skips_corrupted_records();
+  failures += test_recovery_skips_torn_record();
+  failures += test_erase_block_boundaries();
+  failures += test_pop_after_reinit();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
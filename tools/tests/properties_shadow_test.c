@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the reported properties shadow (az_iot_hub_client_properties_shadow).
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+static az_iot_hub_client client;
+static az_iot_hub_client_properties_shadow shadow;
+static az_iot_hub_client_properties_shadow_entry entries[4];
+
+static int setup(void)
+{
+  CHECK(az_result_succeeded(az_iot_hub_client_init(
+      &client,
+      AZ_SPAN_FROM_STR("myiothub.azure-devices.net"),
+      AZ_SPAN_FROM_STR("my_device"),
+      NULL)));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_init(
+      &shadow, entries, (int32_t)(sizeof(entries) / sizeof(entries[0])))));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_set_double(
+      &shadow, AZ_SPAN_EMPTY, AZ_SPAN_FROM_STR("temperature"), 21.5, 1, 0)));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_set_string(
+      &shadow,
+      AZ_SPAN_FROM_STR("deviceInformation"),
+      AZ_SPAN_FROM_STR("manufacturer"),
+      AZ_SPAN_FROM_STR("Contoso"))));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_set_bool(
+      &shadow, AZ_SPAN_EMPTY, AZ_SPAN_FROM_STR("enabled"), true)));
+
+  return 0;
+}
+
+// A write that runs out of space after writing some properties must leave every change to be
+// written by the next one.
+static int test_write_changes_not_enough_space_keeps_changes(void)
+{
+  uint8_t small_buffer[80];
+  uint8_t buffer[256];
+  az_json_writer json_writer;
+  int32_t property_count = 0;
+
+  CHECK(setup() == 0);
+  CHECK(az_iot_hub_client_properties_shadow_get_change_count(&shadow) == 3);
+
+  CHECK(az_result_succeeded(
+      az_json_writer_init(&json_writer, AZ_SPAN_FROM_BUFFER(small_buffer), NULL)));
+  CHECK(
+      az_iot_hub_client_properties_shadow_write_changes(
+          &client, &shadow, &json_writer, &property_count)
+      == AZ_ERROR_NOT_ENOUGH_SPACE);
+
+  CHECK(az_iot_hub_client_properties_shadow_has_changes(&shadow));
+  CHECK(az_iot_hub_client_properties_shadow_get_change_count(&shadow) == 3);
+
+  CHECK(az_result_succeeded(az_json_writer_init(&json_writer, AZ_SPAN_FROM_BUFFER(buffer), NULL)));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_write_changes(
+      &client, &shadow, &json_writer, &property_count)));
+  CHECK(property_count == 3);
+
+  return 0;
+}
+
+// Once written successfully, changes are in flight until the update completes.
+static int test_write_changes_then_complete_update(void)
+{
+  uint8_t buffer[256];
+  az_json_writer json_writer;
+  int32_t property_count = 0;
+
+  CHECK(setup() == 0);
+  CHECK(az_result_succeeded(az_json_writer_init(&json_writer, AZ_SPAN_FROM_BUFFER(buffer), NULL)));
+  CHECK(az_result_succeeded(az_iot_hub_client_properties_shadow_write_changes(
+      &client, &shadow, &json_writer, &property_count)));
+  CHECK(property_count == 3);
+  CHECK(!az_iot_hub_client_properties_shadow_has_changes(&shadow));
+
+  CHECK(az_result_succeeded(
+      az_iot_hub_client_properties_shadow_complete_update(&shadow, AZ_IOT_STATUS_NO_CONTENT)));
+  CHECK(!az_iot_hub_client_properties_shadow_has_changes(&shadow));
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_write_changes_not_enough_space_keeps_changes();
+  failures += test_write_changes_then_complete_update();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
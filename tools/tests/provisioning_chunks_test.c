@@ -0,0 +1,271 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of az_iot_provisioning_client_parse_received_topic_and_payload_chunks().
+ *
+ * Payloads are split at every offset, into two and into three chunks, and the responses parsed
+ * from the chunks are compared with the one az_iot_provisioning_client_parse_received_topic_and_
+ * payload() parses from the contiguous payload.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+#define OPERATION_ID "4.d0a671905ea5b2c8.e7173b7b-0e54-4aa0-9d20-aeb1b89e6c7d"
+#define ASSIGNED_HUB "contoso.azure-devices.net"
+#define DEVICE_ID "paho-sample-device1"
+
+typedef struct
+{
+  const char* name;
+  const char* topic;
+  const char* payload;
+} test_message;
+
+static const test_message messages[] = {
+  { "assigning",
+    "$dps/registrations/res/202/?$rid=1&retry-after=3",
+    "{\"operationId\":\"" OPERATION_ID "\",\"status\":\"assigning\"}" },
+  { "assigning with registration state",
+    "$dps/registrations/res/202/?$rid=1&retry-after=3",
+    "{\"operationId\":\"" OPERATION_ID "\",\"status\":\"assigning\","
+    "\"registrationState\":{\"registrationId\":\"" DEVICE_ID "\",\"status\":\"assigning\"}}" },
+  { "assigned",
+    "$dps/registrations/res/200/?$rid=1",
+    "{\"operationId\":\"" OPERATION_ID "\",\"status\":\"assigned\",\"registrationState\":{"
+    "\"x509\":{},\"registrationId\":\"" DEVICE_ID "\","
+    "\"createdDateTimeUtc\":\"2020-04-10T03:11:13.0276997Z\",\"assignedHub\":\"" ASSIGNED_HUB "\","
+    "\"deviceId\":\"" DEVICE_ID "\",\"status\":\"assigned\",\"substatus\":\"initialAssignment\","
+    "\"lastUpdatedDateTimeUtc\":\"2020-04-10T03:11:13.2096201Z\","
+    "\"etag\":\"IjYxMDA4ZDQ2LTAwMDAtMDEwMC0wMDAwLTVlOGZlM2QxMDAwMCI=\"}}" },
+  { "error",
+    "$dps/registrations/res/401/?$rid=1",
+    "{\"errorCode\":401002,\"trackingId\":\"8ad0463c-6427-4479-9dfa-3e8bb7003e9b\","
+    "\"message\":\"Invalid certificate.\",\"timestampUtc\":\"2020-04-10T05:24:22.4718526Z\"}" },
+};
+
+static az_iot_provisioning_client client;
+
+static int setup(void)
+{
+  CHECK(az_result_succeeded(az_iot_provisioning_client_init(
+      &client,
+      AZ_SPAN_FROM_STR("global.azure-devices-provisioning.net"),
+      AZ_SPAN_FROM_STR("0ne00000000"),
+      AZ_SPAN_FROM_STR(DEVICE_ID),
+      NULL)));
+
+  return 0;
+}
+
+static az_span span_from_str(const char* str)
+{
+  return az_span_create((uint8_t*)(uintptr_t)str, (int32_t)strlen(str));
+}
+
+// Checks a response parsed from chunks is the one parsed in place. Error details are not copied
+// from chunks, so they must be empty.
+static int check_same_response(
+    az_iot_provisioning_client_register_response const* expected,
+    az_iot_provisioning_client_register_response const* response)
+{
+  az_iot_provisioning_client_registration_state const* expected_state
+      = &expected->registration_state;
+  az_iot_provisioning_client_registration_state const* state = &response->registration_state;
+
+  CHECK(response->status == expected->status);
+  CHECK(response->operation_status == expected->operation_status);
+  CHECK(response->retry_after_seconds == expected->retry_after_seconds);
+  CHECK(az_span_is_content_equal(response->operation_id, expected->operation_id));
+  CHECK(az_span_is_content_equal(
+      state->assigned_hub_hostname, expected_state->assigned_hub_hostname));
+  CHECK(az_span_is_content_equal(state->device_id, expected_state->device_id));
+  CHECK(state->error_code == expected_state->error_code);
+  CHECK(state->extended_error_code == expected_state->extended_error_code);
+  CHECK(az_span_size(state->error_message) == 0);
+  CHECK(az_span_size(state->error_tracking_id) == 0);
+  CHECK(az_span_size(state->error_timestamp) == 0);
+
+  return 0;
+}
+
+// Parses the payload split at first and second (0 and size for fewer chunks), with the chunks
+// copied to separate buffers so no string can be read past the end of one.
+static az_result parse_chunks(
+    test_message const* message,
+    int32_t first,
+    int32_t second,
+    az_span destination,
+    az_iot_provisioning_client_register_response* out_response)
+{
+  static uint8_t buffers[3][1024];
+  az_span payload = span_from_str(message->payload);
+  int32_t offsets[4] = { 0, first, second, az_span_size(payload) };
+  az_span chunks[3];
+  int32_t count = 0;
+
+  for (int32_t i = 0; i < 3; i++)
+  {
+    if (offsets[i + 1] > offsets[i])
+    {
+      az_span chunk = az_span_slice(payload, offsets[i], offsets[i + 1]);
+      chunks[count] = az_span_slice(AZ_SPAN_FROM_BUFFER(buffers[count]), 0, az_span_size(chunk));
+      az_span_copy(chunks[count], chunk);
+      count++;
+    }
+  }
+
+  return az_iot_provisioning_client_parse_received_topic_and_payload_chunks(
+      &client, span_from_str(message->topic), chunks, count, destination, out_response);
+}
+
+// Payloads split in two or three chunks at every offset parse to the same response as in place.
+static int test_every_split_matches_in_place_parse(void)
+{
+  uint8_t destination[256];
+
+  CHECK(setup() == 0);
+
+  for (size_t m = 0; m < sizeof(messages) / sizeof(messages[0]); m++)
+  {
+    test_message const* message = &messages[m];
+    int32_t size = (int32_t)strlen(message->payload);
+    az_iot_provisioning_client_register_response expected;
+
+    CHECK(
+        az_iot_provisioning_client_parse_received_topic_and_payload(
+            &client, span_from_str(message->topic), span_from_str(message->payload), &expected)
+        == AZ_OK);
+
+    for (int32_t first = 0; first < size; first++)
+    {
+      for (int32_t second = first + 1; second <= size; second++)
+      {
+        az_iot_provisioning_client_register_response response;
+
+        if (parse_chunks(message, first, second, AZ_SPAN_FROM_BUFFER(destination), &response)
+                != AZ_OK
+            || check_same_response(&expected, &response) != 0)
+        {
+          fprintf(stderr, "%s: split at %d and %d.\n", message->name, (int)first, (int)second);
+          return 1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+// A destination too small for the copied strings fails with AZ_ERROR_NOT_ENOUGH_SPACE, whatever
+// the split, and one just large enough succeeds.
+static int test_destination_too_small(void)
+{
+  test_message const* message = &messages[2];
+  int32_t size = (int32_t)strlen(message->payload);
+  int32_t required = (int32_t)(strlen(OPERATION_ID) + strlen(ASSIGNED_HUB) + strlen(DEVICE_ID));
+  uint8_t destination[256];
+  az_iot_provisioning_client_register_response response;
+
+  CHECK(setup() == 0);
+
+  for (int32_t first = 1; first < size; first++)
+  {
+    for (int32_t destination_size = 0; destination_size < required; destination_size++)
+    {
+      CHECK(
+          parse_chunks(
+              message, first, size, az_span_create(destination, destination_size), &response)
+          == AZ_ERROR_NOT_ENOUGH_SPACE);
+    }
+
+    CHECK(
+        parse_chunks(message, first, size, az_span_create(destination, required), &response)
+        == AZ_OK);
+    CHECK(az_span_is_content_equal(response.operation_id, AZ_SPAN_FROM_STR(OPERATION_ID)));
+    CHECK(az_span_is_content_equal(
+        response.registration_state.assigned_hub_hostname, AZ_SPAN_FROM_STR(ASSIGNED_HUB)));
+    CHECK(az_span_is_content_equal(
+        response.registration_state.device_id, AZ_SPAN_FROM_STR(DEVICE_ID)));
+  }
+
+  return 0;
+}
+
+// A status value straddling chunks is recognized, for each status and each split within it.
+static int test_status_split_across_chunks(void)
+{
+  static const struct
+  {
+    const char* value;
+    az_iot_provisioning_client_operation_status status;
+  } statuses[] = {
+    { "assigning", AZ_IOT_PROVISIONING_STATUS_ASSIGNING },
+    { "assigned", AZ_IOT_PROVISIONING_STATUS_ASSIGNED },
+    { "failed", AZ_IOT_PROVISIONING_STATUS_FAILED },
+    { "unassigned", AZ_IOT_PROVISIONING_STATUS_UNASSIGNED },
+    { "disabled", AZ_IOT_PROVISIONING_STATUS_DISABLED },
+  };
+  uint8_t destination[256];
+
+  CHECK(setup() == 0);
+
+  for (size_t s = 0; s < sizeof(statuses) / sizeof(statuses[0]); s++)
+  {
+    char payload[128];
+    test_message message = { statuses[s].value, "$dps/registrations/res/202/?$rid=1", payload };
+    int prefix_size
+        = snprintf(payload, sizeof(payload), "{\"operationId\":\"%s\",\"status\":\"", "op");
+    (void)snprintf(
+        payload + prefix_size, sizeof(payload) - (size_t)prefix_size, "%s\"}", statuses[s].value);
+
+    for (int32_t split = prefix_size + 1; split < prefix_size + (int32_t)strlen(statuses[s].value);
+         split++)
+    {
+      az_iot_provisioning_client_register_response response;
+
+      CHECK(
+          parse_chunks(
+              &message,
+              split,
+              (int32_t)strlen(payload),
+              AZ_SPAN_FROM_BUFFER(destination),
+              &response)
+          == AZ_OK);
+      CHECK(response.operation_status == statuses[s].status);
+    }
+  }
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_every_split_matches_in_place_parse();
+  failures += test_destination_too_small();
+  failures += test_status_split_across_chunks();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}
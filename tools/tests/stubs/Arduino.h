@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host stand-in for the parts of the Arduino core used by the sample sources the checks are built
+ * with.
+ */
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdio.h>
+#include <string>
+
+#define HEX 16
+
+class String
+{
+public:
+  String(const char* text = "") : value(text) {}
+  String(int number, int base = 10)
+  {
+    char text[16];
+    (void)snprintf(text, sizeof(text), base == HEX ? "%x" : "%d", number);
+    value = text;
+  }
+
+  const char* c_str() const { return value.c_str(); }
+
+  friend String operator+(const String& left, const String& right)
+  {
+    String result(left);
+    result.value += right.value;
+    return result;
+  }
+
+private:
+  std::string value;
+};
+
+#endif // ARDUINO_H
@@ -0,0 +1,284 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Checks of the az_iot_hub_client_telemetry_batch functions.
+ *
+ * Payloads are compared with the JSON the samples are expected to serialize to, and are read back
+ * with az_json_reader to check they are complete JSON documents.
+ *
+ * See readme.md for how to build and run it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+#include <az_iot.h>
+
+#define CHECK(condition)                                                                 \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);      \
+      return 1;                                                                          \
+    }                                                                                    \
+  } while (0)
+
+#define FIELD_COUNT 2
+#define FRACTIONAL_DIGITS 2
+#define MAX_PAYLOAD_SIZE 1024
+
+// The skeleton of every payload, which is all an empty batch writes.
+#define EMPTY_PAYLOAD "{\"temperature\":[],\"humidity\":[]}"
+
+static const az_span field_names[FIELD_COUNT]
+    = { AZ_SPAN_LITERAL_FROM_STR("temperature"), AZ_SPAN_LITERAL_FROM_STR("humidity") };
+
+static az_iot_hub_client_telemetry_batch batch;
+static double sample_buffer[16 * FIELD_COUNT];
+static uint8_t destination[MAX_PAYLOAD_SIZE + AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK];
+
+// Values have exactly FRACTIONAL_DIGITS significant decimals, so they serialize like "%.2f", and
+// grow with the sequence so samples have different sizes.
+static double get_value(int sequence, int field_index)
+{
+  return field_index == 0 ? 5.25 + sequence * 7 : 40.75 + sequence * 31;
+}
+
+static int setup(int32_t capacity)
+{
+  CHECK(capacity <= (int32_t)(sizeof(sample_buffer) / sizeof(sample_buffer[0]) / FIELD_COUNT));
+  CHECK(az_result_succeeded(az_iot_hub_client_telemetry_batch_init(
+      &batch, field_names, FIELD_COUNT, sample_buffer, capacity, FRACTIONAL_DIGITS)));
+
+  return 0;
+}
+
+static int add_samples(int first_sequence, int count)
+{
+  for (int sequence = first_sequence; sequence < first_sequence + count; sequence++)
+  {
+    double values[FIELD_COUNT] = { get_value(sequence, 0), get_value(sequence, 1) };
+
+    CHECK(az_result_succeeded(az_iot_hub_client_telemetry_batch_add_sample(&batch, values, NULL)));
+  }
+
+  return 0;
+}
+
+// Writes the payload expected for count samples starting at first_sequence, and returns its size.
+static int write_expected_payload(char* buffer, size_t size, int first_sequence, int count)
+{
+  int length = 0;
+
+  length += snprintf(buffer + length, size - (size_t)length, "{");
+
+  for (int field_index = 0; field_index < FIELD_COUNT; field_index++)
+  {
+    length += snprintf(
+        buffer + length,
+        size - (size_t)length,
+        "%s\"%.*s\":[",
+        field_index > 0 ? "," : "",
+        (int)az_span_size(field_names[field_index]),
+        (char const*)az_span_ptr(field_names[field_index]));
+
+    for (int sequence = first_sequence; sequence < first_sequence + count; sequence++)
+    {
+      length += snprintf(
+          buffer + length,
+          size - (size_t)length,
+          "%s%.*f",
+          sequence > first_sequence ? "," : "",
+          FRACTIONAL_DIGITS,
+          get_value(sequence, field_index));
+    }
+
+    length += snprintf(buffer + length, size - (size_t)length, "]");
+  }
+
+  length += snprintf(buffer + length, size - (size_t)length, "}");
+
+  return length;
+}
+
+// Checks the payload is a single complete JSON object, equal to the expected one.
+static int check_payload(az_span payload, int first_sequence, int count)
+{
+  char expected[MAX_PAYLOAD_SIZE];
+  int expected_size = write_expected_payload(expected, sizeof(expected), first_sequence, count);
+  az_json_reader reader;
+
+  CHECK(az_span_size(payload) == expected_size);
+  CHECK(memcmp(az_span_ptr(payload), expected, (size_t)expected_size) == 0);
+
+  CHECK(az_json_reader_init(&reader, payload, NULL) == AZ_OK);
+  CHECK(az_json_reader_next_token(&reader) == AZ_OK);
+  CHECK(reader.token.kind == AZ_JSON_TOKEN_BEGIN_OBJECT);
+  CHECK(az_json_reader_skip_children(&reader) == AZ_OK);
+  CHECK(az_json_reader_next_token(&reader) == AZ_ERROR_JSON_READER_DONE);
+
+  return 0;
+}
+
+static az_result get_payload(int32_t max_size, az_span* out_payload, int32_t* out_sample_count)
+{
+  return az_iot_hub_client_telemetry_batch_get_payload(
+      &batch,
+      az_span_create(destination, max_size + AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK),
+      max_size,
+      out_payload,
+      out_sample_count);
+}
+
+// With every budget from the skeleton size up to the whole batch, the payload holds as many whole
+// samples as fit, which includes budgets running out partway through the values of a sample.
+static int test_budget_reached_mid_sample(void)
+{
+  int const sample_count = 10;
+  char expected[MAX_PAYLOAD_SIZE];
+  int32_t const full_size
+      = (int32_t)write_expected_payload(expected, sizeof(expected), 0, sample_count);
+
+  CHECK(setup(sample_count) == 0);
+  CHECK(add_samples(0, sample_count) == 0);
+
+  for (int32_t max_size = (int32_t)strlen(EMPTY_PAYLOAD); max_size <= full_size; max_size++)
+  {
+    int expected_count = 0;
+    az_span payload;
+    int32_t count = -1;
+
+    while (expected_count < sample_count
+           && write_expected_payload(expected, sizeof(expected), 0, expected_count + 1)
+               <= max_size)
+    {
+      expected_count++;
+    }
+
+    if (expected_count == 0)
+    {
+      CHECK(get_payload(max_size, &payload, &count) == AZ_ERROR_NOT_ENOUGH_SPACE);
+      continue;
+    }
+
+    CHECK(get_payload(max_size, &payload, &count) == AZ_OK);
+
+    if (count != expected_count || check_payload(payload, 0, expected_count) != 0)
+    {
+      fprintf(stderr, "Budget of %d bytes: %d samples written.\n", (int)max_size, (int)count);
+      return 1;
+    }
+  }
+
+  CHECK(az_iot_hub_client_telemetry_batch_get_sample_count(&batch) == sample_count);
+
+  return 0;
+}
+
+// Samples overwritten when the ring is full, and removed after a payload is published, leave the
+// remaining ones in order across the end of the ring.
+static int test_ring_wraparound(void)
+{
+  int32_t const capacity = 4;
+  az_span payload;
+  int32_t count;
+  bool overwritten = false;
+  double values[FIELD_COUNT] = { get_value(4, 0), get_value(4, 1) };
+
+  CHECK(setup(capacity) == 0);
+  CHECK(add_samples(0, 4) == 0);
+  CHECK(az_iot_hub_client_telemetry_batch_add_sample(&batch, values, &overwritten) == AZ_OK);
+  CHECK(overwritten);
+  CHECK(add_samples(5, 2) == 0);
+  CHECK(az_iot_hub_client_telemetry_batch_get_sample_count(&batch) == capacity);
+
+  CHECK(get_payload(MAX_PAYLOAD_SIZE, &payload, &count) == AZ_OK);
+  CHECK(count == capacity);
+  CHECK(check_payload(payload, 3, capacity) == 0);
+
+  CHECK(az_iot_hub_client_telemetry_batch_remove_samples(&batch, 3) == AZ_OK);
+  CHECK(add_samples(7, 2) == 0);
+  CHECK(az_iot_hub_client_telemetry_batch_get_sample_count(&batch) == 3);
+
+  CHECK(get_payload(MAX_PAYLOAD_SIZE, &payload, &count) == AZ_OK);
+  CHECK(count == 3);
+  CHECK(check_payload(payload, 6, 3) == 0);
+
+  return 0;
+}
+
+// An empty batch, never filled or emptied by removing its samples, writes empty arrays.
+static int test_empty_batch(void)
+{
+  az_span payload;
+  int32_t count = -1;
+
+  CHECK(setup(4) == 0);
+  CHECK(get_payload(MAX_PAYLOAD_SIZE, &payload, &count) == AZ_OK);
+  CHECK(count == 0);
+  CHECK(az_span_is_content_equal(payload, AZ_SPAN_FROM_STR(EMPTY_PAYLOAD)));
+
+  CHECK(add_samples(0, 3) == 0);
+  CHECK(az_iot_hub_client_telemetry_batch_remove_samples(&batch, 3) == AZ_OK);
+
+  count = -1;
+  CHECK(get_payload((int32_t)strlen(EMPTY_PAYLOAD), &payload, &count) == AZ_OK);
+  CHECK(count == 0);
+  CHECK(check_payload(payload, 0, 0) == 0);
+
+  return 0;
+}
+
+// A budget, or a destination, too small for the field names and empty arrays fails, whether the
+// batch is empty or not.
+static int test_budget_too_small_for_skeleton(void)
+{
+  int32_t const skeleton_size = (int32_t)strlen(EMPTY_PAYLOAD);
+  az_span payload;
+  int32_t count;
+
+  CHECK(setup(4) == 0);
+
+  for (int sample_count = 0; sample_count <= 1; sample_count++)
+  {
+    for (int32_t max_size = 1; max_size < skeleton_size; max_size++)
+    {
+      CHECK(get_payload(max_size, &payload, &count) == AZ_ERROR_NOT_ENOUGH_SPACE);
+    }
+
+    for (int32_t size = 1; size < skeleton_size + AZ_IOT_HUB_CLIENT_TELEMETRY_BATCH_WRITER_SLACK;
+         size++)
+    {
+      CHECK(
+          az_iot_hub_client_telemetry_batch_get_payload(
+              &batch, az_span_create(destination, size), MAX_PAYLOAD_SIZE, &payload, &count)
+          == AZ_ERROR_NOT_ENOUGH_SPACE);
+    }
+
+    CHECK(add_samples(0, 1) == 0);
+  }
+
+  // The skeleton fits, but not a single one of the two samples added.
+  CHECK(get_payload(skeleton_size, &payload, &count) == AZ_ERROR_NOT_ENOUGH_SPACE);
+
+  return 0;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += test_budget_reached_mid_sample();
+  failures += test_ring_wraparound();
+  failures += test_empty_batch();
+  failures += test_budget_too_small_for_skeleton();
+
+  printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+  return failures == 0 ? 0 : 1;
+}